@@ -0,0 +1,278 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef LIBAD_HPP_
+#define LIBAD_HPP_
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include "libeuler.h"
+
+/**
+ * @brief Header-only forward mode automatic differentiation for the C API callbacks
+ *
+ * The model is written once, as a callable templated on the scalar type:
+ * @code
+ * struct model {
+ *   template <class T>
+ *   void operator()(T *f, const double t, const T *x, const double *u, const double **p) const;
+ * };
+ * @endcode
+ * and libeuler::ad_model provides from it both the euler_ode_function (the model evaluated
+ * with doubles) and an exact euler_ode_jacobian (the model evaluated with dual numbers). The
+ * dual numbers carry D derivative directions at once (a fixed size array, whose loops the
+ * compiler vectorizes), thus a dense Jacobian costs ceil(x_size / D) evaluations of the model,
+ * and a sparse Jacobian ceil(groups / D), seeding together the structurally orthogonal columns
+ * of the pattern (see sparse_coloring).
+ *
+ * The math functions for the dual numbers are found by argument dependent lookup: the model
+ * must call them unqualified (e.g. sqrt(x[0]), or with using std::sqrt), not as std::sqrt.
+ * Branches on the state compare the values and differentiate the taken branch.
+ */
+namespace libeuler {
+
+/**
+ * @brief Dual number with D derivative directions, \f$v + \sum_k d_k \epsilon_k\f$
+ */
+template <std::size_t D>
+struct dual {
+  double v;                /**< Value */
+  std::array<double, D> d; /**< Derivatives along the seed directions */
+
+  dual() : v(0), d{} {}
+  dual(const double value) : v(value), d{} {}
+
+  dual &operator+=(const dual &b) { return *this = *this + b; }
+  dual &operator-=(const dual &b) { return *this = *this - b; }
+  dual &operator*=(const dual &b) { return *this = *this * b; }
+  dual &operator/=(const dual &b) { return *this = *this / b; }
+
+  /**
+   * @brief Chain rule of a scalar function with value fv and derivative df in a
+   */
+  friend dual chain(const dual &a, const double fv, const double df) {
+    dual r;
+    r.v = fv;
+    for (std::size_t k = 0; k < D; k++)
+      r.d[k] = df * a.d[k];
+    return r;
+  }
+
+  friend dual operator+(const dual &a) { return a; }
+  friend dual operator-(const dual &a) { return chain(a, -a.v, -1.0); }
+
+  friend dual operator+(const dual &a, const dual &b) {
+    dual r;
+    r.v = a.v + b.v;
+    for (std::size_t k = 0; k < D; k++)
+      r.d[k] = a.d[k] + b.d[k];
+    return r;
+  }
+  friend dual operator+(const dual &a, const double b) { return chain(a, a.v + b, 1.0); }
+  friend dual operator+(const double a, const dual &b) { return chain(b, a + b.v, 1.0); }
+
+  friend dual operator-(const dual &a, const dual &b) {
+    dual r;
+    r.v = a.v - b.v;
+    for (std::size_t k = 0; k < D; k++)
+      r.d[k] = a.d[k] - b.d[k];
+    return r;
+  }
+  friend dual operator-(const dual &a, const double b) { return chain(a, a.v - b, 1.0); }
+  friend dual operator-(const double a, const dual &b) { return chain(b, a - b.v, -1.0); }
+
+  friend dual operator*(const dual &a, const dual &b) {
+    dual r;
+    r.v = a.v * b.v;
+    for (std::size_t k = 0; k < D; k++)
+      r.d[k] = a.d[k] * b.v + a.v * b.d[k];
+    return r;
+  }
+  friend dual operator*(const dual &a, const double b) { return chain(a, a.v * b, b); }
+  friend dual operator*(const double a, const dual &b) { return chain(b, a * b.v, a); }
+
+  friend dual operator/(const dual &a, const dual &b) {
+    dual r;
+    r.v = a.v / b.v;
+    for (std::size_t k = 0; k < D; k++)
+      r.d[k] = (a.d[k] - r.v * b.d[k]) / b.v;
+    return r;
+  }
+  friend dual operator/(const dual &a, const double b) { return chain(a, a.v / b, 1.0 / b); }
+  friend dual operator/(const double a, const dual &b) { return chain(b, a / b.v, -a / (b.v * b.v)); }
+
+  friend bool operator<(const dual &a, const dual &b) { return a.v < b.v; }
+  friend bool operator>(const dual &a, const dual &b) { return a.v > b.v; }
+  friend bool operator<=(const dual &a, const dual &b) { return a.v <= b.v; }
+  friend bool operator>=(const dual &a, const dual &b) { return a.v >= b.v; }
+  friend bool operator==(const dual &a, const dual &b) { return a.v == b.v; }
+  friend bool operator!=(const dual &a, const dual &b) { return a.v != b.v; }
+
+  friend dual sqrt(const dual &a) {
+    const double s = std::sqrt(a.v);
+    return chain(a, s, 0.5 / s);
+  }
+  friend dual exp(const dual &a) {
+    const double e = std::exp(a.v);
+    return chain(a, e, e);
+  }
+  friend dual log(const dual &a) { return chain(a, std::log(a.v), 1.0 / a.v); }
+  friend dual sin(const dual &a) { return chain(a, std::sin(a.v), std::cos(a.v)); }
+  friend dual cos(const dual &a) { return chain(a, std::cos(a.v), -std::sin(a.v)); }
+  friend dual tan(const dual &a) {
+    const double tn = std::tan(a.v);
+    return chain(a, tn, 1 + tn * tn);
+  }
+  friend dual asin(const dual &a) { return chain(a, std::asin(a.v), 1.0 / std::sqrt(1 - a.v * a.v)); }
+  friend dual acos(const dual &a) { return chain(a, std::acos(a.v), -1.0 / std::sqrt(1 - a.v * a.v)); }
+  friend dual atan(const dual &a) { return chain(a, std::atan(a.v), 1.0 / (1 + a.v * a.v)); }
+  friend dual sinh(const dual &a) { return chain(a, std::sinh(a.v), std::cosh(a.v)); }
+  friend dual cosh(const dual &a) { return chain(a, std::cosh(a.v), std::sinh(a.v)); }
+  friend dual tanh(const dual &a) {
+    const double th = std::tanh(a.v);
+    return chain(a, th, 1 - th * th);
+  }
+  friend dual fabs(const dual &a) { return chain(a, std::fabs(a.v), a.v < 0 ? -1.0 : 1.0); }
+  friend dual abs(const dual &a) { return fabs(a); }
+  friend dual fmin(const dual &a, const dual &b) { return b.v < a.v ? b : a; }
+  friend dual fmax(const dual &a, const dual &b) { return b.v > a.v ? b : a; }
+  friend dual pow(const dual &a, const double b) { return chain(a, std::pow(a.v, b), b * std::pow(a.v, b - 1)); }
+  friend dual pow(const double a, const dual &b) {
+    const double pw = std::pow(a, b.v);
+    return chain(b, pw, pw * std::log(a));
+  }
+  friend dual pow(const dual &a, const dual &b) { return exp(b * log(a)); }
+  friend dual atan2(const dual &a, const dual &b) {
+    const double r2 = a.v * a.v + b.v * b.v;
+    dual r;
+    r.v = std::atan2(a.v, b.v);
+    for (std::size_t k = 0; k < D; k++)
+      r.d[k] = (b.v * a.d[k] - a.v * b.d[k]) / r2;
+    return r;
+  }
+};
+
+/**
+ * @brief Vector field and exact Jacobian callbacks of a templated model
+ *
+ * The object is passed to the callbacks as the user data of the options (see attach()), and the
+ * Jacobian has the ordering and the sparsity pattern of the options given to the constructor.
+ * The working memory of the dual numbers is thread local, thus the same object can be used by
+ * the ensemble and pool integrators.
+ * @tparam M model, callable with double and dual<D> scalars
+ * @tparam D number of derivative directions of a model evaluation
+ */
+template <class M, std::size_t D = 8>
+class ad_model {
+public:
+  /**
+   * @brief Creates the callbacks for the options (only x_size, ordering and pattern are used)
+   */
+  ad_model(const M &model, const ::euler_options &opt)
+      : model_(model), n_(opt.x_size), ordering_(opt.ordering),
+        coloring_(opt.pattern ? sparse_coloring_alloc(opt.pattern, opt.ordering) : nullptr),
+        valid_(!opt.pattern || coloring_) {}
+
+  ~ad_model() { sparse_coloring_free(coloring_); }
+
+  ad_model(const ad_model &) = delete;
+  ad_model &operator=(const ad_model &) = delete;
+
+  /**
+   * @brief The column groups of the pattern are allocated (always true for dense Jacobians)
+   */
+  bool valid() const { return valid_; }
+
+  /**
+   * @brief Sets the vector field, the Jacobian and the user data of the options
+   */
+  void attach(::euler_options &opt) {
+    opt.f = function;
+    opt.df = jacobian;
+    opt.data = this;
+  }
+
+  /**
+   * @brief Vector field callback (euler_ode_function), with data pointing to the ad_model
+   */
+  static void function(double *f, const double t, const double *x, const double *u, const double **p, void *data) {
+    const ad_model *self = static_cast<const ad_model *>(data);
+    self->model_(f, t, x, u, p);
+  }
+
+  /**
+   * @brief Jacobian callback (euler_ode_jacobian), with data pointing to the ad_model
+   *
+   * Each evaluation of the model seeds D columns (or D column groups of the pattern).
+   */
+  static void jacobian(double *df, const double t, const double *x, const double *u, const double **p, void *data) {
+    const ad_model *self = static_cast<const ad_model *>(data);
+    const lapack_int n = self->n_;
+    const sparse_coloring *coloring = self->coloring_;
+    const lapack_int seeds = coloring ? coloring->colors : n;
+    thread_local std::vector<dual<D>> xd, fd;
+    xd.resize(n);
+    fd.resize(n);
+
+    for (lapack_int first = 0; first < seeds; first += D) {
+      const lapack_int count = seeds - first < (lapack_int)D ? seeds - first : (lapack_int)D;
+      for (lapack_int j = 0; j < n; j++)
+        xd[j] = dual<D>(x[j]);
+      for (lapack_int k = 0; k < count; k++) {
+        if (!coloring) {
+          xd[first + k].d[k] = 1;
+          continue;
+        }
+        for (lapack_int q = coloring->cptr[first + k]; q < coloring->cptr[first + k + 1]; q++)
+          xd[coloring->cols[q]].d[k] = 1;
+      }
+      self->model_(fd.data(), t, xd.data(), u, p);
+
+      for (lapack_int k = 0; k < count; k++) {
+        if (!coloring) {
+          const lapack_int j = first + k;
+          for (lapack_int i = 0; i < n; i++)
+            df[self->ordering_ == LAPACK_ROW_MAJOR ? i * n + j : i + j * n] = fd[i].d[k];
+          continue;
+        }
+        for (lapack_int q = coloring->cptr[first + k]; q < coloring->cptr[first + k + 1]; q++) {
+          const lapack_int j = coloring->cols[q];
+          for (lapack_int z = coloring->jptr[j]; z < coloring->jptr[j + 1]; z++)
+            df[coloring->pos[z]] = fd[coloring->rows[z]].d[k];
+        }
+      }
+    }
+  }
+
+private:
+  M model_;
+  lapack_int n_;
+  lapack_int ordering_;
+  sparse_coloring *coloring_;
+  bool valid_;
+};
+
+} // namespace libeuler
+
+#endif
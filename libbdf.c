@@ -0,0 +1,237 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <cblas.h>
+#include "libbdf.h"
+
+/**
+ * @brief Internal: coefficients of the BDF formulas, \f$x(t+h) = \sum_j a_j x(t+h-jh) + \beta h f\f$
+ *
+ * Row q - 1 contains \f$a_1 .. a_q\f$.
+ */
+static const double bdf_a[BDF_MAX_ORDER][BDF_MAX_ORDER] = {
+  {1.0, 0.0, 0.0, 0.0, 0.0},
+  {4.0 / 3.0, -1.0 / 3.0, 0.0, 0.0, 0.0},
+  {18.0 / 11.0, -9.0 / 11.0, 2.0 / 11.0, 0.0, 0.0},
+  {48.0 / 25.0, -36.0 / 25.0, 16.0 / 25.0, -3.0 / 25.0, 0.0},
+  {300.0 / 137.0, -300.0 / 137.0, 200.0 / 137.0, -75.0 / 137.0, 12.0 / 137.0}};
+static const double bdf_beta[BDF_MAX_ORDER] = {1.0, 2.0 / 3.0, 6.0 / 11.0, 12.0 / 25.0, 60.0 / 137.0};
+
+/**
+ * @brief Internal: coefficients of the extrapolation polynomial through k equally spaced states,
+ * \f$x(t+h) \approx \sum_j (-1)^{j+1} \binom{k}{j} x(t+h-jh)\f$. Row k - 1 contains the k coefficients
+ */
+static const double bdf_predictor[BDF_MAX_ORDER + 1][BDF_MAX_ORDER + 1] = {
+  {1.0, 0.0, 0.0, 0.0, 0.0, 0.0},
+  {2.0, -1.0, 0.0, 0.0, 0.0, 0.0},
+  {3.0, -3.0, 1.0, 0.0, 0.0, 0.0},
+  {4.0, -6.0, 4.0, -1.0, 0.0, 0.0},
+  {5.0, -10.0, 10.0, -5.0, 1.0, 0.0},
+  {6.0, -15.0, 20.0, -15.0, 6.0, -1.0}};
+
+#define BDF_HISTORY (BDF_MAX_ORDER + 1) /**< Number of states in the ring buffer */
+
+bdf_workspace *bdf_workspace_alloc(const euler_options *opt, const lapack_int order)
+{
+  if (!opt || order < 1 || order > BDF_MAX_ORDER || opt->stiff)
+    return NULL;
+
+  bdf_workspace *ws = (bdf_workspace *)calloc(1, sizeof(bdf_workspace));
+  if (!ws)
+    return NULL;
+  ws->x_size = opt->x_size;
+  ws->order = order;
+
+  ws->history = (double *)calloc(BDF_HISTORY * opt->x_size, sizeof(double));
+  ws->xk = (double *)calloc(opt->x_size, sizeof(double));
+  ws->xpred = (double *)calloc(opt->x_size, sizeof(double));
+  ws->tableau = (double *)calloc(order * opt->x_size, sizeof(double));
+  if (!ws->history || !ws->xk || !ws->xpred || !ws->tableau) {
+    bdf_workspace_free(ws);
+    return NULL;
+  }
+
+  /* The step is solved by the Newton machinery of the implicit Euler step */
+  euler_options step_opt = *opt;
+  step_opt.alpha = 1.0;
+  ws->euler = euler_workspace_alloc(&step_opt);
+  if (!ws->euler) {
+    bdf_workspace_free(ws);
+    return NULL;
+  }
+  return ws;
+}
+
+void bdf_workspace_reset(bdf_workspace *ws)
+{
+  if (!ws)
+    return;
+  ws->history_len = 0;
+  ws->last_order = 0;
+}
+
+void bdf_workspace_free(bdf_workspace *ws)
+{
+  if (!ws)
+    return;
+  free(ws->history);
+  free(ws->xk);
+  free(ws->xpred);
+  free(ws->tableau);
+  euler_workspace_free(ws->euler);
+  free(ws);
+}
+
+/**
+ * @brief Internal: state in history, j steps before the most recent one
+ */
+static const double *bdf_history(const bdf_workspace *ws, const lapack_int j)
+{
+  return ws->history + ((ws->history_head + BDF_HISTORY - j) % BDF_HISTORY) * ws->x_size;
+}
+
+/**
+ * @brief Internal: appends a state to the history
+ */
+static void bdf_history_push(bdf_workspace *ws, const double t, const double *x)
+{
+  ws->history_head = (ws->history_head + 1) % BDF_HISTORY;
+  ws->t_history[ws->history_head] = t;
+  cblas_dcopy(ws->x_size, x, 1, ws->history + ws->history_head * ws->x_size, 1);
+  if (ws->history_len < BDF_HISTORY)
+    ws->history_len++;
+}
+
+/**
+ * @brief Internal: checks if the step continues the history, with the same step size
+ */
+static newton_bool bdf_history_continues(const bdf_workspace *ws, const double h, const double t, const double *x)
+{
+  if (ws->history_len == 0)
+    return NEWTON_FALSE;
+  if (fabs(h - ws->h) > EULER_TIME_EPS * h || fabs(t - ws->t_history[ws->history_head]) > EULER_TIME_EPS * h)
+    return NEWTON_FALSE;
+  if (memcmp(x, bdf_history(ws, 0), ws->x_size * sizeof(double)) != 0)
+    return NEWTON_FALSE;
+  return NEWTON_TRUE;
+}
+
+/**
+ * @brief Internal: start-up step of order q, by extrapolation of implicit Euler steps
+ *
+ * For j = 1 .. q the step is covered with j implicit Euler steps of size h / j, and the results
+ * are extrapolated to a zero step size with the Aitken-Neville scheme (rows of the tableau kept in
+ * ws->tableau). The extrapolation of order q has a local error \f$O(h^{q+1})\f$, as the BDF
+ * formula of order q, and its implicit Euler steps damp the stiff components. The error estimate
+ * is the difference with the extrapolation of order q - 1.
+ */
+static euler_ret bdf_startup(const euler_options *opt, bdf_workspace *ws, double *xp, double *err, const lapack_int q, const double t, const double *x, const double *u, const double **p)
+{
+  const lapack_int n = ws->x_size;
+  const double h = ws->h;
+
+  for (lapack_int j = 1; j <= q; j++) {
+    cblas_dcopy(n, x, 1, ws->xk, 1);
+    for (lapack_int s = 1; s <= j; s++) {
+      cblas_dcopy(n, ws->xk, 1, xp, 1);
+      euler_ret ret = euler_stage_ws(opt, ws->euler, h / j, xp, t + s * h / j, ws->xk, u, p);
+      if (ret != EULER_SUCCESS)
+        return ret;
+      cblas_dcopy(n, xp, 1, ws->xk, 1);
+    }
+    /* Row j of the tableau, in place: T(j, l + 1) = T(j, l) + (T(j, l) - T(j - 1, l)) (j - l) / l */
+    for (lapack_int l = 1; l < j; l++) {
+      double *prev = ws->tableau + (l - 1) * n;
+      const double c = (double)(j - l) / l;
+      for (lapack_int i = 0; i < n; i++) {
+        const double y = xp[i];
+        xp[i] += c * (y - prev[i]);
+        prev[i] = y;
+      }
+    }
+    cblas_dcopy(n, xp, 1, ws->tableau + (j - 1) * n, 1);
+  }
+
+  if (err) {
+    cblas_dcopy(n, xp, 1, err, 1);
+    cblas_daxpy(n, -1, ws->tableau + (q - 2) * n, 1, err, 1);
+  }
+  return EULER_SUCCESS;
+}
+
+euler_ret bdf_step(const euler_options *opt, bdf_workspace *ws, double *xp, double *err, const double t, const double *x, const double *u, const double **p)
+{
+  if (!opt || !ws || !xp || !x)
+    return EULER_NULLPTR;
+  if (ws->x_size != opt->x_size)
+    return EULER_GENERIC;
+
+  const lapack_int n = opt->x_size;
+  const double h = opt->ts;
+
+  /* A step that does not continue the history restarts it */
+  if (!bdf_history_continues(ws, h, t, x)) {
+    bdf_workspace_reset(ws);
+    ws->h = h;
+    bdf_history_push(ws, t, x);
+  }
+  const lapack_int q = ws->order;
+
+  /* Start-up: the history of the formula of order q needs q states */
+  if (ws->history_len < q) {
+    euler_ret ret = bdf_startup(opt, ws, xp, err, q, t, x, u ? u + opt->u_offset : NULL, p);
+    if (ret != EULER_SUCCESS)
+      return ret;
+    ws->last_order = q;
+    bdf_history_push(ws, t + h, xp);
+    return EULER_SUCCESS;
+  }
+  const lapack_int k = ws->history_len < q + 1 ? ws->history_len : q + 1;
+
+  /* Explicit part of the formula and predictor from the history */
+  for (lapack_int i = 0; i < n; i++) {
+    ws->xk[i] = 0;
+    ws->xpred[i] = 0;
+  }
+  for (lapack_int j = 0; j < q; j++)
+    cblas_daxpy(n, bdf_a[q - 1][j], bdf_history(ws, j), 1, ws->xk, 1);
+  for (lapack_int j = 0; j < k; j++)
+    cblas_daxpy(n, bdf_predictor[k - 1][j], bdf_history(ws, j), 1, ws->xpred, 1);
+
+  /* Single nonlinear solution: x(t+h) = xk + beta h f(t+h, x(t+h)) */
+  cblas_dcopy(n, ws->xpred, 1, xp, 1);
+  euler_ret ret = euler_stage_ws(opt, ws->euler, bdf_beta[q - 1] * h, xp, t + h, ws->xk, u ? u + opt->u_offset : NULL, p);
+  if (ret != EULER_SUCCESS)
+    return ret;
+  ws->last_order = q;
+
+  if (err) {
+    cblas_dcopy(n, xp, 1, err, 1);
+    cblas_daxpy(n, -1, ws->xpred, 1, err, 1);
+    cblas_dscal(n, 1.0 / (q + 1), err, 1);
+  }
+  bdf_history_push(ws, t + h, xp);
+  return EULER_SUCCESS;
+}
@@ -0,0 +1,129 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef LIBBDF_H_
+#define LIBBDF_H_
+
+#include "libeuler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BDF_MAX_ORDER 5 /**< Maximum order of the BDF integrator */
+
+/**
+ * @brief Persistent working memory for the BDF integrator
+ *
+ * The workspace keeps the last BDF_MAX_ORDER + 1 states in a ring buffer, that provides both
+ * the explicit part of the BDF formula and the predictor (the extrapolation polynomial through
+ * the history), and an Euler workspace for the Newton solution of the step (see
+ * euler_stage_ws()). With a fixed step and order the iteration matrix \f$-I + \beta h \nabla f\f$
+ * does not change, thus the modified and Broyden methods reuse its factors for many steps. The
+ * tableau holds the extrapolations of the start-up steps.
+ */
+typedef struct bdf_workspace {
+  lapack_int x_size;      /**< State dimensions. Taken from options struct */
+  lapack_int order;       /**< Order of the steps */
+  lapack_int last_order;  /**< Order of the last step */
+  double *history;        /**< Last states (ring). (BDF_MAX_ORDER + 1) * x_size elements */
+  double t_history[BDF_MAX_ORDER + 1]; /**< Times of the states in history */
+  lapack_int history_len; /**< Number of valid states in history */
+  lapack_int history_head; /**< Position of the most recent state in history */
+  double h;               /**< Integration step of the states in history */
+  double *xk;             /**< Explicit part of the step. x_size elements */
+  double *xpred;          /**< Predictor of the step. x_size elements */
+  double *tableau;        /**< Extrapolation tableau of the start-up steps. order * x_size elements */
+  euler_workspace *euler; /**< Workspace for the Newton solver */
+} bdf_workspace;
+
+/**
+ * @brief Allocates the working memory for the BDF integrator
+ * @param opt pointer to struct with options (alpha is not used)
+ * @param order order of the formula, in [1, BDF_MAX_ORDER]
+ * @return the allocated workspace, or NULL if memory cannot be allocated, the order is not valid or
+ *         the stiff index is set (the stages of euler_stage_ws() solve for the whole state)
+ */
+bdf_workspace *bdf_workspace_alloc(const euler_options *opt, const lapack_int order);
+
+/**
+ * @brief Discards the history of the BDF integrator
+ *
+ * The next steps rebuild the history with start-up steps (see bdf_step()). It must be called
+ * after a discontinuity of the model (the history is also discarded automatically when a step
+ * does not start from the last state).
+ * @param ws workspace. It can be NULL.
+ */
+void bdf_workspace_reset(bdf_workspace *ws);
+
+/**
+ * @brief Releases the working memory of the BDF integrator
+ * @param ws workspace to release. It can be NULL.
+ */
+void bdf_workspace_free(bdf_workspace *ws);
+
+/**
+ * @brief BDF step, with a persistent workspace
+ *
+ * Performs a step of size ts (from the options) of the backward differentiation formula
+ * \f{
+ *   x(t+h) = \sum_{j=1}^{q} a_j x(t+h-jh) + \beta h f(t+h, x(t+h), u_{u_{off}..dim(u)}, p)
+ * \f}
+ * that requires a single nonlinear solution, started from the extrapolation of the history.
+ * The order q is the order of the workspace. The formula needs the last q states: after a
+ * (re)start, the first q - 1 steps are start-up steps of the same size and order q, computed
+ * by extrapolation of 1, 2, .., q implicit Euler steps of size h / j (q(q + 1) / 2 nonlinear
+ * solutions each), so the accuracy of order q is reached from the first step and the stiff
+ * components are damped. If the step does not start from the last state in history (a
+ * different time, state or step size), the history is discarded.
+ *
+ * The order is not chosen from error estimates: with a fixed step, a lower order only loses
+ * accuracy, and the choice of the order trades accuracy for the stability region (the formulas
+ * of order 3 to 5 are not A-stable), that depends on the eigenvalues of the model and is left
+ * to the caller.
+ * @param opt pointer to struct with options
+ * @param ws workspace allocated with bdf_workspace_alloc()
+ * @param xp next integration step
+ * @param err local error estimate \f$(x(t+h) - x^{(0)}(t+h)) / (q + 1)\f$, from the difference
+ *        with the predictor (for a start-up step, the difference with the extrapolation of
+ *        order q - 1). It can be NULL
+ * @param t current integration time
+ * @param x current state
+ * @param u control vector (see euler())
+ * @param p pointer to arrays of parameters
+ * @return an exit code to check if integration step succeeded
+ */
+euler_ret bdf_step(
+  const euler_options *opt,
+  bdf_workspace *ws,
+  double *xp,
+  double *err,
+  const double t,
+  const double *x,
+  const double *u,
+  const double **p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBBDF_H_ */
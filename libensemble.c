@@ -0,0 +1,346 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "libensemble.h"
+
+/**
+ * @brief Internal: hint for the vectorization of the loops on the lanes
+ */
+#if defined(__clang__)
+#define ENSEMBLE_SIMD _Pragma("clang loop vectorize(enable)")
+#elif defined(__GNUC__)
+#define ENSEMBLE_SIMD _Pragma("GCC ivdep")
+#else
+#define ENSEMBLE_SIMD
+#endif
+
+#define ENSEMBLE_ALIGN (ENSEMBLE_LANES * sizeof(double)) /**< Alignment of the buffers in bytes */
+#define ENSEMBLE_PIVOT_MIN 1e-300                       /**< Minimum absolute value of a pivot */
+
+/**
+ * @brief Internal: aligned and zeroed allocation
+ */
+static void *ensemble_calloc(size_t n, size_t size)
+{
+  size_t bytes = n * size;
+  bytes = ((bytes + ENSEMBLE_ALIGN - 1) / ENSEMBLE_ALIGN) * ENSEMBLE_ALIGN;
+  if (bytes == 0)
+    bytes = ENSEMBLE_ALIGN;
+  void *ptr = aligned_alloc(ENSEMBLE_ALIGN, bytes);
+  if (ptr)
+    memset(ptr, 0, bytes);
+  return ptr;
+}
+
+double *ensemble_array_alloc(const ensemble_options *opt, const lapack_int components)
+{
+  if (!opt || components < 0)
+    return NULL;
+  return (double *)ensemble_calloc(components * ENSEMBLE_LD(opt->count), sizeof(double));
+}
+
+void ensemble_array_free(double *a)
+{
+  free(a);
+}
+
+ensemble_workspace *ensemble_workspace_alloc(const ensemble_options *opt)
+{
+  if (!opt)
+    return NULL;
+
+  ensemble_workspace *ws = (ensemble_workspace *)calloc(1, sizeof(ensemble_workspace));
+  if (!ws)
+    return NULL;
+  ws->x_size = opt->x_size;
+  ws->u_size = opt->u_size;
+  ws->count = opt->count;
+
+  const lapack_int n = opt->x_size;
+  ws->xk = (double *)ensemble_calloc(n * ENSEMBLE_TILE, sizeof(double));
+  ws->xp = (double *)ensemble_calloc(n * ENSEMBLE_TILE, sizeof(double));
+  ws->u = (double *)ensemble_calloc(opt->u_size * ENSEMBLE_TILE, sizeof(double));
+  ws->g = (double *)ensemble_calloc(n * ENSEMBLE_TILE, sizeof(double));
+  ws->dg = (double *)ensemble_calloc(n * n * ENSEMBLE_TILE, sizeof(double));
+  ws->norm = (double *)ensemble_calloc(ENSEMBLE_TILE, sizeof(double));
+  ws->active = (double *)ensemble_calloc(ENSEMBLE_TILE, sizeof(double));
+  ws->singular = (double *)ensemble_calloc(ENSEMBLE_TILE, sizeof(double));
+  ws->iterations = (lapack_int *)calloc(opt->count > 0 ? opt->count : 1, sizeof(lapack_int));
+  if (!ws->xk || !ws->xp || !ws->u || !ws->g || !ws->dg || 
+      !ws->norm || !ws->active || !ws->singular || !ws->iterations) {
+    ensemble_workspace_free(ws);
+    return NULL;
+  }
+  return ws;
+}
+
+void ensemble_workspace_free(ensemble_workspace *ws)
+{
+  if (!ws)
+    return;
+  free(ws->xk);
+  free(ws->xp);
+  free(ws->u);
+  free(ws->g);
+  free(ws->dg);
+  free(ws->norm);
+  free(ws->active);
+  free(ws->singular);
+  free(ws->iterations);
+  free(ws);
+}
+
+/**
+ * @brief Internal: solves the linear systems of a tile, overwriting the right hand side
+ *
+ * Gaussian elimination, vectorized across the lanes. Partial pivoting is obtained through
+ * per-lane conditional swaps of the rows, so that all the lanes execute the same instructions.
+ * Lanes with a null pivot are flagged in singular and solved with a unit pivot.
+ */
+static void ensemble_tile_solve(const lapack_int n, const lapack_int count, double *restrict a, double *restrict b, double *restrict tmp, double *restrict singular)
+{
+  const lapack_int ld = ENSEMBLE_TILE;
+#define A(i, j) (a + ((i) + (j) * n) * ld)
+#define B(i) (b + (i) * ld)
+  for (lapack_int j = 0; j < n; j++) {
+    /* Pivoting: the largest element in column j is moved in row j, lane by lane */
+    for (lapack_int r = j + 1; r < n; r++) {
+      const double *restrict arj = A(r, j), *restrict ajj = A(j, j);
+      ENSEMBLE_SIMD
+      for (lapack_int k = 0; k < count; k++)
+        tmp[k] = fabs(arj[k]) > fabs(ajj[k]) ? 1.0 : 0.0;
+      for (lapack_int c = j; c <= n; c++) {
+        double *restrict jc = c < n ? A(j, c) : B(j);
+        double *restrict rc = c < n ? A(r, c) : B(r);
+        ENSEMBLE_SIMD
+        for (lapack_int k = 0; k < count; k++) {
+          const double lo = jc[k], hi = rc[k];
+          jc[k] = tmp[k] != 0.0 ? hi : lo;
+          rc[k] = tmp[k] != 0.0 ? lo : hi;
+        }
+      }
+    }
+
+    /* Inverse of the pivot, with singular lanes flagged */
+    const double *restrict ajj = A(j, j);
+    ENSEMBLE_SIMD
+    for (lapack_int k = 0; k < count; k++) {
+      const int null_pivot = fabs(ajj[k]) < ENSEMBLE_PIVOT_MIN;
+      singular[k] = null_pivot ? 1.0 : singular[k];
+      tmp[k] = null_pivot ? 1.0 : 1.0 / ajj[k];
+    }
+
+    /* Elimination of the rows below the pivot */
+    for (lapack_int r = j + 1; r < n; r++) {
+      double *restrict arj = A(r, j);
+      ENSEMBLE_SIMD
+      for (lapack_int k = 0; k < count; k++)
+        arj[k] *= tmp[k];
+      for (lapack_int c = j + 1; c <= n; c++) {
+        const double *restrict jc = c < n ? A(j, c) : B(j);
+        double *restrict rc = c < n ? A(r, c) : B(r);
+        ENSEMBLE_SIMD
+        for (lapack_int k = 0; k < count; k++)
+          rc[k] -= arj[k] * jc[k];
+      }
+    }
+  }
+
+  /* Backward substitution */
+  for (lapack_int i = n - 1; i >= 0; i--) {
+    double *restrict bi = B(i);
+    for (lapack_int c = i + 1; c < n; c++) {
+      const double *restrict aic = A(i, c), *restrict bc = B(c);
+      ENSEMBLE_SIMD
+      for (lapack_int k = 0; k < count; k++)
+        bi[k] -= aic[k] * bc[k];
+    }
+    const double *restrict aii = A(i, i);
+    ENSEMBLE_SIMD
+    for (lapack_int k = 0; k < count; k++)
+      bi[k] = fabs(aii[k]) < ENSEMBLE_PIVOT_MIN ? bi[k] : bi[k] / aii[k];
+  }
+#undef A
+#undef B
+}
+
+/**
+ * @brief Internal: copies a tile from an ensemble array (ld) to a tile buffer (ENSEMBLE_TILE)
+ */
+static void ensemble_tile_load(double *restrict tile, const double *restrict a, const lapack_int components, const lapack_int ld, const lapack_int first, const lapack_int count)
+{
+  for (lapack_int i = 0; i < components; i++)
+    memcpy(tile + i * ENSEMBLE_TILE, a + i * ld + first, count * sizeof(double));
+}
+
+/**
+ * @brief Internal: copies a tile buffer (ENSEMBLE_TILE) in an ensemble array (ld)
+ */
+static void ensemble_tile_store(double *restrict a, const double *restrict tile, const lapack_int components, const lapack_int ld, const lapack_int first, const lapack_int count)
+{
+  for (lapack_int i = 0; i < components; i++)
+    memcpy(a + i * ld + first, tile + i * ENSEMBLE_TILE, count * sizeof(double));
+}
+
+/**
+ * @brief Internal: implicit step for a tile of instances
+ *
+ * Lanes follow the same logic of newton_solve(): a lane stops when the norm of the residual
+ * is below the tolerance, or when the norm of the step is below the step tolerance (in which
+ * case the last step is not applied).
+ */
+static void ensemble_tile_implicit(const ensemble_options *opt, ensemble_workspace *ws, const double t, const double **p, const lapack_int first, const lapack_int count)
+{
+  const lapack_int n = opt->x_size;
+  const lapack_int ld = ENSEMBLE_TILE;
+  const double ah = opt->alpha * opt->ts;
+  const double bh = (1 - opt->alpha) * opt->ts;
+  double *restrict xk = ws->xk, *restrict xp = ws->xp, *restrict g = ws->g, *restrict dg = ws->dg;
+  double *restrict norm = ws->norm, *restrict active = ws->active, *restrict singular = ws->singular;
+  const double *u_next = ws->u + opt->u_offset * ld;
+  lapack_int *iterations = ws->iterations + first;
+
+  /* Explicit part of the step (computed once): xk <- x(k) + (1 - alpha) h f(x(k), u(k)) */
+  opt->f(g, t, xk, ws->u, p, first, count, ld, opt->data);
+  for (lapack_int i = 0; i < n; i++) {
+    double *restrict xi = xk + i * ld, *restrict pi = xp + i * ld;
+    const double *restrict gi = g + i * ld;
+    ENSEMBLE_SIMD
+    for (lapack_int k = 0; k < count; k++) {
+      pi[k] = xi[k];
+      xi[k] += bh * gi[k];
+    }
+  }
+  for (lapack_int k = 0; k < count; k++) {
+    active[k] = 1.0;
+    singular[k] = 0.0;
+    iterations[k] = 0;
+  }
+
+  for (lapack_int iter = 0; iter <= opt->max_iter; iter++) {
+    /* Residual: g <- xk - x(k+1) + alpha h f(x(k+1), u(k+1)) */
+    opt->f(g, t, xp, u_next, p, first, count, ld, opt->data);
+    for (lapack_int k = 0; k < count; k++)
+      norm[k] = 0;
+    for (lapack_int i = 0; i < n; i++) {
+      double *restrict gi = g + i * ld;
+      const double *restrict xi = xk + i * ld, *restrict pi = xp + i * ld;
+      ENSEMBLE_SIMD
+      for (lapack_int k = 0; k < count; k++) {
+        gi[k] = xi[k] - pi[k] + ah * gi[k];
+        norm[k] += gi[k] * gi[k];
+      }
+    }
+    lapack_int running = 0;
+    ENSEMBLE_SIMD
+    for (lapack_int k = 0; k < count; k++) {
+      active[k] = sqrt(norm[k]) < opt->s_tol ? 0.0 : active[k];
+      running += active[k] != 0.0;
+    }
+    if (running == 0 || iter == opt->max_iter)
+      break;
+
+    /* Iteration matrix: dg <- -I + alpha h J(x(k+1), u(k+1)) and right hand side -g */
+    opt->df(dg, t, xp, u_next, p, first, count, ld, opt->data);
+    for (lapack_int e = 0; e < n * n; e++) {
+      double *restrict de = dg + e * ld;
+      const double diag = (e % (n + 1)) == 0 ? 1.0 : 0.0;
+      ENSEMBLE_SIMD
+      for (lapack_int k = 0; k < count; k++)
+        de[k] = ah * de[k] - diag;
+    }
+    for (lapack_int i = 0; i < n; i++) {
+      double *restrict gi = g + i * ld;
+      ENSEMBLE_SIMD
+      for (lapack_int k = 0; k < count; k++)
+        gi[k] = -gi[k];
+    }
+    ensemble_tile_solve(n, count, dg, g, norm, singular);
+
+    /* Masked update: singular lanes and lanes with a small step are stopped */
+    for (lapack_int k = 0; k < count; k++)
+      norm[k] = 0;
+    for (lapack_int i = 0; i < n; i++) {
+      const double *restrict gi = g + i * ld;
+      ENSEMBLE_SIMD
+      for (lapack_int k = 0; k < count; k++)
+        norm[k] += gi[k] * gi[k];
+    }
+    ENSEMBLE_SIMD
+    for (lapack_int k = 0; k < count; k++)
+      active[k] = (singular[k] != 0.0 || sqrt(norm[k]) < opt->x_tol) ? 0.0 : active[k];
+    for (lapack_int i = 0; i < n; i++) {
+      double *restrict pi = xp + i * ld;
+      const double *restrict gi = g + i * ld;
+      ENSEMBLE_SIMD
+      for (lapack_int k = 0; k < count; k++)
+        pi[k] += active[k] * gi[k];
+    }
+    for (lapack_int k = 0; k < count; k++)
+      iterations[k] += active[k] != 0.0;
+  }
+
+  for (lapack_int k = 0; k < count; k++)
+    ws->failures += singular[k] != 0.0;
+}
+
+euler_ret ensemble_step(const ensemble_options *opt, ensemble_workspace *ws, double *xp, const double t, const double *x, const double *u, const double **p)
+{
+  if (!opt || !ws || !xp || !x || (opt->u_size > 0 && !u))
+    return EULER_NULLPTR;
+  if (ws->x_size != opt->x_size || ws->u_size != opt->u_size || ws->count != opt->count)
+    return EULER_GENERIC;
+
+  const lapack_int n = opt->x_size;
+  const lapack_int ld = ENSEMBLE_LD(opt->count);
+  ws->failures = 0;
+
+  /* EXPLICIT IMPLEMENTATION */
+  if (opt->alpha == 0) {
+    opt->f(xp, t, x, u, p, 0, opt->count, ld, opt->data);
+    const double h = opt->ts;
+    double *restrict out = xp;
+    const double *restrict in = x;
+    ENSEMBLE_SIMD
+    for (lapack_int k = 0; k < n * ld; k++)
+      out[k] = in[k] + h * out[k];
+    return EULER_SUCCESS;
+  }
+
+  /* IMPLICIT IMPLEMENTATION */
+  if (!opt->df)
+    return EULER_NULLPTR;
+  for (lapack_int first = 0; first < opt->count; first += ENSEMBLE_TILE) {
+    const lapack_int count = opt->count - first < ENSEMBLE_TILE ? opt->count - first : ENSEMBLE_TILE;
+    ensemble_tile_load(ws->xk, x, n, ld, first, count);
+    ensemble_tile_load(ws->u, u, opt->u_size, ld, first, count);
+    ensemble_tile_implicit(opt, ws, t, p, first, count);
+    ensemble_tile_store(xp, ws->xp, n, ld, first, count);
+  }
+
+  if (ws->failures > 0)
+    return EULER_GENERIC;
+  return EULER_SUCCESS;
+}
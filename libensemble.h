@@ -0,0 +1,190 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef LIBENSEMBLE_H_
+#define LIBENSEMBLE_H_
+
+#include "libeuler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ENSEMBLE_LANES 8     /**< Doubles in the widest vector register (AVX-512). Leading dimensions are
+                                  multiple of this value, and buffers are aligned to its size */
+#define ENSEMBLE_TILE 64     /**< Instances solved together in the implicit step */
+
+/**
+ * @brief Leading dimension for an ensemble of count instances
+ */
+#define ENSEMBLE_LD(count) ((((count) + ENSEMBLE_LANES - 1) / ENSEMBLE_LANES) * ENSEMBLE_LANES)
+
+/**
+ * @brief Callback for the batched ode vector field
+ * The callback evaluates the vector field for a batch of count instances of the ensemble.
+ * All the vectors are stored in structure-of-arrays layout: the component i of the instance k
+ * of the batch is stored at position i * ld + k, thus each component is contiguous across the
+ * instances and the loop on k can be vectorized. The instance k of the batch is the instance
+ * first + k of the ensemble, and this index should be used to access per-instance parameters
+ * in p or data.
+ * @param f output vector for the ODE (x_size components)
+ * @param t current time for the function
+ * @param x state for the ODE evaluation (x_size components)
+ * @param u external input for the ODE evaluation (u_size components)
+ * @param p pointer to arrays of parameters
+ * @param first index in the ensemble of the first instance of the batch
+ * @param count number of instances in the batch
+ * @param ld leading dimension of f, x and u
+ * @param data auxiliary data pointer to void for user data
+ * @returns nothing
+ */
+typedef void (*ensemble_ode_function)(
+    double *f,
+    const double t,
+    const double *x,
+    const double *u,
+    const double **p,
+    const lapack_int first,
+    const lapack_int count,
+    const lapack_int ld,
+    void *data);
+
+/**
+ * @brief Callback for the batched ode vector field Jacobian
+ * Same as ensemble_ode_function, but stores the Jacobian. The element (i, j) of the
+ * Jacobian of instance k is stored at position (i + j * x_size) * ld + k (thus each
+ * Jacobian is in column major order).
+ */
+typedef void (*ensemble_ode_jacobian)(
+    double *df,
+    const double t,
+    const double *x,
+    const double *u,
+    const double **p,
+    const lapack_int first,
+    const lapack_int count,
+    const lapack_int ld,
+    void *data);
+
+/**
+ * @brief Options for the ensemble integrator
+ */
+typedef struct ensemble_options {
+  double ts;                 /**< Integration step */
+  double alpha;              /**< Tustin transform coefficient. \f$\alpha \in [0,1]\f$ */
+  lapack_int x_size;         /**< State dimensions of a single instance */
+  lapack_int u_size;         /**< Input dimension of a single instance (including the offset part) */
+  lapack_int u_offset;       /**< Input offset for implicit steps. It can also be 0 */
+  lapack_int count;          /**< Number of instances in the ensemble */
+  double s_tol;              /**< Tolerance for Newton solution */
+  double x_tol;              /**< Step tolerance for Newton solution */
+  lapack_int max_iter;       /**< Maximum number of iterations for Newton solver */
+  ensemble_ode_function f;   /**< Batched ODE vector field */
+  ensemble_ode_jacobian df;  /**< Batched Jacobian of the vector field */
+  void *data;                /**< Empty space for user data */
+} ensemble_options;
+
+/**
+ * @brief Persistent working memory for the ensemble integrator
+ *
+ * Contains the buffers for a tile of ENSEMBLE_TILE instances of the implicit step,
+ * and the per-instance statistics of the last step.
+ */
+typedef struct ensemble_workspace {
+  lapack_int x_size;      /**< State dimensions. Taken from options struct */
+  lapack_int u_size;      /**< Input dimensions. Taken from options struct */
+  lapack_int count;       /**< Number of instances. Taken from options struct */
+  double *xk;             /**< Explicit part of the step for the tile. x_size * ENSEMBLE_TILE */
+  double *xp;             /**< Newton iterate for the tile. x_size * ENSEMBLE_TILE */
+  double *u;              /**< Input for the tile. u_size * ENSEMBLE_TILE */
+  double *g;              /**< Residual and step for the tile. x_size * ENSEMBLE_TILE */
+  double *dg;             /**< Iteration matrices for the tile. x_size^2 * ENSEMBLE_TILE */
+  double *norm;           /**< Per-lane norms. ENSEMBLE_TILE */
+  double *active;         /**< Per-lane convergence mask (1 active, 0 converged). ENSEMBLE_TILE */
+  double *singular;       /**< Per-lane singular Jacobian flag. ENSEMBLE_TILE */
+  lapack_int *iterations; /**< Newton iterations of the last step, for each instance. count */
+  lapack_int failures;    /**< Instances with a singular iteration matrix in the last step */
+} ensemble_workspace;
+
+/**
+ * @brief Allocates an ensemble array
+ *
+ * Allocates (zeroed and aligned for vector loads) an array with components rows of
+ * ENSEMBLE_LD(count) elements, to be used as state, input or output of the ensemble.
+ * @param opt pointer to struct with options
+ * @param components number of components of each instance
+ * @return the allocated array, or NULL. Must be released with ensemble_array_free()
+ */
+double *ensemble_array_alloc(const ensemble_options *opt, const lapack_int components);
+
+/**
+ * @brief Releases an ensemble array
+ * @param a array to release. It can be NULL.
+ */
+void ensemble_array_free(double *a);
+
+/**
+ * @brief Allocates the working memory for the ensemble integrator
+ * @param opt pointer to struct with options
+ * @return the allocated workspace, or NULL if memory cannot be allocated
+ */
+ensemble_workspace *ensemble_workspace_alloc(const ensemble_options *opt);
+
+/**
+ * @brief Releases the working memory of the ensemble integrator
+ * @param ws workspace to release. It can be NULL.
+ */
+void ensemble_workspace_free(ensemble_workspace *ws);
+
+/**
+ * @brief Euler step (explicit or implicit) for all the instances of the ensemble
+ *
+ * Performs the same step of euler() on each instance. State and inputs are ensemble arrays
+ * with leading dimension ENSEMBLE_LD(count). The explicit step is a single batched evaluation
+ * followed by a vectorized update. In the implicit step the instances are solved in tiles of
+ * ENSEMBLE_TILE instances, that run the Newton iterations together: the linear systems
+ * are solved by Gaussian elimination (with per-lane partial pivoting) vectorized across the
+ * instances, and converged instances are masked out of the update until the whole tile has
+ * converged. The number of iterations for each instance is stored in the workspace.
+ * @param opt pointer to struct with options
+ * @param ws workspace for the integration step
+ * @param xp next integration step (ensemble array)
+ * @param t current integration time
+ * @param x current state (ensemble array)
+ * @param u control vector (ensemble array, see euler()). It can be NULL if u_size is 0
+ * @param p  pointer to arrays of parameters
+ * @return an exit code to check if integration step succeeded
+ */
+euler_ret ensemble_step(
+  const ensemble_options *opt,
+  ensemble_workspace *ws,
+  double *xp,
+  const double t,
+  const double *x,
+  const double *u,
+  const double **p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBENSEMBLE_H_ */
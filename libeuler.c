@@ -20,6 +20,9 @@
  * SOFTWARE.
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <cblas.h>
 #include "libeuler.h"
 
@@ -32,14 +35,43 @@ typedef struct euler_passthrough
   double alpha;           /**< Tustin coefficient. Taken from options struct */
   lapack_int u_offset;    /**< Input offset for \f$t+h\f$ callbacks. Taken from options struct */
   euler_ode_function f;   /**< Vector field to integrate. Taken from input struct */
+  euler_ode_function_batch f_batch; /**< Batched vector field. Taken from options struct */
   euler_ode_jacobian df;  /**< Jacobian of the vector field. Taken from options struct */
-  const double *xk;       /**< Current state. Taken from parameters */
+  euler_ode_jacobian_vector jv; /**< Jacobian-vector product of the vector field. Taken from options struct */
+  euler_ode_preconditioner prec; /**< Preconditioner of the iteration matrix. Taken from options struct */
+  const double *xk;       /**< Explicit part of the step: \f$x(t) + (1-\alpha) h f(x(t), u_{1..u_{off}}, p)\f$ */
   lapack_int x_size;      /**< Ode dimension, taken from the input struct */
   double *work_f;         /**< Working space. Allocated in integration step */
   double *work_df;        /**< Working space. Allocated in integration step */
+  const lapack_int *map;  /**< Positions of the Jacobian nonzeros and of the diagonal in the iteration
+                               matrix. NULL for dense Jacobians */
+  lapack_int nnz;         /**< Nonzeros of the Jacobian */
+  lapack_int nnz_iteration; /**< Nonzeros of the iteration matrix */
   void *data;             /**< User supplied data. Taken from parameters */
 } euler_passtrough;
 
+/**
+ * @brief Internal: Struct passed to the callbacks of the partitioned (IMEX) implicit step
+ */
+typedef struct euler_partition_passtrough
+{
+  double ah;              /**< Product of the Tustin coefficient and the integration step */
+  lapack_int u_offset;    /**< Input offset for \f$t+h\f$ callbacks. Taken from options struct */
+  euler_ode_function f;   /**< Vector field to integrate. Taken from input struct */
+  euler_ode_jacobian df;  /**< Jacobian of the vector field. Taken from options struct */
+  const double *xk;       /**< Explicit part of the step of the whole state (only the stiff components are used) */
+  lapack_int x_size;      /**< Ode dimension, taken from the input struct */
+  lapack_int ordering;    /**< Ordering of the Jacobian. Taken from options struct */
+  const sparse_pattern *pattern; /**< Pattern of the Jacobian. Taken from options struct */
+  const lapack_int *stiff; /**< Indexes of the stiff components. Taken from options struct */
+  lapack_int stiff_size;  /**< Number of stiff components. Taken from options struct */
+  const lapack_int *position; /**< Position of each component in the stiff subsystem, -1 for the explicit ones */
+  double *x;              /**< Whole state, with the explicit components at \f$t+h\f$ */
+  double *fx;             /**< Vector field of the whole state */
+  double *jac;            /**< Jacobian of the whole state (dense or nonzeros of the pattern) */
+  void *data;             /**< User supplied data. Taken from parameters */
+} euler_partition_passtrough;
+
 /**
  * @brief Euler implicit step wrapper
  * 
@@ -53,6 +85,14 @@ typedef struct euler_passthrough
  */
 void euler_function_wrapper(double *f, const double t, const double *x, const double *u, const double **p, void *data);
 
+/**
+ * @brief Euler implicit step wrapper, batched
+ *
+ * Same residual of euler_function_wrapper() in count points with stride ld, with a single call of
+ * the user supplied batched vector field
+ */
+void euler_function_batch_wrapper(double *f, const double t, const double *x, const double *u, const double **p, const lapack_int count, const lapack_int ld, void *data);
+
 /**
  * @brief Euler implicit step wrapper jacobian
  * 
@@ -64,75 +104,1152 @@ void euler_function_wrapper(double *f, const double t, const double *x, const do
  */
 void euler_jacobian_wrapper(double *f, const double t, const double *x, const double *u, const double **p, void *data);
 
-    euler_ret euler(const euler_options *opt, double *xp, const double t, const double *x, const double *u, const double **p, void *data)
+/**
+ * @brief Euler implicit step wrapper Jacobian-vector product
+ *
+ * Implements \f$\nabla_{x(t+h)} g(\cdot) v = -v + \alpha h \nabla f(x(t+h)) v\f$
+ * by using the user supplied product callback
+ */
+void euler_jacobian_vector_wrapper(double *jv, const double *v, const double t, const double *x, const double *u, const double **p, void *data);
+
+/**
+ * @brief Euler implicit step wrapper preconditioner
+ *
+ * The iteration matrix is \f$-(I - \alpha h \nabla f)\f$, thus the wrapper changes the sign
+ * of the user supplied preconditioner
+ */
+void euler_preconditioner_wrapper(double *z, const double *r, const double t, const double *x, const double *u, const double **p, void *data);
+
+/**
+ * @brief Partitioned implicit step wrapper
+ *
+ * With the stiff components \f$z\f$ inserted in the whole state (whose explicit components are
+ * already at \f$t+h\f$), implements
+ * \f{
+ *   g(z) = -z + x_S(t) + (1-\alpha) h f_S(x(t), u_{1..u_{off}}, p) + \alpha h f_S(x_E(t+h), z, u_{u_{off}..dim(u)}, p)
+ * \f}
+ */
+void euler_partition_function_wrapper(double *f, const double t, const double *z, const double *u, const double **p, void *data);
+
+/**
+ * @brief Partitioned implicit step wrapper jacobian
+ *
+ * Extracts the stiff block of the user supplied Jacobian, and stores the dense column major
+ * matrix \f$-I + \alpha h \nabla_{x_S} f_S\f$
+ */
+void euler_partition_jacobian_wrapper(double *df, const double t, const double *z, const double *u, const double **p, void *data);
+
+/**
+ * @brief Internal: options for the Newton solver of the implicit step
+ */
+static newton_options euler_newton_options(const euler_options *opt, const euler_workspace *ws)
 {
+  newton_options newton_opts = {
+    .ordering = opt->ordering,
+    .f_size = opt->x_size,
+    .x_size = opt->x_size,
+    .f_tol = opt->s_tol,
+    .x_tol = opt->x_tol,
+    .max_iter = opt->max_iter,
+    .f = euler_function_wrapper,
+    .df = opt->df ? euler_jacobian_wrapper : NULL,
+    .method = opt->method,
+    .contraction = opt->contraction,
+    .pattern = ws->pattern,
+    .jv = opt->jv ? euler_jacobian_vector_wrapper : NULL,
+    .prec = opt->prec ? euler_preconditioner_wrapper : NULL,
+    .restart = opt->restart,
+    .deadline = 0,
+    .globalization = opt->globalization,
+    .f_batch = opt->f_batch ? euler_function_batch_wrapper : NULL,
+    .mixed = opt->mixed
+  };
+  return newton_opts;
+}
 
-  /* EXPLICIT IMPLEMENTATION */
-/* Performin a very simple step if alpha == 0 */
-if (opt->alpha == 0)
+/**
+ * @brief Internal: options for the Newton solver of the stiff subsystem of the partitioned step
+ *
+ * The batched vector field is not used: the finite differences perturb the stiff columns one by
+ * one through the wrapper, that evaluates the whole state.
+ */
+static newton_options euler_partition_options(const euler_options *opt)
+{
+  newton_options newton_opts = {
+    .ordering = LAPACK_COL_MAJOR,
+    .f_size = opt->stiff_size,
+    .x_size = opt->stiff_size,
+    .f_tol = opt->s_tol,
+    .x_tol = opt->x_tol,
+    .max_iter = opt->max_iter,
+    .f = euler_partition_function_wrapper,
+    .df = opt->df ? euler_partition_jacobian_wrapper : NULL,
+    .method = opt->method,
+    .contraction = opt->contraction,
+    .pattern = NULL,
+    .jv = NULL,
+    .prec = NULL,
+    .restart = 0,
+    .deadline = 0,
+    .globalization = opt->globalization,
+    .f_batch = NULL,
+    .mixed = opt->mixed
+  };
+  return newton_opts;
+}
+
+/**
+ * @brief Internal: explicit Euler step. Does not require working memory.
+ */
+static euler_ret euler_explicit(const euler_options *opt, const double h, double *xp, const double t, const double *x, const double *u, const double **p)
 {
   opt->f(xp, t, x, u, p, opt->data);
-  cblas_dscal(opt->x_size, opt->ts, xp, 1);
+  cblas_dscal(opt->x_size, h, xp, 1);
   cblas_daxpy(opt->x_size, 1, x, 1, xp, 1);
   return EULER_SUCCESS;
-  }
+}
+
+euler_ret euler(const euler_options *opt, double *xp, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  /* EXPLICIT IMPLEMENTATION */
+  /* Performin a very simple step if alpha == 0 */
+  if (opt->alpha == 0)
+    return euler_explicit(opt, opt->ts, xp, t, x, u, p);
 
   /* IMPLICIT IMPLEMENTTION */
   /* Allocating working memory */
-  double *work_f = (double *)calloc(2 * opt->x_size, sizeof(double));
-  if (!work_f)
-    return EULER_EMALLOC;
-  double *work_df = (double *)calloc(2 * opt->x_size * opt->x_size, sizeof(double));
-  if(!work_df) {
-    free(work_f);
+  euler_workspace *ws = euler_workspace_alloc(opt);
+  if (!ws)
     return EULER_EMALLOC;
+
+  euler_ret ret = euler_ws(opt, ws, xp, t, x, u, p, data);
+
+  /* Freeing space */
+  euler_workspace_free(ws);
+  return ret;
+}
+
+euler_workspace *euler_workspace_alloc(const euler_options *opt)
+{
+  if (!opt)
+    return NULL;
+
+  euler_workspace *ws = (euler_workspace *)calloc(1, sizeof(euler_workspace));
+  if (!ws)
+    return NULL;
+  ws->x_size = opt->x_size;
+
+  if (opt->dense) {
+    ws->dense = (double *)calloc(4 * opt->x_size, sizeof(double));
+    if (!ws->dense) {
+      euler_workspace_free(ws);
+      return NULL;
+    }
   }
-  /* Setting up the identity matrix in work_df second space, once forever */
-  for (lapack_int i = 0; i < opt->x_size; i++)
-    work_df[(opt->x_size * opt->x_size) + i + i * opt->x_size] = -1.0;
 
-  /* Setting up options for Euler step */
-  newton_options newton_opts = {
-    opt->ordering, opt->x_size, opt->x_size, 
-    opt->s_tol, opt->x_tol, opt->max_iter,
-    euler_function_wrapper,
-    euler_jacobian_wrapper
-  };
+  /* Explicit steps does not require any working memory */
+  if (opt->alpha == 0)
+    return ws;
+
+  ws->work_f = (double *)calloc(3 * opt->x_size, sizeof(double));
+  ws->history = (double *)calloc(3 * opt->x_size, sizeof(double));
+  if (!ws->work_f || !ws->history) {
+    euler_workspace_free(ws);
+    return NULL;
+  }
+
+  /* Partitioned step: the Newton solver works on the stiff subsystem, with a dense iteration matrix */
+  if (opt->stiff) {
+    const lapack_int n = opt->x_size;
+    const lapack_int jac_size = opt->pattern ? opt->pattern->ptr[n] : n * n;
+    ws->stiff_position = (lapack_int *)calloc(n, sizeof(lapack_int));
+    ws->work_partition = (double *)calloc(2 * n + opt->stiff_size + (opt->df ? jac_size : 0), sizeof(double));
+    if (!ws->stiff_position || !ws->work_partition || opt->method == NEWTON_KRYLOV ||
+        opt->stiff_size < 1 || opt->stiff_size > n || (opt->pattern && opt->pattern->n != n)) {
+      euler_workspace_free(ws);
+      return NULL;
+    }
+    for (lapack_int i = 0; i < n; i++)
+      ws->stiff_position[i] = -1;
+    for (lapack_int j = 0; j < opt->stiff_size; j++) {
+      const lapack_int i = opt->stiff[j];
+      if (i < 0 || i >= n || (j > 0 && i <= opt->stiff[j - 1])) {
+        euler_workspace_free(ws);
+        return NULL;
+      }
+      ws->stiff_position[i] = j;
+    }
+    newton_options newton_opts = euler_partition_options(opt);
+    ws->newton = newton_workspace_alloc(&newton_opts);
+    if (!ws->newton) {
+      euler_workspace_free(ws);
+      return NULL;
+    }
+    return ws;
+  }
+
+  /* Finite difference Jacobians (df is NULL) and the Krylov method do not use the working space
+     of the Jacobian wrapper */
+  if (opt->pattern) {
+    /* Sparse Jacobian: the iteration matrix has the pattern of the Jacobian and the diagonal */
+    if (opt->pattern->n != opt->x_size) {
+      euler_workspace_free(ws);
+      return NULL;
+    }
+    const lapack_int nnz = opt->pattern->ptr[opt->x_size];
+    ws->work_df = opt->df ? (double *)calloc(nnz + 1, sizeof(double)) : NULL;
+    ws->pattern_map = (lapack_int *)calloc(nnz + opt->x_size, sizeof(lapack_int));
+    if ((opt->df && !ws->work_df) || !ws->pattern_map) {
+      euler_workspace_free(ws);
+      return NULL;
+    }
+    ws->pattern = sparse_pattern_diagonal(opt->pattern, ws->pattern_map);
+    if (!ws->pattern) {
+      euler_workspace_free(ws);
+      return NULL;
+    }
+  } else if (opt->df && opt->method != NEWTON_KRYLOV) {
+    ws->work_df = (double *)calloc(2 * opt->x_size * opt->x_size, sizeof(double));
+    if (!ws->work_df) {
+      euler_workspace_free(ws);
+      return NULL;
+    }
+    /* Setting up the identity matrix in work_df second space, once forever */
+    for (lapack_int i = 0; i < opt->x_size; i++)
+      ws->work_df[(opt->x_size * opt->x_size) + i + i * opt->x_size] = -1.0;
+  }
+
+  newton_options newton_opts = euler_newton_options(opt, ws);
+  ws->newton = newton_workspace_alloc(&newton_opts);
+  if (!ws->newton) {
+    euler_workspace_free(ws);
+    return NULL;
+  }
+  return ws;
+}
+
+void euler_workspace_free(euler_workspace *ws)
+{
+  if (!ws)
+    return;
+  free(ws->work_f);
+  free(ws->work_df);
+  free(ws->history);
+  free(ws->dense);
+  free(ws->pattern);
+  free(ws->pattern_map);
+  free(ws->stiff_position);
+  free(ws->work_partition);
+  free(ws->trajectory);
+  free(ws->fired);
+  newton_workspace_free(ws->newton);
+  free(ws);
+}
+
+/**
+ * @brief Internal: checks if the step starts from the last state in history
+ */
+static newton_bool euler_history_continues(const euler_workspace *ws, const double h, const double t, const double *x)
+{
+  if (ws->history_len == 0)
+    return NEWTON_FALSE;
+  if (fabs(t - ws->t_history[ws->history_head]) > EULER_TIME_EPS * h)
+    return NEWTON_FALSE;
+  if (memcmp(x, ws->history + ws->history_head * ws->x_size, ws->x_size * sizeof(double)) != 0)
+    return NEWTON_FALSE;
+  return NEWTON_TRUE;
+}
+
+/**
+ * @brief Internal: appends a state to the history
+ */
+static void euler_history_push(euler_workspace *ws, const double t, const double *x)
+{
+  ws->history_head = (ws->history_head + 1) % 3;
+  ws->t_history[ws->history_head] = t;
+  cblas_dcopy(ws->x_size, x, 1, ws->history + ws->history_head * ws->x_size, 1);
+  if (ws->history_len < 3)
+    ws->history_len++;
+}
+
+/**
+ * @brief Internal: stores an accepted step in the history of the extrapolation predictor
+ *
+ * Called by the drivers once the step is final: rejected, repeated or discarded implicit steps
+ * must not enter the history.
+ */
+static void euler_history_update(const euler_options *opt, euler_workspace *ws, const double h, const double t, const double *x, const double *xp)
+{
+  if (opt->alpha == 0 || opt->predictor != EULER_PREDICT_EXTRAPOLATE || ws->x_size != opt->x_size)
+    return;
+  if (!euler_history_continues(ws, h, t, x)) {
+    ws->history_len = 0;
+    euler_history_push(ws, t, x);
+  }
+  euler_history_push(ws, t + h, xp);
+}
+
+/**
+ * @brief Internal: initial guess for the Newton solver
+ *
+ * The extrapolation is the Lagrange polynomial through the current state and (up to) the
+ * two previous states in history, evaluated in t + h. Requires f(x(t)) in work_f.
+ */
+static void euler_predict(const euler_options *opt, euler_workspace *ws, const double h, double *xp, const double t, const double *x)
+{
+  const lapack_int n = opt->x_size;
+  const double *fk = ws->work_f + 2 * n;
 
+  switch (opt->predictor) {
+  case EULER_PREDICT_EXTRAPOLATE:
+    if (euler_history_continues(ws, h, t, x) && ws->history_len > 1) {
+      const lapack_int points = ws->history_len;
+      const double tp = t + h;
+      for (lapack_int i = 0; i < n; i++)
+        xp[i] = 0;
+      for (lapack_int j = 0; j < points; j++) {
+        const lapack_int sj = (ws->history_head + 3 - j) % 3;
+        double l = 1;
+        for (lapack_int m = 0; m < points; m++) {
+          const lapack_int sm = (ws->history_head + 3 - m) % 3;
+          if (m != j)
+            l *= (tp - ws->t_history[sm]) / (ws->t_history[sj] - ws->t_history[sm]);
+        }
+        cblas_daxpy(n, l, ws->history + sj * n, 1, xp, 1);
+      }
+      return;
+    }
+    /* No history: explicit step */
+    /* fall through */
+  case EULER_PREDICT_EXPLICIT:
+    cblas_dcopy(n, x, 1, xp, 1);
+    cblas_daxpy(n, h, fk, 1, xp, 1);
+    return;
+  default:
+    cblas_dcopy(n, x, 1, xp, 1);
+    return;
+  }
+}
+
+/**
+ * @brief Internal: checks that the workspace can be used for implicit steps with the options
+ */
+static euler_ret euler_implicit_check(const euler_options *opt, const euler_workspace *ws)
+{
+  if (!ws->newton || ws->x_size != opt->x_size)
+    return EULER_NULLPTR;
+  /* The Newton workspace of the partitioned step has the size of the stiff subsystem */
+  if ((opt->stiff != NULL) != (ws->stiff_position != NULL))
+    return EULER_GENERIC;
+  if (opt->stiff)
+    return EULER_SUCCESS;
+  if ((opt->pattern != NULL) != (ws->pattern != NULL) ||
+      (opt->df && opt->method != NEWTON_KRYLOV && !ws->work_df))
+    return EULER_GENERIC;
+  return EULER_SUCCESS;
+}
+
+/**
+ * @brief Internal: data of the wrappers for \f$x = x_k + \alpha h f(x, u_{u_{off}..dim(u)}, p)\f$
+ *
+ * The factors in the Newton workspace are invalidated if they refer to a different alpha h.
+ */
+static euler_passtrough euler_newton_data(const euler_options *opt, euler_workspace *ws, const double h, const double alpha, const lapack_int u_offset, const double *xk)
+{
+  const lapack_int n = opt->x_size;
   euler_passtrough pt = {
-    opt->ts, opt->alpha, opt->u_offset,
-    opt->f, opt->df, x, opt->x_size,
-    work_f, work_df,
+    h, alpha, u_offset,
+    opt->f, opt->f_batch, opt->df, opt->jv, opt->prec, xk, opt->x_size,
+    ws->work_f, ws->work_df,
+    ws->pattern_map,
+    opt->pattern ? opt->pattern->ptr[n] : 0,
+    ws->pattern ? ws->pattern->ptr[n] : 0,
     opt->data
   };
 
-  cblas_dcopy(opt->x_size, x, 1, xp, 1);
-  newton_ret nwt = newton_solve(&newton_opts, t, xp, u, p, ((void *)&pt)); 
+  /* Reused factors refer to the iteration matrix with the same alpha h */
+  if (ws->lu_ah != alpha * h) {
+    newton_workspace_invalidate(ws->newton);
+    ws->lu_ah = alpha * h;
+  }
+  return pt;
+}
 
-  /* Freeing space */
-  free(work_f);
-  free(work_df);
+/**
+ * @brief Internal: solves \f$x = x_k + \alpha h f(x, u_{u_{off}..dim(u)}, p)\f$ with the Newton solver
+ *
+ * The initial guess is in xp. The results of the solver are stored in the workspace. With factor,
+ * the iteration matrix is only evaluated in xp and factorized in the Newton workspace.
+ */
+static newton_ret euler_newton(const euler_options *opt, euler_workspace *ws, const double h, const double alpha, const lapack_int u_offset, double *xp, const double t, const double *xk, const double *u, const double **p, const newton_bool factor)
+{
+  /* Setting up options for Euler step */
+  newton_options newton_opts = euler_newton_options(opt, ws);
+  euler_passtrough pt = euler_newton_data(opt, ws, h, alpha, u_offset, xk);
+  newton_opts.deadline = ws->deadline;
+
+  if (factor)
+    return newton_workspace_factor(&newton_opts, ws->newton, t, xp, u, p, ((void *)&pt));
+  return newton_solve_r(&newton_opts, ws->newton, &ws->stats, t, xp, u, p, ((void *)&pt));
+}
+
+/**
+ * @brief Internal: the reused factors did not converge, and the solution must be repeated with a fresh Jacobian
+ *
+ * There is no retry once the deadline of the step expired: the iterate of the first attempt is kept.
+ */
+static newton_bool euler_newton_retry(const euler_options *opt, euler_workspace *ws, const newton_ret nwt)
+{
+  if ((opt->method == NEWTON_MODIFIED || opt->method == NEWTON_BROYDEN) &&
+      nwt >= NEWTON_MAX_ITER && nwt != NEWTON_DEADLINE && ws->stats.jacobians == 0 &&
+      (ws->deadline == 0 || newton_clock() < ws->deadline)) {
+    newton_workspace_invalidate(ws->newton);
+    return NEWTON_TRUE;
+  }
+  return NEWTON_FALSE;
+}
+
+/**
+ * @brief Internal: solves the stiff subsystem of the partitioned step with the Newton solver
+ *
+ * The whole state in xp contains the explicit components at t+h and the initial guess of the
+ * stiff ones, that are replaced by the solution. The explicit part of the step is in xk. With
+ * factor, the iteration matrix is only evaluated in xp and factorized in the Newton workspace.
+ */
+static newton_ret euler_partition_newton(const euler_options *opt, euler_workspace *ws, const double h, double *xp, const double t, const double *xk, const double *u, const double **p, const newton_bool factor)
+{
+  const lapack_int n = opt->x_size;
+  const lapack_int m = opt->stiff_size;
+  double *z = ws->work_partition + 2 * n;
+
+  newton_options newton_opts = euler_partition_options(opt);
+  euler_partition_passtrough pt = {
+    opt->alpha * h, opt->u_offset,
+    opt->f, opt->df, xk, n, opt->ordering, opt->pattern,
+    opt->stiff, m, ws->stiff_position,
+    ws->work_partition, ws->work_partition + n, ws->work_partition + 2 * n + m,
+    opt->data
+  };
+  newton_opts.deadline = ws->deadline;
+
+  /* Reused factors refer to the iteration matrix with the same alpha h */
+  if (ws->lu_ah != opt->alpha * h) {
+    newton_workspace_invalidate(ws->newton);
+    ws->lu_ah = opt->alpha * h;
+  }
+  cblas_dcopy(n, xp, 1, ws->work_partition, 1);
+  for (lapack_int j = 0; j < m; j++)
+    z[j] = xp[opt->stiff[j]];
+  if (factor)
+    return newton_workspace_factor(&newton_opts, ws->newton, t, z, u, p, ((void *)&pt));
+  newton_ret nwt = newton_solve_r(&newton_opts, ws->newton, &ws->stats, t, z, u, p, ((void *)&pt));
+  for (lapack_int j = 0; j < m; j++)
+    xp[opt->stiff[j]] = z[j];
+  return nwt;
+}
+
+/**
+ * @brief Internal: partitioned (IMEX) implicit step
+ *
+ * The explicit components advance with the explicit Euler step, then the stiff subsystem is
+ * solved with the explicit components fixed at t+h, from the predicted stiff components.
+ */
+static newton_ret euler_partition(const euler_options *opt, euler_workspace *ws, const double h, double *xp, const double t, const double *x, const double *xk, const double *u, const double **p)
+{
+  const lapack_int n = opt->x_size;
+  const double *fk = ws->work_f + 2 * n;
+  newton_ret nwt = NEWTON_MAX_ITER;
+
+  lapack_int iterations = 0;
+
+  for (int attempt = 0; attempt < 2; attempt++) {
+    /* Under a deadline, the retry continues from the iterate of the first attempt */
+    if (attempt == 0 || ws->deadline == 0) {
+      euler_predict(opt, ws, h, xp, t, x);
+      for (lapack_int i = 0; i < n; i++)
+        if (ws->stiff_position[i] < 0)
+          xp[i] = x[i] + h * fk[i];
+    }
+    nwt = euler_partition_newton(opt, ws, h, xp, t, xk, u, p, NEWTON_FALSE);
+    if (ws->deadline > 0)
+      ws->stats.iterations += iterations;
+
+    /* Reused factors did not converge: the step is repeated with a fresh Jacobian */
+    if (!euler_newton_retry(opt, ws, nwt))
+      break;
+    iterations = ws->stats.iterations;
+  }
+  return nwt;
+}
+
+/**
+ * @brief Internal: implicit Euler step with integration step h. Memory is taken from workspace.
+ */
+static euler_ret euler_implicit(const euler_options *opt, euler_workspace *ws, const double h, double *xp, const double t, const double *x, const double *u, const double **p)
+{
+  euler_ret ret = euler_implicit_check(opt, ws);
+  if (ret != EULER_SUCCESS)
+    return ret;
+
+  /* Explicit part of the step, once for all the iterations: xk <- x(k) + (1 - alpha) h f(x(k), u(k)) */
+  const lapack_int n = opt->x_size;
+  double *xk = ws->work_f;
+  double *fk = ws->work_f + 2 * n;
+  opt->f(fk, t, x, u, p, opt->data);
+  cblas_dcopy(n, x, 1, xk, 1);
+  cblas_daxpy(n, (1 - opt->alpha) * h, fk, 1, xk, 1);
+
+  newton_ret nwt;
+  if (opt->stiff) {
+    nwt = euler_partition(opt, ws, h, xp, t, x, xk, u, p);
+  } else {
+    euler_predict(opt, ws, h, xp, t, x);
+    nwt = euler_newton(opt, ws, h, opt->alpha, opt->u_offset, xp, t, xk, u, p, NEWTON_FALSE);
+
+    /* Reused factors did not converge: the step is repeated with a fresh Jacobian. Under a
+       deadline it continues from the first iterate, that survives a retry stopped at once */
+    if (euler_newton_retry(opt, ws, nwt)) {
+      const lapack_int iterations = ws->stats.iterations;
+      if (ws->deadline == 0)
+        euler_predict(opt, ws, h, xp, t, x);
+      nwt = euler_newton(opt, ws, h, opt->alpha, opt->u_offset, xp, t, xk, u, p, NEWTON_FALSE);
+      if (ws->deadline > 0)
+        ws->stats.iterations += iterations;
+    }
+  }
+
+  ws->status = nwt;
   if (nwt > NEWTON_MAX_ITER)
     return EULER_GENERIC;
   return EULER_SUCCESS;
 }
 
+euler_ret euler_stage_ws(const euler_options *opt, euler_workspace *ws, const double ah, double *xp, const double t, const double *xk, const double *u, const double **p)
+{
+  if (!opt || !ws || !xp || !xk)
+    return EULER_NULLPTR;
+  euler_ret ret = euler_implicit_check(opt, ws);
+  if (ret != EULER_SUCCESS)
+    return ret;
+  if (opt->stiff)
+    return EULER_GENERIC;
+
+  newton_ret nwt = euler_newton(opt, ws, ah, 1.0, 0, xp, t, xk, u, p, NEWTON_FALSE);
+
+  /* Reused factors did not converge: the stage is repeated with a fresh Jacobian, from xk */
+  if (euler_newton_retry(opt, ws, nwt)) {
+    cblas_dcopy(opt->x_size, xk, 1, xp, 1);
+    nwt = euler_newton(opt, ws, ah, 1.0, 0, xp, t, xk, u, p, NEWTON_FALSE);
+  }
+
+  /* The stage has no status check in its callers: an unconverged solution is an error */
+  ws->status = nwt;
+  if (nwt >= NEWTON_MAX_ITER)
+    return EULER_GENERIC;
+  return EULER_SUCCESS;
+}
+
+euler_ret euler_factor_ws(const euler_options *opt, euler_workspace *ws, const double ah, const double t, const double *x, const double *u, const double **p)
+{
+  if (!opt || !ws || !x)
+    return EULER_NULLPTR;
+  euler_ret ret = euler_implicit_check(opt, ws);
+  if (ret != EULER_SUCCESS)
+    return ret;
+  if (opt->stiff || opt->method == NEWTON_KRYLOV)
+    return EULER_GENERIC;
+
+  /* The explicit part cancels in the differences of the residual: the step's one is kept */
+  newton_options newton_opts = euler_newton_options(opt, ws);
+  euler_passtrough pt = euler_newton_data(opt, ws, ah, 1.0, 0, ws->work_f);
+  if (newton_workspace_factor(&newton_opts, ws->newton, t, x, u, p, ((void *)&pt)) != NEWTON_F_TOL)
+    return EULER_GENERIC;
+  return EULER_SUCCESS;
+}
+
+/**
+ * @brief Internal: derivatives at the ends of the step from x to xp, for the dense output
+ *
+ * For the implicit step, f(x(t)) is in work_f and f(x(t+h)) is recovered from the step. The
+ * explicit step gives f(x(t)), and f(x(t+h)) requires an evaluation.
+ */
+static void euler_dense_data(const euler_options *opt, const euler_workspace *ws, const double h, const double t, const double *x, const double *xp, const double *u, const double **p, double *f0, double *f1)
+{
+  const lapack_int n = opt->x_size;
+  if (opt->alpha == 0) {
+    cblas_dcopy(n, xp, 1, f0, 1);
+    cblas_daxpy(n, -1, x, 1, f0, 1);
+    cblas_dscal(n, 1 / h, f0, 1);
+    opt->f(f1, t + h, xp, u ? u + opt->u_offset : NULL, p, opt->data);
+    return;
+  }
+  cblas_dcopy(n, ws->work_f + 2 * n, 1, f0, 1);
+  /* Partitioned step: the explicit components do not give f(x(t+h)) */
+  if (opt->stiff) {
+    opt->f(f1, t + h, xp, u ? u + opt->u_offset : NULL, p, opt->data);
+    return;
+  }
+  cblas_dcopy(n, xp, 1, f1, 1);
+  cblas_daxpy(n, -1, x, 1, f1, 1);
+  cblas_dscal(n, 1 / h, f1, 1);
+  cblas_daxpy(n, -(1 - opt->alpha), f0, 1, f1, 1);
+  cblas_dscal(n, 1 / opt->alpha, f1, 1);
+}
+
+/**
+ * @brief Internal: cubic Hermite interpolation of the step of size h, in theta in [0, 1]
+ */
+static void euler_hermite(const lapack_int n, const double h, const double theta, const double *x0, const double *x1, const double *f0, const double *f1, double *x)
+{
+  const double t2 = theta * theta, t3 = t2 * theta;
+  const double h00 = 2 * t3 - 3 * t2 + 1;
+  const double h10 = (t3 - 2 * t2 + theta) * h;
+  const double h01 = 3 * t2 - 2 * t3;
+  const double h11 = (t3 - t2) * h;
+  for (lapack_int i = 0; i < n; i++)
+    x[i] = h00 * x0[i] + h10 * f0[i] + h01 * x1[i] + h11 * f1[i];
+}
+
+euler_ret euler_ws(const euler_options *opt, euler_workspace *ws, double *xp, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  if (!opt || !ws || !xp || !x)
+    return EULER_NULLPTR;
+
+  euler_ret ret;
+  if (opt->alpha == 0)
+    /* EXPLICIT IMPLEMENTATION */
+    ret = euler_explicit(opt, opt->ts, xp, t, x, u, p);
+  else
+    /* IMPLICIT IMPLEMENTTION */
+    ret = euler_implicit(opt, ws, opt->ts, xp, t, x, u, p);
+  if (ret == EULER_SUCCESS)
+    euler_history_update(opt, ws, opt->ts, t, x, xp);
+
+  /* Data of the dense output: x(t), x(t+h), f(x(t)), f(x(t+h)) */
+  if (ws->dense && ws->x_size == opt->x_size) {
+    const lapack_int n = opt->x_size;
+    ws->dense_h = 0;
+    if (ret == EULER_SUCCESS) {
+      cblas_dcopy(n, x, 1, ws->dense, 1);
+      cblas_dcopy(n, xp, 1, ws->dense + n, 1);
+      euler_dense_data(opt, ws, opt->ts, t, x, xp, u, p, ws->dense + 2 * n, ws->dense + 3 * n);
+      ws->dense_t = t;
+      ws->dense_h = opt->ts;
+    }
+  }
+  return ret;
+}
+
+/**
+ * @brief Internal: bin of the latency histogram, log2 of the latency in microseconds
+ */
+static lapack_int euler_rt_bin(const double latency)
+{
+  lapack_int bin = 0;
+  for (double us = latency * 1e6; us >= 1 && bin < EULER_RT_LATENCY_BINS - 1; us /= 2)
+    bin++;
+  return bin;
+}
+
+euler_ret euler_rt_step(const euler_options *opt, euler_workspace *ws, const double budget, double *xp, const double t, const double *x, const double *u, const double **p, euler_rt_status *status, euler_rt_stats *stats)
+{
+  if (!opt || !ws || !xp || !x)
+    return EULER_NULLPTR;
+
+  const double start = newton_clock();
+  euler_rt_status st = EULER_RT_CONVERGED;
+  lapack_int iterations = 0;
+  euler_ret ret;
+  if (opt->alpha == 0) {
+    ret = euler_explicit(opt, opt->ts, xp, t, x, u, p);
+  } else {
+    ret = euler_implicit_check(opt, ws);
+    if (ret != EULER_SUCCESS)
+      return ret;
+    ws->deadline = budget > 0 ? start + budget : 0;
+    ret = euler_implicit(opt, ws, opt->ts, xp, t, x, u, p);
+    ws->deadline = 0;
+    iterations = ws->stats.iterations;
+
+    newton_bool finite = NEWTON_TRUE;
+    for (lapack_int i = 0; i < opt->x_size; i++)
+      if (!isfinite(xp[i]))
+        finite = NEWTON_FALSE;
+    if (ws->status == NEWTON_F_TOL || ws->status == NEWTON_X_TOL) {
+      st = finite ? EULER_RT_CONVERGED : EULER_RT_FALLBACK;
+    } else if ((ws->status == NEWTON_DEADLINE || ws->status == NEWTON_MAX_ITER) && iterations > 0 && finite) {
+      st = EULER_RT_ITERATE;
+    } else {
+      st = EULER_RT_FALLBACK;
+    }
+
+    /* Explicit step, from f(x(t)) evaluated for the explicit part of the implicit step */
+    if (st == EULER_RT_FALLBACK) {
+      cblas_dcopy(opt->x_size, x, 1, xp, 1);
+      cblas_daxpy(opt->x_size, opt->ts, ws->work_f + 2 * opt->x_size, 1, xp, 1);
+    }
+    euler_history_update(opt, ws, opt->ts, t, x, xp);
+    ret = EULER_SUCCESS;
+  }
+
+  if (status)
+    *status = st;
+  if (stats) {
+    const double latency = newton_clock() - start;
+    stats->steps++;
+    stats->deadlines += (opt->alpha != 0 && ws->status == NEWTON_DEADLINE) ? 1 : 0;
+    stats->fallbacks += st == EULER_RT_FALLBACK ? 1 : 0;
+    stats->worst_latency = fmax(stats->worst_latency, latency);
+    stats->latency[euler_rt_bin(latency)]++;
+    stats->iterations[iterations < EULER_RT_ITER_BINS ? iterations : EULER_RT_ITER_BINS - 1]++;
+  }
+  return ret;
+}
+
+euler_ret euler_dense(const euler_workspace *ws, const double t, double *x)
+{
+  if (!ws || !ws->dense || !x)
+    return EULER_NULLPTR;
+  const double h = ws->dense_h;
+  if (!(h > 0) || t < ws->dense_t - EULER_TIME_EPS * h || t > ws->dense_t + (1 + EULER_TIME_EPS) * h)
+    return EULER_GENERIC;
+
+  const lapack_int n = ws->x_size;
+  const double theta = fmin(1.0, fmax(0.0, (t - ws->dense_t) / h));
+  euler_hermite(n, h, theta, ws->dense, ws->dense + n, ws->dense + 2 * n, ws->dense + 3 * n, x);
+  return EULER_SUCCESS;
+}
+
+/**
+ * @brief Internal: appends a row to the output block, flushing it on the sink when full
+ */
+static euler_ret euler_output_row(const euler_integrate_options *iopt, double *block, lapack_int *rows, const lapack_int block_rows, const double t, const double *x, const lapack_int x_size, const double *u, const lapack_int u_cols)
+{
+  double *row = block + (*rows) * (x_size + 1 + u_cols);
+  row[0] = t;
+  cblas_dcopy(x_size, x, 1, row + 1, 1);
+  if (u_cols)
+    cblas_dcopy(u_cols, u, 1, row + 1 + x_size, 1);
+  (*rows)++;
+  if (*rows < block_rows)
+    return EULER_SUCCESS;
+  lapack_int n_rows = *rows;
+  *rows = 0;
+  if (iopt->sink && iopt->sink(block, n_rows, x_size + 1 + u_cols, iopt->data))
+    return EULER_INTERRUPTED;
+  return EULER_SUCCESS;
+}
+
+/**
+ * @brief Internal: scaled RMS norm of the local error estimate
+ */
+static double euler_error_norm(const euler_integrate_options *iopt, const lapack_int n, const double *e, const double *x, const double *xp)
+{
+  double sum = 0;
+  for (lapack_int i = 0; i < n; i++) {
+    const double scale = iopt->atol + iopt->rtol * fmax(fabs(x[i]), fabs(xp[i]));
+    const double r = e[i] / scale;
+    sum += r * r;
+  }
+  return sqrt(sum / n);
+}
+
+/**
+ * @brief Internal: step with local error estimate (for the adaptive integration)
+ *
+ * Returns the scaled error norm in err (infinity if the Newton solver did not converge).
+ * The work vectors fk and e must contain x_size elements each.
+ */
+static euler_ret euler_step_error(const euler_options *opt, const euler_integrate_options *iopt, euler_workspace *ws, const double h, double *xp, const double t, const double *x, const double *u, const double **p, double *fk, double *e, double *err)
+{
+  const lapack_int n = opt->x_size;
+  *err = INFINITY;
+
+  /* EXPLICIT: Euler against Heun, e = h / 2 (f(x(k+1)) - f(x(k))) */
+  if (opt->alpha == 0) {
+    opt->f(fk, t, x, u, p, opt->data);
+    cblas_dcopy(n, x, 1, xp, 1);
+    cblas_daxpy(n, h, fk, 1, xp, 1);
+    opt->f(e, t + h, xp, u ? u + opt->u_offset : NULL, p, opt->data);
+    cblas_daxpy(n, -1, fk, 1, e, 1);
+    cblas_dscal(n, h / 2, e, 1);
+    *err = euler_error_norm(iopt, n, e, x, xp);
+    return EULER_SUCCESS;
+  }
+
+  /* IMPLICIT: Euler against the implicit step, e = x(k+1) - x(k) - h f(x(k)) */
+  euler_ret ret = euler_implicit(opt, ws, h, xp, t, x, u, p);
+  if (ret != EULER_SUCCESS || ws->status >= NEWTON_MAX_ITER)
+    return ret;
+  cblas_dcopy(n, xp, 1, e, 1);
+  cblas_daxpy(n, -1, x, 1, e, 1);
+  cblas_daxpy(n, -h, ws->work_f + 2 * n, 1, e, 1);
+  /* Stiff components are filtered with (I - alpha h J)^-1 = -(-I + alpha h J)^-1 (for the partitioned
+     step, with the iteration matrix of the stiff subsystem). The factors of the step are used only if
+     the Jacobian was evaluated in it, otherwise the iteration matrix is factorized in x(k+1) */
+  const newton_bool fresh = ((opt->method == NEWTON_MODIFIED || opt->method == NEWTON_BROYDEN) &&
+                             ws->stats.jacobians > 0) ? NEWTON_TRUE : NEWTON_FALSE;
+  if (!fresh) {
+    if (opt->stiff)
+      euler_partition_newton(opt, ws, h, xp, t, ws->work_f, u, p, NEWTON_TRUE);
+    else
+      euler_newton(opt, ws, h, opt->alpha, opt->u_offset, xp, t, ws->work_f, u, p, NEWTON_TRUE);
+  }
+  if (opt->stiff) {
+    double *z = ws->work_partition + 2 * n;
+    for (lapack_int j = 0; j < opt->stiff_size; j++)
+      z[j] = e[opt->stiff[j]];
+    if (newton_workspace_solve(ws->newton, z) == NEWTON_F_TOL)
+      for (lapack_int j = 0; j < opt->stiff_size; j++)
+        e[opt->stiff[j]] = -z[j];
+  } else if (newton_workspace_solve(ws->newton, e) == NEWTON_F_TOL) {
+    cblas_dscal(n, -1, e, 1);
+  }
+  *err = euler_error_norm(iopt, n, e, x, xp);
+  return EULER_SUCCESS;
+}
+
+/**
+ * @brief Internal: checks if a guard crossed zero along the step. A guard that is zero at the
+ * start of the step (after its event) does not fire again
+ */
+static newton_bool euler_event_crossed(const double g0, const double g1)
+{
+  return (g0 != 0 && (g1 == 0 || (g0 > 0) != (g1 > 0))) ? NEWTON_TRUE : NEWTON_FALSE;
+}
+
+/**
+ * @brief Internal: Illinois localization of the root of guard i along the step, on the linear
+ * interpolation of the states. Returns the fraction of the step of the bracket end past the root
+ */
+static double euler_event_root(const euler_integrate_options *iopt, const lapack_int n, const lapack_int i, const double t, const double h, const double *x, const double *xp, double *xs, double *g, double g_lo, double g_hi, const double tol)
+{
+  double lo = 0, hi = 1;
+  int side = 0;
+  if (g_hi == 0)
+    return hi;
+  for (lapack_int it = 0; it < EULER_EVENT_MAX_ITER && (hi - lo) * h > tol; it++) {
+    double s = hi - g_hi * (hi - lo) / (g_hi - g_lo);
+    if (!(s > lo && s < hi))
+      s = 0.5 * (lo + hi);
+    cblas_dcopy(n, x, 1, xs, 1);
+    cblas_dscal(n, 1 - s, xs, 1);
+    cblas_daxpy(n, s, xp, 1, xs, 1);
+    iopt->event(g, t + s * h, xs, iopt->data);
+    if (g[i] == 0)
+      return s;
+    /* The end that is kept twice has its guard halved (Illinois) */
+    if ((g[i] > 0) == (g_hi > 0)) {
+      hi = s;
+      g_hi = g[i];
+      if (side == 1)
+        g_lo /= 2;
+      side = 1;
+    } else {
+      lo = s;
+      g_lo = g[i];
+      if (side == -1)
+        g_hi /= 2;
+      side = -1;
+    }
+  }
+  return hi;
+}
+
+/**
+ * @brief Internal: earliest event along the step, as a fraction of the step (INFINITY if no
+ * guard crossed zero). The guards within the time tolerance of the earliest root fire together
+ */
+static double euler_event_locate(const euler_integrate_options *iopt, const lapack_int n, const double t, const double h, const double *x, const double *xp, double *xs, const double *g_old, const double *g_new, double *g, double *roots, lapack_int *fired, const double tol)
+{
+  double s_min = INFINITY;
+  for (lapack_int i = 0; i < iopt->n_events; i++) {
+    roots[i] = INFINITY;
+    if (euler_event_crossed(g_old[i], g_new[i]))
+      roots[i] = euler_event_root(iopt, n, i, t, h, x, xp, xs, g, g_old[i], g_new[i], tol);
+    s_min = fmin(s_min, roots[i]);
+  }
+  for (lapack_int i = 0; i < iopt->n_events; i++) {
+    fired[i] = 0;
+    if (isfinite(roots[i]) && (roots[i] - s_min) * h <= tol)
+      fired[i] = g_old[i] < 0 ? 1 : -1;
+  }
+  return s_min;
+}
+
+euler_ret euler_integrate(const euler_options *opt, const euler_integrate_options *iopt, euler_workspace *ws, const double t0, const double t1, const double *x0, double *xf, const double **p)
+{
+  if (!opt || !iopt || !x0)
+    return EULER_NULLPTR;
+  if (!(opt->ts > 0) || t1 < t0 || (iopt->input && iopt->u_size <= 0))
+    return EULER_GENERIC;
+  if ((iopt->event && iopt->n_events <= 0) || (iopt->n_tstops > 0 && !iopt->tstops) || iopt->output_dt < 0)
+    return EULER_GENERIC;
+
+  const lapack_int x_size = opt->x_size;
+  const lapack_int u_len = iopt->input ? opt->u_offset + iopt->u_size : 0;
+  const lapack_int u_cols = iopt->input ? iopt->u_size : 0;
+  const lapack_int n_ev = iopt->event ? iopt->n_events : 0;
+  const lapack_int block_rows = iopt->block_rows > 0 ? iopt->block_rows : EULER_BLOCK_ROWS;
+  const lapack_int decimation = iopt->decimation > 1 ? iopt->decimation : 1;
+  const newton_bool adaptive = (iopt->rtol > 0 || iopt->atol > 0) ? NEWTON_TRUE : NEWTON_FALSE;
+  const double h_min = iopt->h_min > 0 ? iopt->h_min : EULER_TIME_EPS * opt->ts;
+  const double h_max = iopt->h_max > 0 ? iopt->h_max : t1 - t0;
+  const double event_tol = iopt->event_tol > 0 ? iopt->event_tol : EULER_TIME_EPS * opt->ts;
+  const double output_dt = iopt->output_dt;
+  const lapack_int dense_len = output_dt > 0 ? 3 * x_size : 0;
+
+  /* SETUP (once per trajectory) */
+  euler_workspace *own_ws = NULL;
+  if (!ws) {
+    ws = own_ws = euler_workspace_alloc(opt);
+    if (!ws)
+      return EULER_EMALLOC;
+  }
+
+  /* Scratch of the trajectory, kept in the workspace: the next trajectories of the same size do not allocate */
+  const lapack_int buffer_len = 4 * x_size + u_len + 2 * u_cols + block_rows * (x_size + 1 + u_cols) + 4 * n_ev + dense_len;
+  if (ws->trajectory_len < buffer_len) {
+    double *grown = (double *)realloc(ws->trajectory, buffer_len * sizeof(double));
+    if (!grown) {
+      euler_workspace_free(own_ws);
+      return EULER_EMALLOC;
+    }
+    ws->trajectory = grown;
+    ws->trajectory_len = buffer_len;
+  }
+  if (ws->fired_len < n_ev) {
+    lapack_int *grown = (lapack_int *)realloc(ws->fired, n_ev * sizeof(lapack_int));
+    if (!grown) {
+      euler_workspace_free(own_ws);
+      return EULER_EMALLOC;
+    }
+    ws->fired = grown;
+    ws->fired_len = n_ev;
+  }
+  double *buffer = ws->trajectory;
+  lapack_int *fired = n_ev ? ws->fired : NULL;
+  memset(buffer, 0, buffer_len * sizeof(double));
+  if (n_ev)
+    memset(fired, 0, n_ev * sizeof(lapack_int));
+  double *x = buffer;
+  double *xp = buffer + x_size;
+  double *fk = buffer + 2 * x_size;
+  double *e = buffer + 3 * x_size;
+  double *u = u_len ? buffer + 4 * x_size : NULL;
+  double *u_row = buffer + 4 * x_size + u_len;
+  double *u_sample = u_row + u_cols;
+  double *block = u_sample + u_cols;
+  double *g_old = block + block_rows * (x_size + 1 + u_cols);
+  double *g_new = g_old + n_ev;
+  double *g = g_old + 2 * n_ev;
+  double *roots = g_old + 3 * n_ev;
+  double *f0 = g_old + 4 * n_ev;
+  double *f1 = f0 + x_size;
+  double *xs = f0 + 2 * x_size;
+
+  cblas_dcopy(x_size, x0, 1, x, 1);
+  if (u) {
+    iopt->input(u, t0, x, iopt->data);
+    cblas_dcopy(u_cols, u, 1, u_row, 1);
+  }
+  if (n_ev)
+    iopt->event(g_old, t0, x, iopt->data);
+
+  /* INTEGRATION LOOP */
+  lapack_int k = 0, rows = 0, grid = 0, stop = 0, sample = 1;
+  newton_bool stored = NEWTON_TRUE, on_grid = NEWTON_TRUE;
+  double t = t0;
+  double h = adaptive ? fmin(opt->ts, h_max) : opt->ts;
+  double err_old = 1.0;
+  euler_ret ret = euler_output_row(iopt, block, &rows, block_rows, t, x, x_size, u_row, u_cols);
+
+  while (ret == EULER_SUCCESS && t1 - t > EULER_TIME_EPS * opt->ts) {
+    /* The step ends on the next tstop or on t1, if it is closer than the step */
+    while (stop < iopt->n_tstops && iopt->tstops[stop] <= t + EULER_TIME_EPS * opt->ts)
+      stop++;
+    const newton_bool tstop = (stop < iopt->n_tstops && iopt->tstops[stop] < t1) ? NEWTON_TRUE : NEWTON_FALSE;
+    const double t_end = tstop ? iopt->tstops[stop] : t1;
+    const double t_grid = t0 + (grid + 1) * opt->ts;
+    const double h_next = adaptive ? h : (on_grid ? opt->ts : t_grid - t);
+    const double remaining = t_end - t;
+    const newton_bool last = remaining <= (1 + EULER_TIME_EPS) * h_next ? NEWTON_TRUE : NEWTON_FALSE;
+    const double hk = last ? remaining : h_next;
+    double tn = last ? t_end : (adaptive ? t + hk : t_grid);
+
+    /* On a tstop the input at the end of the step is its left limit */
+    if (u && opt->u_offset > 0)
+      iopt->input(u + opt->u_offset, (last && tstop) ? nextafter(tn, t) : tn, x, iopt->data);
+
+    if (adaptive) {
+      double err;
+      ret = euler_step_error(opt, iopt, ws, hk, xp, t, x, u, p, fk, e, &err);
+      if (ret == EULER_EMALLOC || ret == EULER_NULLPTR)
+        break;
+      if (ret != EULER_SUCCESS || !(err <= 1.0)) {
+        /* Rejected step: retried with a smaller step */
+        ret = EULER_SUCCESS;
+        h = hk * (isfinite(err) ? fmax(EULER_FAC_MIN, EULER_SAFETY * pow(err, -0.5)) : EULER_FAC_MIN);
+        if (h < h_min) {
+          ret = EULER_GENERIC;
+          break;
+        }
+        continue;
+      }
+      /* Accepted step: PI controller for the next step (error of order 2) */
+      err = fmax(err, 1e-10);
+      double fac = EULER_SAFETY * pow(err, -0.35) * pow(err_old, 0.2);
+      fac = fmin(EULER_FAC_MAX, fmax(EULER_FAC_MIN, fac));
+      if (fac >= 1.0 && fac <= EULER_FAC_KEEP)
+        fac = 1.0;
+      if (!last || fac < 1.0)
+        h = fmin(h_max, fmax(h_min, hk * fac));
+      err_old = err;
+    } else {
+      if (opt->alpha == 0)
+        ret = euler_explicit(opt, hk, xp, t, x, u, p);
+      else
+        ret = euler_implicit(opt, ws, hk, xp, t, x, u, p);
+      if (ret != EULER_SUCCESS)
+        break;
+    }
+
+    /* EVENTS: the step is repeated to end on the earliest sign change of the guards */
+    newton_bool event = NEWTON_FALSE;
+    if (n_ev) {
+      iopt->event(g_new, tn, xp, iopt->data);
+      const double s = euler_event_locate(iopt, x_size, t, tn - t, x, xp, e, g_old, g_new, g, roots, fired, event_tol);
+      if (s <= 1) {
+        event = NEWTON_TRUE;
+        const double te = t + s * (tn - t);
+        if (te - t <= EULER_TIME_EPS * opt->ts) {
+          cblas_dcopy(x_size, x, 1, xp, 1);
+          tn = t;
+        } else if (tn - te > event_tol) {
+          if (u && opt->u_offset > 0)
+            iopt->input(u + opt->u_offset, te, x, iopt->data);
+          if (opt->alpha == 0)
+            ret = euler_explicit(opt, te - t, xp, t, x, u, p);
+          else
+            ret = euler_implicit(opt, ws, te - t, xp, t, x, u, p);
+          if (ret != EULER_SUCCESS)
+            break;
+          tn = te;
+        }
+      }
+    }
+    const newton_bool restart = (event || (last && tstop && tn == t_end)) ? NEWTON_TRUE : NEWTON_FALSE;
+
+    /* Input of the rows at the end of the step: u(t+h) with the offset, otherwise the input held
+       along the step */
+    if (u)
+      cblas_dcopy(u_cols, tn > t ? u + opt->u_offset : u, 1, u_row, 1);
+
+    /* OUTPUT GRID: dense output of the step on the grid times in (t, tn], with the input
+       interpolated between the ends of the step */
+    newton_bool sampled = NEWTON_FALSE;
+    if (output_dt > 0 && tn > t) {
+      euler_dense_data(opt, ws, tn - t, t, x, xp, u, p, f0, f1);
+      double t_sample;
+      while (ret == EULER_SUCCESS && (t_sample = t0 + sample * output_dt) <= fmin(tn, t1) + EULER_TIME_EPS * output_dt) {
+        const double theta = fmin(1.0, (t_sample - t) / (tn - t));
+        euler_hermite(x_size, tn - t, theta, x, xp, f0, f1, xs);
+        for (lapack_int i = 0; i < u_cols; i++)
+          u_sample[i] = u[i] + theta * (u_row[i] - u[i]);
+        ret = euler_output_row(iopt, block, &rows, block_rows, t_sample, xs, x_size, u_sample, u_cols);
+        sampled = fabs(t_sample - tn) <= EULER_TIME_EPS * output_dt ? NEWTON_TRUE : NEWTON_FALSE;
+        sample++;
+      }
+    }
+    if (!adaptive) {
+      on_grid = fabs(tn - t_grid) <= EULER_TIME_EPS * opt->ts ? NEWTON_TRUE : NEWTON_FALSE;
+      if (on_grid)
+        grid++;
+    }
+
+    /* The step is final: it enters the history of the predictor */
+    if (tn > t)
+      euler_history_update(opt, ws, tn - t, t, x, xp);
+
+    /* Ping-pong of the state buffers */
+    double *swap = x;
+    x = xp;
+    xp = swap;
+    t = tn;
+    k++;
+
+    stored = sampled;
+    if (ret == EULER_SUCCESS && ((!dense_len && k % decimation == 0) || (restart && !sampled))) {
+      stored = NEWTON_TRUE;
+      ret = euler_output_row(iopt, block, &rows, block_rows, t, x, x_size, u_row, u_cols);
+    }
+
+    /* The handler can modify the state; the guards that fired are masked for the next step */
+    int terminate = 0;
+    if (event && ret == EULER_SUCCESS) {
+      cblas_dcopy(x_size, x, 1, fk, 1);
+      if (iopt->handler)
+        terminate = iopt->handler(fired, t, x, iopt->data);
+      if (memcmp(x, fk, x_size * sizeof(double)) != 0)
+        ret = euler_output_row(iopt, block, &rows, block_rows, t, x, x_size, u_row, u_cols);
+      iopt->event(g_old, t, x, iopt->data);
+      for (lapack_int i = 0; i < n_ev; i++)
+        if (fired[i])
+          g_old[i] = 0;
+    } else if (n_ev && !event) {
+      cblas_dcopy(n_ev, g_new, 1, g_old, 1);
+    }
+    if (terminate)
+      break;
+
+    /* After a restart the input is requested again on the restart time */
+    if (u) {
+      if (opt->u_offset > 0 && !restart)
+        memmove(u, u + opt->u_offset, iopt->u_size * sizeof(double));
+      else
+        iopt->input(u, t, x, iopt->data);
+    }
+    if (restart)
+      err_old = 1.0;
+  }
+
+  /* Last state is always stored, and the pending block is flushed */
+  if (ret == EULER_SUCCESS && !stored)
+    ret = euler_output_row(iopt, block, &rows, block_rows, t, x, x_size, u_row, u_cols);
+  if (ret != EULER_INTERRUPTED && rows > 0 && iopt->sink)
+    if (iopt->sink(block, rows, x_size + 1 + u_cols, iopt->data) && ret == EULER_SUCCESS)
+      ret = EULER_INTERRUPTED;
+
+  if (xf)
+    cblas_dcopy(x_size, x, 1, xf, 1);
+
+  euler_workspace_free(own_ws);
+  return ret;
+}
+
 void euler_function_wrapper(double *f, const double t, const double *x, const double *u, const double **p, void *data) {
   euler_passtrough *_data = ((euler_passtrough *)data);
+  double *fp = _data->work_f + _data->x_size;
 
-  /* Evaluating f(x(k), u(k)) and f(x(k+1), u(k+1)), storing result in work_f */
-  _data->f(_data->work_f, t, _data->xk, u, p, _data->data);
-  _data->f(_data->work_f + _data->x_size, t, x, u + _data->u_offset, p, _data->data);
+  /* Evaluating f(x(k+1), u(k+1)), storing result in work_f (f(x(k), u(k)) is already in xk) */
+  _data->f(fp, t, x, u + _data->u_offset, p, _data->data);
 
-  /* Computing: x(k) - x(k+1) + (1-alpha) ts f(x(k), u(k)) + alpha ts f(x(k+1), u(k+1)) */
-  cblas_dscal(_data->x_size, (1 - _data->alpha) * _data->ts, _data->work_f, 1);
-  cblas_dscal(_data->x_size, _data->alpha * _data->ts, _data->work_f + _data->x_size, 1);
-  cblas_daxpy(_data->x_size, 1, _data->work_f + _data->x_size, 1, _data->work_f, 1);
-  cblas_daxpy(_data->x_size, -1, x, 1, _data->work_f, 1);
-  cblas_daxpy(_data->x_size, 1, _data->xk, 1, _data->work_f, 1);
+  /* Computing: x(k) + (1-alpha) ts f(x(k), u(k)) - x(k+1) + alpha ts f(x(k+1), u(k+1)) */
+  cblas_dcopy(_data->x_size, _data->xk, 1, f, 1);
+  cblas_daxpy(_data->x_size, -1, x, 1, f, 1);
+  cblas_daxpy(_data->x_size, _data->alpha * _data->ts, fp, 1, f, 1);
+}
 
-  /* Copying result in output */
-  cblas_dcopy(_data->x_size, _data->work_f, 1, f, 1);
+void euler_function_batch_wrapper(double *f, const double t, const double *x, const double *u, const double **p, const lapack_int count, const lapack_int ld, void *data) {
+  euler_passtrough *_data = ((euler_passtrough *)data);
+
+  /* Evaluating f(x(k+1), u(k+1)) in all the points, directly in the output */
+  _data->f_batch(f, t, x, u + _data->u_offset, p, count, ld, _data->data);
+
+  /* Computing in place: x(k) + (1-alpha) ts f(x(k), u(k)) - x(k+1) + alpha ts f(x(k+1), u(k+1)) */
+  for (lapack_int k = 0; k < count; k++)
+    for (lapack_int i = 0; i < _data->x_size; i++)
+      f[k * ld + i] = (_data->xk[i] - x[k * ld + i]) + _data->alpha * _data->ts * f[k * ld + i];
 }
 
 void euler_jacobian_wrapper(double *df, const double t, const double *x, const double *u, const double **p, void *data) {
@@ -141,10 +1258,81 @@ void euler_jacobian_wrapper(double *df, const double t, const double *x, const d
   /* Evaluating JAC(f)(x(k+1), u(k+1)) */
   _data->df(_data->work_df, t, x, u + _data->u_offset, p, _data->data);
 
+  /* Sparse Jacobian: -I + alpha ts JAC(f)(x(k+1), u(k+1)) in the pattern of the iteration matrix */
+  if (_data->map) {
+    memset(df, 0, _data->nnz_iteration * sizeof(double));
+    for (lapack_int k = 0; k < _data->nnz; k++)
+      df[_data->map[k]] = _data->alpha * _data->ts * _data->work_df[k];
+    for (lapack_int i = 0; i < _data->x_size; i++)
+      df[_data->map[_data->nnz + i]] -= 1.0;
+    return;
+  }
+
   /* Computing: -I + alpha ts JAC(f)(x(k+1), u(k+1)) (still using level 1 Blas) */
   cblas_dscal(_data->x_size * _data->x_size, _data->alpha * _data->ts, _data->work_df, 1);
   cblas_daxpy(_data->x_size * _data->x_size, 1, _data->work_df + _data->x_size * _data->x_size, 1, _data->work_df, 1);
 
   /* Copying result in output */
   cblas_dcopy(_data->x_size * _data->x_size, _data->work_df, 1, df, 1);
-}
\ No newline at end of file
+}
+void euler_jacobian_vector_wrapper(double *jv, const double *v, const double t, const double *x, const double *u, const double **p, void *data) {
+  euler_passtrough *_data = ((euler_passtrough *)data);
+
+  /* Computing: -v + alpha ts JAC(f)(x(k+1), u(k+1)) v */
+  _data->jv(jv, v, t, x, u + _data->u_offset, p, _data->data);
+  cblas_dscal(_data->x_size, _data->alpha * _data->ts, jv, 1);
+  cblas_daxpy(_data->x_size, -1, v, 1, jv, 1);
+}
+
+void euler_preconditioner_wrapper(double *z, const double *r, const double t, const double *x, const double *u, const double **p, void *data) {
+  euler_passtrough *_data = ((euler_passtrough *)data);
+
+  /* Solving: -(I - alpha ts JAC(f)(x(k+1), u(k+1))) z = r */
+  _data->prec(z, r, _data->alpha * _data->ts, t, x, u + _data->u_offset, p, _data->data);
+  cblas_dscal(_data->x_size, -1, z, 1);
+}
+
+void euler_partition_function_wrapper(double *f, const double t, const double *z, const double *u, const double **p, void *data) {
+  euler_partition_passtrough *_data = ((euler_partition_passtrough *)data);
+
+  /* Evaluating f(x_E(k+1), z, u(k+1)) */
+  for (lapack_int j = 0; j < _data->stiff_size; j++)
+    _data->x[_data->stiff[j]] = z[j];
+  _data->f(_data->fx, t, _data->x, u + _data->u_offset, p, _data->data);
+
+  /* Computing: x_S(k) + (1-alpha) ts f_S(x(k), u(k)) - z + alpha ts f_S(x_E(k+1), z, u(k+1)) */
+  for (lapack_int j = 0; j < _data->stiff_size; j++)
+    f[j] = _data->xk[_data->stiff[j]] - z[j] + _data->ah * _data->fx[_data->stiff[j]];
+}
+
+void euler_partition_jacobian_wrapper(double *df, const double t, const double *z, const double *u, const double **p, void *data) {
+  euler_partition_passtrough *_data = ((euler_partition_passtrough *)data);
+  const lapack_int n = _data->x_size;
+  const lapack_int m = _data->stiff_size;
+
+  /* Evaluating JAC(f)(x_E(k+1), z, u(k+1)) */
+  for (lapack_int j = 0; j < m; j++)
+    _data->x[_data->stiff[j]] = z[j];
+  _data->df(_data->jac, t, _data->x, u + _data->u_offset, p, _data->data);
+
+  /* Computing: -I + alpha ts JAC_SS(f), column major */
+  memset(df, 0, m * m * sizeof(double));
+  if (_data->pattern) {
+    const sparse_pattern *pattern = _data->pattern;
+    for (lapack_int c = 0; c < n; c++)
+      for (lapack_int q = pattern->ptr[c]; q < pattern->ptr[c + 1]; q++) {
+        const lapack_int row = _data->ordering == LAPACK_ROW_MAJOR ? c : pattern->idx[q];
+        const lapack_int col = _data->ordering == LAPACK_ROW_MAJOR ? pattern->idx[q] : c;
+        if (_data->position[row] >= 0 && _data->position[col] >= 0)
+          df[_data->position[row] + _data->position[col] * m] = _data->ah * _data->jac[q];
+      }
+  } else {
+    for (lapack_int j = 0; j < m; j++)
+      for (lapack_int i = 0; i < m; i++) {
+        const lapack_int row = _data->stiff[i], col = _data->stiff[j];
+        df[i + j * m] = _data->ah * _data->jac[_data->ordering == LAPACK_ROW_MAJOR ? row * n + col : row + col * n];
+      }
+  }
+  for (lapack_int i = 0; i < m; i++)
+    df[i + i * m] -= 1.0;
+}
@@ -26,6 +26,10 @@
 #include <cblas.h>
 #include "libnewton.h" /**< Custom solver for implicit step */
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * @brief Callback for the ode vector field
  * The callback for the ODE model. The callback stores the output in
@@ -66,13 +70,41 @@ typedef void (*euler_ode_function)(
     const double **p,
     void *data);
 
+/**
+ * @brief Callback for the batched ode vector field
+ * Evaluates the vector field in count states with a single call. The state k is stored at
+ * x + k * ld, and its vector field must be stored at f + k * ld. All the states share the time,
+ * the input and the parameters. The library uses it for all the evaluations on several points
+ * at once (the columns, or column groups, of the finite difference Jacobians).
+ * @param f output vectors for the ODE (x_size elements each)
+ * @param t current time for the function
+ * @param x states for the ODE evaluation (x_size elements each)
+ * @param u external input for the ODE evaluation
+ * @param p pointer to arrays of parameters
+ * @param count number of states
+ * @param ld stride between the states, and between the outputs (at least x_size)
+ * @param data auxiliary data pointer to void for user data
+ * @returns nothing
+ */
+typedef void (*euler_ode_function_batch)(
+    double *f,
+    const double t,
+    const double *x,
+    const double *u,
+    const double **p,
+    const lapack_int count,
+    const lapack_int ld,
+    void *data);
+
 /**
  * @brief Callback for the ode vector field Jacobian
  * The callback for the ODE Jacobian. The callback stores the output in
  * the first pointer (df). The function does not need to allocate nor free
  * the input vector, but may overflow if exceedes the dimension that is
  * declared in the euler options structure. The matrix is stored continuosly
- * inan array, with ordering as specified in options structure.
+ * inan array, with ordering as specified in options structure. If a sparsity
+ * pattern is given in the options structure, only the nonzeros are stored, in
+ * the order of the pattern.
  * @param f otput vector for the ODE
  * @param t current time for the function
  * @param x state for the ODE evaluation
@@ -91,6 +123,132 @@ typedef void (*euler_ode_jacobian)(
     const double **p,
     void *data);
 
+/**
+ * @brief Callback for the product of the ode vector field Jacobian with a vector
+ * The callback stores in the first pointer (jv) the product \f$\nabla f(x) v\f$,
+ * without forming the Jacobian. It is used by the Newton-Krylov implicit step.
+ * @param jv output vector for the product (x_size elements)
+ * @param v input vector (x_size elements)
+ * @param t current time for the function
+ * @param x state for the ODE evaluation
+ * @param u external input for the ODE evaluation
+ * @param p pointer to arrays of parameters
+ * @param data auxiliary data pointer to void for user data
+ * @returns nothing
+ */
+typedef void (*euler_ode_jacobian_vector)(
+    double *jv,
+    const double *v,
+    const double t,
+    const double *x,
+    const double *u,
+    const double **p,
+    void *data);
+
+/**
+ * @brief Callback for the preconditioner of the Newton-Krylov implicit step
+ * The callback stores in the first pointer (z) an approximate solution of
+ * \f$(I - \gamma \nabla f(x)) z = r\f$, where \f$\gamma = \alpha h\f$ (e.g. by using
+ * only the diagonal of the Jacobian, or the stiff part of the model).
+ * @param z output vector (x_size elements)
+ * @param r input vector (x_size elements)
+ * @param gamma coefficient of the Jacobian in the iteration matrix
+ * @param t current time for the function
+ * @param x state for the ODE evaluation
+ * @param u external input for the ODE evaluation
+ * @param p pointer to arrays of parameters
+ * @param data auxiliary data pointer to void for user data
+ * @returns nothing
+ */
+typedef void (*euler_ode_preconditioner)(
+    double *z,
+    const double *r,
+    const double gamma,
+    const double t,
+    const double *x,
+    const double *u,
+    const double **p,
+    void *data);
+
+/**
+ * @brief Callback for the external input of a trajectory
+ * The callback stores in the first pointer (u) the input at time t, that will be
+ * used in the integration step. The state is the one at the beginning of the
+ * integration step (thus it is possible to implement a static feedback).
+ * @param u output vector for the input (u_size elements, see euler_integrate_options)
+ * @param t time of the input sample
+ * @param x current state
+ * @param data auxiliary data pointer to void for user data
+ * @returns nothing
+ */
+typedef void (*euler_input_function)(
+    double *u,
+    const double t,
+    const double *x,
+    void *data);
+
+/**
+ * @brief Callback for the output of a trajectory
+ * The callback receives a block of rows of the trajectory. The block is stored in
+ * row major order, and each row contains \f$[t, x_1, \dots, x_n]\f$, followed by the inputs
+ * \f$[u_1, \dots, u_m]\f$ if the trajectory has an input provider (see euler_integrate()).
+ * The block is owned by the integrator and it is overwritten after the callback returns.
+ * @param rows block of rows
+ * @param n_rows number of rows in the block
+ * @param n_cols number of columns of each row (x_size + 1, plus u_size with an input provider)
+ * @param data auxiliary data pointer to void for user data
+ * @returns 0 to continue the integration, any other value to interrupt it
+ */
+typedef int (*euler_output_sink)(
+    const double *rows,
+    const lapack_int n_rows,
+    const lapack_int n_cols,
+    void *data);
+
+/**
+ * @brief Guard functions for the events of a trajectory
+ *
+ * An event occurs when a guard changes its sign. The guards are evaluated at the start of the
+ * trajectory, at the end of each step and, during the localization of an event, on the
+ * interpolated states.
+ * @param g value of the guards (n_events elements)
+ * @param t time
+ * @param x state
+ * @param data user data of the trajectory options
+ */
+typedef void (*euler_event_function)(
+    double *g,
+    const double t,
+    const double *x,
+    void *data);
+
+/**
+ * @brief Handler of the events of a trajectory
+ *
+ * The handler is called at the time of the event, after the row of the event is stored. The
+ * integration restarts from the state, that can be modified by the handler (e.g. a reset map).
+ * @param fired for each guard: 1 if it crossed zero upward, -1 downward, 0 if it did not fire
+ * @param t time of the event
+ * @param x state at the event
+ * @param data user data of the trajectory options
+ * @return zero to continue the integration, non zero to terminate it at the event
+ */
+typedef int (*euler_event_handler)(
+    const lapack_int *fired,
+    const double t,
+    double *x,
+    void *data);
+
+#define EULER_BLOCK_ROWS 256 /**< Default number of rows for the output blocks */
+#define EULER_TIME_EPS 1e-9  /**< Relative tolerance (on the step) for the final time */
+#define EULER_SAFETY 0.9      /**< Safety factor of the adaptive step controller */
+#define EULER_FAC_MIN 0.2     /**< Minimum step ratio of the adaptive step controller */
+#define EULER_FAC_MAX 5.0     /**< Maximum step ratio of the adaptive step controller */
+#define EULER_FAC_KEEP 1.2    /**< Step ratios in [1, EULER_FAC_KEEP] keep the step (and its factors) */
+#define EULER_EVENT_MAX_ITER 50 /**< Maximum iterations for the localization of an event */
+#define EULER_RT_LATENCY_BINS 32  /**< Bins of the latency histogram of the real-time steps */
+#define EULER_RT_ITER_BINS 16     /**< Bins of the iterations histogram of the real-time steps */
+
 /**
  * @brief Returning value for the integrator
  */
@@ -98,9 +256,21 @@ typedef enum euler_ret {
   EULER_SUCCESS = 0,  /**< Correct execution */
   EULER_EMALLOC,      /**< Memory allocation error */
   EULER_NULLPTR,      /**< Received a null pointer */
-  EULER_GENERIC       /**< Generic error raised. @todo: should be divided for Newton error */
+  EULER_GENERIC,      /**< Generic error raised. @todo: should be divided for Newton error */
+  EULER_INTERRUPTED   /**< Integration interrupted by the output sink */
 } euler_ret;
 
+/**
+ * @brief Initial guess for the Newton solver of the implicit step
+ */
+typedef enum euler_predictor {
+  EULER_PREDICT_NONE = 0,      /**< The initial guess is the current state \f$x(t)\f$ */
+  EULER_PREDICT_EXPLICIT,      /**< The initial guess is the explicit step \f$x(t) + h f(x(t), u, p)\f$ */
+  EULER_PREDICT_EXTRAPOLATE    /**< Polynomial extrapolation (up to second order) of the states of
+                                    the previous steps stored in the workspace. Falls back to the 
+                                    explicit step when there is no history */
+} euler_predictor;
+
 typedef struct euler_options {
   double ts;               /**< Integration step */
   double alpha;            /**< Tustin transform coefficient. \f$\alpha \in [0,1]\f$. 
@@ -112,10 +282,118 @@ typedef struct euler_options {
   double x_tol;            /**< Step tolerance for Newton solution */
   lapack_int max_iter;     /**< Maximum number of iterations for Newton solver */
   euler_ode_function f;    /**< Actual ODE vector field */
-  euler_ode_jacobian df;   /**< Jacobian of the vector field */
+  euler_ode_jacobian df;   /**< Jacobian of the vector field. If NULL, the iteration matrix is computed by
+                                finite differences of the implicit step residual (with column groups,
+                                if the pattern is given) */
   void *data;              /**< Empty space for user data */
+  newton_method method;    /**< Newton variant for the implicit step. With NEWTON_KRYLOV the iteration
+                                matrix is never formed (the Jacobian is not required). With NEWTON_MODIFIED or
+                                NEWTON_BROYDEN the factors of the iteration matrix are reused 
+                                in the following steps (if the workspace is reused) */
+  double contraction;      /**< Maximum contraction rate for reused factors. If 0, uses NEWTON_CONTRACTION */
+  euler_predictor predictor; /**< Initial guess for the implicit step */
+  const sparse_pattern *pattern; /**< Sparsity pattern of the Jacobian (CSR for row major, CSC for column
+                                      major ordering). If not NULL, the Jacobian callback stores only the
+                                      nonzeros and the implicit step uses a sparse LU, whose symbolic
+                                      analysis is computed once in the workspace */
+  euler_ode_jacobian_vector jv;  /**< Jacobian-vector product for NEWTON_KRYLOV. If NULL, uses directional
+                                      differences of the vector field */
+  euler_ode_preconditioner prec; /**< Preconditioner for NEWTON_KRYLOV. It can be NULL */
+  lapack_int restart;            /**< GMRES restart for NEWTON_KRYLOV. If 0, uses NEWTON_KRYLOV_RESTART */
+  newton_bool dense;             /**< The steps of euler_ws() store the data for the dense output (see
+                                      euler_dense()). It costs one evaluation of the vector field per
+                                      explicit step, and no evaluation for implicit steps */
+  newton_globalization globalization; /**< Globalization of the Newton step (line search or dogleg), for
+                                           implicit steps with a large step size. Zero selects the full step */
+  euler_ode_function_batch f_batch; /**< Batched vector field (the same of f). If not NULL, the finite
+                                         difference Jacobian of the implicit step evaluates its perturbed
+                                         states with a call every NEWTON_BATCH_MAX states (not for the
+                                         partitioned step, see stiff). It can be NULL */
+  newton_bool mixed;             /**< Mixed precision iteration matrix for NEWTON_FULL with a dense Jacobian:
+                                      single precision factors with iterative refinement (see
+                                      newton_options.mixed) */
+  const lapack_int *stiff;       /**< Sorted indexes of the stiff components, for the partitioned (IMEX) implicit
+                                      step: only these components are implicit (Tustin step with alpha), the
+                                      others advance with the explicit Euler step, and the Newton solver works
+                                      on the stiff subsystem only (see euler_ws()). NULL for the whole state */
+  lapack_int stiff_size;         /**< Number of stiff components */
 } euler_options;
 
+/**
+ * @brief Options for the trajectory integration
+ */
+typedef struct euler_integrate_options {
+  lapack_int u_size;           /**< Input dimension for a single time instant */
+  euler_input_function input;  /**< Input provider. It can be NULL if the model has no input */
+  euler_output_sink sink;      /**< Output sink. It can be NULL to discard the trajectory */
+  lapack_int decimation;       /**< A row is stored every decimation steps (0 and 1 store all) */
+  lapack_int block_rows;       /**< Rows of an output block. If 0, uses EULER_BLOCK_ROWS */
+  void *data;                  /**< User data for input provider and output sink */
+  double rtol;                 /**< Relative tolerance of the adaptive step. If both tolerances are 0,
+                                    the integration step is fixed */
+  double atol;                 /**< Absolute tolerance of the adaptive step */
+  double h_min;                /**< Minimum adaptive step. If 0, uses EULER_TIME_EPS * ts */
+  double h_max;                /**< Maximum adaptive step. If 0, the step is not bounded (t1 - t0).
+                                    Inputs are sampled once per step: the tstops of all the input
+                                    discontinuities should be given */
+  const double *tstops;        /**< Sorted times on which a step must end (e.g. the discontinuities of
+                                    the input). It can be NULL */
+  lapack_int n_tstops;         /**< Number of elements of tstops */
+  euler_event_function event;  /**< Guard functions of the events. It can be NULL if there are no events */
+  euler_event_handler handler; /**< Handler of the events. It can be NULL */
+  lapack_int n_events;         /**< Number of guard functions */
+  double event_tol;            /**< Time tolerance for the localization of the events. If 0, uses
+                                    EULER_TIME_EPS * ts */
+  double output_dt;            /**< If not 0, the rows are interpolated (see euler_dense()) on the grid
+                                    \f$t_0 + j\,output\_dt\f$ instead of stored at the steps, and the
+                                    decimation is not used */
+} euler_integrate_options;
+
+/**
+ * @brief Persistent working memory for the Euler integrator
+ *
+ * The workspace owns all the scratch buffers used by the implicit step: the working space
+ * for the wrappers of the vector field and of the Jacobian (with the \f$-I\f$ block set up
+ * once at allocation) and the Newton workspace. It is created once for a given euler_options
+ * structure and passed to euler_ws(), that does not allocate any memory.
+ */
+typedef struct euler_workspace {
+  lapack_int x_size;          /**< State dimensions. Taken from options struct */
+  double *work_f;             /**< Working space for the vector field wrapper. 3 * x_size elements:
+                                   explicit part of the step, \f$f(x(t+h))\f$ and \f$f(x(t))\f$ */
+  double *work_df;            /**< Working space for the Jacobian wrapper. 2 * x_size^2 elements,
+                                   the second block contains \f$-I\f$ (the nonzeros of the Jacobian
+                                   for sparse Jacobians, NULL for finite difference Jacobians) */
+  sparse_pattern *pattern;    /**< Pattern of the iteration matrix (Jacobian and diagonal). NULL for dense Jacobians */
+  lapack_int *pattern_map;    /**< Position in the iteration matrix of the nonzeros of the Jacobian, followed
+                                   by the position of the diagonal elements */
+  newton_workspace *newton;   /**< Workspace for the Newton solver. NULL for explicit options */
+  newton_stats stats;         /**< Results of the Newton solver in the last implicit step */
+  newton_ret status;          /**< Exit code of the Newton solver in the last implicit step */
+  double lu_ah;               /**< Product \f$\alpha h\f$ of the iteration matrix factorized in the Newton workspace */
+  double *history;            /**< States of the last steps, for the predictor. 3 * x_size elements (ring) */
+  double t_history[3];        /**< Times of the states in history */
+  lapack_int history_len;     /**< Number of valid states in history */
+  lapack_int history_head;    /**< Position of the most recent state in history */
+  double *dense;              /**< Data of the dense output of the last step: \f$x(t)\f$, \f$x(t+h)\f$,
+                                   \f$f(x(t))\f$ and \f$f(x(t+h))\f$. 4 * x_size elements, NULL if the
+                                   dense output is not enabled in the options */
+  double dense_t;             /**< Start time of the last step */
+  double dense_h;             /**< Size of the last step, 0 if there is no step */
+  double deadline;            /**< Deadline of the Newton solver in the current step (see euler_rt_step()).
+                                   0 if there is no deadline */
+  lapack_int *stiff_position; /**< Position of each component in the stiff subsystem, -1 for the explicit
+                                   components. x_size elements, NULL if the step is not partitioned */
+  double *work_partition;     /**< Working space of the partitioned step: full state, full vector field and
+                                   stiff components (2 * x_size + stiff_size elements), followed by the full
+                                   Jacobian (x_size^2, or the nonzeros of the pattern) if the callback is given */
+  double *trajectory;         /**< Scratch of euler_integrate() (states, inputs, block of rows, events), grown
+                                   on demand and kept for the next trajectories. NULL before the first one */
+  lapack_int trajectory_len;  /**< Allocated elements of trajectory */
+  lapack_int *fired;          /**< Guards fired in a step of euler_integrate(), grown on demand as trajectory */
+  lapack_int fired_len;       /**< Allocated elements of fired */
+} euler_workspace;
+
 /**
  * @brief Euler step (explicit or implicit)
  * 
@@ -131,7 +409,8 @@ typedef struct euler_options {
  *            \alpha h f(x(t+h), u_{u_{off}..dim(u)}, p)
  * \f}
  * which is an implicit integration step. The initial guess for the solution of the 
- * non linear problem is the state \f$x(t)\f$.
+ * non linear problem is selected by the predictor option (by default, the state \f$x(t)\f$).
+ * The explicit part of the step is evaluated once, before the Newton iterations.
  * @param opt pointer to scruct with options
  * @param xp next integration step
  * @param t current integration time
@@ -152,4 +431,270 @@ euler_ret euler(
   const double **p,
   void *data);
 
+/**
+ * @brief Allocates the working memory for the Euler integrator
+ *
+ * If the Tustin coefficient in the options is zero, only the explicit step can be performed
+ * with the workspace, and no memory for the Newton solver is allocated.
+ * @param opt pointer to struct with options
+ * @return the allocated workspace, or NULL if memory cannot be allocated
+ */
+euler_workspace *euler_workspace_alloc(const euler_options *opt);
+
+/**
+ * @brief Releases the working memory of the Euler integrator
+ * @param ws workspace to release. It can be NULL.
+ */
+void euler_workspace_free(euler_workspace *ws);
+
+/**
+ * @brief Euler step (explicit or implicit), with a persistent workspace
+ *
+ * Same step of euler(), but all the scratch memory is taken from the workspace, thus
+ * the function does not allocate. The workspace must be allocated with euler_workspace_alloc()
+ * for options with the same state dimension and ordering.
+ *
+ * With the stiff index set in the options the implicit step is partitioned (IMEX): the explicit
+ * components \f$x_E\f$ advance first with the explicit Euler step, and the stiff ones solve
+ * \f{
+ *   x_S(t+h) = x_S(t) + (1-\alpha) h f_S(x(t), u_{1..u_{off}}, p) +
+ *              \alpha h f_S(x_E(t+h), x_S(t+h), u_{u_{off}..dim(u)}, p)
+ * \f}
+ * The Newton solver, its iteration matrix \f$-I + \alpha h \nabla_{x_S} f_S\f$ (dense, extracted
+ * from the Jacobian callback or computed by finite differences on the stiff columns, a call of f
+ * per column: f_batch is not used) and its factors have the size of the stiff subsystem.
+ * NEWTON_KRYLOV is not supported, and the partitioned workspace cannot be used by
+ * euler_stage_ws(), thus neither by the Runge-Kutta and BDF integrators.
+ * @param opt pointer to scruct with options
+ * @param ws workspace for the integration step
+ * @param xp next integration step
+ * @param t current integration time
+ * @param x current state
+ * @param u control vector (see euler())
+ * @param p  pointer to arrays of parameters
+ * @param data void pointer to userspace data
+ * @return an exit code to check if integration step succeeded
+ */
+euler_ret euler_ws(
+  const euler_options *opt,
+  euler_workspace *ws,
+  double *xp,
+  const double t,
+  const double *x,
+  const double *u,
+  const double **p,
+  void *data);
+
+/**
+ * @brief Dense output of the last step of euler_ws()
+ *
+ * Evaluates in \f$t_k + \theta h\f$, \f$\theta \in [0, 1]\f$, the cubic Hermite interpolation of the
+ * last step
+ * \f{
+ *   x = (2\theta^3 - 3\theta^2 + 1) x(t_k) + (\theta^3 - 2\theta^2 + \theta) h f(x(t_k))
+ *       + (3\theta^2 - 2\theta^3) x(t_k+h) + (\theta^3 - \theta^2) h f(x(t_k+h))
+ * \f}
+ * The derivative at the end of an implicit step is recovered from the step,
+ * \f$f(x(t_k+h)) = ((x(t_k+h) - x(t_k)) / h - (1 - \alpha) f(x(t_k))) / \alpha\f$, thus the
+ * interpolation is of order 3 for the Tustin step, and it does not require evaluations of the
+ * vector field. The steps store the data only if the dense option is set.
+ * @param ws workspace of the last step, allocated with the dense option
+ * @param t evaluation time, in the last step
+ * @param x interpolated state
+ * @return EULER_NULLPTR if the dense output is not enabled, EULER_GENERIC if t is not in the last step
+ */
+euler_ret euler_dense(const euler_workspace *ws, const double t, double *x);
+
+/**
+ * @brief Outcome of a real-time step
+ */
+typedef enum euler_rt_status {
+  EULER_RT_CONVERGED = 0, /**< The Newton solver converged within the deadline */
+  EULER_RT_ITERATE,       /**< The Newton solver stopped (deadline or maximum iterations): the step is
+                               the iterate with the smallest residual (the last one for the maximum
+                               number of iterations) */
+  EULER_RT_FALLBACK       /**< The Newton solver did not produce an iterate (deadline expired before
+                               the first update, or failure): the step is the explicit step */
+} euler_rt_status;
+
+/**
+ * @brief Latency and iterations statistics of the real-time steps
+ *
+ * The structure is updated by euler_rt_step(), and it must be zero initialized.
+ */
+typedef struct euler_rt_stats {
+  lapack_int steps;                                /**< Number of steps */
+  lapack_int deadlines;                            /**< Steps stopped by the deadline */
+  lapack_int fallbacks;                            /**< Steps that returned the explicit step */
+  double worst_latency;                            /**< Worst latency of a step [s] */
+  lapack_int latency[EULER_RT_LATENCY_BINS];       /**< Histogram of the latencies: bin i counts the
+                                                        latencies in \f$[2^{i-1}, 2^i)\f$ us (bin 0
+                                                        below 1 us, the last bin includes the longer) */
+  lapack_int iterations[EULER_RT_ITER_BINS];       /**< Histogram of the Newton iterations (the last bin
+                                                        includes the larger counts) */
+} euler_rt_stats;
+
+/**
+ * @brief Euler step with a time budget, for real-time loops
+ *
+ * Same step of euler_ws(), that does not allocate and does not perform system calls (the
+ * monotonic clock is read through the vDSO on Linux), with a deadline checked by the Newton
+ * solver before each iteration (the evaluations of the vector field, the Jacobian and the
+ * factorization of an iteration are not interrupted, thus the budget should include the cost of
+ * one iteration). If the deadline expires, the step is the Newton iterate with the smallest
+ * residual norm (the maximum number of iterations, as in euler_ws(), leaves the last one). When
+ * the reused factors do not converge, the retry with a fresh Jacobian starts only before the
+ * deadline, from the iterate of the first attempt; if there is no finite iterate (the deadline
+ * expired before the first update, or the solver failed), the step is the explicit Euler step,
+ * computed from the vector field already evaluated for the step. Explicit
+ * options are never stopped. With the modified or Broyden methods the reused factors make most
+ * of the steps a few back substitutions.
+ * @param opt pointer to struct with options
+ * @param ws workspace for the integration step
+ * @param budget time budget of the step [s]. If 0, there is no deadline
+ * @param xp next integration step
+ * @param t current integration time
+ * @param x current state
+ * @param u control vector (see euler())
+ * @param p pointer to arrays of parameters
+ * @param status outcome of the step. It can be NULL
+ * @param stats statistics, updated with the step. It can be NULL
+ * @return EULER_SUCCESS if xp contains a step (also after a deadline or a fallback), otherwise an
+ *         error code for wrong arguments
+ */
+euler_ret euler_rt_step(
+  const euler_options *opt,
+  euler_workspace *ws,
+  const double budget,
+  double *xp,
+  const double t,
+  const double *x,
+  const double *u,
+  const double **p,
+  euler_rt_status *status,
+  euler_rt_stats *stats);
+
+/**
+ * @brief Solves an implicit stage, with a persistent workspace
+ *
+ * Solves for \f$x\f$ the equation
+ * \f{
+ *   x = x_k + a h f(t, x, u, p)
+ * \f}
+ * with the Newton solver and the Jacobian machinery of the implicit step (iteration matrix
+ * \f$-I + a h \nabla f\f$, sparse or finite difference Jacobians, Krylov method, and reuse of the
+ * factors for the same product \f$a h\f$). It is the building block of the diagonally implicit
+ * Runge-Kutta stages (see librk.h). The step and alpha in the options are not used, but the
+ * workspace must be allocated with a non zero alpha, and without the stiff index set.
+ * @param opt pointer to struct with options
+ * @param ws workspace for the integration step
+ * @param ah coefficient \f$a h\f$ of the vector field
+ * @param xp solution. On input, the initial guess
+ * @param t time for the evaluation of the vector field
+ * @param xk constant part of the equation
+ * @param u control vector for the vector field (the offset is not applied). It can be NULL.
+ * @param p pointer to arrays of parameters
+ * @return an exit code to check if the solution succeeded. Unlike euler_ws(), a Newton solution
+ *         that does not converge (NEWTON_MAX_ITER in ws->status) is an error
+ */
+euler_ret euler_stage_ws(
+  const euler_options *opt,
+  euler_workspace *ws,
+  const double ah,
+  double *xp,
+  const double t,
+  const double *xk,
+  const double *u,
+  const double **p);
+
+/**
+ * @brief Factorizes the iteration matrix of an implicit stage, with a persistent workspace
+ *
+ * Evaluates in x the iteration matrix \f$-I + a h \nabla f(t, x, u, p)\f$ of euler_stage_ws(), with
+ * the same Jacobian machinery (callback, sparse pattern, finite differences on the groups of the
+ * column coloring, batched vector field), and factorizes it in the Newton workspace: the factors
+ * are applied by newton_workspace_solve() on ws->newton, and are reused by the next steps with the
+ * same product \f$a h\f$ (modified and Broyden methods). The workspace must be allocated with a non
+ * zero alpha, without the stiff index set and not for NEWTON_KRYLOV.
+ * @param opt pointer to struct with options
+ * @param ws workspace for the integration step
+ * @param ah coefficient \f$a h\f$ of the vector field
+ * @param t time for the evaluation of the vector field
+ * @param x state for the evaluation
+ * @param u control vector for the vector field (the offset is not applied). It can be NULL.
+ * @param p pointer to arrays of parameters
+ * @return an exit code (EULER_GENERIC also if the iteration matrix is singular)
+ */
+euler_ret euler_factor_ws(
+  const euler_options *opt,
+  euler_workspace *ws,
+  const double ah,
+  const double t,
+  const double *x,
+  const double *u,
+  const double **p);
+
+/**
+ * @brief Integration of a whole trajectory
+ *
+ * Integrates the trajectory from t0 to t1 with integration step ts (the last step is
+ * shortened to land exactly on t1). The setup is performed once for the whole trajectory,
+ * and the state buffers are swapped at each step, without copies. The input is requested
+ * to the input provider for each step (if the input offset in the options is not zero, the
+ * input vector for the step is \f$[u(t), u(t+h)]\f$ with \f$u(t+h)\f$ stored at the offset,
+ * and only \f$u(t+h)\f$ is requested). The rows of the trajectory (starting from t0, one
+ * every decimation steps, and always including the final state) are sent to the output
+ * sink in blocks. With an input provider, each row ends with the input of the step that
+ * produced it: \f$u(t+h)\f$ with the input offset (the left limit on a tstop), otherwise the
+ * input held along the step; the rows of the output grid interpolate it between the ends of
+ * the step.
+ *
+ * If a tolerance is set in the trajectory options, the step is adaptive, starting from ts and
+ * up to h_max (by default not bounded; the error estimate cannot see the inputs between the
+ * samples, thus their discontinuities must be tstops). The local error is estimated with an embedded pair: the explicit Euler step against
+ * the implicit step (for \f$\alpha > 0\f$, filtered with the iteration matrix factorized in
+ * \f$x(t+h)\f$, or with the factors of the step if the Jacobian was evaluated in it), or the
+ * explicit Euler step against the Heun step (for \f$\alpha = 0\f$, with one more evaluation of
+ * the vector field). Only the accepted steps enter the history of the predictor. Steps with a scaled RMS error
+ * \f$\|e_i / (atol + rtol \max(|x_i(t)|, |x_i(t+h)|))\| > 1\f$ are rejected and retried, and the
+ * step is updated by a PI controller. Decimation counts the accepted steps.
+ *
+ * Steps are shortened to land exactly on the tstops and, with fixed step, the following step
+ * returns on the grid \f$t_0 + k\,ts\f$. On a tstop the step ends with the left limit of the input
+ * (requested just before the tstop), and the next step restarts with the input requested on the
+ * tstop, thus a piecewise input is never averaged across its discontinuities. If the guard
+ * functions are given, the earliest sign change along an accepted step is localized by the
+ * Illinois method on the linear interpolation of the states, the step is repeated to end on the
+ * event, and the handler is called; the integration restarts from the event, where the guards
+ * that fired are not checked again until the next step. The rows on the tstops and on the events
+ * are always stored (an event also stores the state modified by the handler).
+ *
+ * If output_dt is set, the rows are sampled on the grid \f$t_0 + j\,output\_dt\f$ by the cubic
+ * Hermite interpolation of the steps (see euler_dense()), thus the output resolution does not
+ * depend on the integration step.
+ * @param opt pointer to struct with options
+ * @param iopt pointer to struct with trajectory options
+ * @param ws workspace for the integration steps. If NULL, it is allocated for the trajectory.
+ *        It keeps the scratch of the trajectory: the next ones of the same size do not allocate
+ * @param t0 initial time
+ * @param t1 final time
+ * @param x0 initial state
+ * @param xf final state. It can be NULL
+ * @param p pointer to arrays of parameters
+ * @return an exit code to check if the integration succeeded
+ */
+euler_ret euler_integrate(
+  const euler_options *opt,
+  const euler_integrate_options *iopt,
+  euler_workspace *ws,
+  const double t0,
+  const double t1,
+  const double *x0,
+  double *xf,
+  const double **p);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* LIBEULER_H_ */
\ No newline at end of file
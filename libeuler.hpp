@@ -0,0 +1,301 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef LIBEULER_HPP_
+#define LIBEULER_HPP_
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+
+/**
+ * @brief Header-only fixed-size Euler integrator
+ *
+ * C++ (C++17) version of the Euler step and of the Newton solver for small state dimensions.
+ * The state size N and the ordering of the Jacobian are template parameters: all the working
+ * memory is on the stack (std::array), the loops have compile time bounds (and are unrolled
+ * by the compiler), the linear system is solved in closed form for N <= 2 and by an inlined LU
+ * with partial pivoting otherwise, and the model is any callable (e.g. a lambda), that the
+ * compiler can inline. Neither BLAS nor LAPACK are required.
+ *
+ * The algorithms are the same of libeuler.h and libnewton.h (full Newton, initial guess
+ * \f$x(t)\f$), and the exit codes have the same values of the C enums.
+ *
+ * The callbacks have the signatures:
+ * @code
+ * void f(std::array<double, N> &f, const double t, const std::array<double, N> &x, const double *u);
+ * void df(std::array<double, N * N> &df, const double t, const std::array<double, N> &x, const double *u);
+ * @endcode
+ * and parameters and user data are captured by the lambda.
+ */
+namespace libeuler {
+
+/**
+ * @brief Ordering of the Jacobian matrix (as LAPACK_ROW_MAJOR and LAPACK_COL_MAJOR)
+ */
+enum class ordering {
+  row_major, /**< Element (i, j) is df[i * N + j] */
+  col_major  /**< Element (i, j) is df[i + j * N] */
+};
+
+/**
+ * @brief Error code returned by the Newton algorithm (same values of newton_ret)
+ */
+enum class newton_ret {
+  f_tol = 0,        /**< (0) The solver reached the required tolerance limit for the vector field */
+  x_tol,            /**< (1) The last step for solution update was less than the minimum */
+  max_iter,         /**< (2) Maximum number of iterations reached */
+  singular_jacobian /**< (3) The jacobian is singular */
+};
+
+/**
+ * @brief Returning value for the integrator (same values of euler_ret)
+ */
+enum class euler_ret {
+  success = 0, /**< Correct execution */
+  generic = 3  /**< The Newton solver failed */
+};
+
+/**
+ * @brief Options for the Newton algorithm
+ */
+struct newton_options {
+  double f_tol;        /**< Stopping tolerance for the zero */
+  double x_tol;        /**< Stopping tolerance for the x vector step */
+  int max_iter;        /**< Maximum number of iterations */
+};
+
+/**
+ * @brief Results of the Newton algorithm
+ */
+struct newton_stats {
+  double f_norm;       /**< 2 norm of the vector field in the solution */
+  double x_norm;       /**< 2 norm of the last update step */
+  int iterations;      /**< Number of executed iterations */
+};
+
+/**
+ * @brief Options for the Euler step
+ */
+struct euler_options {
+  double ts;            /**< Integration step */
+  double alpha;         /**< Tustin transform coefficient. For alpha = 0, no optimization is performed */
+  std::size_t u_offset; /**< Input offset for implicit steps. It can also be 0 */
+  double s_tol;         /**< Tolerance for Newton solution */
+  double x_tol;         /**< Step tolerance for Newton solution */
+  int max_iter;         /**< Maximum number of iterations for Newton solver */
+};
+
+template <std::size_t N>
+using vector = std::array<double, N>;
+
+template <std::size_t N>
+using matrix = std::array<double, N * N>;
+
+/**
+ * @brief Element (i, j) of a matrix with the given ordering
+ */
+template <std::size_t N, ordering O>
+constexpr double &at(matrix<N> &a, const std::size_t i, const std::size_t j) {
+  return O == ordering::row_major ? a[i * N + j] : a[i + j * N];
+}
+
+/**
+ * @brief 2 norm of a vector
+ */
+template <std::size_t N>
+inline double norm(const vector<N> &v) {
+  double sum = 0;
+  for (std::size_t i = 0; i < N; i++)
+    sum += v[i] * v[i];
+  return std::sqrt(sum);
+}
+
+/**
+ * @brief Solves the linear system a x = b in place (b is overwritten by x, a by its factors)
+ *
+ * Closed form for N <= 2, LU with partial pivoting otherwise.
+ * @return false if the matrix is singular
+ */
+template <std::size_t N, ordering O>
+inline bool solve(matrix<N> &a, vector<N> &b) {
+  if constexpr (N == 1) {
+    if (a[0] == 0)
+      return false;
+    b[0] /= a[0];
+    return true;
+  } else if constexpr (N == 2) {
+    const double a00 = at<N, O>(a, 0, 0), a01 = at<N, O>(a, 0, 1);
+    const double a10 = at<N, O>(a, 1, 0), a11 = at<N, O>(a, 1, 1);
+    const double det = a00 * a11 - a01 * a10;
+    if (det == 0)
+      return false;
+    const double b0 = b[0];
+    b[0] = (a11 * b0 - a01 * b[1]) / det;
+    b[1] = (a00 * b[1] - a10 * b0) / det;
+    return true;
+  } else {
+    for (std::size_t k = 0; k < N; k++) {
+      std::size_t pivot = k;
+      for (std::size_t i = k + 1; i < N; i++)
+        if (std::fabs(at<N, O>(a, i, k)) > std::fabs(at<N, O>(a, pivot, k)))
+          pivot = i;
+      if (at<N, O>(a, pivot, k) == 0)
+        return false;
+      if (pivot != k) {
+        for (std::size_t j = 0; j < N; j++) {
+          const double swap = at<N, O>(a, k, j);
+          at<N, O>(a, k, j) = at<N, O>(a, pivot, j);
+          at<N, O>(a, pivot, j) = swap;
+        }
+        const double swap = b[k];
+        b[k] = b[pivot];
+        b[pivot] = swap;
+      }
+      for (std::size_t i = k + 1; i < N; i++) {
+        const double l = at<N, O>(a, i, k) / at<N, O>(a, k, k);
+        for (std::size_t j = k + 1; j < N; j++)
+          at<N, O>(a, i, j) -= l * at<N, O>(a, k, j);
+        b[i] -= l * b[k];
+      }
+    }
+    for (std::size_t k = N; k-- > 0;) {
+      for (std::size_t j = k + 1; j < N; j++)
+        b[k] -= at<N, O>(a, k, j) * b[j];
+      b[k] /= at<N, O>(a, k, k);
+    }
+    return true;
+  }
+}
+
+/**
+ * @brief Executes the Newton algorithm for root finding (see newton_solve())
+ *
+ * The callbacks are f(out, x) and df(out, x), with the Jacobian in the template ordering.
+ * @param opt option structure
+ * @param f vector field
+ * @param df Jacobian of the vector field
+ * @param x root position and initial condition. Will be modified
+ * @param stats results of the algorithm. It can be NULL.
+ * @return a status exit code as described in newton_ret enum.
+ */
+template <std::size_t N, ordering O = ordering::col_major, class F, class J>
+inline newton_ret newton_solve(const newton_options &opt, F &&f, J &&df, vector<N> &x, newton_stats *stats = nullptr) {
+  vector<N> fx{};
+  matrix<N> dfx{};
+  double f_norm = opt.f_tol;
+  double x_norm = opt.x_tol;
+  int counts = 0;
+  newton_ret ret = newton_ret::max_iter;
+
+  while (counts <= opt.max_iter) {
+    f(fx, x);                                                                     /* FUNCTION EVALUATION */
+    f_norm = norm<N>(fx);
+
+    /* Function Tollerance condition */
+    if (f_norm < opt.f_tol) {
+      ret = newton_ret::f_tol;
+      break;
+    }
+    for (std::size_t i = 0; i < N; i++)
+      fx[i] = -fx[i];
+
+    df(dfx, x);                                                                   /* JACOBIAN EVALUATION */
+    if (!solve<N, O>(dfx, fx)) {
+      ret = newton_ret::singular_jacobian;
+      break;
+    }
+
+    /* Update Step condition */
+    x_norm = norm<N>(fx);
+    if (x_norm < opt.x_tol) {
+      ret = newton_ret::x_tol;
+      break;
+    }
+
+    for (std::size_t i = 0; i < N; i++)
+      x[i] += fx[i];
+    counts++;
+  }
+
+  ret = opt.max_iter <= counts ? newton_ret::max_iter : ret;
+  if (stats)
+    *stats = newton_stats{f_norm, x_norm, counts};
+  return ret;
+}
+
+/**
+ * @brief Euler step (explicit or implicit), see euler()
+ * @param opt options structure
+ * @param f vector field, f(out, t, x, u)
+ * @param df Jacobian of the vector field, df(out, t, x, u), in the template ordering.
+ *        Not used for explicit steps
+ * @param xp next integration step
+ * @param t current integration time
+ * @param x current state
+ * @param u control vector \f$u = [u(t), u(t+h)]\f$ (see the offset). It can be NULL if the model has no input
+ * @param stats results of the Newton solver. It can be NULL.
+ * @return an exit code to check if integration step succeeded
+ */
+template <std::size_t N, ordering O = ordering::col_major, class F, class J>
+inline euler_ret euler_step(const euler_options &opt, F &&f, J &&df, vector<N> &xp, const double t, const vector<N> &x, const double *u, newton_stats *stats = nullptr) {
+  /* EXPLICIT IMPLEMENTATION */
+  if (opt.alpha == 0) {
+    f(xp, t, x, u);
+    for (std::size_t i = 0; i < N; i++)
+      xp[i] = x[i] + opt.ts * xp[i];
+    return euler_ret::success;
+  }
+
+  /* IMPLICIT IMPLEMENTATION */
+  /* Explicit part of the step: xk <- x(k) + (1 - alpha) h f(x(k), u(k)) */
+  vector<N> xk;
+  f(xk, t, x, u);
+  for (std::size_t i = 0; i < N; i++)
+    xk[i] = x[i] + (1 - opt.alpha) * opt.ts * xk[i];
+
+  const double ah = opt.alpha * opt.ts;
+  const double *up = u ? u + opt.u_offset : nullptr;
+  auto g = [&](vector<N> &out, const vector<N> &xn) {
+    f(out, t, xn, up);
+    for (std::size_t i = 0; i < N; i++)
+      out[i] = xk[i] - xn[i] + ah * out[i];
+  };
+  auto dg = [&](matrix<N> &out, const vector<N> &xn) {
+    df(out, t, xn, up);
+    for (std::size_t k = 0; k < N * N; k++)
+      out[k] *= ah;
+    for (std::size_t i = 0; i < N; i++)
+      out[i * (N + 1)] -= 1.0;
+  };
+
+  xp = x;
+  const newton_options newton_opts{opt.s_tol, opt.x_tol, opt.max_iter};
+  const newton_ret nwt = newton_solve<N, O>(newton_opts, g, dg, xp, stats);
+  if (nwt > newton_ret::max_iter)
+    return euler_ret::generic;
+  return euler_ret::success;
+}
+
+} // namespace libeuler
+
+#endif
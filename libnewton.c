@@ -21,44 +21,1019 @@
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <time.h>
 #include "libnewton.h"
 
+/**
+ * @brief Internal: least squares solution of the linearized problem
+ *
+ * Solves the linear problem with DGELS, using the workspace working space. LAPACKE
+ * transposes row major matrices in a temporary buffer, thus the row major Jacobian
+ * is seen as its column major transpose and solved with the transposed problem.
+ * Sparse Jacobians are factorized and solved with the sparse LU (with the same trick).
+ */
+static lapack_int newton_linear_solve(newton_workspace *ws) {
+  if (ws->lu) {
+    lapack_int ret = sparse_lu_factor(ws->lu, ws->df);
+    if (ret == 0)
+      sparse_lu_solve(ws->lu, ws->ordering == LAPACK_ROW_MAJOR ? 'T' : 'N', ws->f);
+    return ret;
+  }
+  if (ws->ordering == LAPACK_ROW_MAJOR)
+    return LAPACKE_dgels_work(LAPACK_COL_MAJOR, 'T', ws->x_size, ws->f_size, 1, 
+                              ws->df, ws->x_size, ws->f, ws->ldb, ws->work, ws->lwork);
+  return LAPACKE_dgels_work(LAPACK_COL_MAJOR, 'N', ws->f_size, ws->x_size, 1, 
+                            ws->df, ws->f_size, ws->f, ws->ldb, ws->work, ws->lwork);
+}
+
+/**
+ * @brief Internal: checks that the pattern contains the whole diagonal (the static pivots of the sparse LU)
+ */
+static newton_bool newton_pattern_diagonal(const sparse_pattern *pattern) {
+  for (lapack_int k = 0; k < pattern->n; k++) {
+    newton_bool found = NEWTON_FALSE;
+    for (lapack_int q = pattern->ptr[k]; q < pattern->ptr[k + 1]; q++)
+      if (pattern->idx[q] == k)
+        found = NEWTON_TRUE;
+    if (!found)
+      return NEWTON_FALSE;
+  }
+  return NEWTON_TRUE;
+}
+
+newton_workspace *newton_workspace_alloc(const newton_options *opt) {
+  if (!opt)
+    return NULL;
+
+  newton_workspace *ws = (newton_workspace *)calloc(1, sizeof(newton_workspace));
+  if (!ws)
+    return NULL;
+
+  ws->ordering = opt->ordering;
+  ws->f_size = opt->f_size;
+  ws->x_size = opt->x_size;
+  ws->ldb = opt->f_size > opt->x_size ? opt->f_size : opt->x_size;
+
+  /* Iterate with the smallest residual under a deadline, for all the methods */
+  ws->best = (double *)calloc(opt->x_size, sizeof(double));
+  if (!ws->best) {
+    newton_workspace_free(ws);
+    return NULL;
+  }
+
+  /* Krylov method: the Jacobian is never formed */
+  if (opt->method == NEWTON_KRYLOV) {
+    const lapack_int n = opt->x_size;
+    ws->restart = opt->restart > 0 ? opt->restart : NEWTON_KRYLOV_RESTART;
+    ws->f = (double *)calloc(ws->ldb, sizeof(double));
+    ws->fd_x = (double *)calloc(n, sizeof(double));
+    ws->fd_f = (double *)calloc(n, sizeof(double));
+    ws->krylov = (double *)calloc((n + ws->restart + 3) * (ws->restart + 1) + 3 * n, sizeof(double));
+    if (opt->f_size != n || !ws->f || !ws->fd_x || !ws->fd_f || !ws->krylov) {
+      newton_workspace_free(ws);
+      return NULL;
+    }
+    return ws;
+  }
+
+  /* Sparse Jacobians: symbolic analysis, once for the workspace */
+  if (opt->pattern) {
+    if (opt->f_size != opt->x_size || opt->pattern->n != opt->x_size || !newton_pattern_diagonal(opt->pattern)) {
+      newton_workspace_free(ws);
+      return NULL;
+    }
+    ws->lu = sparse_lu_alloc(opt->pattern);
+    ws->f = (double *)calloc(ws->ldb, sizeof(double));
+    ws->df = (double *)calloc(ws->lu ? ws->lu->nnz + 1 : 1, sizeof(double));
+    if (!ws->lu || !ws->f || !ws->df) {
+      newton_workspace_free(ws);
+      return NULL;
+    }
+  } else {
+    ws->f = (double *)calloc(ws->ldb, sizeof(double));
+    ws->df = (double *)calloc(opt->f_size * opt->x_size, sizeof(double));
+    if (!ws->f || !ws->df) {
+      newton_workspace_free(ws);
+      return NULL;
+    }
+  }
+
+  /* Working space query for DGELS */
+  double lwork = 0;
+  ws->work = &lwork;
+  ws->lwork = -1;
+  if (ws->lu || newton_linear_solve(ws) != 0)
+    lwork = ws->ldb;
+  ws->lwork = (lapack_int)lwork;
+  ws->work = (double *)calloc(ws->lwork, sizeof(double));
+  if (!ws->work) {
+    newton_workspace_free(ws);
+    return NULL;
+  }
+
+  /* Memory for the LU based methods */
+  /* Memory for the finite difference Jacobian */
+  if (!opt->df) {
+    ws->coloring = opt->pattern ? sparse_coloring_alloc(opt->pattern, opt->ordering) : NULL;
+    /* Batched callback: the perturbed points of a call, with stride ldb */
+    if (opt->f_batch) {
+      const lapack_int points = ws->coloring ? ws->coloring->colors : opt->x_size;
+      ws->fd_batch = points < NEWTON_BATCH_MAX ? points : NEWTON_BATCH_MAX;
+    }
+    ws->fd_x = (double *)calloc(ws->fd_batch > 0 ? ws->fd_batch * ws->ldb : opt->x_size, sizeof(double));
+    ws->fd_f = (double *)calloc(ws->fd_batch > 0 ? ws->fd_batch * ws->ldb : opt->f_size, sizeof(double));
+    if (!ws->fd_x || !ws->fd_f || (opt->pattern && !ws->coloring)) {
+      newton_workspace_free(ws);
+      return NULL;
+    }
+  }
+
+  /* Pivots of the dense LU factors (also for the full method, see newton_workspace_factor()) */
+  if (opt->f_size == opt->x_size && !ws->lu) {
+    ws->ipiv = (lapack_int *)calloc(opt->x_size, sizeof(lapack_int));
+    if (!ws->ipiv) {
+      newton_workspace_free(ws);
+      return NULL;
+    }
+  }
+  if (opt->method != NEWTON_FULL && opt->f_size == opt->x_size) {
+    ws->r = (double *)calloc(opt->x_size, sizeof(double));
+    if (!ws->r) {
+      newton_workspace_free(ws);
+      return NULL;
+    }
+  }
+  if (opt->method == NEWTON_BROYDEN && opt->f_size == opt->x_size) {
+    ws->r_old = (double *)calloc(opt->x_size, sizeof(double));
+    ws->broyden = (double *)calloc(2 * opt->x_size * NEWTON_BROYDEN_MAX, sizeof(double));
+    if (!ws->r_old || !ws->broyden) {
+      newton_workspace_free(ws);
+      return NULL;
+    }
+  }
+
+  /* Mixed precision: single precision factors (full method, dense square Jacobian) */
+  if (opt->mixed && opt->method == NEWTON_FULL && opt->f_size == opt->x_size && !opt->pattern) {
+    const lapack_int n = opt->x_size;
+    ws->single = (float *)calloc(n * (n + 1), sizeof(float));
+    ws->refine = (double *)calloc(2 * n, sizeof(double));
+    if (!ws->single || !ws->refine) {
+      newton_workspace_free(ws);
+      return NULL;
+    }
+  }
+
+  /* Globalization: trial point, and the gradient of the dogleg (full method, dense Jacobian) */
+  if (opt->globalization != NEWTON_GLOBAL_NONE) {
+    ws->trial = (double *)calloc(opt->x_size + opt->f_size, sizeof(double));
+    if (!ws->trial) {
+      newton_workspace_free(ws);
+      return NULL;
+    }
+  }
+  if (opt->globalization == NEWTON_DOGLEG && opt->method == NEWTON_FULL && !opt->pattern) {
+    ws->dogleg = (double *)calloc(opt->x_size + opt->f_size, sizeof(double));
+    if (!ws->dogleg) {
+      newton_workspace_free(ws);
+      return NULL;
+    }
+  }
+  return ws;
+}
+
+double newton_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/**
+ * @brief Internal: checks if the deadline of the options expired
+ */
+static newton_bool newton_expired(const newton_options *opt) {
+  return (opt->deadline > 0 && newton_clock() >= opt->deadline) ? NEWTON_TRUE : NEWTON_FALSE;
+}
+
+/**
+ * @brief Internal: under a deadline, keeps the iterate x if its residual norm is the smallest so far
+ */
+static void newton_best_keep(const newton_options *opt, newton_workspace *ws, const double *x, const double f_norm, double *best_norm) {
+  if (opt->deadline > 0 && f_norm < *best_norm) {
+    cblas_dcopy(opt->x_size, x, 1, ws->best, 1);
+    *best_norm = f_norm;
+  }
+}
+
+/**
+ * @brief Internal: the deadline expired, x is replaced by the iterate with the smallest residual norm
+ */
+static void newton_best_restore(const newton_options *opt, newton_workspace *ws, double *x, double *f_norm, const double best_norm) {
+  if (best_norm < *f_norm) {
+    cblas_dcopy(opt->x_size, ws->best, 1, x, 1);
+    *f_norm = best_norm;
+  }
+}
+
+void newton_workspace_invalidate(newton_workspace *ws) {
+  if (!ws)
+    return;
+  ws->lu_valid = NEWTON_FALSE;
+  ws->updates = 0;
+}
+
+void newton_workspace_free(newton_workspace *ws) {
+  if (!ws)
+    return;
+  free(ws->f);
+  free(ws->best);
+  free(ws->df);
+  free(ws->work);
+  free(ws->ipiv);
+  free(ws->r);
+  free(ws->r_old);
+  free(ws->broyden);
+  sparse_lu_free(ws->lu);
+  sparse_coloring_free(ws->coloring);
+  free(ws->fd_x);
+  free(ws->fd_f);
+  free(ws->krylov);
+  free(ws->trial);
+  free(ws->dogleg);
+  free(ws->single);
+  free(ws->refine);
+  free(ws);
+}
 
 newton_ret newton_solve(newton_options *opt, const double t, double *x, const double *u, const double **p, void *data) {
-  double set_f_tol = opt->f_tol;
-  double set_x_tol = opt->x_tol;
+  newton_workspace *ws = newton_workspace_alloc(opt);
+  if (!ws)
+    return NEWTON_MALLOC_ERROR;
+
+  newton_ret ret = newton_solve_ws(opt, ws, t, x, u, p, data);
+
+  newton_workspace_free(ws);
+  return ret;
+}
+
+newton_ret newton_solve_ws(newton_options *opt, newton_workspace *ws, const double t, double *x, const double *u, const double **p, void *data) {
+  if (!opt)
+    return NEWTON_GENERIC_ERROR;
+
+  newton_stats stats = {
+    .f_norm = opt->f_tol,
+    .x_norm = opt->x_tol,
+    .iterations = opt->max_iter,
+    .jacobians = 0,
+    .evaluations = 0,
+    .products = 0,
+    .refinements = 0,
+    .fallbacks = 0
+  };
+  newton_ret ret = newton_solve_r(opt, ws, &stats, t, x, u, p, data);
+
+  opt->f_tol = stats.f_norm;
+  opt->x_tol = stats.x_norm;
+  opt->max_iter = stats.iterations;
+  return ret;
+}
+
+/**
+ * @brief Internal: finite difference Jacobian with the batched callback
+ *
+ * Same perturbations of newton_jacobian_eval(). The points (one for each column, or for each
+ * group of the coloring) are evaluated fd_batch at a time, the point k of a call is stored at
+ * fd_x + k * ldb. Returns the number of vector field evaluations.
+ */
+static lapack_int newton_jacobian_batch(const newton_options *opt, newton_workspace *ws, const double t, const double *x, const double *fx, const double *u, const double **p, void *data) {
+  const lapack_int n = ws->x_size;
+  const lapack_int m = ws->f_size;
+  const lapack_int ld = ws->ldb;
+  const double eps = sqrt(DBL_EPSILON);
+  const sparse_coloring *coloring = ws->coloring;
+  const lapack_int points = coloring ? coloring->colors : n;
+
+  for (lapack_int first = 0; first < points; first += ws->fd_batch) {
+    const lapack_int count = points - first < ws->fd_batch ? points - first : ws->fd_batch;
+    for (lapack_int k = 0; k < count; k++) {
+      const lapack_int q0 = coloring ? coloring->cptr[first + k] : first + k;
+      const lapack_int q1 = coloring ? coloring->cptr[first + k + 1] : first + k + 1;
+      double *xd = ws->fd_x + k * ld;
+      cblas_dcopy(n, x, 1, xd, 1);
+      for (lapack_int q = q0; q < q1; q++) {
+        const lapack_int j = coloring ? coloring->cols[q] : q;
+        xd[j] = x[j] + (x[j] < 0 ? -eps : eps) * fmax(fabs(x[j]), 1.0);
+      }
+    }
+    opt->f_batch(ws->fd_f, t, ws->fd_x, u, p, count, ld, data);
+
+    for (lapack_int k = 0; k < count; k++) {
+      const double *xd = ws->fd_x + k * ld;
+      const double *fd = ws->fd_f + k * ld;
+      if (!coloring) {
+        const lapack_int j = first + k;
+        const double delta = xd[j] - x[j];
+        for (lapack_int i = 0; i < m; i++)
+          ws->df[ws->ordering == LAPACK_ROW_MAJOR ? i * n + j : i + j * m] = (fd[i] - fx[i]) / delta;
+        continue;
+      }
+      for (lapack_int q = coloring->cptr[first + k]; q < coloring->cptr[first + k + 1]; q++) {
+        const lapack_int j = coloring->cols[q];
+        const double delta = xd[j] - x[j];
+        for (lapack_int r = coloring->jptr[j]; r < coloring->jptr[j + 1]; r++)
+          ws->df[coloring->pos[r]] = (fd[coloring->rows[r]] - fx[coloring->rows[r]]) / delta;
+      }
+    }
+  }
+  return points;
+}
+
+/**
+ * @brief Internal: Jacobian evaluation, with the callback or by finite differences
+ *
+ * The finite differences reuse the vector field fx in x. The columns of a group are perturbed
+ * together, and the perturbation is rounded to a step that is exactly representable in x + delta.
+ * Returns the number of vector field evaluations.
+ */
+static lapack_int newton_jacobian_eval(const newton_options *opt, newton_workspace *ws, const double t, const double *x, const double *fx, const double *u, const double **p, void *data) {
+  if (opt->df) {
+    opt->df(ws->df, t, x, u, p, data);
+    return 0;
+  }
+
+  const lapack_int n = ws->x_size;
+  const lapack_int m = ws->f_size;
+  const double eps = sqrt(DBL_EPSILON);
+  double *xd = ws->fd_x;
+  double *fd = ws->fd_f;
+  cblas_dcopy(n, x, 1, xd, 1);
+
+  /* Batched callback: all the perturbed points in a single call */
+  if (opt->f_batch && ws->fd_batch > 0)
+    return newton_jacobian_batch(opt, ws, t, x, fx, u, p, data);
+
+  /* Dense Jacobian: one column at a time */
+  if (!ws->coloring) {
+    for (lapack_int j = 0; j < n; j++) {
+      xd[j] = x[j] + (x[j] < 0 ? -eps : eps) * fmax(fabs(x[j]), 1.0);
+      const double delta = xd[j] - x[j];
+      opt->f(fd, t, xd, u, p, data);
+      for (lapack_int i = 0; i < m; i++)
+        ws->df[ws->ordering == LAPACK_ROW_MAJOR ? i * n + j : i + j * m] = (fd[i] - fx[i]) / delta;
+      xd[j] = x[j];
+    }
+    return n;
+  }
+
+  /* Sparse Jacobian: one group of structurally orthogonal columns at a time */
+  const sparse_coloring *coloring = ws->coloring;
+  for (lapack_int c = 0; c < coloring->colors; c++) {
+    for (lapack_int q = coloring->cptr[c]; q < coloring->cptr[c + 1]; q++) {
+      const lapack_int j = coloring->cols[q];
+      xd[j] = x[j] + (x[j] < 0 ? -eps : eps) * fmax(fabs(x[j]), 1.0);
+    }
+    opt->f(fd, t, xd, u, p, data);
+    for (lapack_int q = coloring->cptr[c]; q < coloring->cptr[c + 1]; q++) {
+      const lapack_int j = coloring->cols[q];
+      const double delta = xd[j] - x[j];
+      for (lapack_int k = coloring->jptr[j]; k < coloring->jptr[j + 1]; k++)
+        ws->df[coloring->pos[k]] = (fd[coloring->rows[k]] - fx[coloring->rows[k]]) / delta;
+      xd[j] = x[j];
+    }
+  }
+  return coloring->colors;
+}
+
+/**
+ * @brief Internal: evaluates the Jacobian and computes its LU factors in the workspace
+ *
+ * Returns the LAPACK exit code, and adds the vector field evaluations to evaluations.
+ */
+static lapack_int newton_lu_refresh(const newton_options *opt, newton_workspace *ws, const double t, const double *x, const double *fx, const double *u, const double **p, void *data, lapack_int *evaluations) {
+  *evaluations += newton_jacobian_eval(opt, ws, t, x, fx, u, p, data);            /* JACOBIAN EVALUATION */
+  ws->updates = 0;
+  lapack_int ret = ws->lu ? sparse_lu_factor(ws->lu, ws->df)
+                          : LAPACKE_dgetrf_work(LAPACK_COL_MAJOR, ws->x_size, ws->x_size, ws->df, ws->x_size, ws->ipiv);
+  ws->lu_valid = ret == 0 ? NEWTON_TRUE : NEWTON_FALSE;
+  return ret;
+}
+
+/**
+ * @brief Internal: applies the (updated) inverse of the Jacobian to v, in place
+ *
+ * The inverse is \f$H_k = (I + a_{k-1} s_{k-1}^T) \cdots (I + a_0 s_0^T) H_0\f$, where \f$H_0\f$
+ * is given by the LU factors (of the transpose, for row major ordering).
+ */
+static void newton_lu_apply(newton_workspace *ws, double *v) {
+  const lapack_int n = ws->x_size;
+  if (ws->lu)
+    sparse_lu_solve(ws->lu, ws->ordering == LAPACK_ROW_MAJOR ? 'T' : 'N', v);
+  else
+    LAPACKE_dgetrs_work(LAPACK_COL_MAJOR, ws->ordering == LAPACK_ROW_MAJOR ? 'T' : 'N', 
+                        n, 1, ws->df, n, ws->ipiv, v, n);
+  for (lapack_int j = 0; j < ws->updates; j++) {
+    const double *a = ws->broyden + 2 * j * n;
+    const double *s = a + n;
+    cblas_daxpy(n, cblas_ddot(n, s, 1, v, 1), a, 1, v, 1);
+  }
+}
+
+newton_ret newton_workspace_factor(const newton_options *opt, newton_workspace *ws, const double t, const double *x, const double *u, const double **p, void *data) {
+  if (!opt || !ws || !x || !ws->df || (!ws->ipiv && !ws->lu))
+    return NEWTON_GENERIC_ERROR;
+  if ((opt->pattern != NULL) != (ws->lu != NULL) || (!opt->df && !ws->fd_x))
+    return NEWTON_GENERIC_ERROR;
+
+  /* The finite differences reuse the vector field in x */
+  lapack_int evaluations = 0;
+  if (!opt->df)
+    opt->f(ws->f, t, x, u, p, data);                                              /* FUNCTION EVALUATION */
+  if (newton_lu_refresh(opt, ws, t, x, ws->f, u, p, data, &evaluations) != 0)
+    return NEWTON_SINGULAR_JACOBIAN;
+  return NEWTON_F_TOL;
+}
+
+newton_ret newton_workspace_solve(newton_workspace *ws, double *v) {
+  if (!ws || !v || !ws->lu_valid)
+    return NEWTON_GENERIC_ERROR;
+  newton_lu_apply(ws, v);
+  return NEWTON_F_TOL;
+}
+
+/**
+ * @brief Internal: Broyden ("good") rank one update of the inverse Jacobian
+ *
+ * With the last step \f$s\f$ (stored in the update slot) and \f$y = F(x_{k+1}) - F(x_k)\f$:
+ * \f{
+ *   H_{k+1} = H_k + \frac{(s - H_k y) s^T H_k}{s^T H_k y}
+ * \f}
+ * When the maximum number of updates is reached, the factors are invalidated.
+ */
+static void newton_broyden_update(newton_workspace *ws) {
+  const lapack_int n = ws->x_size;
+  double *a = ws->broyden + 2 * ws->updates * n;
+  const double *s = a + n;
+
+  /* a <- H_k (r - r_old) */
+  cblas_dcopy(n, ws->r, 1, a, 1);
+  cblas_daxpy(n, -1, ws->r_old, 1, a, 1);
+  newton_lu_apply(ws, a);
+
+  double den = cblas_ddot(n, s, 1, a, 1);
+  if (fabs(den) <= DBL_EPSILON * cblas_dnrm2(n, s, 1) * cblas_dnrm2(n, a, 1))
+    return;
+  /* a <- (s - H_k y) / (s^T H_k y) */
+  cblas_dscal(n, -1, a, 1);
+  cblas_daxpy(n, 1, s, 1, a, 1);
+  cblas_dscal(n, 1 / den, a, 1);
+  ws->updates++;
+  if (ws->updates == NEWTON_BROYDEN_MAX)
+    ws->lu_valid = NEWTON_FALSE;
+}
+
+/**
+ * @brief Internal: mixed precision solution of the square system in the workspace
+ *
+ * The Jacobian (kept in double precision) is rounded and factorized in single precision, and the
+ * solution is refined with the residual \f$r = b - \nabla F x\f$ computed in double precision, until
+ * \f$\|r\|_\infty \leq \|x\|_\infty \|\nabla F\|_\infty \epsilon \sqrt{n}\f$ (as in DSGESV). If the single
+ * precision factorization fails (singular or out of range Jacobian) or the residual does not
+ * halve at each refinement, the system is solved with the double precision LU. The right hand
+ * side is in f, and it is replaced by the solution. Returns the LAPACK exit code.
+ */
+static lapack_int newton_mixed_solve(newton_workspace *ws, lapack_int *refinements, lapack_int *fallbacks) {
+  const lapack_int n = ws->x_size;
+  const char trans = ws->ordering == LAPACK_ROW_MAJOR ? 'T' : 'N';
+  const CBLAS_ORDER order = ws->ordering == LAPACK_ROW_MAJOR ? CblasRowMajor : CblasColMajor;
+  float *a = ws->single;
+  float *c = ws->single + n * n;
+  double *b = ws->refine;
+  double *r = ws->refine + n;
+  double *x = ws->f;
+
+  /* Infinity norm, and rounding to single precision */
+  newton_bool fits = NEWTON_TRUE;
+  for (lapack_int k = 0; k < n * n; k++) {
+    fits = fabs(ws->df[k]) <= FLT_MAX ? fits : NEWTON_FALSE;
+    a[k] = (float)ws->df[k];
+  }
+  double a_norm = 0;
+  for (lapack_int i = 0; i < n; i++)
+    a_norm = fmax(a_norm, cblas_dasum(n, ws->df + (order == CblasRowMajor ? i * n : i), order == CblasRowMajor ? 1 : n));
+
+  lapack_int info = fits ? LAPACKE_sgetrf_work(LAPACK_COL_MAJOR, n, n, a, n, ws->ipiv) : -1;
+  if (info == 0) {
+    const double tol = a_norm * DBL_EPSILON * sqrt((double)n);
+    double r_norm_old = INFINITY;
+    cblas_dcopy(n, x, 1, b, 1);
+    cblas_dcopy(n, x, 1, r, 1);
+    for (lapack_int i = 0; i < n; i++)
+      x[i] = 0;
+    for (lapack_int k = 0; k < NEWTON_REFINE_MAX; k++) {
+      for (lapack_int i = 0; i < n; i++)
+        c[i] = (float)r[i];
+      LAPACKE_sgetrs_work(LAPACK_COL_MAJOR, trans, n, 1, a, n, ws->ipiv, c, n);
+      (*refinements)++;
+      for (lapack_int i = 0; i < n; i++)
+        x[i] += c[i];
+
+      /* Residual in double precision */
+      cblas_dcopy(n, b, 1, r, 1);
+      cblas_dgemv(order, CblasNoTrans, n, n, -1.0, ws->df, n, x, 1, 1.0, r, 1);
+      const double r_norm = fabs(r[cblas_idamax(n, r, 1)]);
+      if (r_norm <= fabs(x[cblas_idamax(n, x, 1)]) * tol)
+        return 0;
+      if (!(r_norm < 0.5 * r_norm_old))
+        break;
+      r_norm_old = r_norm;
+    }
+    cblas_dcopy(n, b, 1, x, 1);
+  }
+
+  /* Stalled refinement: double precision factors */
+  (*fallbacks)++;
+  info = LAPACKE_dgetrf_work(LAPACK_COL_MAJOR, n, n, ws->df, n, ws->ipiv);
+  if (info == 0)
+    LAPACKE_dgetrs_work(LAPACK_COL_MAJOR, trans, n, 1, ws->df, n, ws->ipiv, x, n);
+  return info;
+}
+
+/**
+ * @brief Internal: Armijo backtracking along the step d, with the quadratic model of
+ * \f$\phi(\lambda) = \|f(x + \lambda d)\|^2\f$ (safeguarded in [0.1, 0.5] of the previous step).
+ *
+ * Moves x to the accepted point (the last trial if the sufficient decrease is not reached) and
+ * leaves its vector field in the trial buffer. Returns the step fraction.
+ */
+static double newton_line_search(const newton_options *opt, newton_workspace *ws, const double t, double *x, const double *d, const double f_norm, const double *u, const double **p, void *data, lapack_int *evaluations) {
+  const lapack_int n = ws->x_size;
+  double *xt = ws->trial;
+  double *ft = ws->trial + n;
+  const double phi0 = f_norm * f_norm;
+  double lambda = 1.0;
+
+  for (lapack_int k = 1;; k++) {
+    cblas_dcopy(n, x, 1, xt, 1);
+    cblas_daxpy(n, lambda, d, 1, xt, 1);
+    opt->f(ft, t, xt, u, p, data);                                                /* FUNCTION EVALUATION */
+    (*evaluations)++;
+    const double f_trial = cblas_dnrm2(ws->f_size, ft, 1);
+    const double phi = f_trial * f_trial;
+    if ((isfinite(phi) && phi <= (1 - 2 * NEWTON_ARMIJO * lambda) * phi0) || k >= NEWTON_LS_MAX)
+      break;
+    const double next = isfinite(phi) ? lambda * lambda * phi0 / (phi - phi0 + 2 * lambda * phi0) : 0;
+    lambda = fmin(0.5 * lambda, fmax(0.1 * lambda, next));
+  }
+  cblas_dcopy(n, xt, 1, x, 1);
+  return lambda;
+}
+
+/**
+ * @brief Internal: dogleg step in the trust region of the given radius
+ *
+ * The step is \f$a g + b d_N\f$, with the gradient \f$g = \nabla f^T f\f$ and the Newton (least squares)
+ * step \f$d_N\f$, whose residual has squared norm rn2. The predicted reduction of the linear model is
+ * \f$\|f\|^2 - (1-b)^2 (\|f\|^2 - rn2) - 2a(1-b)\|g\|^2 - a^2\|\nabla f g\|^2 - rn2\f$, that does not
+ * require the Jacobian (overwritten by its factors). Rejected steps shrink the radius and are
+ * repeated with the same factors. Moves x to the accepted point, with its vector field in the
+ * trial buffer. Returns NEWTON_FALSE if the radius collapsed without an accepted step.
+ */
+static newton_bool newton_dogleg(const newton_options *opt, newton_workspace *ws, const double t, double *x, const double *dn, const double f_norm, const double rn2, double *radius, const double *u, const double **p, void *data, lapack_int *evaluations) {
+  const lapack_int n = ws->x_size;
+  const lapack_int m = ws->f_size;
+  const double *g = ws->dogleg;
+  double *xt = ws->trial;
+  double *ft = ws->trial + n;
+
+  const double phi0 = f_norm * f_norm;
+  const double gg = cblas_ddot(n, g, 1, g, 1);
+  const double jgjg = cblas_ddot(m, ws->dogleg + n, 1, ws->dogleg + n, 1);
+  const double nn = cblas_ddot(n, dn, 1, dn, 1);
+  const double gd = cblas_ddot(n, g, 1, dn, 1);
+  const double cauchy = jgjg > 0 ? gg / jgjg : 0; /* d_C = -cauchy g */
+
+  for (lapack_int k = 0; k < NEWTON_TR_MAX && *radius >= opt->x_tol; k++) {
+    double a = 0, b = 1;
+    if (sqrt(nn) > *radius && gg > 0) {
+      if (cauchy == 0 || cauchy * sqrt(gg) >= *radius) {
+        /* Steepest descent, truncated on the boundary */
+        a = -*radius / sqrt(gg);
+        b = 0;
+      } else {
+        /* Dogleg: d_C + tau (d_N - d_C) on the boundary */
+        const double cc = cauchy * cauchy * gg;
+        const double cw = -cauchy * gd - cc;
+        const double ww = nn + 2 * cauchy * gd + cc;
+        const double tau = (-cw + sqrt(fmax(0, cw * cw + ww * (*radius * *radius - cc)))) / ww;
+        a = -(1 - tau) * cauchy;
+        b = tau;
+      }
+    }
+    cblas_dcopy(n, x, 1, xt, 1);
+    if (a != 0)
+      cblas_daxpy(n, a, g, 1, xt, 1);
+    if (b != 0)
+      cblas_daxpy(n, b, dn, 1, xt, 1);
+    opt->f(ft, t, xt, u, p, data);                                                /* FUNCTION EVALUATION */
+    (*evaluations)++;
+    const double f_trial = cblas_dnrm2(m, ft, 1);
+
+    const double model = (1 - b) * (1 - b) * (phi0 - rn2) + 2 * a * (1 - b) * gg + a * a * jgjg + rn2;
+    const double pred = phi0 - model;
+    const double rho = pred > 0 ? (phi0 - f_trial * f_trial) / pred : -1;
+    const double step = sqrt(fmax(0, a * a * gg + 2 * a * b * gd + b * b * nn));
+
+    /* Trust radius update */
+    if (!(rho >= 0.25))
+      *radius = 0.25 * step;
+    else if (rho > 0.75 && step >= 0.99 * *radius)
+      *radius = 2 * *radius;
+    if (rho > NEWTON_ARMIJO) {
+      cblas_dcopy(n, xt, 1, x, 1);
+      return NEWTON_TRUE;
+    }
+  }
+  return NEWTON_FALSE;
+}
+
+/**
+ * @brief Internal: modified Newton and Broyden methods (square systems only)
+ */
+static newton_ret newton_solve_lu(const newton_options *opt, newton_workspace *ws, newton_stats *stats, const double t, double *x, const double *u, const double **p, void *data) {
+  const lapack_int n = opt->x_size;
+  const double contraction = opt->contraction > 0 ? opt->contraction : NEWTON_CONTRACTION;
+  double f_norm = opt->f_tol;
+  double x_norm = opt->x_tol;
+  double x_norm_old = 0;
   lapack_int counts = 0;
+  lapack_int jacobians = 0;
+  lapack_int evaluations = 0;
+  double best_norm = INFINITY;
 
   newton_ret ret = NEWTON_GENERIC_ERROR;
-  double *df, *f;
-  
-  lapack_int ldb = opt->f_size > opt->x_size ? opt->f_size : opt->x_size;
-  lapack_int lda = opt->f_size;
+  double *r = ws->r;
+  double *dx = ws->f;
 
-  f = (double*)calloc(ldb, sizeof(double));
-  if (!f)
-    return NEWTON_MALLOC_ERROR;
-  df = (double*)calloc(opt->f_size * opt->x_size, sizeof(double));
-  if (!df) {
-    free(f);
-    return NEWTON_MALLOC_ERROR;
+  /* Broyden updates refer to a single problem, factors are kept among calls */
+  ws->updates = 0;
+
+  newton_bool evaluated = NEWTON_FALSE;
+  while (counts <= opt->max_iter) {
+    if (!evaluated) {
+      opt->f(r, t, x, u, p, data);                                                /* FUNCTION EVALUATION */
+      evaluations++;
+    }
+    evaluated = NEWTON_FALSE;
+    f_norm = cblas_dnrm2(n, r, 1);
+
+    /* Function Tollerance condition */
+    if (f_norm < opt->f_tol) {
+      ret = NEWTON_F_TOL;
+      break;
+    }
+    newton_best_keep(opt, ws, x, f_norm, &best_norm);
+    if (newton_expired(opt)) {
+      newton_best_restore(opt, ws, x, &f_norm, best_norm);
+      ret = NEWTON_DEADLINE;
+      break;
+    }
+
+    if (opt->method == NEWTON_BROYDEN) {
+      if (counts > 0 && ws->lu_valid && ws->updates < NEWTON_BROYDEN_MAX)
+        newton_broyden_update(ws);
+      cblas_dcopy(n, r, 1, ws->r_old, 1);
+    }
+
+    newton_bool fresh = NEWTON_FALSE;
+    if (!ws->lu_valid) {
+      jacobians++;
+      fresh = NEWTON_TRUE;
+      if (newton_lu_refresh(opt, ws, t, x, r, u, p, data, &evaluations) != 0) {
+        ret = NEWTON_SINGULAR_JACOBIAN;
+        break;
+      }
+    }
+
+    for (;;) {
+      cblas_dcopy(n, r, 1, dx, 1);
+      cblas_dscal(n, -1.0, dx, 1);
+      newton_lu_apply(ws, dx);
+      x_norm = cblas_dnrm2(n, dx, 1);
+      if (fresh || x_norm_old == 0 || x_norm <= contraction * x_norm_old)
+        break;
+
+      /* Slow contraction: the Jacobian is evaluated in the current point */
+      jacobians++;
+      fresh = NEWTON_TRUE;
+      if (newton_lu_refresh(opt, ws, t, x, r, u, p, data, &evaluations) != 0)
+        break;
+    }
+    if (!ws->lu_valid) {
+      ret = NEWTON_SINGULAR_JACOBIAN;
+      break;
+    }
+    
+    /* Update Step condition */
+    if (x_norm < opt->x_tol) {
+      ret = NEWTON_X_TOL;
+      break;
+    }
+
+    /* Line search: the vector field in the accepted point is reused, the step is scaled */
+    if (opt->globalization != NEWTON_GLOBAL_NONE) {
+      const double lambda = newton_line_search(opt, ws, t, x, dx, f_norm, u, p, data, &evaluations);
+      cblas_dcopy(n, ws->trial + n, 1, r, 1);
+      cblas_dscal(n, lambda, dx, 1);
+      evaluated = NEWTON_TRUE;
+    } else {
+      cblas_daxpy(n, 1, dx, 1, x, 1);
+    }
+    if (opt->method == NEWTON_BROYDEN && ws->updates < NEWTON_BROYDEN_MAX)
+      cblas_dcopy(n, dx, 1, ws->broyden + (2 * ws->updates + 1) * n, 1);
+    x_norm_old = x_norm;
+    counts++;
+  }
+
+  ret = opt->max_iter <= counts ? NEWTON_MAX_ITER : ret;
+  if (stats) {
+    stats->f_norm = f_norm;
+    stats->x_norm = x_norm;
+    stats->iterations = counts;
+    stats->jacobians = jacobians;
+    stats->evaluations = evaluations;
+    stats->products = 0;
+    stats->refinements = 0;
+    stats->fallbacks = 0;
+  }
+
+  return ret;
+}
+
+/**
+ * @brief Internal: Jacobian-vector product, with the callback or by directional differences
+ *
+ * The directional difference reuses the vector field fx in x, with the step
+ * \f$\sigma = \sqrt{\epsilon} (1 + |x|) / |v|\f$.
+ */
+static void newton_jv(const newton_options *opt, newton_workspace *ws, double *jv, const double *v, const double t, const double *x, const double *fx, const double *u, const double **p, void *data, newton_stats *counters) {
+  const lapack_int n = ws->x_size;
+  counters->products++;
+  if (opt->jv) {
+    opt->jv(jv, v, t, x, u, p, data);
+    return;
+  }
+  const double v_norm = cblas_dnrm2(n, v, 1);
+  if (v_norm == 0) {
+    for (lapack_int i = 0; i < n; i++)
+      jv[i] = 0;
+    return;
   }
+  const double sigma = sqrt(DBL_EPSILON) * (1 + cblas_dnrm2(n, x, 1)) / v_norm;
+  cblas_dcopy(n, x, 1, ws->fd_x, 1);
+  cblas_daxpy(n, sigma, v, 1, ws->fd_x, 1);
+  opt->f(jv, t, ws->fd_x, u, p, data);
+  counters->evaluations++;
+  cblas_daxpy(n, -1, fx, 1, jv, 1);
+  cblas_dscal(n, 1 / sigma, jv, 1);
+}
 
+/**
+ * @brief Internal: right preconditioned restarted GMRES for the Newton step
+ *
+ * Solves \f$\nabla F(x) d = -F(x)\f$ until \f$|F(x) + \nabla F(x) d| \leq \eta |F(x)|\f$
+ * (or for NEWTON_KRYLOV_CYCLES cycles), starting from d = 0. The Arnoldi basis is orthogonalized
+ * with modified Gram-Schmidt and the least squares problem is updated with Givens rotations.
+ */
+static void newton_gmres(const newton_options *opt, newton_workspace *ws, double *d, const double eta, const double t, const double *x, const double *fx, const double *u, const double **p, void *data, newton_stats *counters) {
+  const lapack_int n = ws->x_size;
+  const lapack_int m = ws->restart;
+  double *V = ws->krylov;
+  double *z = V + n * (m + 1);
+  double *w = z + n;
+  double *H = w + 2 * n;
+  double *g = H + (m + 1) * m;
+  double *cs = g + m + 1;
+  double *sn = cs + m;
+
+  /* Residual of the initial guess d = 0 */
+  for (lapack_int i = 0; i < n; i++)
+    d[i] = 0;
+  cblas_dcopy(n, fx, 1, V, 1);
+  cblas_dscal(n, -1, V, 1);
+  double beta = cblas_dnrm2(n, V, 1);
+  const double tol = eta * beta;
+
+  for (lapack_int cycle = 0; cycle < NEWTON_KRYLOV_CYCLES && beta > tol; cycle++) {
+    cblas_dscal(n, 1 / beta, V, 1);
+    g[0] = beta;
+    lapack_int k = 0;
+    while (k < m) {
+      /* Arnoldi step: w = J M^-1 v_k */
+      const lapack_int j = k++;
+      if (opt->prec)
+        opt->prec(z, V + j * n, t, x, u, p, data);
+      else
+        cblas_dcopy(n, V + j * n, 1, z, 1);
+      newton_jv(opt, ws, w, z, t, x, fx, u, p, data, counters);
+      double *h = H + j * (m + 1);
+      for (lapack_int i = 0; i <= j; i++) {
+        h[i] = cblas_ddot(n, w, 1, V + i * n, 1);
+        cblas_daxpy(n, -h[i], V + i * n, 1, w, 1);
+      }
+      h[j + 1] = cblas_dnrm2(n, w, 1);
+      if (h[j + 1] > 0) {
+        cblas_dcopy(n, w, 1, V + (j + 1) * n, 1);
+        cblas_dscal(n, 1 / h[j + 1], V + (j + 1) * n, 1);
+      }
+
+      /* Givens rotations on the new column of the Hessenberg matrix */
+      for (lapack_int i = 0; i < j; i++) {
+        const double hi = cs[i] * h[i] + sn[i] * h[i + 1];
+        h[i + 1] = -sn[i] * h[i] + cs[i] * h[i + 1];
+        h[i] = hi;
+      }
+      const double r = hypot(h[j], h[j + 1]);
+      if (r == 0) {
+        k--;
+        break;
+      }
+      cs[j] = h[j] / r;
+      sn[j] = h[j + 1] / r;
+      h[j] = r;
+      h[j + 1] = 0;
+      g[j + 1] = -sn[j] * g[j];
+      g[j] = cs[j] * g[j];
+      if (fabs(g[j + 1]) <= tol)
+        break;
+    }
+
+    /* Update d += M^-1 V y, with H y = g (upper triangular) */
+    for (lapack_int i = k - 1; i >= 0; i--) {
+      for (lapack_int l = i + 1; l < k; l++)
+        g[i] -= H[i + l * (m + 1)] * g[l];
+      g[i] /= H[i + i * (m + 1)];
+    }
+    for (lapack_int i = 0; i < n; i++)
+      w[i] = 0;
+    for (lapack_int i = 0; i < k; i++)
+      cblas_daxpy(n, g[i], V + i * n, 1, w, 1);
+    if (opt->prec)
+      opt->prec(z, w, t, x, u, p, data);
+    else
+      cblas_dcopy(n, w, 1, z, 1);
+    cblas_daxpy(n, 1, z, 1, d, 1);
+    if (k == 0)
+      break;
+
+    /* Residual for the restart: v_0 = -F - J d */
+    newton_jv(opt, ws, V, d, t, x, fx, u, p, data, counters);
+    cblas_daxpy(n, 1, fx, 1, V, 1);
+    cblas_dscal(n, -1, V, 1);
+    beta = cblas_dnrm2(n, V, 1);
+  }
+}
+
+/**
+ * @brief Internal: Jacobian-free Newton-Krylov method (square systems only)
+ */
+static newton_ret newton_solve_krylov(const newton_options *opt, newton_workspace *ws, newton_stats *stats, const double t, double *x, const double *u, const double **p, void *data) {
+  const lapack_int n = opt->x_size;
+  newton_stats counters = {
+    .f_norm = opt->f_tol,
+    .x_norm = opt->x_tol,
+    .iterations = 0,
+    .jacobians = 0,
+    .evaluations = 0,
+    .products = 0,
+    .refinements = 0,
+    .fallbacks = 0
+  };
+  double *fx = ws->f;
+  double *d = ws->krylov + n * (ws->restart + 1) + 2 * n;
+  double f_norm_old = 0;
+  double eta = NEWTON_EW_MAX;
+  double best_norm = INFINITY;
+
+  newton_ret ret = NEWTON_GENERIC_ERROR;
+  while (counters.iterations <= opt->max_iter) {
+    opt->f(fx, t, x, u, p, data);                                                 /* FUNCTION EVALUATION */
+    counters.evaluations++;
+    counters.f_norm = cblas_dnrm2(n, fx, 1);
+
+    /* Function Tollerance condition */
+    if (counters.f_norm < opt->f_tol) {
+      ret = NEWTON_F_TOL;
+      break;
+    }
+    if (!isfinite(counters.f_norm))
+      break;
+    newton_best_keep(opt, ws, x, counters.f_norm, &best_norm);
+    if (newton_expired(opt)) {
+      newton_best_restore(opt, ws, x, &counters.f_norm, best_norm);
+      ret = NEWTON_DEADLINE;
+      break;
+    }
+
+    /* Eisenstat-Walker forcing term (choice 2), with safeguards */
+    if (counters.iterations > 0) {
+      const double eta_old = eta;
+      const double ratio = counters.f_norm / f_norm_old;
+      eta = NEWTON_EW_GAMMA * ratio * ratio;
+      if (NEWTON_EW_GAMMA * eta_old * eta_old > 0.1)
+        eta = fmax(eta, NEWTON_EW_GAMMA * eta_old * eta_old);
+      eta = fmin(NEWTON_EW_MAX, fmax(eta, 0.5 * opt->f_tol / counters.f_norm));
+    }
+    f_norm_old = counters.f_norm;
+
+    newton_gmres(opt, ws, d, eta, t, x, fx, u, p, data, &counters);                /* LINEAR SOLUTION */
+
+    /* Update Step condition */
+    counters.x_norm = cblas_dnrm2(n, d, 1);
+    if (counters.x_norm < opt->x_tol) {
+      ret = NEWTON_X_TOL;
+      break;
+    }
+
+    cblas_daxpy(n, 1, d, 1, x, 1);
+    counters.iterations++;
+  }
+
+  ret = opt->max_iter <= counters.iterations ? NEWTON_MAX_ITER : ret;
+  if (stats)
+    *stats = counters;
+  return ret;
+}
+
+newton_ret newton_solve_r(const newton_options *opt, newton_workspace *ws, newton_stats *stats, const double t, double *x, const double *u, const double **p, void *data) {
+  if (!opt || !ws || !x)
+    return NEWTON_GENERIC_ERROR;
+  if (ws->f_size != opt->f_size || ws->x_size != opt->x_size || ws->ordering != opt->ordering)
+    return NEWTON_GENERIC_ERROR;
+
+  if (opt->method == NEWTON_KRYLOV)
+    return ws->krylov ? newton_solve_krylov(opt, ws, stats, t, x, u, p, data) : NEWTON_GENERIC_ERROR;
+  if ((opt->pattern != NULL) != (ws->lu != NULL) || (!opt->df && !ws->fd_x) ||
+      (opt->globalization != NEWTON_GLOBAL_NONE && !ws->trial))
+    return NEWTON_GENERIC_ERROR;
+
+  if (opt->method != NEWTON_FULL && ws->r)
+    return newton_solve_lu(opt, ws, stats, t, x, u, p, data);
+
+  /* The factorizations overwrite the Jacobian: the factors of newton_workspace_factor() are lost */
+  newton_workspace_invalidate(ws);
+
+  double f_norm = opt->f_tol;
+  double x_norm = opt->x_tol;
+  lapack_int counts = 0;
+  lapack_int jacobians = 0;
+  lapack_int evaluations = 0;
+  lapack_int refinements = 0;
+  lapack_int fallbacks = 0;
+  double best_norm = INFINITY;
+
+  newton_ret ret = NEWTON_GENERIC_ERROR;
+  double *f = ws->f;
+  double radius = NEWTON_TR_FACTOR * fmax(cblas_dnrm2(opt->x_size, x, 1), 1.0);
+
+  newton_bool evaluated = NEWTON_FALSE;
   while (counts <= opt->max_iter) {
-    opt->f(f, t, x, u, p, data);                                                  /* FUNCTION EVALUATION */
-    opt->f_tol = cblas_dnrm2(opt->f_size, f, 1);
+    if (!evaluated) {
+      opt->f(f, t, x, u, p, data);                                                /* FUNCTION EVALUATION */
+      evaluations++;
+    }
+    evaluated = NEWTON_FALSE;
+    f_norm = cblas_dnrm2(opt->f_size, f, 1);
 
     /* Function Tollerance condition */
-    if (opt->f_tol < set_f_tol) {
+    if (f_norm < opt->f_tol) {
       ret = NEWTON_F_TOL;
       break;
     }
-    cblas_dscal(opt->f_size, -1.0, f, 1);
+    newton_best_keep(opt, ws, x, f_norm, &best_norm);
+    if (newton_expired(opt)) {
+      newton_best_restore(opt, ws, x, &f_norm, best_norm);
+      ret = NEWTON_DEADLINE;
+      break;
+    }
   
-    opt->df(df, t, x, u, p, data);                                                /* JACOBIAN EVALUATION */
+    evaluations += newton_jacobian_eval(opt, ws, t, x, f, u, p, data);             /* JACOBIAN EVALUATION */
+    jacobians++;
+
+    /* Dogleg: gradient g = J' f and J g, before the factorization overwrites the Jacobian */
+    if (ws->dogleg) {
+      const lapack_int m = opt->f_size;
+      const lapack_int ld = ws->ordering == LAPACK_ROW_MAJOR ? opt->x_size : m;
+      cblas_dgemv(ws->ordering == LAPACK_ROW_MAJOR ? CblasRowMajor : CblasColMajor, CblasTrans,
+                  m, opt->x_size, 1.0, ws->df, ld, f, 1, 0.0, ws->dogleg, 1);
+      cblas_dgemv(ws->ordering == LAPACK_ROW_MAJOR ? CblasRowMajor : CblasColMajor, CblasNoTrans,
+                  m, opt->x_size, 1.0, ws->df, ld, ws->dogleg, 1, 0.0, ws->dogleg + opt->x_size, 1);
+    }
+    cblas_dscal(opt->f_size, -1.0, f, 1);
     
     lapack_int sol_ret = -1;
-    sol_ret = LAPACKE_dgels(opt->ordering, 'N', opt->f_size, opt->x_size, 1, df, lda, f, ldb);
+    sol_ret = ws->single ? newton_mixed_solve(ws, &refinements, &fallbacks) : newton_linear_solve(ws);
     if (sol_ret != 0) {
       if (sol_ret > 0)
         ret = NEWTON_SINGULAR_JACOBIAN;
@@ -68,20 +1043,46 @@ newton_ret newton_solve(newton_options *opt, const double t, double *x, const do
     }
     
     /* Update Step condition */
-    opt->x_tol = cblas_dnrm2(opt->x_size, f, 1);
-    if (opt->x_tol < set_x_tol) {
+    x_norm = cblas_dnrm2(opt->x_size, f, 1);
+    if (x_norm < opt->x_tol) {
       ret = NEWTON_X_TOL;
       break;
     }
-    
-    cblas_daxpy(opt->x_size, 1, f, 1, x, 1);
+
+    /* Globalization: the vector field in the accepted point is reused */
+    if (ws->dogleg) {
+      /* Squared norm of the least squares residual, in the tail of the DGELS solution */
+      double rn2 = 0;
+      for (lapack_int i = opt->x_size; i < opt->f_size; i++)
+        rn2 += f[i] * f[i];
+      /* Collapsed trust region: the point is not a solution, the iteration failed */
+      if (!newton_dogleg(opt, ws, t, x, f, f_norm, rn2, &radius, u, p, data, &evaluations)) {
+        ret = NEWTON_MAX_ITER;
+        break;
+      }
+    } else if (opt->globalization != NEWTON_GLOBAL_NONE) {
+      newton_line_search(opt, ws, t, x, f, f_norm, u, p, data, &evaluations);
+    } else {
+      cblas_daxpy(opt->x_size, 1, f, 1, x, 1);
+    }
+    if (opt->globalization != NEWTON_GLOBAL_NONE) {
+      cblas_dcopy(opt->f_size, ws->trial + opt->x_size, 1, f, 1);
+      evaluated = NEWTON_TRUE;
+    }
     counts++;
   }
   
   ret = opt->max_iter <= counts ? NEWTON_MAX_ITER : ret;
-  opt->max_iter = counts;  
+  if (stats) {
+    stats->f_norm = f_norm;
+    stats->x_norm = x_norm;
+    stats->iterations = counts;
+    stats->jacobians = jacobians;
+    stats->evaluations = evaluations;
+    stats->products = 0;
+    stats->refinements = refinements;
+    stats->fallbacks = fallbacks;
+  }
 
-  free(f);
-  free(df);
   return ret;
 }
@@ -25,6 +25,11 @@
 
 #include <lapacke.h>
 #include <cblas.h>
+#include "libsparse.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /**
  * @brief Jacobian Callback for the Newton algorithm
@@ -68,12 +73,140 @@ typedef void (*newton_function)(
     const double **p,
     void *data);
 
+/**
+ * @brief Batched vector field callback for the Newton algorithm
+ *
+ * Evaluates the vector field in count points with a single call, for evaluators whose cost is
+ * dominated by the per call overhead (table lookups, surrogate models). The points are stored
+ * with a stride: the point k is at x + k * ld and its vector field must be stored at f + k * ld.
+ * All the points share the time, the control and the parameters.
+ * @param f output vectors (f_size elements each)
+ * @param t current time for evaluation
+ * @param x points for evaluation (x_size elements each)
+ * @param u current control for evaluation
+ * @param p array of parameter vectors
+ * @param count number of points
+ * @param ld stride between the points, and between the outputs (at least the max of x_size and f_size)
+ * @param data user space input (simply use it as a pointer casted to void)
+ */
+typedef void (*newton_function_batch)(
+    double *f,
+    const double t,
+    const double *x,
+    const double *u,
+    const double **p,
+    const lapack_int count,
+    const lapack_int ld,
+    void *data);
+
+/**
+ * @brief Jacobian-vector product callback for the Newton-Krylov algorithm
+ *
+ * The callback stores in jv the product \f$\nabla F(x) v\f$ of the Jacobian in the current
+ * point with the vector v, without forming the Jacobian.
+ * @param jv output vector (f_size elements)
+ * @param v input vector (x_size elements)
+ * @param t current time for evaluation
+ * @param x current point for evaluation
+ * @param u current control for evaluation
+ * @param p array of parameter vectors
+ * @param data user space input (simply use it as a pointer casted to void)
+ */
+typedef void (*newton_jacobian_vector)(
+    double *jv,
+    const double *v,
+    const double t,
+    const double *x,
+    const double *u,
+    const double **p,
+    void *data);
+
+/**
+ * @brief Preconditioner callback for the Newton-Krylov algorithm
+ *
+ * The callback stores in z the solution of \f$M z = r\f$, where \f$M\f$ is an approximation
+ * of the Jacobian \f$\nabla F(x)\f$ in the current point that is cheap to invert (e.g. its
+ * diagonal or an incomplete factorization). It is applied as a right preconditioner.
+ * @param z output vector (x_size elements)
+ * @param r input vector (f_size elements)
+ * @param t current time for evaluation
+ * @param x current point for evaluation
+ * @param u current control for evaluation
+ * @param p array of parameter vectors
+ * @param data user space input (simply use it as a pointer casted to void)
+ */
+typedef void (*newton_preconditioner)(
+    double *z,
+    const double *r,
+    const double t,
+    const double *x,
+    const double *u,
+    const double **p,
+    void *data);
+
+/**
+ * @brief Boolean implementation
+ */
+typedef enum newton_bool {
+  NEWTON_FALSE = 0, /**< False */
+  NEWTON_TRUE       /**< True */
+} newton_bool;
+
+/**
+ * @brief Variant of the Newton algorithm
+ *
+ * The modified and Broyden variants are available only for square systems (for non square
+ * systems the full Newton is always used). They factorize the Jacobian with LU and keep the
+ * factors in the workspace, reusing them in the following iterations and in the following calls
+ * (e.g. the following integration steps) while the contraction rate of the steps
+ * \f$\theta = |\Delta x_{k}| / |\Delta x_{k-1}|\f$ stays below the contraction option.
+ * When the contraction degrades, the Jacobian is evaluated again in the current point.
+ *
+ * The Newton-Krylov variant (square systems only) never forms the Jacobian: the steps are
+ * computed by restarted GMRES, with the Jacobian-vector products given by the callback or by
+ * directional differences of the vector field, and the relative tolerance of each linear solution
+ * is selected by the Eisenstat-Walker forcing term
+ * \f$\eta_k = \gamma (|F(x_k)| / |F(x_{k-1})|)^2\f$ (with the usual safeguards).
+ */
+typedef enum newton_method {
+  NEWTON_FULL = 0,   /**< (0) Jacobian evaluation and DGELS solution at each iteration */
+  NEWTON_MODIFIED,   /**< (1) LU factors of the Jacobian reused while the contraction is acceptable */
+  NEWTON_BROYDEN,    /**< (2) As modified, with Broyden rank-one updates of the inverse Jacobian */
+  NEWTON_KRYLOV      /**< (3) Jacobian-free Newton-Krylov (restarted GMRES, inexact steps) */
+} newton_method;
+
+/**
+ * @brief Globalization strategy of the Newton step
+ */
+typedef enum newton_globalization {
+  NEWTON_GLOBAL_NONE = 0, /**< (0) Full Newton step */
+  NEWTON_LINE_SEARCH,     /**< (1) Armijo backtracking on \f$\|f\|^2\f$ along the Newton step */
+  NEWTON_DOGLEG           /**< (2) Trust region with the Powell dogleg between the steepest descent and the
+                               Newton step (NEWTON_FULL with a dense Jacobian, otherwise the line search).
+                               If the radius collapses without an accepted step, the solver stops
+                               with NEWTON_MAX_ITER */
+} newton_globalization;
+
+#define NEWTON_CONTRACTION 0.5    /**< Default maximum contraction rate for reused Jacobians */
+#define NEWTON_BROYDEN_MAX 16     /**< Maximum number of Broyden updates before a new Jacobian */
+#define NEWTON_KRYLOV_RESTART 30  /**< Default dimension of the Krylov subspace before a GMRES restart */
+#define NEWTON_KRYLOV_CYCLES 10   /**< Maximum number of GMRES restarts for a Newton step */
+#define NEWTON_EW_GAMMA 0.9       /**< Eisenstat-Walker forcing term coefficient */
+#define NEWTON_EW_MAX 0.9         /**< Maximum (and initial) forcing term */
+#define NEWTON_ARMIJO 1e-4        /**< Sufficient decrease coefficient of the line search */
+#define NEWTON_LS_MAX 20          /**< Maximum number of backtracking steps of the line search */
+#define NEWTON_TR_FACTOR 100.0    /**< Initial trust radius, relative to \f$\max(\|x_0\|, 1)\f$ */
+#define NEWTON_TR_MAX 30          /**< Maximum number of rejected dogleg steps in an iteration */
+#define NEWTON_BATCH_MAX 256      /**< Maximum number of points in a call of the batched vector field */
+#define NEWTON_REFINE_MAX 10      /**< Maximum number of single precision solutions of the iterative refinement */
+
 /**
  * @brief Options for the Newton Algorithm
  * 
  * This structure contains all the options for the Newton algorithm, alongside the callbacks.
  * The structure will be modified by the algorithm with some debug information, such as number
- * of iterations, tolerances and ordering for the jacobian matrix.
+ * of iterations, tolerances and ordering for the jacobian matrix. The reentrant newton_solve_r()
+ * does not modify it, and stores the same information in a newton_stats structure.
  */
 typedef struct newton_options {
   lapack_int ordering; /**< Should be LAPACK_ROW_MAJOR or LAPACK_COL_MAJOR */
@@ -87,7 +220,30 @@ typedef struct newton_options {
   lapack_int max_iter; /**< Maximum number of iteration,
                               At the end will contain the number of step executed  */
   newton_function f;   /**< Pointer to vector field callback */
-  newton_jacobian df;  /**<  Pointer to Jacobian callback */
+  newton_jacobian df;  /**<  Pointer to Jacobian callback. If NULL, the Jacobian is computed by finite
+                              differences (with column groups, if the pattern is given) */
+  newton_method method; /**< Variant of the algorithm. Zero initialization selects NEWTON_FULL */
+  double contraction;  /**< Maximum contraction rate for reused Jacobians. If 0, uses NEWTON_CONTRACTION */
+  const sparse_pattern *pattern; /**< Sparsity pattern of the Jacobian (square systems only). If not NULL,
+                                      the Jacobian callback stores only the nonzeros, in the order of the
+                                      pattern (CSR for row major, CSC for column major ordering), and the
+                                      linear systems are solved with a sparse LU. The sparse LU pivots on
+                                      the diagonal, that must be in the pattern */
+  newton_jacobian_vector jv; /**< Jacobian-vector product for the Krylov method. If NULL, uses directional
+                                  differences of the vector field */
+  newton_preconditioner prec; /**< Right preconditioner for the Krylov method. It can be NULL */
+  lapack_int restart;  /**< GMRES restart for the Krylov method. If 0, uses NEWTON_KRYLOV_RESTART */
+  double deadline;     /**< Time (see newton_clock()) after which the iterations stop with NEWTON_DEADLINE,
+                              leaving in x the iterate with the smallest residual norm. If 0, there is no deadline */
+  newton_globalization globalization; /**< Globalization of the step. Zero initialization selects the
+                                           full Newton step (not used by NEWTON_KRYLOV) */
+  newton_function_batch f_batch; /**< Batched vector field. If not NULL, the finite difference Jacobian
+                                      evaluates its perturbed points (columns or column groups) with a
+                                      call for each NEWTON_BATCH_MAX points. It can be NULL */
+  newton_bool mixed;   /**< Mixed precision linear solutions for NEWTON_FULL on dense square systems: the
+                              Jacobian is factorized in single precision (sgetrf) and the double precision
+                              solution is recovered by iterative refinement, with a double precision
+                              factorization if the refinement stalls. Ignored by the other methods */
 } newton_options;
 
 /**
@@ -100,16 +256,71 @@ typedef enum newton_ret {
   NEWTON_SINGULAR_JACOBIAN, /**< (3 LAPACKE) The jacobian is singular */
   NEWTON_ILLEGAL_JACOBIAN,  /**< (4 LAPACKE) Illegal jacobian */
   NEWTON_MALLOC_ERROR,      /**< (5) Cannot allocate memory */
-  NEWTON_GENERIC_ERROR      /**< (6) Generic error in the execution of the algorithm */
+  NEWTON_GENERIC_ERROR,     /**< (6) Generic error in the execution of the algorithm */
+  NEWTON_DEADLINE           /**< (7) The deadline expired before the convergence */
 } newton_ret;
 
 /**
- * @brief Boolean implementation
+ * @brief Results of the Newton algorithm
+ *
+ * Contains the information that newton_solve() writes back in the option structure. It is
+ * filled by newton_solve_r(), that leaves the options untouched.
  */
-typedef enum newton_bool {
-  NEWTON_FALSE = 0, /**< False */
-  NEWTON_TRUE       /**< True */
-} newton_bool;
+typedef struct newton_stats {
+  double f_norm;         /**< 2 norm of the vector field in the solution */
+  double x_norm;         /**< 2 norm of the last update step */
+  lapack_int iterations; /**< Number of executed iterations */
+  lapack_int jacobians;  /**< Number of Jacobian evaluations */
+  lapack_int evaluations; /**< Number of vector field evaluations (including finite differences) */
+  lapack_int products;   /**< Number of Jacobian-vector products (Krylov method) */
+  lapack_int refinements; /**< Number of single precision solutions of the iterative refinement (mixed precision) */
+  lapack_int fallbacks;  /**< Number of double precision factorizations after a stalled refinement (mixed precision) */
+} newton_stats;
+
+/**
+ * @brief Persistent working memory for the Newton algorithm
+ *
+ * The workspace owns all the scratch buffers used by the Newton iterations (vector field,
+ * Jacobian and the DGELS working array) and, for the LU based methods, the factors that are
+ * reused among the calls. It is created once for a given newton_options
+ * structure (the sizes and the ordering must not change afterwards) and then passed to
+ * newton_solve_ws(), that does not allocate any memory.
+ */
+typedef struct newton_workspace {
+  lapack_int ordering; /**< Ordering of the Jacobian matrix. Taken from options struct */
+  lapack_int f_size;   /**< Vector field size. Taken from options struct */
+  lapack_int x_size;   /**< Variable vector size. Taken from options struct */
+  lapack_int ldb;      /**< Leading dimension of the right hand side (max of the two sizes) */
+  double *f;           /**< Vector field and update step. ldb elements */
+  double *best;        /**< Iterate with the smallest residual norm under a deadline. x_size elements */
+  double *df;          /**< Jacobian matrix. f_size * x_size elements (the nonzeros for sparse Jacobians) */
+  double *work;        /**< Working space for DGELS */
+  lapack_int lwork;    /**< Dimension of the DGELS working space */
+  lapack_int *ipiv;    /**< Pivoting of the LU factors stored in df (or in single). NULL for the full method
+                            in double precision */
+  double *r;           /**< Residual for the LU based methods. x_size elements */
+  double *r_old;       /**< Residual of the previous iteration for the Broyden update. x_size elements */
+  double *broyden;     /**< Broyden updates. 2 * x_size * NEWTON_BROYDEN_MAX elements */
+  lapack_int updates;  /**< Number of Broyden updates currently applied to the LU factors */
+  newton_bool lu_valid; /**< The LU factors in df can be reused */
+  sparse_lu *lu;       /**< Sparse LU factors, with the symbolic analysis of the pattern. NULL for dense Jacobians */
+  sparse_coloring *coloring; /**< Column groups of the pattern for the finite difference Jacobian */
+  double *fd_x;        /**< Perturbed points for the finite difference Jacobian. x_size elements
+                            (fd_batch * ldb with the batched callback), NULL if the Jacobian callback is given */
+  double *fd_f;        /**< Vector field in the perturbed points. f_size elements (fd_batch * ldb) */
+  lapack_int fd_batch; /**< Maximum number of perturbed points (columns, or column groups) of a batched
+                            call, up to NEWTON_BATCH_MAX. 0 without the batched callback */
+  float *single;       /**< Single precision LU factors and right hand side for the mixed precision solutions.
+                            x_size * (x_size + 1) elements, NULL if not used */
+  double *refine;      /**< Right hand side and residual of the iterative refinement. 2 * x_size elements */
+  lapack_int restart;  /**< GMRES restart for the Krylov method. Taken from options struct */
+  double *krylov;      /**< GMRES basis, Hessenberg matrix and rotations for the Krylov method.
+                            (x_size + restart + 3) * (restart + 1) + 3 * x_size elements, NULL for the other methods */
+  double *trial;       /**< Trial point and its vector field for the globalization. x_size + f_size
+                            elements, NULL without globalization */
+  double *dogleg;      /**< Gradient \f$\nabla f^T f\f$ and \f$\nabla f \nabla f^T f\f$ for the dogleg.
+                            x_size + f_size elements, NULL for the other strategies */
+} newton_workspace;
 
 /**
  * @brief Executes the Newton algorithm for root finding
@@ -123,7 +334,15 @@ typedef enum newton_bool {
  *  * Number of iterations bigger than maximum allowed (specified in newton_options)
  *  * \f$ |x_{k+1} - x_k| \leq x_{tol}\f$
  *  * \f$ |f(x_k, u, p)| \leq y_{tol}\f$
- * and the function and jacobian are evaluated through callbacks. On exit, the values 
+ * and the function and jacobian are evaluated through callbacks (if the Jacobian callback is
+ * NULL, the Jacobian is computed by forward finite differences, reusing the vector field
+ * already evaluated in \f$x_k\f$: each column is perturbed by
+ * \f$\delta_j = \sqrt{\epsilon} \max(|x_j|, 1)\f$, with the sign of \f$x_j\f$, and with a sparsity
+ * pattern the structurally orthogonal columns are perturbed together). With a globalization
+ * strategy, the step is scaled by an Armijo backtracking on \f$\|F\|^2\f$, or replaced by the
+ * dogleg step in a trust region (with the gradient \f$\nabla F^T F\f$ computed before the DGELS
+ * factorization, whose residual gives the predicted reduction); in both cases the vector field
+ * of the accepted point is reused by the next iteration. On exit, the values 
  * inside the option structure are update for debuggin purposes (this is why Newton 
  * options is not a const pointer). It returns a status enum.
  * @param opt option structure
@@ -141,4 +360,130 @@ newton_ret newton_solve(
     const double **p,
     void *data);
 
+/**
+ * @brief Allocates the working memory for the Newton algorithm
+ *
+ * Allocates all the buffers required by newton_solve_ws() and queries LAPACK for the
+ * optimal dimension of the DGELS working space. For sparse Jacobians, computes instead the
+ * symbolic analysis of the pattern, that is reused by all the factorizations. The workspace can
+ * be reused for any number of calls with options that have the same sizes, ordering and pattern.
+ * @param opt option structure (only sizes, ordering, method and pattern are used)
+ * @return the allocated workspace, or NULL if memory cannot be allocated or the pattern does not
+ *         contain the whole diagonal
+ */
+newton_workspace *newton_workspace_alloc(const newton_options *opt);
+
+/**
+ * @brief Monotonic clock for the deadlines
+ *
+ * Reads CLOCK_MONOTONIC, that on Linux does not enter the kernel (vDSO).
+ * @return time in seconds, from an arbitrary origin
+ */
+double newton_clock(void);
+
+/**
+ * @brief Discards the Jacobian factorization stored in the workspace
+ *
+ * For the modified and Broyden methods, forces a new Jacobian evaluation in the next call. It
+ * must be called when the problem changes in a way that the reused factors cannot detect
+ * (e.g. the integration step of the implicit Euler step).
+ * @param ws workspace. It can be NULL.
+ */
+void newton_workspace_invalidate(newton_workspace *ws);
+
+/**
+ * @brief Evaluates the Jacobian in x and stores its LU factors in the workspace
+ *
+ * The Jacobian is computed as in the solver (with the callback or by finite differences, dense
+ * or sparse) and factorized with LU, to be applied by newton_workspace_solve(). For the modified
+ * and Broyden methods the factors replace the reused ones; the full method discards them in the
+ * next solution. Square systems only, not available for the Krylov method.
+ * @param opt options of the workspace
+ * @param ws workspace allocated with newton_workspace_alloc() for the same options
+ * @param t time
+ * @param x point of the Jacobian. x_size elements
+ * @param u input vector
+ * @param p parameters vector
+ * @param data user data
+ * @return NEWTON_F_TOL on success, NEWTON_SINGULAR_JACOBIAN if the factorization fails,
+ *         NEWTON_GENERIC_ERROR if the workspace has no LU factors
+ */
+newton_ret newton_workspace_factor(
+    const newton_options *opt,
+    newton_workspace *ws,
+    const double t,
+    const double *x,
+    const double *u,
+    const double **p,
+    void *data);
+
+/**
+ * @brief Solves a linear system with the Jacobian factorization stored in the workspace
+ *
+ * Applies in place the inverse of the last Jacobian factorized by the modified or Broyden
+ * methods (including the Broyden updates) or by newton_workspace_factor() to v.
+ * @param ws workspace
+ * @param v right hand side on input, solution on output. x_size elements
+ * @return NEWTON_F_TOL on success, NEWTON_GENERIC_ERROR if there are no valid factors
+ */
+newton_ret newton_workspace_solve(newton_workspace *ws, double *v);
+
+/**
+ * @brief Releases the working memory of the Newton algorithm
+ * @param ws workspace to release. It can be NULL.
+ */
+void newton_workspace_free(newton_workspace *ws);
+
+/**
+ * @brief Executes the Newton algorithm for root finding, with a persistent workspace
+ *
+ * Same algorithm of newton_solve(), but all the scratch memory is taken from the
+ * workspace, thus the function does not allocate. It is intended to be called
+ * several times (e.g. once for each implicit integration step).
+ * @param opt option structure
+ * @param ws workspace allocated with newton_workspace_alloc() for the same options
+ * @param x root position and initial condition. Will be modified
+ * @param u control action input. It can be NULL.
+ * @param p parameter array of vectors. It can be NULL.
+ * @param data space for user data. Will be passed to callbacks. It can be NULL
+ * @return a status exit code as described in newton_ret enum.
+ */
+newton_ret newton_solve_ws(
+    newton_options *opt,
+    newton_workspace *ws,
+    const double t,
+    double *x,
+    const double *u,
+    const double **p,
+    void *data);
+
+/**
+ * @brief Executes the Newton algorithm for root finding (reentrant version)
+ *
+ * Same algorithm of newton_solve_ws(), but the options are not modified: the results are
+ * stored in the stats structure. A single option structure can thus be shared by several
+ * threads, each one with its own workspace.
+ * @param opt option structure
+ * @param ws workspace allocated with newton_workspace_alloc() for the same options
+ * @param stats results of the algorithm. It can be NULL.
+ * @param x root position and initial condition. Will be modified
+ * @param u control action input. It can be NULL.
+ * @param p parameter array of vectors. It can be NULL.
+ * @param data space for user data. Will be passed to callbacks. It can be NULL
+ * @return a status exit code as described in newton_ret enum.
+ */
+newton_ret newton_solve_r(
+    const newton_options *opt,
+    newton_workspace *ws,
+    newton_stats *stats,
+    const double t,
+    double *x,
+    const double *u,
+    const double **p,
+    void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,436 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <math.h>
+#include "libpool.h"
+
+#define POOL_CACHE_LINE 64 /**< Size of a cache line, to avoid false sharing among the ranges */
+
+/**
+ * @brief Internal: range of task indices owned by a worker
+ */
+typedef struct pool_range {
+  pthread_mutex_t lock;               /**< Protects head and tail */
+  lapack_int head;                    /**< Next index to execute (owner side) */
+  lapack_int tail;                    /**< One past the last index (thieves side) */
+  char pad[POOL_CACHE_LINE];          /**< Padding to keep ranges on different cache lines */
+} pool_range;
+
+/**
+ * @brief Internal: argument of a worker thread
+ */
+typedef struct pool_worker_arg {
+  pool *pl;          /**< Owner pool */
+  lapack_int worker; /**< Index of the worker */
+} pool_worker_arg;
+
+struct pool {
+  lapack_int threads;        /**< Number of workers, including the calling thread */
+  pthread_t *handles;        /**< Handles of the threads (threads - 1) */
+  pool_worker_arg *args;     /**< Arguments of the threads (threads - 1) */
+  pool_range *ranges;        /**< Ranges of the workers (threads) */
+  pthread_mutex_t lock;      /**< Protects the fields below */
+  pthread_cond_t start;      /**< Signals a new run (or the exit) to the threads */
+  pthread_cond_t done;       /**< Signals the end of the run to the calling thread */
+  unsigned long generation;  /**< Counter of the runs */
+  lapack_int running;        /**< Threads still working in the current run */
+  newton_bool quit;          /**< Threads must exit */
+  pool_function fn;          /**< Task of the current run */
+  void *data;                /**< User data of the current run */
+};
+
+/**
+ * @brief Internal: gets the next task for a worker, stealing from the others if needed
+ */
+static newton_bool pool_next(pool *pl, const lapack_int worker, lapack_int *index)
+{
+  pool_range *own = pl->ranges + worker;
+  pthread_mutex_lock(&own->lock);
+  if (own->head < own->tail) {
+    *index = own->head++;
+    pthread_mutex_unlock(&own->lock);
+    return NEWTON_TRUE;
+  }
+  pthread_mutex_unlock(&own->lock);
+
+  /* Work stealing: takes the second half of the first non-empty range */
+  for (lapack_int s = 1; s < pl->threads; s++) {
+    pool_range *victim = pl->ranges + (worker + s) % pl->threads;
+    pthread_mutex_lock(&victim->lock);
+    lapack_int left = victim->tail - victim->head;
+    if (left <= 0) {
+      pthread_mutex_unlock(&victim->lock);
+      continue;
+    }
+    lapack_int take = (left + 1) / 2;
+    lapack_int begin = victim->tail - take;
+    victim->tail = begin;
+    pthread_mutex_unlock(&victim->lock);
+
+    pthread_mutex_lock(&own->lock);
+    own->head = begin + 1;
+    own->tail = begin + take;
+    pthread_mutex_unlock(&own->lock);
+    *index = begin;
+    return NEWTON_TRUE;
+  }
+  return NEWTON_FALSE;
+}
+
+/**
+ * @brief Internal: executes tasks until there is nothing left to steal
+ */
+static void pool_work(pool *pl, const lapack_int worker)
+{
+  lapack_int index;
+  while (pool_next(pl, worker, &index))
+    pl->fn(index, worker, pl->data);
+}
+
+/**
+ * @brief Internal: main loop of a worker thread
+ */
+static void *pool_thread(void *arg)
+{
+  pool *pl = ((pool_worker_arg *)arg)->pl;
+  const lapack_int worker = ((pool_worker_arg *)arg)->worker;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&pl->lock);
+  for (;;) {
+    while (!pl->quit && pl->generation == seen)
+      pthread_cond_wait(&pl->start, &pl->lock);
+    if (pl->quit)
+      break;
+    seen = pl->generation;
+    pthread_mutex_unlock(&pl->lock);
+
+    pool_work(pl, worker);
+
+    pthread_mutex_lock(&pl->lock);
+    if (--pl->running == 0)
+      pthread_cond_signal(&pl->done);
+  }
+  pthread_mutex_unlock(&pl->lock);
+  return NULL;
+}
+
+pool *pool_create(const lapack_int threads)
+{
+  pool *pl = (pool *)calloc(1, sizeof(pool));
+  if (!pl)
+    return NULL;
+
+  pl->threads = threads > 0 ? threads : (lapack_int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (pl->threads < 1)
+    pl->threads = 1;
+
+  pl->ranges = (pool_range *)calloc(pl->threads, sizeof(pool_range));
+  pl->handles = (pthread_t *)calloc(pl->threads, sizeof(pthread_t));
+  pl->args = (pool_worker_arg *)calloc(pl->threads, sizeof(pool_worker_arg));
+  if (!pl->ranges || !pl->handles || !pl->args) {
+    free(pl->ranges);
+    free(pl->handles);
+    free(pl->args);
+    free(pl);
+    return NULL;
+  }
+  for (lapack_int w = 0; w < pl->threads; w++)
+    pthread_mutex_init(&pl->ranges[w].lock, NULL);
+  pthread_mutex_init(&pl->lock, NULL);
+  pthread_cond_init(&pl->start, NULL);
+  pthread_cond_init(&pl->done, NULL);
+
+  /* The calling thread is worker 0 */
+  for (lapack_int w = 1; w < pl->threads; w++) {
+    pl->args[w].pl = pl;
+    pl->args[w].worker = w;
+    if (pthread_create(pl->handles + w, NULL, pool_thread, pl->args + w) != 0) {
+      pl->threads = w;
+      pool_destroy(pl);
+      return NULL;
+    }
+  }
+  return pl;
+}
+
+void pool_destroy(pool *pl)
+{
+  if (!pl)
+    return;
+
+  pthread_mutex_lock(&pl->lock);
+  pl->quit = NEWTON_TRUE;
+  pthread_cond_broadcast(&pl->start);
+  pthread_mutex_unlock(&pl->lock);
+  for (lapack_int w = 1; w < pl->threads; w++)
+    pthread_join(pl->handles[w], NULL);
+
+  for (lapack_int w = 0; w < pl->threads; w++)
+    pthread_mutex_destroy(&pl->ranges[w].lock);
+  pthread_mutex_destroy(&pl->lock);
+  pthread_cond_destroy(&pl->start);
+  pthread_cond_destroy(&pl->done);
+  free(pl->ranges);
+  free(pl->handles);
+  free(pl->args);
+  free(pl);
+}
+
+lapack_int pool_threads(const pool *pl)
+{
+  return pl ? pl->threads : 0;
+}
+
+void pool_run(pool *pl, const lapack_int count, pool_function fn, void *data)
+{
+  if (!pl || !fn || count <= 0)
+    return;
+
+  /* Static initial partition, balanced at runtime by stealing */
+  pthread_mutex_lock(&pl->lock);
+  for (lapack_int w = 0; w < pl->threads; w++) {
+    pl->ranges[w].head = (lapack_int)(((long)count * w) / pl->threads);
+    pl->ranges[w].tail = (lapack_int)(((long)count * (w + 1)) / pl->threads);
+  }
+  pl->fn = fn;
+  pl->data = data;
+  pl->running = pl->threads - 1;
+  pl->generation++;
+  pthread_cond_broadcast(&pl->start);
+  pthread_mutex_unlock(&pl->lock);
+
+  pool_work(pl, 0);
+
+  pthread_mutex_lock(&pl->lock);
+  while (pl->running > 0)
+    pthread_cond_wait(&pl->done, &pl->lock);
+  pthread_mutex_unlock(&pl->lock);
+}
+
+/**
+ * @brief Internal: context of an integration run
+ */
+typedef struct pool_euler_context {
+  const euler_options *opt;  /**< Shared options */
+  pool_euler_task task;      /**< Integration task */
+  euler_workspace **ws;      /**< Workspace of each worker */
+  euler_ret *results;        /**< Result of each trajectory */
+  void *data;                /**< User data */
+} pool_euler_context;
+
+/**
+ * @brief Internal: executes an integration task with the workspace of the worker
+ */
+static void pool_euler_function(const lapack_int index, const lapack_int worker, void *data)
+{
+  pool_euler_context *ctx = (pool_euler_context *)data;
+  ctx->results[index] = ctx->task(ctx->opt, ctx->ws[worker], index, ctx->data);
+}
+
+/**
+ * @brief Internal: allocates a workspace for each worker of the pool. NULL if memory cannot be allocated
+ */
+static euler_workspace **pool_workspaces_alloc(const pool *pl, const euler_options *opt)
+{
+  euler_workspace **ws = (euler_workspace **)calloc(pl->threads, sizeof(euler_workspace *));
+  if (!ws)
+    return NULL;
+  for (lapack_int w = 0; w < pl->threads; w++) {
+    ws[w] = euler_workspace_alloc(opt);
+    if (!ws[w]) {
+      for (lapack_int v = 0; v < w; v++)
+        euler_workspace_free(ws[v]);
+      free(ws);
+      return NULL;
+    }
+  }
+  return ws;
+}
+
+/**
+ * @brief Internal: releases the workspaces of the workers
+ */
+static void pool_workspaces_free(const pool *pl, euler_workspace **ws)
+{
+  if (!ws)
+    return;
+  for (lapack_int w = 0; w < pl->threads; w++)
+    euler_workspace_free(ws[w]);
+  free(ws);
+}
+
+/**
+ * @brief Internal: executes the integration tasks with the given workspaces of the workers
+ *
+ * The results must hold count elements. Returns the first error code, in order of index.
+ */
+static euler_ret pool_euler_execute(pool *pl, const euler_options *opt, euler_workspace **ws, const lapack_int count, pool_euler_task task, euler_ret *results, void *data)
+{
+  pool_euler_context ctx = { opt, task, ws, results, data };
+  pool_run(pl, count, pool_euler_function, &ctx);
+  for (lapack_int i = 0; i < count; i++)
+    if (results[i] != EULER_SUCCESS)
+      return results[i];
+  return EULER_SUCCESS;
+}
+
+euler_ret pool_euler_run(pool *pl, const euler_options *opt, const lapack_int count, pool_euler_task task, euler_ret *results, void *data)
+{
+  if (!pl || !opt || !task)
+    return EULER_NULLPTR;
+  if (count <= 0)
+    return EULER_SUCCESS;
+
+  euler_ret *own_results = NULL;
+  if (!results) {
+    results = own_results = (euler_ret *)calloc(count, sizeof(euler_ret));
+    if (!results)
+      return EULER_EMALLOC;
+  }
+  euler_workspace **ws = pool_workspaces_alloc(pl, opt);
+  euler_ret ret = ws ? pool_euler_execute(pl, opt, ws, count, task, results, data) : EULER_EMALLOC;
+
+  pool_workspaces_free(pl, ws);
+  free(own_results);
+  return ret;
+}
+
+/**
+ * @brief Internal: shared data of the fine propagations of a Parareal iteration
+ */
+typedef struct pool_parareal_context {
+  const euler_integrate_options *iopt; /**< Trajectory options of the fine propagator (without sink) */
+  const double *times;                 /**< Times of the slice boundaries */
+  const double *xs;                    /**< States at the slice boundaries */
+  double *fine;                        /**< Fine propagation of each slice, at its end */
+  lapack_int first;                    /**< First slice to propagate */
+  const double **p;                    /**< Parameters */
+} pool_parareal_context;
+
+/**
+ * @brief Internal: fine propagation of a slice
+ */
+static euler_ret pool_parareal_fine(const euler_options *opt, euler_workspace *ws, const lapack_int index, void *data)
+{
+  pool_parareal_context *ctx = (pool_parareal_context *)data;
+  const lapack_int s = ctx->first + index;
+  const lapack_int n = opt->x_size;
+  return euler_integrate(opt, ctx->iopt, ws, ctx->times[s], ctx->times[s + 1], ctx->xs + s * n, ctx->fine + (s + 1) * n, ctx->p);
+}
+
+euler_ret pool_parareal(pool *pl, const euler_options *opt, const euler_integrate_options *iopt, const pool_parareal_options *popt, const double t0, const double t1, const double *x0, double *xs, const double **p, pool_parareal_stats *stats)
+{
+  if (!pl || !opt || !iopt || !popt || !x0 || !xs)
+    return EULER_NULLPTR;
+  if (t1 <= t0)
+    return EULER_GENERIC;
+
+  const lapack_int n = opt->x_size;
+  const lapack_int slices = popt->slices > 0 ? popt->slices : pl->threads;
+  const lapack_int max_iter = popt->max_iter > 0 ? popt->max_iter : slices;
+  const lapack_int coarse_steps = popt->coarse_steps > 0 ? popt->coarse_steps : 1;
+
+  /* Fine propagator: the trajectory options without the output */
+  euler_integrate_options fine_iopt = *iopt;
+  fine_iopt.sink = NULL;
+
+  /* Coarse propagator: explicit Euler with a fixed step */
+  euler_options coarse_opt = *opt;
+  coarse_opt.alpha = 0;
+  coarse_opt.ts = (t1 - t0) / slices / coarse_steps;
+  coarse_opt.dense = NEWTON_FALSE;
+  euler_integrate_options coarse_iopt = fine_iopt;
+  coarse_iopt.rtol = 0;
+  coarse_iopt.atol = 0;
+  coarse_iopt.output_dt = 0;
+
+  double *times = (double *)calloc(slices + 1, sizeof(double));
+  double *fine = (double *)calloc((slices + 1) * n, sizeof(double));
+  double *coarse = (double *)calloc((slices + 1) * n, sizeof(double));
+  double *g = (double *)calloc(n, sizeof(double));
+  euler_ret *results = (euler_ret *)calloc(slices, sizeof(euler_ret));
+  euler_workspace *ws = euler_workspace_alloc(&coarse_opt);
+  /* Workspaces of the fine propagators, once for all the iterations */
+  euler_workspace **fine_ws = pool_workspaces_alloc(pl, opt);
+  euler_ret ret = (times && fine && coarse && g && results && ws && fine_ws) ? EULER_SUCCESS : EULER_EMALLOC;
+
+  pool_parareal_stats st = { 0, 0, 0 };
+  if (ret == EULER_SUCCESS) {
+    for (lapack_int s = 0; s < slices; s++)
+      times[s] = t0 + (t1 - t0) * s / slices;
+    times[slices] = t1;
+
+    /* Initial coarse sweep */
+    for (lapack_int i = 0; i < n; i++)
+      xs[i] = x0[i];
+    for (lapack_int s = 0; s < slices && ret == EULER_SUCCESS; s++) {
+      ret = euler_integrate(&coarse_opt, &coarse_iopt, ws, times[s], times[s + 1], xs + s * n, coarse + (s + 1) * n, p);
+      for (lapack_int i = 0; i < n; i++)
+        xs[(s + 1) * n + i] = coarse[(s + 1) * n + i];
+    }
+  }
+
+  for (lapack_int k = 0; k < max_iter && k < slices && ret == EULER_SUCCESS; k++) {
+    /* Fine propagations in parallel, from the slices that are not exact yet */
+    pool_parareal_context ctx = { &fine_iopt, times, xs, fine, k, p };
+    ret = pool_euler_execute(pl, opt, fine_ws, slices - k, pool_parareal_fine, results, &ctx);
+    if (ret != EULER_SUCCESS)
+      break;
+    st.fine_slices += slices - k;
+
+    /* Sequential correction: x(s+1) = G(x(s)) + F(x_old(s)) - G(x_old(s)) */
+    st.correction = 0;
+    for (lapack_int s = k; s < slices && ret == EULER_SUCCESS; s++) {
+      ret = euler_integrate(&coarse_opt, &coarse_iopt, ws, times[s], times[s + 1], xs + s * n, g, p);
+      double *x = xs + (s + 1) * n;
+      double *gs = coarse + (s + 1) * n;
+      const double *fs = fine + (s + 1) * n;
+      double dx = 0, x_norm = 1.0;
+      for (lapack_int i = 0; i < n; i++) {
+        const double next = g[i] + fs[i] - gs[i];
+        dx = fmax(dx, fabs(next - x[i]));
+        x_norm = fmax(x_norm, fabs(next));
+        x[i] = next;
+        gs[i] = g[i];
+      }
+      st.correction = fmax(st.correction, dx / x_norm);
+    }
+    st.iterations = k + 1;
+    if (st.correction <= popt->tol)
+      break;
+  }
+
+  if (stats)
+    *stats = st;
+  euler_workspace_free(ws);
+  pool_workspaces_free(pl, fine_ws);
+  free(times);
+  free(fine);
+  free(coarse);
+  free(g);
+  free(results);
+  return ret;
+}
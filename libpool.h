@@ -0,0 +1,190 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef LIBPOOL_H_
+#define LIBPOOL_H_
+
+#include "libeuler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Thread pool (opaque structure)
+ *
+ * The pool keeps its threads alive between runs. Each run executes a set of tasks, identified
+ * by their index. Indices are initially split in equal contiguous ranges between the workers,
+ * and a worker that empties its range steals half of the remaining range of another worker, 
+ * thus tasks with very different cost are balanced automatically.
+ */
+typedef struct pool pool;
+
+/**
+ * @brief Callback for a task of the pool
+ * @param index index of the task
+ * @param worker index of the worker executing the task (in [0, threads))
+ * @param data auxiliary data pointer to void for user data
+ * @returns nothing
+ */
+typedef void (*pool_function)(
+    const lapack_int index,
+    const lapack_int worker,
+    void *data);
+
+/**
+ * @brief Callback for an integration task of the pool
+ * The callback receives the shared (read only) options and the workspace of the worker
+ * executing the task, and should integrate the trajectory with the given index (e.g. with
+ * euler_integrate() or euler_ws()).
+ * @param opt pointer to struct with options, shared among all the workers
+ * @param ws workspace of the worker
+ * @param index index of the trajectory
+ * @param data auxiliary data pointer to void for user data
+ * @returns an exit code for the integration
+ */
+typedef euler_ret (*pool_euler_task)(
+    const euler_options *opt,
+    euler_workspace *ws,
+    const lapack_int index,
+    void *data);
+
+/**
+ * @brief Options for the Parareal integration (see pool_parareal())
+ */
+typedef struct pool_parareal_options {
+  lapack_int slices;       /**< Number of time slices. If 0, uses the number of workers */
+  lapack_int coarse_steps; /**< Explicit Euler steps of the coarse propagator in a slice. If 0, uses 1.
+                                The coarse step must be stable for the model */
+  lapack_int max_iter;     /**< Maximum number of Parareal iterations. If 0, uses slices (after slices
+                                iterations the solution is the sequential fine one) */
+  double tol;              /**< Tolerance on the correction of the states at the slice boundaries,
+                                \f$\|\Delta x\|_\infty \leq tol \max(\|x\|_\infty, 1)\f$ */
+} pool_parareal_options;
+
+/**
+ * @brief Results of the Parareal integration
+ */
+typedef struct pool_parareal_stats {
+  lapack_int iterations;   /**< Number of executed Parareal iterations */
+  lapack_int fine_slices;  /**< Number of fine propagations of a slice (slices * iterations at most) */
+  double correction;       /**< Scaled correction of the last iteration */
+} pool_parareal_stats;
+
+/**
+ * @brief Creates a thread pool
+ * @param threads number of workers (including the calling thread). If 0, uses all the online cores.
+ * @return the pool, or NULL if memory or threads cannot be allocated
+ */
+pool *pool_create(const lapack_int threads);
+
+/**
+ * @brief Stops the threads and releases a thread pool
+ * @param pl pool to release. It can be NULL.
+ */
+void pool_destroy(pool *pl);
+
+/**
+ * @brief Number of workers of a pool
+ */
+lapack_int pool_threads(const pool *pl);
+
+/**
+ * @brief Executes count tasks on the pool
+ *
+ * The calling thread works as worker 0, and the function returns when all the tasks are
+ * completed. Runs on the same pool must not be executed concurrently.
+ * @param pl thread pool
+ * @param count number of tasks
+ * @param fn task callback
+ * @param data auxiliary data pointer to void for user data
+ */
+void pool_run(pool *pl, const lapack_int count, pool_function fn, void *data);
+
+/**
+ * @brief Integrates count trajectories on the pool
+ *
+ * Each worker allocates its own workspace for the options, once for the run.
+ * @param pl thread pool
+ * @param opt pointer to struct with options, shared among all the workers
+ * @param count number of trajectories
+ * @param task integration task
+ * @param results exit code of each trajectory. It can be NULL.
+ * @param data auxiliary data pointer to void for user data
+ * @return EULER_SUCCESS if all the trajectories succeeded, otherwise the first error code
+ *         (in order of index)
+ */
+euler_ret pool_euler_run(
+    pool *pl,
+    const euler_options *opt,
+    const lapack_int count,
+    pool_euler_task task,
+    euler_ret *results,
+    void *data);
+
+/**
+ * @brief Parareal integration of a single trajectory on the pool
+ *
+ * Splits [t0, t1] in equal time slices. The coarse propagator G is the explicit Euler step
+ * (coarse_steps steps per slice), the fine propagator F is euler_integrate() with the given
+ * options (e.g. the implicit Tustin step with a fine ts). An initial coarse sweep gives the
+ * states at the slice boundaries, then each iteration propagates all the slices that are not
+ * yet exact with F in parallel, and corrects the boundaries sequentially:
+ * \f{
+ *   x_{n+1}^{k+1} = G(x_n^{k+1}) + F(x_n^k) - G(x_n^k)
+ * \f}
+ * until the correction is below the tolerance. The iteration k makes the first k + 1 slices
+ * exact, thus they are not propagated again. The input provider is called by several workers
+ * at the same time (it must be thread safe), and the output sink of the trajectory options is
+ * not used. The workspaces of the workers are allocated once for all the iterations, and keep
+ * the scratch of euler_integrate(): after the first iteration the fine propagations do not allocate.
+ * @param pl thread pool
+ * @param opt pointer to struct with options of the fine propagator
+ * @param iopt pointer to struct with trajectory options (input, tolerances, tstops, events)
+ * @param popt pointer to struct with Parareal options
+ * @param t0 initial time
+ * @param t1 final time
+ * @param x0 initial state
+ * @param xs states at the slice boundaries, (slices + 1) * x_size elements, one state after the
+ *        other (the first is x0, the last is the final state)
+ * @param p pointer to arrays of parameters
+ * @param stats results of the iterations. It can be NULL
+ * @return EULER_SUCCESS if the correction converged (or the maximum iterations were executed),
+ *         otherwise the first error code of the propagators
+ */
+euler_ret pool_parareal(
+    pool *pl,
+    const euler_options *opt,
+    const euler_integrate_options *iopt,
+    const pool_parareal_options *popt,
+    const double t0,
+    const double t1,
+    const double *x0,
+    double *xs,
+    const double **p,
+    pool_parareal_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBPOOL_H_ */
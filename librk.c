@@ -0,0 +1,204 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdlib.h>
+#include <cblas.h>
+#include "librk.h"
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* Classic Runge-Kutta of order 4 */
+static const double rk4_a[] = {
+  0.0, 0.0, 0.0, 0.0,
+  0.5, 0.0, 0.0, 0.0,
+  0.0, 0.5, 0.0, 0.0,
+  0.0, 0.0, 1.0, 0.0};
+static const double rk4_b[] = {1.0 / 6.0, 1.0 / 3.0, 1.0 / 3.0, 1.0 / 6.0};
+static const double rk4_c[] = {0.0, 0.5, 0.5, 1.0};
+const rk_tableau rk_rk4 = {4, 4, rk4_a, rk4_b, rk4_c, NULL};
+
+/* Dormand-Prince 5(4) */
+static const double dopri5_a[] = {
+  0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0,
+  1.0 / 5.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0,
+  3.0 / 40.0, 9.0 / 40.0, 0.0, 0.0, 0.0, 0.0, 0.0,
+  44.0 / 45.0, -56.0 / 15.0, 32.0 / 9.0, 0.0, 0.0, 0.0, 0.0,
+  19372.0 / 6561.0, -25360.0 / 2187.0, 64448.0 / 6561.0, -212.0 / 729.0, 0.0, 0.0, 0.0,
+  9017.0 / 3168.0, -355.0 / 33.0, 46732.0 / 5247.0, 49.0 / 176.0, -5103.0 / 18656.0, 0.0, 0.0,
+  35.0 / 384.0, 0.0, 500.0 / 1113.0, 125.0 / 192.0, -2187.0 / 6784.0, 11.0 / 84.0, 0.0};
+static const double dopri5_b[] = {35.0 / 384.0, 0.0, 500.0 / 1113.0, 125.0 / 192.0, -2187.0 / 6784.0, 11.0 / 84.0, 0.0};
+static const double dopri5_c[] = {0.0, 1.0 / 5.0, 3.0 / 10.0, 4.0 / 5.0, 8.0 / 9.0, 1.0, 1.0};
+static const double dopri5_e[] = {71.0 / 57600.0, 0.0, -71.0 / 16695.0, 71.0 / 1920.0, -17253.0 / 339200.0, 22.0 / 525.0, -1.0 / 40.0};
+const rk_tableau rk_dopri5 = {7, 5, dopri5_a, dopri5_b, dopri5_c, dopri5_e};
+
+/* SDIRK of order 2, gamma = 1 - 1/sqrt(2). The embedded method is the first stage (b^ = [1, 0]) */
+#define RK_SDIRK2_GAMMA 0.292893218813452475599
+static const double sdirk2_a[] = {
+  RK_SDIRK2_GAMMA, 0.0,
+  1.0 - RK_SDIRK2_GAMMA, RK_SDIRK2_GAMMA};
+static const double sdirk2_b[] = {1.0 - RK_SDIRK2_GAMMA, RK_SDIRK2_GAMMA};
+static const double sdirk2_c[] = {RK_SDIRK2_GAMMA, 1.0};
+static const double sdirk2_e[] = {-RK_SDIRK2_GAMMA, RK_SDIRK2_GAMMA};
+const rk_tableau rk_sdirk2 = {2, 2, sdirk2_a, sdirk2_b, sdirk2_c, sdirk2_e};
+
+/* SDIRK of order 3 (Alexander), gamma root of x^3 - 3 x^2 + 3/2 x - 1/6. The embedded method
+   is the order 2 combination of the first two stages */
+#define RK_SDIRK3_GAMMA 0.435866521508458999416
+#define RK_SDIRK3_B1 1.208496649176010070336
+#define RK_SDIRK3_B2 -0.644363170684469069752
+static const double sdirk3_a[] = {
+  RK_SDIRK3_GAMMA, 0.0, 0.0,
+  (1.0 - RK_SDIRK3_GAMMA) / 2.0, RK_SDIRK3_GAMMA, 0.0,
+  RK_SDIRK3_B1, RK_SDIRK3_B2, RK_SDIRK3_GAMMA};
+static const double sdirk3_b[] = {RK_SDIRK3_B1, RK_SDIRK3_B2, RK_SDIRK3_GAMMA};
+static const double sdirk3_c[] = {RK_SDIRK3_GAMMA, (1.0 + RK_SDIRK3_GAMMA) / 2.0, 1.0};
+static const double sdirk3_e[] = {RK_SDIRK3_GAMMA, -2.0 * RK_SDIRK3_GAMMA, RK_SDIRK3_GAMMA};
+const rk_tableau rk_sdirk3 = {3, 3, sdirk3_a, sdirk3_b, sdirk3_c, sdirk3_e};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @brief Internal: checks if the tableau has implicit stages
+ */
+static newton_bool rk_implicit(const rk_tableau *tableau)
+{
+  for (lapack_int i = 0; i < tableau->stages; i++)
+    if (tableau->a[i * tableau->stages + i] != 0)
+      return NEWTON_TRUE;
+  return NEWTON_FALSE;
+}
+
+rk_workspace *rk_workspace_alloc(const euler_options *opt, const rk_tableau *tableau)
+{
+  if (!opt || !tableau || tableau->stages <= 0 || opt->stiff)
+    return NULL;
+
+  rk_workspace *ws = (rk_workspace *)calloc(1, sizeof(rk_workspace));
+  if (!ws)
+    return NULL;
+  ws->x_size = opt->x_size;
+  ws->stages = tableau->stages;
+  ws->u_size = opt->u_offset;
+
+  ws->k = (double *)calloc(tableau->stages * opt->x_size, sizeof(double));
+  ws->xs = (double *)calloc(opt->x_size, sizeof(double));
+  ws->xk = (double *)calloc(opt->x_size, sizeof(double));
+  ws->us = (double *)calloc(opt->u_offset > 0 ? opt->u_offset : 1, sizeof(double));
+  if (!ws->k || !ws->xs || !ws->xk || !ws->us) {
+    rk_workspace_free(ws);
+    return NULL;
+  }
+
+  /* Implicit stages are solved by the Newton machinery of the implicit Euler step */
+  if (rk_implicit(tableau)) {
+    euler_options stage_opt = *opt;
+    stage_opt.alpha = 1.0;
+    ws->euler = euler_workspace_alloc(&stage_opt);
+    if (!ws->euler) {
+      rk_workspace_free(ws);
+      return NULL;
+    }
+  }
+  return ws;
+}
+
+void rk_workspace_free(rk_workspace *ws)
+{
+  if (!ws)
+    return;
+  free(ws->k);
+  free(ws->xs);
+  free(ws->xk);
+  free(ws->us);
+  euler_workspace_free(ws->euler);
+  free(ws);
+}
+
+euler_ret rk_step(const euler_options *opt, const rk_tableau *tableau, rk_workspace *ws, double *xp, double *err, const double t, const double *x, const double *u, const double **p)
+{
+  if (!opt || !tableau || !ws || !xp || !x)
+    return EULER_NULLPTR;
+  if (ws->x_size != opt->x_size || ws->stages != tableau->stages || ws->u_size != opt->u_offset)
+    return EULER_GENERIC;
+
+  const lapack_int n = opt->x_size;
+  const lapack_int s = tableau->stages;
+  const double h = opt->ts;
+
+  for (lapack_int i = 0; i < s; i++) {
+    const double ti = t + tableau->c[i] * h;
+    double *ki = ws->k + i * n;
+
+    /* Input of the stage: linear interpolation of [u(t), u(t+h)], or held constant */
+    const double *ui = u;
+    if (u && ws->u_size > 0) {
+      for (lapack_int j = 0; j < ws->u_size; j++)
+        ws->us[j] = (1 - tableau->c[i]) * u[j] + tableau->c[i] * u[ws->u_size + j];
+      ui = ws->us;
+    }
+
+    /* Constant part of the stage: xk <- x(t) + h sum_{j < i} a_ij k_j */
+    cblas_dcopy(n, x, 1, ws->xk, 1);
+    for (lapack_int j = 0; j < i; j++)
+      if (tableau->a[i * s + j] != 0)
+        cblas_daxpy(n, h * tableau->a[i * s + j], ws->k + j * n, 1, ws->xk, 1);
+
+    /* EXPLICIT STAGE */
+    const double aii = tableau->a[i * s + i];
+    if (aii == 0) {
+      opt->f(ki, ti, ws->xk, ui, p, opt->data);
+      continue;
+    }
+
+    /* IMPLICIT STAGE: xs = xk + aii h f(xs), from xk + aii h k_{i-1} */
+    if (!ws->euler)
+      return EULER_NULLPTR;
+    cblas_dcopy(n, ws->xk, 1, ws->xs, 1);
+    if (i > 0)
+      cblas_daxpy(n, aii * h, ws->k + (i - 1) * n, 1, ws->xs, 1);
+    euler_ret ret = euler_stage_ws(opt, ws->euler, aii * h, ws->xs, ti, ws->xk, ui, p);
+    if (ret != EULER_SUCCESS)
+      return ret;
+
+    /* k_i = (xs - xk) / (aii h), without a further evaluation of the vector field */
+    cblas_dcopy(n, ws->xs, 1, ki, 1);
+    cblas_daxpy(n, -1, ws->xk, 1, ki, 1);
+    cblas_dscal(n, 1 / (aii * h), ki, 1);
+  }
+
+  /* Step and local error estimate */
+  cblas_dcopy(n, x, 1, xp, 1);
+  if (err)
+    for (lapack_int j = 0; j < n; j++)
+      err[j] = 0;
+  for (lapack_int i = 0; i < s; i++) {
+    if (tableau->b[i] != 0)
+      cblas_daxpy(n, h * tableau->b[i], ws->k + i * n, 1, xp, 1);
+    if (err && tableau->e && tableau->e[i] != 0)
+      cblas_daxpy(n, h * tableau->e[i], ws->k + i * n, 1, err, 1);
+  }
+
+  /* Stiff components of the estimate are filtered with (I - aii h J)^-1 = -(-I + aii h J)^-1,
+     when the factors of the stages are available (modified and Broyden methods) */
+  if (err && tableau->e && ws->euler && newton_workspace_solve(ws->euler->newton, err) == NEWTON_F_TOL)
+    cblas_dscal(n, -1, err, 1);
+  return EULER_SUCCESS;
+}
@@ -0,0 +1,132 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef LIBRK_H_
+#define LIBRK_H_
+
+#include "libeuler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Butcher tableau of a Runge-Kutta method
+ *
+ * The method is explicit (strictly lower triangular a) or diagonally implicit (lower triangular
+ * a, with some non zero diagonal element). The stages are:
+ * \f{
+ *   k_i = f(t + c_i h, x(t) + h \sum_{j \leq i} a_{ij} k_j, u, p)
+ * \f}
+ * and the step is \f$x(t+h) = x(t) + h \sum_i b_i k_i\f$. The stages with \f$a_{ii} \neq 0\f$ are
+ * solved with the Newton machinery of the implicit Euler step (see euler_stage_ws()).
+ */
+typedef struct rk_tableau {
+  lapack_int stages;   /**< Number of stages */
+  lapack_int order;    /**< Order of the method */
+  const double *a;     /**< Coefficients of the stages. stages * stages elements, row major */
+  const double *b;     /**< Weights of the step. stages elements */
+  const double *c;     /**< Nodes (time fractions of the step). stages elements */
+  const double *e;     /**< Weights of the local error estimate \f$b - \hat{b}\f$ of the embedded method
+                            (of order order - 1). NULL if the method has no embedded pair */
+} rk_tableau;
+
+extern const rk_tableau rk_rk4;    /**< Classic explicit Runge-Kutta of order 4 (no error estimate) */
+extern const rk_tableau rk_dopri5; /**< Dormand-Prince 5(4), explicit, 7 stages */
+extern const rk_tableau rk_sdirk2; /**< L-stable, stiffly accurate SDIRK of order 2, 2 stages
+                                        (\f$\gamma = 1 - 1/\sqrt{2}\f$), with an order 1 estimate */
+extern const rk_tableau rk_sdirk3; /**< L-stable, stiffly accurate SDIRK of order 3, 3 stages
+                                        (Alexander), with an order 2 estimate */
+
+/**
+ * @brief Persistent working memory for the Runge-Kutta step
+ *
+ * The workspace owns the stage storage and, for diagonally implicit tableaus, an Euler
+ * workspace for the Newton solution of the implicit stages (the iteration matrix is the same
+ * for all the stages with the same diagonal coefficient, thus the factors are reused by the
+ * modified and Broyden methods). It is created once for a tableau and an euler_options
+ * structure and passed to rk_step(), that does not allocate any memory.
+ */
+typedef struct rk_workspace {
+  lapack_int x_size;      /**< State dimensions. Taken from options struct */
+  lapack_int stages;      /**< Number of stages. Taken from the tableau */
+  lapack_int u_size;      /**< Size of the interpolated input (the input offset of the options) */
+  double *k;              /**< Derivatives of the stages. stages * x_size elements */
+  double *xs;             /**< State of the current stage. x_size elements */
+  double *xk;             /**< Constant part of the current stage. x_size elements */
+  double *us;             /**< Input of the current stage. u_size elements */
+  euler_workspace *euler; /**< Workspace for the implicit stages. NULL for explicit tableaus */
+} rk_workspace;
+
+/**
+ * @brief Allocates the working memory for the Runge-Kutta step
+ * @param opt pointer to struct with options (alpha is not used)
+ * @param tableau Butcher tableau of the method
+ * @return the allocated workspace, or NULL if memory cannot be allocated or the stiff index is set
+ *         (the stages of euler_stage_ws() solve for the whole state)
+ */
+rk_workspace *rk_workspace_alloc(const euler_options *opt, const rk_tableau *tableau);
+
+/**
+ * @brief Releases the working memory of the Runge-Kutta step
+ * @param ws workspace to release. It can be NULL.
+ */
+void rk_workspace_free(rk_workspace *ws);
+
+/**
+ * @brief Runge-Kutta step, with a persistent workspace
+ *
+ * Performs a step of size ts (from the options) of the method described by the tableau,
+ * with the callbacks of the options. If the input offset in the options is not zero, the
+ * control vector is \f$u = [u(t), u(t+h)]\f$ as for euler(), and the input of each stage is the
+ * linear interpolation in \f$t + c_i h\f$, otherwise u is held constant along the step. The
+ * implicit stages use the Newton options (tolerances, method, pattern, Krylov callbacks), with
+ * the stage derivative of the previous stage as initial guess.
+ * @param opt pointer to struct with options
+ * @param tableau Butcher tableau of the method (the same used for the workspace)
+ * @param ws workspace allocated with rk_workspace_alloc()
+ * @param xp next integration step
+ * @param err local error estimate \f$h \sum_i e_i k_i\f$ (for implicit tableaus, filtered with
+ *        \f$(I - a_{ii} h \nabla f)^{-1}\f$ when the factors of the stages are reused, as in
+ *        euler_integrate()). It can be NULL (or it is set to zero if the tableau has no embedded pair)
+ * @param t current integration time
+ * @param x current state
+ * @param u control vector
+ * @param p pointer to arrays of parameters
+ * @return an exit code to check if integration step succeeded
+ */
+euler_ret rk_step(
+  const euler_options *opt,
+  const rk_tableau *tableau,
+  rk_workspace *ws,
+  double *xp,
+  double *err,
+  const double t,
+  const double *x,
+  const double *u,
+  const double **p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBRK_H_ */
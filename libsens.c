@@ -0,0 +1,252 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <cblas.h>
+#include "libsens.h"
+
+sens_workspace *sens_workspace_alloc(const euler_options *opt, const sens_options *sopt)
+{
+  if (!opt || !sopt || sopt->p_size < 0 || opt->method == NEWTON_KRYLOV || opt->stiff)
+    return NULL;
+  /* The finite difference parameter Jacobian perturbs the parameter values in place */
+  if (!sopt->dfdp && sopt->p_size > 0 && !sopt->p_values)
+    return NULL;
+  if (opt->pattern && opt->pattern->n != opt->x_size)
+    return NULL;
+
+  sens_workspace *ws = (sens_workspace *)calloc(1, sizeof(sens_workspace));
+  if (!ws)
+    return NULL;
+  const lapack_int n = opt->x_size;
+  ws->x_size = n;
+  ws->p_size = sopt->p_size;
+  ws->jac_size = opt->pattern ? opt->pattern->ptr[n] : n * n;
+
+  ws->euler = euler_workspace_alloc(opt);
+  ws->work = (double *)calloc(4 * n, sizeof(double));
+  if (!ws->euler || !ws->work) {
+    sens_workspace_free(ws);
+    return NULL;
+  }
+  for (int k = 0; k < 2; k++) {
+    ws->jac[k] = (double *)calloc(ws->jac_size + 1, sizeof(double));
+    ws->fx[k] = (double *)calloc(n, sizeof(double));
+    ws->fp[k] = (double *)calloc(n * ws->p_size + 1, sizeof(double));
+    if (!ws->jac[k] || !ws->fx[k] || !ws->fp[k]) {
+      sens_workspace_free(ws);
+      return NULL;
+    }
+  }
+  return ws;
+}
+
+void sens_workspace_free(sens_workspace *ws)
+{
+  if (!ws)
+    return;
+  for (int k = 0; k < 2; k++) {
+    free(ws->jac[k]);
+    free(ws->fx[k]);
+    free(ws->fp[k]);
+  }
+  free(ws->work);
+  euler_workspace_free(ws->euler);
+  free(ws);
+}
+
+/**
+ * @brief Internal: vector field, Jacobian (if the callback is given) and parameter Jacobian at the
+ * end k of the step
+ *
+ * Without the callback, the parameter Jacobian is computed by forward differences, perturbing each
+ * parameter value by \f$\sqrt{\epsilon} \max(|p_j|, 1)\f$ and restoring it.
+ */
+static void sens_point(const euler_options *opt, const sens_options *sopt, sens_workspace *ws, const int k, const double t, const double *x, const double *u, const double **p)
+{
+  const lapack_int n = ws->x_size;
+  opt->f(ws->fx[k], t, x, u, p, opt->data);
+  ws->jac_valid[k] = NEWTON_FALSE;
+  if (opt->df) {
+    opt->df(ws->jac[k], t, x, u, p, opt->data);
+    ws->jac_valid[k] = NEWTON_TRUE;
+  }
+
+  if (sopt->dfdp) {
+    sopt->dfdp(ws->fp[k], t, x, u, p, opt->data);
+    return;
+  }
+  const double eps = sqrt(DBL_EPSILON);
+  for (lapack_int j = 0; j < ws->p_size; j++) {
+    double *pj = sopt->p_values[j];
+    double *col = ws->fp[k] + j * n;
+    const double pj0 = *pj;
+    const double delta = (pj0 < 0 ? -eps : eps) * fmax(fabs(pj0), 1.0);
+    *pj = pj0 + delta;
+    opt->f(col, t, x, u, p, opt->data);
+    *pj = pj0;
+    cblas_daxpy(n, -1, ws->fx[k], 1, col, 1);
+    cblas_dscal(n, 1 / delta, col, 1);
+  }
+}
+
+/**
+ * @brief Internal: product of the Jacobian at the end k of the step by v
+ *
+ * Uses the evaluated Jacobian (dense, or the nonzeros of the pattern, CSR for row major and CSC for
+ * column major ordering), or the directional difference with the step
+ * \f$\sigma = \sqrt{\epsilon} (1 + |x|) / |v|\f$ (as the Krylov method of the Newton solver).
+ */
+static void sens_jv(const euler_options *opt, sens_workspace *ws, const int k, double *jv, const double *v, const double t, const double *x, const double *u, const double **p)
+{
+  const lapack_int n = ws->x_size;
+  if (ws->jac_valid[k] && !opt->pattern) {
+    cblas_dgemv(opt->ordering == LAPACK_ROW_MAJOR ? CblasRowMajor : CblasColMajor, CblasNoTrans,
+                n, n, 1.0, ws->jac[k], n, v, 1, 0.0, jv, 1);
+    return;
+  }
+  if (ws->jac_valid[k]) {
+    const sparse_pattern *pattern = opt->pattern;
+    for (lapack_int i = 0; i < n; i++)
+      jv[i] = 0;
+    for (lapack_int c = 0; c < n; c++)
+      for (lapack_int q = pattern->ptr[c]; q < pattern->ptr[c + 1]; q++) {
+        if (opt->ordering == LAPACK_ROW_MAJOR)
+          jv[c] += ws->jac[k][q] * v[pattern->idx[q]];
+        else
+          jv[pattern->idx[q]] += ws->jac[k][q] * v[c];
+      }
+    return;
+  }
+
+  const double v_norm = cblas_dnrm2(n, v, 1);
+  if (v_norm == 0) {
+    for (lapack_int i = 0; i < n; i++)
+      jv[i] = 0;
+    return;
+  }
+  double *xd = ws->work + 3 * n;
+  const double sigma = sqrt(DBL_EPSILON) * (1 + cblas_dnrm2(n, x, 1)) / v_norm;
+  cblas_dcopy(n, x, 1, xd, 1);
+  cblas_daxpy(n, sigma, v, 1, xd, 1);
+  opt->f(jv, t, xd, u, p, opt->data);
+  cblas_daxpy(n, -1, ws->fx[k], 1, jv, 1);
+  cblas_dscal(n, 1 / sigma, jv, 1);
+}
+
+euler_ret sens_step(const euler_options *opt, const sens_options *sopt, sens_workspace *ws, double *xp, double *sp, const double t, const double *x, const double *s, const double *u, const double **p)
+{
+  if (!opt || !sopt || !ws || !xp || !sp || !x || !s)
+    return EULER_NULLPTR;
+  if (opt->x_size != ws->x_size || sopt->p_size != ws->p_size)
+    return EULER_GENERIC;
+
+  euler_ret ret = euler_ws(opt, ws->euler, xp, t, x, u, p, opt->data);
+  if (ret != EULER_SUCCESS)
+    return ret;
+
+  const lapack_int n = ws->x_size;
+  const double h = opt->ts;
+  const double alpha = opt->alpha;
+  const double *u1 = u ? u + opt->u_offset : NULL;
+  double *r = ws->work;
+  double *rhs = ws->work + n;
+  double *jv = ws->work + 2 * n;
+  ws->iterations = 0;
+  ws->factorizations = 0;
+
+  /* Derivatives at the two ends, only where the step uses them */
+  if (alpha < 1)
+    sens_point(opt, sopt, ws, 0, t, x, u, p);
+  if (alpha > 0)
+    sens_point(opt, sopt, ws, 1, t, xp, u1, p);
+
+  /* Explicit part of the sensitivity step, directly in the output:
+     S + (1 - alpha) h (J0 S + fp0) + alpha h fp1 */
+  for (lapack_int j = 0; j < ws->p_size; j++) {
+    const double *sj = s + j * n;
+    double *spj = sp + j * n;
+    cblas_dcopy(n, sj, 1, spj, 1);
+    if (alpha < 1) {
+      sens_jv(opt, ws, 0, jv, sj, t, x, u, p);
+      cblas_daxpy(n, (1 - alpha) * h, jv, 1, spj, 1);
+      cblas_daxpy(n, (1 - alpha) * h, ws->fp[0] + j * n, 1, spj, 1);
+    }
+    if (alpha > 0)
+      cblas_daxpy(n, alpha * h, ws->fp[1] + j * n, 1, spj, 1);
+  }
+  if (alpha == 0)
+    return EULER_SUCCESS;
+
+  /* Staggered direct method: (-I + alpha h J1) S(t+h) = -rhs, column by column. The residuals with
+     directional differences are accurate only to the square root of the machine precision */
+  const double tol = ws->jac_valid[1] ? opt->s_tol : fmax(opt->s_tol, sqrt(DBL_EPSILON));
+  newton_bool own = NEWTON_FALSE;
+  for (lapack_int j = 0; j < ws->p_size; j++) {
+    double *spj = sp + j * n;
+    lapack_int solves = 0;
+    newton_bool converged = NEWTON_FALSE;
+    cblas_dcopy(n, spj, 1, rhs, 1);
+
+    /* Newton factors: corrections from S(t+h) = 0, with the residual r = (-I + alpha h J1) S(t+h) + rhs */
+    for (lapack_int i = 0; i < n; i++)
+      spj[i] = 0;
+    cblas_dcopy(n, rhs, 1, r, 1);
+    while (!own && solves < SENS_MAX_ITER) {
+      if (newton_workspace_solve(ws->euler->newton, r) != NEWTON_F_TOL)
+        break;
+      cblas_daxpy(n, -1, r, 1, spj, 1);
+      solves++;
+      sens_jv(opt, ws, 1, jv, spj, t, xp, u1, p);
+      cblas_dcopy(n, rhs, 1, r, 1);
+      cblas_daxpy(n, -1, spj, 1, r, 1);
+      cblas_daxpy(n, alpha * h, jv, 1, r, 1);
+      if (cblas_dnrm2(n, r, 1) <= tol * fmax(cblas_dnrm2(n, spj, 1), 1.0)) {
+        converged = NEWTON_TRUE;
+        break;
+      }
+    }
+
+    /* Fresh factors in xp, once for all the remaining columns: a single solve per column. They
+       are computed by the Newton workspace (finite differences on the column groups, batched
+       vector field), and the next steps reuse them */
+    if (!converged) {
+      if (!own) {
+        if (euler_factor_ws(opt, ws->euler, alpha * h, t, xp, u1, p) != EULER_SUCCESS)
+          return EULER_GENERIC;
+        ws->factorizations++;
+      }
+      own = NEWTON_TRUE;
+      cblas_dcopy(n, rhs, 1, r, 1);
+      if (newton_workspace_solve(ws->euler->newton, r) != NEWTON_F_TOL)
+        return EULER_GENERIC;
+      for (lapack_int i = 0; i < n; i++)
+        spj[i] = -r[i];
+      solves++;
+    }
+    if (solves > ws->iterations)
+      ws->iterations = solves;
+  }
+  return EULER_SUCCESS;
+}
@@ -0,0 +1,153 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef LIBSENS_H_
+#define LIBSENS_H_
+
+#include "libeuler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SENS_MAX_ITER 10 /**< Maximum number of linear solves for a column with the Newton factors */
+
+/**
+ * @brief Callback for the Jacobian of the vector field with respect to the parameters
+ * The callback stores in dfdp the x_size * p_size matrix \f$\partial f / \partial p\f$ in column
+ * major order: the column j contains the derivative with respect to the parameter j (the
+ * parameters are numbered by the user, see sens_options).
+ * @param dfdp output matrix
+ * @param t current time for the function
+ * @param x state for the evaluation
+ * @param u external input for the evaluation
+ * @param p pointer to arrays of parameters
+ * @param data auxiliary data pointer to void for user data
+ * @returns nothing
+ */
+typedef void (*sens_parameter_jacobian)(
+    double *dfdp,
+    const double t,
+    const double *x,
+    const double *u,
+    const double **p,
+    void *data);
+
+/**
+ * @brief Options for the forward sensitivities
+ */
+typedef struct sens_options {
+  lapack_int p_size;            /**< Number of parameters of the sensitivities */
+  sens_parameter_jacobian dfdp; /**< Jacobian with respect to the parameters. If NULL, it is computed by
+                                     forward finite differences, perturbing the values in p_values */
+  double **p_values;            /**< Pointers to the parameter values (inside the arrays of p), used by the
+                                     finite differences. p_size elements. It can be NULL if dfdp is given */
+} sens_options;
+
+/**
+ * @brief Persistent working memory for the forward sensitivities
+ *
+ * The workspace owns an Euler workspace for the steps, the derivatives of the vector field at
+ * the two ends of the step. The factors of the iteration matrix are always those of the Newton
+ * workspace inside the Euler one, refreshed with euler_factor_ws() when they are missing.
+ */
+typedef struct sens_workspace {
+  lapack_int x_size;      /**< State dimensions. Taken from options struct */
+  lapack_int p_size;      /**< Number of parameters. Taken from sensitivity options */
+  lapack_int jac_size;    /**< Elements of a Jacobian: x_size^2, or the nonzeros of the pattern */
+  double *jac[2];         /**< Jacobian at the start and at the end of the step. jac_size elements */
+  newton_bool jac_valid[2]; /**< The Jacobians are evaluated (Jacobian callback given). Otherwise the
+                                 products use directional differences of the vector field */
+  double *fx[2];          /**< Vector field at the start and at the end of the step. x_size elements */
+  double *fp[2];          /**< Jacobian with respect to the parameters at the start and at the end of
+                               the step. x_size * p_size elements */
+  double *work;           /**< Residual, correction, product and perturbed state. 4 * x_size elements */
+  lapack_int iterations;  /**< Maximum number of linear solves for a column in the last step */
+  lapack_int factorizations; /**< Fresh factorizations in the last step (0 if the Newton factors are reused) */
+  euler_workspace *euler; /**< Workspace for the steps */
+} sens_workspace;
+
+/**
+ * @brief Allocates the working memory for the forward sensitivities
+ * @param opt pointer to struct with options (NEWTON_KRYLOV and the partitioned step are not supported)
+ * @param sopt pointer to struct with sensitivity options
+ * @return the allocated workspace, or NULL if memory cannot be allocated or the options are not supported
+ */
+sens_workspace *sens_workspace_alloc(const euler_options *opt, const sens_options *sopt);
+
+/**
+ * @brief Releases the working memory of the forward sensitivities
+ * @param ws workspace to release. It can be NULL.
+ */
+void sens_workspace_free(sens_workspace *ws);
+
+/**
+ * @brief Euler step with the forward sensitivities of the state
+ *
+ * Performs the step of euler_ws() and propagates the sensitivities \f$S = \partial x / \partial p\f$
+ * with the derivative of the Tustin step (staggered direct method):
+ * \f{
+ *   (I - \alpha h \nabla f_1) S(t+h) = S(t) + (1-\alpha) h (\nabla f_0 S(t) + \partial f_0 / \partial p)
+ *      + \alpha h \partial f_1 / \partial p
+ * \f}
+ * where the subscripts 0 and 1 denote the two ends of the step (evaluated as in the implicit
+ * step, with the same time and the inputs u and u + u_offset). The linear system is solved with
+ * the factors of the iteration matrix already computed by the Newton solver (the modified and
+ * Broyden methods keep them): a column costs a pair of triangular solves, plus a correction for
+ * each residual above s_tol (or the square root of the machine precision, for directional
+ * differences), since the factors may refer to an older Jacobian. When the Newton
+ * factors are missing or the corrections do not converge in SENS_MAX_ITER solves, the iteration
+ * matrix is refactorized once at the end of the step with euler_factor_ws() (the Jacobian
+ * callback, or finite differences on the column groups of the pattern with the batched vector
+ * field), for all the remaining columns and the next steps. The products with
+ * the Jacobian use the Jacobian callback, or directional differences of the vector field.
+ * @param opt pointer to struct with options
+ * @param sopt pointer to struct with sensitivity options
+ * @param ws workspace allocated with sens_workspace_alloc()
+ * @param xp next integration step
+ * @param sp sensitivities at the next step. x_size * p_size elements, column major
+ * @param t current integration time
+ * @param x current state
+ * @param s current sensitivities. x_size * p_size elements, column major (the column j contains
+ *        \f$\partial x / \partial p_j\f$)
+ * @param u control vector (see euler())
+ * @param p pointer to arrays of parameters
+ * @return an exit code to check if integration step succeeded (EULER_GENERIC also if the iteration
+ *         matrix is singular)
+ */
+euler_ret sens_step(
+  const euler_options *opt,
+  const sens_options *sopt,
+  sens_workspace *ws,
+  double *xp,
+  double *sp,
+  const double t,
+  const double *x,
+  const double *s,
+  const double *u,
+  const double **p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSENS_H_ */
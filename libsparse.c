@@ -0,0 +1,684 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include "libsparse.h"
+
+/**
+ * @brief Internal: comparison of indexes for qsort
+ */
+static int sparse_compare(const void *a, const void *b)
+{
+  const lapack_int ia = *(const lapack_int *)a;
+  const lapack_int ib = *(const lapack_int *)b;
+  return (ia > ib) - (ia < ib);
+}
+
+/**
+ * @brief Internal: pattern of \f$M + M^T\f$ without diagonal and without duplicates
+ *
+ * Returns the offsets (n + 1 elements) and stores the indexes in si. Both arrays must be
+ * released by the caller.
+ */
+static lapack_int *sparse_symmetric(const sparse_pattern *pattern, lapack_int **si)
+{
+  const lapack_int n = pattern->n;
+  lapack_int *sp = (lapack_int *)calloc(n + 1, sizeof(lapack_int));
+  lapack_int *mark = (lapack_int *)malloc(n * sizeof(lapack_int));
+  *si = NULL;
+  if (!sp || !mark)
+    goto error;
+
+  for (lapack_int j = 0; j < n; j++)
+    for (lapack_int p = pattern->ptr[j]; p < pattern->ptr[j + 1]; p++)
+      if (pattern->idx[p] != j) {
+        sp[pattern->idx[p] + 1]++;
+        sp[j + 1]++;
+      }
+  for (lapack_int k = 0; k < n; k++)
+    sp[k + 1] += sp[k];
+
+  *si = (lapack_int *)malloc((sp[n] > 0 ? sp[n] : 1) * sizeof(lapack_int));
+  if (!*si)
+    goto error;
+  for (lapack_int j = 0; j < n; j++)
+    mark[j] = sp[j];
+  for (lapack_int j = 0; j < n; j++)
+    for (lapack_int p = pattern->ptr[j]; p < pattern->ptr[j + 1]; p++) {
+      const lapack_int i = pattern->idx[p];
+      if (i != j) {
+        (*si)[mark[i]++] = j;
+        (*si)[mark[j]++] = i;
+      }
+    }
+
+  /* Duplicates (entries present in both M and M^T) are removed in place */
+  for (lapack_int k = 0; k < n; k++)
+    mark[k] = -1;
+  lapack_int q = 0;
+  for (lapack_int k = 0; k < n; k++) {
+    const lapack_int start = sp[k];
+    sp[k] = q;
+    for (lapack_int p = start; p < sp[k + 1]; p++) {
+      const lapack_int w = (*si)[p];
+      if (mark[w] != k) {
+        mark[w] = k;
+        (*si)[q++] = w;
+      }
+    }
+  }
+  sp[n] = q;
+  free(mark);
+  return sp;
+
+error:
+  free(sp);
+  free(mark);
+  free(*si);
+  *si = NULL;
+  return NULL;
+}
+
+/**
+ * @brief Internal: breadth first visit for the Cuthill-McKee ordering
+ *
+ * Visits the nodes with negative level reachable from root, storing them in order. The
+ * neighbours of each node are visited by increasing degree. Returns the number of visited nodes.
+ */
+static lapack_int sparse_bfs(const lapack_int *sp, const lapack_int *si, const lapack_int root, lapack_int *order, lapack_int *level)
+{
+  lapack_int head = 0, tail = 0;
+  order[tail++] = root;
+  level[root] = 0;
+  while (head < tail) {
+    const lapack_int v = order[head++];
+    const lapack_int start = tail;
+    for (lapack_int p = sp[v]; p < sp[v + 1]; p++) {
+      const lapack_int w = si[p];
+      if (level[w] < 0) {
+        level[w] = level[v] + 1;
+        order[tail++] = w;
+      }
+    }
+    for (lapack_int a = start + 1; a < tail; a++) {
+      const lapack_int w = order[a];
+      const lapack_int dw = sp[w + 1] - sp[w];
+      lapack_int b = a;
+      for (; b > start && sp[order[b - 1] + 1] - sp[order[b - 1]] > dw; b--)
+        order[b] = order[b - 1];
+      order[b] = w;
+    }
+  }
+  return tail;
+}
+
+/**
+ * @brief Internal: reverse Cuthill-McKee ordering of a symmetric pattern
+ *
+ * Each connected component starts from a pseudo-peripheral node, found with repeated visits
+ * from the nodes of minimum degree of the last level. Returns perm (n elements) or NULL.
+ */
+static lapack_int *sparse_rcm(const lapack_int n, const lapack_int *sp, const lapack_int *si)
+{
+  lapack_int *perm = (lapack_int *)malloc(n * sizeof(lapack_int));
+  lapack_int *level = (lapack_int *)malloc(n * sizeof(lapack_int));
+  lapack_int *nodes = (lapack_int *)calloc(n + 1, sizeof(lapack_int));
+  if (!perm || !level || !nodes) {
+    free(perm);
+    free(level);
+    free(nodes);
+    return NULL;
+  }
+
+  /* Nodes sorted by degree (counting sort), used for the start of the components */
+  lapack_int *count = level;
+  for (lapack_int k = 0; k < n; k++)
+    count[k] = 0;
+  for (lapack_int k = 0; k < n; k++)
+    count[sp[k + 1] - sp[k]]++;
+  for (lapack_int d = 0, total = 0; d < n; d++) {
+    const lapack_int c = count[d];
+    count[d] = total;
+    total += c;
+  }
+  for (lapack_int k = 0; k < n; k++)
+    nodes[count[sp[k + 1] - sp[k]]++] = k;
+  for (lapack_int k = 0; k < n; k++)
+    level[k] = -1;
+
+  lapack_int q = 0;
+  for (lapack_int s = 0; s < n; s++) {
+    lapack_int root = nodes[s];
+    if (level[root] >= 0)
+      continue;
+    lapack_int visited = sparse_bfs(sp, si, root, perm + q, level);
+    lapack_int depth = level[perm[q + visited - 1]];
+    for (;;) {
+      lapack_int candidate = perm[q + visited - 1];
+      for (lapack_int a = visited - 1; a >= 0 && level[perm[q + a]] == depth; a--)
+        if (sp[perm[q + a] + 1] - sp[perm[q + a]] < sp[candidate + 1] - sp[candidate])
+          candidate = perm[q + a];
+      if (candidate == root)
+        break;
+      for (lapack_int a = 0; a < visited; a++)
+        level[perm[q + a]] = -1;
+      visited = sparse_bfs(sp, si, candidate, perm + q, level);
+      root = candidate;
+      if (level[perm[q + visited - 1]] <= depth)
+        break;
+      depth = level[perm[q + visited - 1]];
+    }
+    q += visited;
+  }
+
+  for (lapack_int k = 0; k < n / 2; k++) {
+    const lapack_int swap = perm[k];
+    perm[k] = perm[n - 1 - k];
+    perm[n - 1 - k] = swap;
+  }
+  free(level);
+  free(nodes);
+  return perm;
+}
+
+/**
+ * @brief Internal: setup of the banded path
+ */
+static int sparse_band_setup(sparse_lu *lu, const sparse_pattern *pattern, const lapack_int *iperm)
+{
+  const lapack_int n = lu->n;
+  const lapack_int ldab = 2 * lu->kl + lu->ku + 1;
+  lu->ab = (double *)calloc(ldab * n, sizeof(double));
+  lu->ipiv = (lapack_int *)calloc(n, sizeof(lapack_int));
+  if (!lu->ab || !lu->ipiv)
+    return -1;
+  for (lapack_int j = 0; j < n; j++)
+    for (lapack_int p = pattern->ptr[j]; p < pattern->ptr[j + 1]; p++) {
+      const lapack_int bi = iperm ? iperm[pattern->idx[p]] : pattern->idx[p];
+      const lapack_int bj = iperm ? iperm[j] : j;
+      lu->map[p] = lu->kl + lu->ku + bi - bj + bj * ldab;
+    }
+  return 0;
+}
+
+/**
+ * @brief Internal: symbolic analysis of the general path
+ *
+ * Splits the permuted matrix \f$B = P M P^T\f$ in the upper part (by columns) and in the
+ * strictly lower part (by rows), computes the elimination tree of \f$B + B^T\f$ and, from it,
+ * the row patterns of L (the column patterns of U), that are the same for any values.
+ */
+static int sparse_symbolic(sparse_lu *lu, const sparse_pattern *pattern, const lapack_int *sp, const lapack_int *si, const lapack_int *iperm)
+{
+  const lapack_int n = lu->n;
+  lu->up = (lapack_int *)calloc(n + 1, sizeof(lapack_int));
+  lu->lp = (lapack_int *)calloc(n + 1, sizeof(lapack_int));
+  lu->rp = (lapack_int *)calloc(n + 1, sizeof(lapack_int));
+  lu->fp = (lapack_int *)calloc(n + 1, sizeof(lapack_int));
+  lu->ui = (lapack_int *)malloc((lu->nnz > 0 ? lu->nnz : 1) * sizeof(lapack_int));
+  lu->ud = (double *)calloc(n, sizeof(double));
+  lapack_int *parent = (lapack_int *)malloc(n * sizeof(lapack_int));
+  lapack_int *mark = (lapack_int *)malloc(n * sizeof(lapack_int));
+  int ret = -1;
+  if (!lu->up || !lu->lp || !lu->rp || !lu->fp || !lu->ui || !lu->ud || !parent || !mark)
+    goto exit;
+
+  /* Upper and lower parts of B, with the index of the values of M */
+  for (lapack_int j = 0; j < n; j++)
+    for (lapack_int p = pattern->ptr[j]; p < pattern->ptr[j + 1]; p++) {
+      const lapack_int bi = iperm[pattern->idx[p]];
+      const lapack_int bj = iperm[j];
+      if (bi <= bj)
+        lu->up[bj + 1]++;
+      else
+        lu->lp[bi + 1]++;
+    }
+  for (lapack_int k = 0; k < n; k++) {
+    lu->up[k + 1] += lu->up[k];
+    lu->lp[k + 1] += lu->lp[k];
+  }
+  lu->lj = lu->ui + lu->up[n];
+  for (lapack_int k = 0; k < n; k++)
+    mark[k] = lu->up[k];
+  for (lapack_int k = 0; k < n; k++)
+    parent[k] = lu->lp[k];
+  for (lapack_int j = 0; j < n; j++)
+    for (lapack_int p = pattern->ptr[j]; p < pattern->ptr[j + 1]; p++) {
+      const lapack_int bi = iperm[pattern->idx[p]];
+      const lapack_int bj = iperm[j];
+      if (bi <= bj) {
+        lu->ui[mark[bj]] = bi;
+        lu->map[mark[bj]++] = p;
+      } else {
+        lu->lj[parent[bi]] = bj;
+        lu->map[lu->up[n] + parent[bi]++] = p;
+      }
+    }
+
+  /* Elimination tree (with path compression on the ancestors, stored in mark) */
+  for (lapack_int k = 0; k < n; k++) {
+    parent[k] = -1;
+    mark[k] = -1;
+    for (lapack_int p = sp[lu->perm[k]]; p < sp[lu->perm[k] + 1]; p++) {
+      lapack_int i = iperm[si[p]];
+      while (i != -1 && i < k) {
+        const lapack_int next = mark[i];
+        mark[i] = k;
+        if (next == -1)
+          parent[i] = k;
+        i = next;
+      }
+    }
+  }
+
+  /* Row patterns of L: reach of the row of B in the elimination tree (counted, then stored) */
+  for (int pass = 0; pass < 2; pass++) {
+    for (lapack_int k = 0; k < n; k++)
+      mark[k] = -1;
+    for (lapack_int k = 0; k < n; k++) {
+      lapack_int len = 0;
+      mark[k] = k;
+      for (lapack_int p = sp[lu->perm[k]]; p < sp[lu->perm[k] + 1]; p++)
+        for (lapack_int i = iperm[si[p]]; i < k && mark[i] != k; i = parent[i]) {
+          mark[i] = k;
+          if (pass)
+            lu->ri[lu->rp[k] + len] = i;
+          len++;
+        }
+      if (pass)
+        qsort(lu->ri + lu->rp[k], len, sizeof(lapack_int), sparse_compare);
+      else
+        lu->rp[k + 1] = lu->rp[k] + len;
+    }
+    if (!pass) {
+      lu->nnz_lu = lu->rp[n];
+      lu->ri = (lapack_int *)malloc((lu->nnz_lu > 0 ? lu->nnz_lu : 1) * sizeof(lapack_int));
+      if (!lu->ri)
+        goto exit;
+    }
+  }
+
+  /* Column patterns of L, filled by rows thus sorted, and position of the row patterns elements */
+  const lapack_int size = lu->nnz_lu > 0 ? lu->nnz_lu : 1;
+  lu->rslot = (lapack_int *)malloc(size * sizeof(lapack_int));
+  lu->fi = (lapack_int *)malloc(size * sizeof(lapack_int));
+  lu->lx = (double *)calloc(size, sizeof(double));
+  lu->ux = (double *)calloc(size, sizeof(double));
+  if (!lu->rslot || !lu->fi || !lu->lx || !lu->ux)
+    goto exit;
+  for (lapack_int r = 0; r < lu->nnz_lu; r++)
+    lu->fp[lu->ri[r] + 1]++;
+  for (lapack_int k = 0; k < n; k++) {
+    lu->fp[k + 1] += lu->fp[k];
+    mark[k] = lu->fp[k];
+  }
+  for (lapack_int k = 0; k < n; k++)
+    for (lapack_int r = lu->rp[k]; r < lu->rp[k + 1]; r++) {
+      const lapack_int slot = mark[lu->ri[r]]++;
+      lu->fi[slot] = k;
+      lu->rslot[r] = slot;
+    }
+  ret = 0;
+
+exit:
+  free(parent);
+  free(mark);
+  return ret;
+}
+
+sparse_lu *sparse_lu_alloc(const sparse_pattern *pattern)
+{
+  if (!pattern || !pattern->ptr || !pattern->idx || pattern->n <= 0)
+    return NULL;
+  const lapack_int n = pattern->n;
+  for (lapack_int p = 0; p < pattern->ptr[n]; p++)
+    if (pattern->idx[p] < 0 || pattern->idx[p] >= n)
+      return NULL;
+
+  sparse_lu *lu = (sparse_lu *)calloc(1, sizeof(sparse_lu));
+  if (!lu)
+    return NULL;
+  lu->n = n;
+  lu->nnz = pattern->ptr[n];
+  lu->ku = -1;
+  lu->map = (lapack_int *)malloc((lu->nnz > 0 ? lu->nnz : 1) * sizeof(lapack_int));
+  lu->work = (double *)calloc(2 * n, sizeof(double));
+
+  lapack_int *si = NULL;
+  lapack_int *sp = sparse_symmetric(pattern, &si);
+  lapack_int *iperm = (lapack_int *)malloc(n * sizeof(lapack_int));
+  if (!lu->map || !lu->work || !sp || !iperm)
+    goto error;
+  lu->perm = sparse_rcm(n, sp, si);
+  if (!lu->perm)
+    goto error;
+  for (lapack_int k = 0; k < n; k++)
+    iperm[lu->perm[k]] = k;
+
+  /* Bandwidths of M, and of the symmetric pattern in the reverse Cuthill-McKee ordering */
+  lapack_int kl = 0, ku = 0, bw = 0;
+  for (lapack_int j = 0; j < n; j++)
+    for (lapack_int p = pattern->ptr[j]; p < pattern->ptr[j + 1]; p++) {
+      const lapack_int d = pattern->idx[p] - j;
+      kl = d > kl ? d : kl;
+      ku = -d > ku ? -d : ku;
+    }
+  for (lapack_int k = 0; k < n; k++)
+    for (lapack_int p = sp[k]; p < sp[k + 1]; p++) {
+      const lapack_int d = iperm[k] - iperm[si[p]];
+      bw = d > bw ? d : bw;
+    }
+
+  int ret;
+  if (2 * kl + ku + 1 <= SPARSE_BAND_MAX && 2 * kl + ku <= 3 * bw) {
+    /* BANDED PATH, natural ordering */
+    free(lu->perm);
+    lu->perm = NULL;
+    lu->kl = kl;
+    lu->ku = ku;
+    ret = sparse_band_setup(lu, pattern, NULL);
+  } else if (3 * bw + 1 <= SPARSE_BAND_MAX) {
+    /* BANDED PATH, reverse Cuthill-McKee ordering */
+    lu->kl = bw;
+    lu->ku = bw;
+    ret = sparse_band_setup(lu, pattern, iperm);
+  } else {
+    /* GENERAL PATH */
+    ret = sparse_symbolic(lu, pattern, sp, si, iperm);
+  }
+  if (ret != 0)
+    goto error;
+
+  free(sp);
+  free(si);
+  free(iperm);
+  return lu;
+
+error:
+  free(sp);
+  free(si);
+  free(iperm);
+  sparse_lu_free(lu);
+  return NULL;
+}
+
+void sparse_lu_free(sparse_lu *lu)
+{
+  if (!lu)
+    return;
+  free(lu->perm);
+  free(lu->ipiv);
+  free(lu->ab);
+  free(lu->map);
+  free(lu->up);
+  free(lu->ui);
+  free(lu->lp);
+  free(lu->rp);
+  free(lu->ri);
+  free(lu->rslot);
+  free(lu->fp);
+  free(lu->fi);
+  free(lu->lx);
+  free(lu->ux);
+  free(lu->ud);
+  free(lu->work);
+  free(lu);
+}
+
+lapack_int sparse_lu_factor(sparse_lu *lu, const double *values)
+{
+  const lapack_int n = lu->n;
+
+  /* BANDED PATH */
+  if (lu->ku >= 0) {
+    const lapack_int ldab = 2 * lu->kl + lu->ku + 1;
+    memset(lu->ab, 0, ldab * n * sizeof(double));
+    for (lapack_int p = 0; p < lu->nnz; p++)
+      lu->ab[lu->map[p]] = values[p];
+    return LAPACKE_dgbtrf_work(LAPACK_COL_MAJOR, n, n, lu->kl, lu->ku, lu->ab, ldab, lu->ipiv);
+  }
+
+  /* GENERAL PATH: row k of L and column k of U, from the previous rows and columns */
+  double *xc = lu->work;
+  double *xr = lu->work + n;
+  const lapack_int *lmap = lu->map + lu->up[n];
+  for (lapack_int k = 0; k < n; k++) {
+    double scale = 0;
+    for (lapack_int q = lu->up[k]; q < lu->up[k + 1]; q++) {
+      xc[lu->ui[q]] = values[lu->map[q]];
+      scale = fmax(scale, fabs(values[lu->map[q]]));
+    }
+    for (lapack_int q = lu->lp[k]; q < lu->lp[k + 1]; q++) {
+      xr[lu->lj[q]] = values[lmap[q]];
+      scale = fmax(scale, fabs(values[lmap[q]]));
+    }
+    double d = xc[k];
+    xc[k] = 0;
+
+    for (lapack_int r = lu->rp[k]; r < lu->rp[k + 1]; r++) {
+      const lapack_int j = lu->ri[r];
+      const double u = xc[j];
+      const double l = xr[j] / lu->ud[j];
+      xc[j] = 0;
+      xr[j] = 0;
+      for (lapack_int p = lu->fp[j]; p < lu->fp[j + 1] && lu->fi[p] < k; p++) {
+        xc[lu->fi[p]] -= lu->lx[p] * u;
+        xr[lu->fi[p]] -= l * lu->ux[p];
+      }
+      d -= l * u;
+      lu->lx[lu->rslot[r]] = l;
+      lu->ux[lu->rslot[r]] = u;
+    }
+
+    /* Static pivoting: zero and tiny pivots (relative to the row and column) are rejected */
+    if (!(fabs(d) > SPARSE_PIVOT_TOL * scale))
+      return k + 1;
+    lu->ud[k] = d;
+  }
+  return 0;
+}
+
+void sparse_lu_solve(sparse_lu *lu, const char trans, double *b)
+{
+  const lapack_int n = lu->n;
+  double *y = lu->perm ? lu->work : b;
+  if (lu->perm)
+    for (lapack_int k = 0; k < n; k++)
+      y[k] = b[lu->perm[k]];
+
+  if (lu->ku >= 0) {
+    /* BANDED PATH */
+    LAPACKE_dgbtrs_work(LAPACK_COL_MAJOR, trans, n, lu->kl, lu->ku, 1,
+                        lu->ab, 2 * lu->kl + lu->ku + 1, lu->ipiv, y, n);
+  } else if (trans == 'N' || trans == 'n') {
+    /* L U y = b: forward with the columns of L, backward with the rows of U */
+    for (lapack_int j = 0; j < n; j++)
+      for (lapack_int p = lu->fp[j]; p < lu->fp[j + 1]; p++)
+        y[lu->fi[p]] -= lu->lx[p] * y[j];
+    for (lapack_int j = n - 1; j >= 0; j--) {
+      double s = y[j];
+      for (lapack_int p = lu->fp[j]; p < lu->fp[j + 1]; p++)
+        s -= lu->ux[p] * y[lu->fi[p]];
+      y[j] = s / lu->ud[j];
+    }
+  } else {
+    /* U^T L^T y = b: forward with the columns of U^T, backward with the rows of L^T */
+    for (lapack_int j = 0; j < n; j++) {
+      y[j] /= lu->ud[j];
+      for (lapack_int p = lu->fp[j]; p < lu->fp[j + 1]; p++)
+        y[lu->fi[p]] -= lu->ux[p] * y[j];
+    }
+    for (lapack_int j = n - 1; j >= 0; j--) {
+      double s = y[j];
+      for (lapack_int p = lu->fp[j]; p < lu->fp[j + 1]; p++)
+        s -= lu->lx[p] * y[lu->fi[p]];
+      y[j] = s;
+    }
+  }
+
+  if (lu->perm)
+    for (lapack_int k = 0; k < n; k++)
+      b[lu->perm[k]] = y[k];
+}
+
+sparse_pattern *sparse_pattern_diagonal(const sparse_pattern *pattern, lapack_int *map)
+{
+  if (!pattern || !map)
+    return NULL;
+  const lapack_int n = pattern->n;
+  const lapack_int nnz = pattern->ptr[n];
+
+  lapack_int missing = n;
+  for (lapack_int k = 0; k < n; k++)
+    for (lapack_int p = pattern->ptr[k]; p < pattern->ptr[k + 1]; p++)
+      if (pattern->idx[p] == k)
+        missing--;
+
+  sparse_pattern *diagonal = (sparse_pattern *)malloc(sizeof(sparse_pattern) + (n + 1 + nnz + missing) * sizeof(lapack_int));
+  if (!diagonal)
+    return NULL;
+  lapack_int *ptr = (lapack_int *)(diagonal + 1);
+  lapack_int *idx = ptr + n + 1;
+  diagonal->n = n;
+  diagonal->ptr = ptr;
+  diagonal->idx = idx;
+
+  /* Nonzeros are copied, and the missing diagonal elements appended to their row (column) */
+  lapack_int q = 0;
+  for (lapack_int k = 0; k < n; k++) {
+    ptr[k] = q;
+    map[nnz + k] = -1;
+    for (lapack_int p = pattern->ptr[k]; p < pattern->ptr[k + 1]; p++) {
+      if (pattern->idx[p] == k)
+        map[nnz + k] = q;
+      map[p] = q;
+      idx[q++] = pattern->idx[p];
+    }
+    if (map[nnz + k] < 0) {
+      map[nnz + k] = q;
+      idx[q++] = k;
+    }
+  }
+  ptr[n] = q;
+  return diagonal;
+}
+
+sparse_coloring *sparse_coloring_alloc(const sparse_pattern *pattern, const lapack_int ordering)
+{
+  if (!pattern || !pattern->ptr || !pattern->idx || pattern->n <= 0)
+    return NULL;
+  const lapack_int n = pattern->n;
+  const lapack_int nnz = pattern->ptr[n];
+
+  sparse_coloring *coloring = (sparse_coloring *)calloc(1, sizeof(sparse_coloring));
+  if (!coloring)
+    return NULL;
+  coloring->n = n;
+  coloring->cptr = (lapack_int *)calloc(n + 1, sizeof(lapack_int));
+  coloring->cols = (lapack_int *)calloc(n, sizeof(lapack_int));
+  coloring->jptr = (lapack_int *)calloc(n + 1, sizeof(lapack_int));
+  coloring->rows = (lapack_int *)calloc(nnz + 1, sizeof(lapack_int));
+  coloring->pos = (lapack_int *)calloc(nnz + 1, sizeof(lapack_int));
+  lapack_int *iptr = (lapack_int *)calloc(n + 1, sizeof(lapack_int));
+  lapack_int *icols = (lapack_int *)calloc(nnz + 1, sizeof(lapack_int));
+  lapack_int *color = (lapack_int *)malloc(n * sizeof(lapack_int));
+  lapack_int *forbidden = (lapack_int *)malloc(n * sizeof(lapack_int));
+  if (!coloring->cptr || !coloring->cols || !coloring->jptr || !coloring->rows || !coloring->pos ||
+      !iptr || !icols || !color || !forbidden) {
+    sparse_coloring_free(coloring);
+    coloring = NULL;
+    goto exit;
+  }
+
+  /* Nonzeros by columns (jptr, rows, pos) and by rows (iptr, icols), whatever the ordering */
+  const int csr = ordering == LAPACK_ROW_MAJOR;
+  for (lapack_int k = 0; k < n; k++)
+    for (lapack_int q = pattern->ptr[k]; q < pattern->ptr[k + 1]; q++) {
+      coloring->jptr[(csr ? pattern->idx[q] : k) + 1]++;
+      iptr[(csr ? k : pattern->idx[q]) + 1]++;
+    }
+  for (lapack_int k = 0; k < n; k++) {
+    coloring->jptr[k + 1] += coloring->jptr[k];
+    iptr[k + 1] += iptr[k];
+    color[k] = coloring->jptr[k];
+    forbidden[k] = iptr[k];
+  }
+  for (lapack_int k = 0; k < n; k++)
+    for (lapack_int q = pattern->ptr[k]; q < pattern->ptr[k + 1]; q++) {
+      const lapack_int i = csr ? k : pattern->idx[q];
+      const lapack_int j = csr ? pattern->idx[q] : k;
+      coloring->rows[color[j]] = i;
+      coloring->pos[color[j]++] = q;
+      icols[forbidden[i]++] = j;
+    }
+
+  /* Greedy coloring: each column takes the first group without nonzeros in its rows */
+  for (lapack_int k = 0; k < n; k++) {
+    color[k] = -1;
+    forbidden[k] = -1;
+  }
+  for (lapack_int j = 0; j < n; j++) {
+    for (lapack_int p = coloring->jptr[j]; p < coloring->jptr[j + 1]; p++) {
+      const lapack_int i = coloring->rows[p];
+      for (lapack_int r = iptr[i]; r < iptr[i + 1]; r++)
+        if (color[icols[r]] >= 0)
+          forbidden[color[icols[r]]] = j;
+    }
+    lapack_int c = 0;
+    while (c < coloring->colors && forbidden[c] == j)
+      c++;
+    color[j] = c;
+    if (c == coloring->colors)
+      coloring->colors++;
+  }
+
+  /* Columns sorted by group */
+  for (lapack_int j = 0; j < n; j++)
+    coloring->cptr[color[j] + 1]++;
+  for (lapack_int c = 0; c < coloring->colors; c++) {
+    coloring->cptr[c + 1] += coloring->cptr[c];
+    forbidden[c] = coloring->cptr[c];
+  }
+  for (lapack_int j = 0; j < n; j++)
+    coloring->cols[forbidden[color[j]]++] = j;
+
+exit:
+  free(iptr);
+  free(icols);
+  free(color);
+  free(forbidden);
+  return coloring;
+}
+
+void sparse_coloring_free(sparse_coloring *coloring)
+{
+  if (!coloring)
+    return;
+  free(coloring->cptr);
+  free(coloring->cols);
+  free(coloring->jptr);
+  free(coloring->rows);
+  free(coloring->pos);
+  free(coloring);
+}
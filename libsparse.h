@@ -0,0 +1,184 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef LIBSPARSE_H_
+#define LIBSPARSE_H_
+
+#include <lapacke.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Sparsity pattern of a square matrix
+ *
+ * The pattern is stored in compressed form. For LAPACK_ROW_MAJOR ordering it is a compressed
+ * sparse row (CSR) pattern: ptr contains the offsets of the rows and idx the column indexes.
+ * For LAPACK_COL_MAJOR ordering it is a compressed sparse column (CSC) pattern: ptr contains
+ * the offsets of the columns and idx the row indexes. The values of the matrix are stored in
+ * an array of ptr[n] elements, in the same order of idx. Indexes are 0 based and must not be
+ * repeated in a row (column).
+ */
+typedef struct sparse_pattern {
+  lapack_int n;          /**< Matrix dimension */
+  const lapack_int *ptr; /**< Offsets of the compressed rows (columns). n + 1 elements */
+  const lapack_int *idx; /**< Column (row) indexes of the nonzeros. ptr[n] elements */
+} sparse_pattern;
+
+#define SPARSE_BAND_MAX 32 /**< Maximum band storage width (2 kl + ku + 1) for the banded path */
+#define SPARSE_PIVOT_TOL 1e-12 /**< Minimum ratio between a pivot of the general path and the largest
+                                     entry of its row and column in the matrix */
+
+/**
+ * @brief Sparse LU factorization with reusable symbolic analysis
+ *
+ * The structure is created once for a pattern: the symbolic analysis (fill reducing ordering,
+ * elimination tree and pattern of the factors) is computed at allocation, and each numeric
+ * factorization only fills the preallocated factors, without allocating memory.
+ *
+ * The matrix is always seen as the CSC matrix \f$M\f$ described by the pattern, that is the
+ * matrix itself for column major ordering and its transpose for row major ordering (the same
+ * trick used with DGELS): systems with row major matrices are solved as transposed systems.
+ *
+ * If the (symmetric, reverse Cuthill-McKee permuted) pattern fits in a band of storage width
+ * at most SPARSE_BAND_MAX, the banded LAPACK solver (DGBTRF/DGBTRS, with partial pivoting) is
+ * used. Otherwise the factors \f$P M P^T = L U\f$ are computed by an up-looking algorithm
+ * with static (diagonal) pivoting, that is well suited for the iteration matrices of the
+ * implicit steps \f$-I + \alpha h J\f$ (whose diagonal is always in the pattern), but fails (as a
+ * singular matrix) on zero pivots and on pivots below SPARSE_PIVOT_TOL times the largest entry
+ * of their row and column, that would make the factors unstable.
+ */
+typedef struct sparse_lu {
+  lapack_int n;          /**< Matrix dimension */
+  lapack_int nnz;        /**< Nonzeros of the matrix (dimension of the values array) */
+  lapack_int nnz_lu;     /**< Off diagonal nonzeros of each of the L and U factors */
+  lapack_int *perm;      /**< Symmetric permutation: row (column) k of the factors is perm[k] of M.
+                              NULL for the natural ordering */
+  lapack_int kl;         /**< Lower bandwidth for the banded path */
+  lapack_int ku;         /**< Upper bandwidth for the banded path. Negative for the general path */
+  lapack_int *ipiv;      /**< Pivoting of the banded factors. n elements */
+  double *ab;            /**< Banded factors. (2 kl + ku + 1) * n elements */
+  lapack_int *map;       /**< Banded path: position of each value of M in the band storage.
+                              General path: index of the value of M of each element of the upper
+                              part, followed by the lower part, of the permuted matrix */
+  lapack_int *up;        /**< Offsets of the upper part (with the diagonal) of the permuted matrix
+                              by columns. n + 1 elements */
+  lapack_int *ui;        /**< Row indexes of the upper part of the permuted matrix */
+  lapack_int *lp;        /**< Offsets of the strictly lower part of the permuted matrix by rows.
+                              n + 1 elements */
+  lapack_int *lj;        /**< Column indexes of the strictly lower part of the permuted matrix */
+  lapack_int *rp;        /**< Offsets of the row patterns of L (sorted). n + 1 elements */
+  lapack_int *ri;        /**< Column indexes of the row patterns of L. nnz_lu elements */
+  lapack_int *rslot;     /**< Position in the factors of each element of the row patterns */
+  lapack_int *fp;        /**< Offsets of the columns of L (equal to the rows of U). n + 1 elements */
+  lapack_int *fi;        /**< Row indexes of the columns of L (column indexes of the rows of U) */
+  double *lx;            /**< Values of L (unit diagonal, not stored). nnz_lu elements */
+  double *ux;            /**< Values of U, without diagonal. nnz_lu elements */
+  double *ud;            /**< Diagonal of U. n elements */
+  double *work;          /**< Working space. 2 * n elements */
+} sparse_lu;
+
+/**
+ * @brief Column groups for the finite difference Jacobian (Curtis-Powell-Reid)
+ *
+ * The columns are partitioned in groups of structurally orthogonal columns (that have no nonzero
+ * in the same row), by a greedy coloring of the column intersection graph. All the columns of a
+ * group are perturbed together, thus a Jacobian costs one vector field evaluation per group
+ * (e.g. three for a tridiagonal matrix), instead of one per column.
+ */
+typedef struct sparse_coloring {
+  lapack_int n;          /**< Matrix dimension */
+  lapack_int colors;     /**< Number of groups */
+  lapack_int *cptr;      /**< Offsets of the groups. colors + 1 elements */
+  lapack_int *cols;      /**< Columns of the groups. n elements */
+  lapack_int *jptr;      /**< Offsets of the nonzeros of each column. n + 1 elements */
+  lapack_int *rows;      /**< Row index of the nonzeros, by columns */
+  lapack_int *pos;       /**< Position in the values array of the nonzeros, by columns */
+} sparse_coloring;
+
+/**
+ * @brief Allocates the column groups of a sparsity pattern
+ * @param pattern pattern of the matrix
+ * @param ordering LAPACK_ROW_MAJOR for a CSR pattern, LAPACK_COL_MAJOR for a CSC pattern
+ * @return the column groups, or NULL if memory cannot be allocated
+ */
+sparse_coloring *sparse_coloring_alloc(const sparse_pattern *pattern, const lapack_int ordering);
+
+/**
+ * @brief Releases the column groups of a sparsity pattern
+ * @param coloring column groups to release. It can be NULL.
+ */
+void sparse_coloring_free(sparse_coloring *coloring);
+
+/**
+ * @brief Allocates a sparse LU factorization and computes its symbolic analysis
+ * @param pattern pattern of the matrix
+ * @return the factorization structure, or NULL if memory cannot be allocated or the
+ *         pattern is not valid
+ */
+sparse_lu *sparse_lu_alloc(const sparse_pattern *pattern);
+
+/**
+ * @brief Computes the numeric factorization
+ *
+ * Does not allocate memory. The symbolic analysis is reused for any values of the matrix with
+ * the pattern given at allocation.
+ * @param lu factorization structure
+ * @param values nonzeros of the matrix, in the order of the pattern
+ * @return 0 on success, k > 0 if the k-th pivot is zero (as LAPACK) or, for the general path,
+ *         below the SPARSE_PIVOT_TOL threshold
+ */
+lapack_int sparse_lu_factor(sparse_lu *lu, const double *values);
+
+/**
+ * @brief Solves a linear system with the factors, in place
+ * @param lu factorization structure, factorized with sparse_lu_factor()
+ * @param trans 'N' to solve \f$M x = b\f$, 'T' to solve \f$M^T x = b\f$
+ * @param b right hand side on input, solution on output. n elements
+ */
+void sparse_lu_solve(sparse_lu *lu, const char trans, double *b);
+
+/**
+ * @brief Releases a sparse LU factorization
+ * @param lu factorization to release. It can be NULL.
+ */
+void sparse_lu_free(sparse_lu *lu);
+
+/**
+ * @brief Adds the diagonal to a sparsity pattern
+ *
+ * Creates a new pattern, allocated in a single block (to be released with free()), that contains
+ * all the nonzeros of the input pattern and the whole diagonal (e.g. for the iteration matrix
+ * \f$-I + \alpha h J\f$). The ordering of the pattern is preserved.
+ * @param pattern input pattern
+ * @param map position in the new pattern of each nonzero of the input pattern (ptr[n] elements),
+ *        followed by the position of each diagonal element (n elements)
+ * @return the new pattern, or NULL if memory cannot be allocated
+ */
+sparse_pattern *sparse_pattern_diagonal(const sparse_pattern *pattern, lapack_int *map);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,311 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libtraj.h"
+
+struct traj_writer {
+  int fd;                 /**< File descriptor */
+  lapack_int x_size;      /**< Number of state columns */
+  lapack_int u_size;      /**< Number of input columns */
+  lapack_int cols;        /**< Columns of a row, 1 + x_size + u_size */
+  lapack_int chunk_rows;  /**< Rows of a chunk */
+  double *buffer[2];      /**< Chunk buffers, in columnar order. cols * chunk_rows elements each */
+  lapack_int active;      /**< Buffer receiving the rows */
+  lapack_int fill;        /**< Rows in the active buffer */
+  int64_t rows;           /**< Rows pushed */
+  pthread_t thread;       /**< Writer thread */
+  pthread_mutex_t lock;   /**< Protects the fields below */
+  pthread_cond_t ready;   /**< Signals a pending chunk (or the exit) to the thread */
+  pthread_cond_t idle;    /**< Signals that the pending chunk was written */
+  lapack_int pending;     /**< Buffer to be written, -1 if none */
+  lapack_int pending_fill; /**< Rows of the pending buffer */
+  int64_t chunks;         /**< Chunks written */
+  newton_bool failed;     /**< A write failed */
+  newton_bool quit;       /**< The thread must exit */
+};
+
+/**
+ * @brief Internal: writes the whole buffer at the offset, retrying partial writes
+ */
+static newton_bool traj_pwrite(const int fd, const void *buffer, size_t size, off_t offset)
+{
+  const char *p = (const char *)buffer;
+  while (size > 0) {
+    ssize_t written = pwrite(fd, p, size, offset);
+    if (written <= 0)
+      return NEWTON_FALSE;
+    p += written;
+    size -= (size_t)written;
+    offset += written;
+  }
+  return NEWTON_TRUE;
+}
+
+/**
+ * @brief Internal: main loop of the writer thread
+ */
+static void *traj_thread(void *arg)
+{
+  traj_writer *w = (traj_writer *)arg;
+  const size_t chunk_bytes = (size_t)w->cols * w->chunk_rows * sizeof(double);
+
+  pthread_mutex_lock(&w->lock);
+  for (;;) {
+    while (w->pending < 0 && !w->quit)
+      pthread_cond_wait(&w->ready, &w->lock);
+    if (w->pending < 0)
+      break;
+    double *chunk = w->buffer[w->pending];
+    const lapack_int fill = w->pending_fill;
+    const off_t offset = (off_t)sizeof(traj_header) + (off_t)w->chunks * chunk_bytes;
+    pthread_mutex_unlock(&w->lock);
+
+    /* The last chunk is padded with zeros, thus all the chunks have the same layout */
+    if (fill < w->chunk_rows)
+      for (lapack_int j = 0; j < w->cols; j++)
+        memset(chunk + j * w->chunk_rows + fill, 0, (w->chunk_rows - fill) * sizeof(double));
+    const newton_bool ok = traj_pwrite(w->fd, chunk, chunk_bytes, offset);
+
+    pthread_mutex_lock(&w->lock);
+    if (!ok)
+      w->failed = NEWTON_TRUE;
+    w->chunks++;
+    w->pending = -1;
+    pthread_cond_signal(&w->idle);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+/**
+ * @brief Internal: hands the active buffer to the thread and switches to the other one. It
+ * waits only if the other buffer is still being written
+ */
+static traj_ret traj_submit(traj_writer *w)
+{
+  pthread_mutex_lock(&w->lock);
+  while (w->pending >= 0)
+    pthread_cond_wait(&w->idle, &w->lock);
+  const newton_bool failed = w->failed;
+  w->pending = w->active;
+  w->pending_fill = w->fill;
+  pthread_cond_signal(&w->ready);
+  pthread_mutex_unlock(&w->lock);
+
+  w->active = 1 - w->active;
+  w->fill = 0;
+  return failed ? TRAJ_EIO : TRAJ_SUCCESS;
+}
+
+traj_writer *traj_writer_open(const char *path, const lapack_int x_size, const lapack_int u_size, const lapack_int chunk_rows)
+{
+  if (!path || x_size <= 0 || u_size < 0 || chunk_rows < 0)
+    return NULL;
+
+  traj_writer *w = (traj_writer *)calloc(1, sizeof(traj_writer));
+  if (!w)
+    return NULL;
+  w->x_size = x_size;
+  w->u_size = u_size;
+  w->cols = 1 + x_size + u_size;
+  w->chunk_rows = chunk_rows > 0 ? chunk_rows : TRAJ_CHUNK_ROWS;
+  w->pending = -1;
+
+  w->buffer[0] = (double *)malloc((size_t)w->cols * w->chunk_rows * sizeof(double));
+  w->buffer[1] = (double *)malloc((size_t)w->cols * w->chunk_rows * sizeof(double));
+  w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (!w->buffer[0] || !w->buffer[1] || w->fd < 0) {
+    if (w->fd >= 0)
+      close(w->fd);
+    free(w->buffer[0]);
+    free(w->buffer[1]);
+    free(w);
+    return NULL;
+  }
+
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->ready, NULL);
+  pthread_cond_init(&w->idle, NULL);
+  if (pthread_create(&w->thread, NULL, traj_thread, w) != 0) {
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->ready);
+    pthread_cond_destroy(&w->idle);
+    close(w->fd);
+    free(w->buffer[0]);
+    free(w->buffer[1]);
+    free(w);
+    return NULL;
+  }
+  return w;
+}
+
+traj_ret traj_writer_push(traj_writer *w, const double t, const double *x, const double *u)
+{
+  if (!w || !x)
+    return TRAJ_NULLPTR;
+
+  double *col = w->buffer[w->active] + w->fill;
+  col[0] = t;
+  for (lapack_int j = 0; j < w->x_size; j++)
+    col[(1 + j) * w->chunk_rows] = x[j];
+  for (lapack_int j = 0; j < w->u_size; j++)
+    col[(1 + w->x_size + j) * w->chunk_rows] = u ? u[j] : NAN;
+  w->rows++;
+
+  if (++w->fill == w->chunk_rows)
+    return traj_submit(w);
+  return TRAJ_SUCCESS;
+}
+
+traj_ret traj_writer_append(traj_writer *w, const double *rows, const lapack_int n_rows, const lapack_int n_cols)
+{
+  if (!w || (!rows && n_rows > 0))
+    return TRAJ_NULLPTR;
+  if (n_cols != w->cols && n_cols != 1 + w->x_size)
+    return TRAJ_GENERIC;
+
+  for (lapack_int i = 0; i < n_rows; i++) {
+    const double *row = rows + i * n_cols;
+    traj_ret ret = traj_writer_push(w, row[0], row + 1, n_cols == w->cols ? row + 1 + w->x_size : NULL);
+    if (ret != TRAJ_SUCCESS)
+      return ret;
+  }
+  return TRAJ_SUCCESS;
+}
+
+traj_ret traj_writer_close(traj_writer *w)
+{
+  if (!w)
+    return TRAJ_SUCCESS;
+
+  if (w->fill > 0)
+    traj_submit(w);
+  pthread_mutex_lock(&w->lock);
+  w->quit = NEWTON_TRUE;
+  pthread_cond_signal(&w->ready);
+  pthread_mutex_unlock(&w->lock);
+  pthread_join(w->thread, NULL);
+
+  /* The header is written last: an interrupted file has no valid row count */
+  traj_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRAJ_MAGIC, sizeof(TRAJ_MAGIC));
+  header.version = TRAJ_VERSION;
+  header.x_size = w->x_size;
+  header.u_size = w->u_size;
+  header.chunk_rows = w->chunk_rows;
+  header.rows = w->rows;
+  newton_bool ok = !w->failed && traj_pwrite(w->fd, &header, sizeof(header), 0) ? NEWTON_TRUE : NEWTON_FALSE;
+  if (close(w->fd) != 0)
+    ok = NEWTON_FALSE;
+
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->ready);
+  pthread_cond_destroy(&w->idle);
+  free(w->buffer[0]);
+  free(w->buffer[1]);
+  free(w);
+  return ok ? TRAJ_SUCCESS : TRAJ_EIO;
+}
+
+int traj_sink(const double *rows, const lapack_int n_rows, const lapack_int n_cols, void *data)
+{
+  return traj_writer_append((traj_writer *)data, rows, n_rows, n_cols) != TRAJ_SUCCESS;
+}
+
+traj_reader *traj_reader_open(const char *path)
+{
+  if (!path)
+    return NULL;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(traj_header)) {
+    close(fd);
+    return NULL;
+  }
+  void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  /* Checks the header, and that the file contains all the chunks */
+  const traj_header *header = (const traj_header *)map;
+  const int64_t cols = 1 + header->x_size + header->u_size;
+  const int64_t chunks = header->chunk_rows > 0 ? (header->rows + header->chunk_rows - 1) / header->chunk_rows : 0;
+  if (memcmp(header->magic, TRAJ_MAGIC, sizeof(TRAJ_MAGIC)) != 0 || header->version != TRAJ_VERSION ||
+      header->x_size <= 0 || header->u_size < 0 || header->chunk_rows <= 0 || header->rows < 0 ||
+      (int64_t)sizeof(traj_header) + chunks * cols * header->chunk_rows * (int64_t)sizeof(double) > (int64_t)st.st_size) {
+    munmap(map, (size_t)st.st_size);
+    return NULL;
+  }
+
+  traj_reader *r = (traj_reader *)calloc(1, sizeof(traj_reader));
+  if (!r) {
+    munmap(map, (size_t)st.st_size);
+    return NULL;
+  }
+  r->x_size = (lapack_int)header->x_size;
+  r->u_size = (lapack_int)header->u_size;
+  r->chunk_rows = (lapack_int)header->chunk_rows;
+  r->chunks = (lapack_int)chunks;
+  r->rows = header->rows;
+  r->data = (const double *)((const char *)map + sizeof(traj_header));
+  r->map = map;
+  r->map_size = (size_t)st.st_size;
+  return r;
+}
+
+const double *traj_reader_column(const traj_reader *r, const lapack_int chunk, const lapack_int column)
+{
+  if (!r || chunk < 0 || chunk >= r->chunks || column < 0 || column > r->x_size + r->u_size)
+    return NULL;
+  const size_t cols = 1 + r->x_size + r->u_size;
+  return r->data + ((size_t)chunk * cols + column) * r->chunk_rows;
+}
+
+lapack_int traj_reader_chunk_rows(const traj_reader *r, const lapack_int chunk)
+{
+  if (!r || chunk < 0 || chunk >= r->chunks)
+    return 0;
+  if (chunk < r->chunks - 1)
+    return r->chunk_rows;
+  return (lapack_int)(r->rows - (int64_t)chunk * r->chunk_rows);
+}
+
+void traj_reader_close(traj_reader *r)
+{
+  if (!r)
+    return;
+  munmap(r->map, r->map_size);
+  free(r);
+}
@@ -0,0 +1,173 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef LIBTRAJ_H_
+#define LIBTRAJ_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "libeuler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRAJ_MAGIC "EULTRAJ"  /**< Magic string at the start of a trajectory file */
+#define TRAJ_VERSION 1        /**< Version of the file format */
+#define TRAJ_CHUNK_ROWS 65536 /**< Default number of rows of a chunk */
+
+/**
+ * @brief Returning value for the trajectory storage
+ */
+typedef enum traj_ret {
+  TRAJ_SUCCESS = 0, /**< Correct execution */
+  TRAJ_EMALLOC,     /**< Memory allocation (or thread creation) error */
+  TRAJ_NULLPTR,     /**< Received a null pointer */
+  TRAJ_EIO,         /**< The file cannot be written */
+  TRAJ_GENERIC      /**< Wrong dimensions */
+} traj_ret;
+
+/**
+ * @brief Header of a trajectory file (64 bytes, in the byte order of the writer)
+ *
+ * The header is followed by the chunks. Each chunk stores chunk_rows rows in columnar order:
+ * the time column, then the state columns \f$x_1 .. x_n\f$ and the input columns
+ * \f$u_1 .. u_m\f$, each one of chunk_rows contiguous doubles. All the chunks have the same size
+ * (the last one is padded with zeros), thus column j of chunk c starts at byte
+ * \f$64 + 8\,(c\,(1 + n + m) + j)\,chunk\_rows\f$.
+ */
+typedef struct traj_header {
+  char magic[8];        /**< TRAJ_MAGIC, zero terminated */
+  int64_t version;      /**< TRAJ_VERSION. A different value also reveals a different byte order */
+  int64_t x_size;       /**< Number of state columns */
+  int64_t u_size;       /**< Number of input columns */
+  int64_t chunk_rows;   /**< Rows of a chunk */
+  int64_t rows;         /**< Number of rows in the file. Written when the writer is closed */
+  int64_t reserved[2];  /**< Reserved, zero */
+} traj_header;
+
+/**
+ * @brief Trajectory writer (opaque structure)
+ *
+ * The rows are stored in a chunk buffer, and a full chunk is handed to a background thread
+ * that writes it, while the rows continue on a second buffer (double buffering). The caller
+ * waits only if the disk is slower than the integration, when both the buffers are full.
+ */
+typedef struct traj_writer traj_writer;
+
+/**
+ * @brief Creates a trajectory file and starts its writer thread
+ * @param path file path. An existing file is truncated
+ * @param x_size number of state columns
+ * @param u_size number of input columns (it can be 0)
+ * @param chunk_rows rows of a chunk. If 0, uses TRAJ_CHUNK_ROWS
+ * @return the writer, or NULL if the file, the memory or the thread cannot be allocated
+ */
+traj_writer *traj_writer_open(const char *path, const lapack_int x_size, const lapack_int u_size, const lapack_int chunk_rows);
+
+/**
+ * @brief Appends a row to the trajectory
+ * @param w writer
+ * @param t time
+ * @param x state (x_size elements)
+ * @param u input (u_size elements). If NULL, the input columns of the row are NaN
+ * @return TRAJ_SUCCESS, or TRAJ_EIO if a previous chunk could not be written
+ */
+traj_ret traj_writer_push(traj_writer *w, const double t, const double *x, const double *u);
+
+/**
+ * @brief Appends a block of rows to the trajectory
+ * @param w writer
+ * @param rows block of rows in row major order, each one \f$[t, x_1 .. x_n, u_1 .. u_m]\f$
+ * @param n_rows number of rows in the block
+ * @param n_cols number of columns of the block. If it is 1 + x_size (as for the output sink of
+ *        euler_integrate() without an input provider), the input columns are NaN
+ * @return TRAJ_SUCCESS, TRAJ_GENERIC if the columns do not match, or TRAJ_EIO
+ */
+traj_ret traj_writer_append(traj_writer *w, const double *rows, const lapack_int n_rows, const lapack_int n_cols);
+
+/**
+ * @brief Flushes the pending rows, writes the header, stops the thread and releases the writer
+ * @param w writer. It can be NULL
+ * @return TRAJ_SUCCESS if the whole trajectory was written, otherwise TRAJ_EIO
+ */
+traj_ret traj_writer_close(traj_writer *w);
+
+/**
+ * @brief Output sink for euler_integrate(), that writes the trajectory to a writer
+ *
+ * The data pointer of the trajectory options must be the writer (see traj_writer_append()).
+ * @return non zero (interrupting the integration) if the rows cannot be written
+ */
+int traj_sink(const double *rows, const lapack_int n_rows, const lapack_int n_cols, void *data);
+
+/**
+ * @brief Zero-copy reader of a trajectory file
+ *
+ * The file is mapped in memory, and the columns of the chunks are read in place.
+ */
+typedef struct traj_reader {
+  lapack_int x_size;     /**< Number of state columns */
+  lapack_int u_size;     /**< Number of input columns */
+  lapack_int chunk_rows; /**< Rows of a chunk */
+  lapack_int chunks;     /**< Number of chunks */
+  int64_t rows;          /**< Number of rows */
+  const double *data;    /**< Mapped chunks */
+  void *map;             /**< Mapped file */
+  size_t map_size;       /**< Size of the mapping */
+} traj_reader;
+
+/**
+ * @brief Maps a trajectory file
+ * @param path file path
+ * @return the reader, or NULL if the file cannot be mapped or it is not a complete trajectory
+ *         file of the same byte order
+ */
+traj_reader *traj_reader_open(const char *path);
+
+/**
+ * @brief Column of a chunk
+ * @param r reader
+ * @param chunk index of the chunk, in [0, chunks)
+ * @param column 0 for the time, \f$1..n\f$ for the states, \f$n+1..n+m\f$ for the inputs
+ * @return pointer to the traj_reader_chunk_rows() values of the column, or NULL if the indices
+ *         are not valid
+ */
+const double *traj_reader_column(const traj_reader *r, const lapack_int chunk, const lapack_int column);
+
+/**
+ * @brief Number of valid rows of a chunk (chunk_rows, except for the last chunk)
+ */
+lapack_int traj_reader_chunk_rows(const traj_reader *r, const lapack_int chunk);
+
+/**
+ * @brief Unmaps a trajectory file and releases the reader
+ * @param r reader. It can be NULL
+ */
+void traj_reader_close(traj_reader *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBTRAJ_H_ */
@@ -0,0 +1,169 @@
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include "libeuler.h"
+#include "libad.hpp"
+
+/* Two tanks model, as in euleri_test.c, written once for the vector field and the Jacobian */
+const double A1 = 0.180, k = 0.003, a1 = 0.006, g = 9.810, A2 = 0.080, a2 = 0.008;
+
+struct tanks {
+  template <class T>
+  void operator()(T *f, const double t, const T *x, const double *u, const double **p) const {
+    f[0] = 1.0 / A1 * (k * u[0] - a1 * sqrt(2 * g * x[0]));
+    f[1] = 1.0 / A2 * (a1 * sqrt(2 * g * x[0]) - a2 * sqrt(2 * g * x[1]));
+  }
+};
+
+void f(double *f, double t, const double *x, const double *u, const double **p, void *data)
+{
+  f[0] = 1.0 / A1 * (k * u[0] - a1 * sqrt(2 * g * x[0]));
+  f[1] = 1.0 / A2 * (a1 * sqrt(2 * g * x[0]) - a2 * sqrt(2 * g * x[1]));
+}
+
+void df(double *df, double t, const double *x, const double *u, const double **p, void *data)
+{
+  df[0] = -(a1 * sqrt(g)) / (A1 * sqrt(2 * x[0]));
+  df[1] = (a1 * sqrt(g)) / (A2 * sqrt(2 * x[0]));
+  df[2] = 0;
+  df[3] = -(a2 * sqrt(g)) / (A2 * sqrt(2 * x[1]));
+}
+
+/* Nonlinear chain x_i' = -tanh(x_i) - x_i^3 + c (x_{i-1} - 2 x_i + x_{i+1}) + u */
+const double C = 10.0;
+
+struct chain {
+  lapack_int n;
+  template <class T>
+  void operator()(T *f, const double t, const T *x, const double *u, const double **p) const {
+    for (lapack_int i = 0; i < n; i++) {
+      const T left = i > 0 ? x[i - 1] : T(0);
+      const T right = i < n - 1 ? x[i + 1] : T(0);
+      f[i] = -tanh(x[i]) - x[i] * x[i] * x[i] + C * (left - 2 * x[i] + right) + u[0];
+    }
+  }
+};
+
+double elapsed_since(const std::chrono::steady_clock::time_point &start)
+{
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+  /* Two tanks: the AD callbacks against the hand-written ones, along an integration */
+  euler_options opt = {};
+  opt.ts = 1e-2;
+  opt.alpha = 0.5;
+  opt.x_size = 2;
+  opt.ordering = LAPACK_COL_MAJOR;
+  opt.s_tol = 1e-12;
+  opt.x_tol = 1e-12;
+  opt.max_iter = 100;
+  opt.f = f;
+  opt.df = df;
+  euler_options opt_ad = opt;
+  libeuler::ad_model<tanks, 2> tanks_ad(tanks{}, opt_ad);
+  tanks_ad.attach(opt_ad);
+
+  euler_workspace *ws = euler_workspace_alloc(&opt);
+  euler_workspace *ws_ad = euler_workspace_alloc(&opt_ad);
+  if (!ws || !ws_ad)
+    return 1;
+  double x[2] = {0.1, 0.1}, x_ad[2] = {0.1, 0.1}, xp[2], jac[4], jac_ad[4];
+  double err_jac = 0, err_x = 0;
+  for (long s = 0; s < 10000; s++) {
+    const double u = s < 5000 ? 10.0 : 5.0;
+    df(jac, s * opt.ts, x, &u, NULL, NULL);
+    tanks_ad.jacobian(jac_ad, s * opt.ts, x, &u, NULL, &tanks_ad);
+    for (int q = 0; q < 4; q++)
+      err_jac = fmax(err_jac, fabs(jac[q] - jac_ad[q]) / fmax(fabs(jac[q]), 1e-12));
+
+    if (euler_ws(&opt, ws, xp, s * opt.ts, x, &u, NULL, NULL) != EULER_SUCCESS)
+      return 1;
+    for (int i = 0; i < 2; i++)
+      x[i] = xp[i];
+    if (euler_ws(&opt_ad, ws_ad, xp, s * opt.ts, x_ad, &u, NULL, NULL) != EULER_SUCCESS)
+      return 1;
+    for (int i = 0; i < 2; i++) {
+      x_ad[i] = xp[i];
+      err_x = fmax(err_x, fabs(x[i] - x_ad[i]));
+    }
+  }
+  euler_workspace_free(ws);
+  euler_workspace_free(ws_ad);
+  printf("Two tanks: max relative Jacobian error = %.2e, max state difference = %.2e\n", err_jac, err_x);
+
+  /* Chain: cost of a Jacobian, with finite differences and with the dual numbers */
+  const lapack_int n = 400;
+  std::vector<lapack_int> row_ptr(n + 1), col_idx(3 * n);
+  lapack_int nnz = 0;
+  for (lapack_int i = 0; i < n; i++) {
+    row_ptr[i] = nnz;
+    if (i > 0)
+      col_idx[nnz++] = i - 1;
+    col_idx[nnz++] = i;
+    if (i < n - 1)
+      col_idx[nnz++] = i + 1;
+  }
+  row_ptr[n] = nnz;
+  sparse_pattern pattern = {n, row_ptr.data(), col_idx.data()};
+
+  euler_options chain_opt = {};
+  chain_opt.x_size = n;
+  chain_opt.ordering = LAPACK_ROW_MAJOR;
+  libeuler::ad_model<chain> dense_ad(chain{n}, chain_opt);
+  chain_opt.pattern = &pattern;
+  libeuler::ad_model<chain> sparse_ad(chain{n}, chain_opt);
+  if (!sparse_ad.valid())
+    return 1;
+
+  std::vector<double> xc(n), fx(n), fd(n), xd(n), jac_fd(n * n), jac_dense(n * n), jac_sparse(nnz);
+  for (lapack_int i = 0; i < n; i++)
+    xc[i] = std::sin(0.1 * i);
+  const double uc = 1.0;
+  const int repeat = 20;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeat; r++) {
+    dense_ad.function(fx.data(), 0, xc.data(), &uc, NULL, &dense_ad);
+    for (lapack_int j = 0; j < n; j++) {
+      const double delta = std::sqrt(2.2e-16) * fmax(fabs(xc[j]), 1.0);
+      xd = xc;
+      xd[j] += delta;
+      dense_ad.function(fd.data(), 0, xd.data(), &uc, NULL, &dense_ad);
+      for (lapack_int i = 0; i < n; i++)
+        jac_fd[i * n + j] = (fd[i] - fx[i]) / delta;
+    }
+  }
+  const double elapsed_fd = elapsed_since(start) / repeat;
+
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeat; r++)
+    dense_ad.jacobian(jac_dense.data(), 0, xc.data(), &uc, NULL, &dense_ad);
+  const double elapsed_dense = elapsed_since(start) / repeat;
+
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeat; r++)
+    sparse_ad.jacobian(jac_sparse.data(), 0, xc.data(), &uc, NULL, &sparse_ad);
+  const double elapsed_sparse = elapsed_since(start) / repeat;
+
+  double err_fd = 0, err_sparse = 0;
+  for (lapack_int i = 0; i < n; i++)
+    for (lapack_int q = row_ptr[i]; q < row_ptr[i + 1]; q++) {
+      const double exact = jac_dense[i * n + col_idx[q]];
+      err_fd = fmax(err_fd, fabs(jac_fd[i * n + col_idx[q]] - exact));
+      err_sparse = fmax(err_sparse, fabs(jac_sparse[q] - exact));
+    }
+  printf("Chain of %d states, Jacobian:\n", (int)n);
+  printf("  finite differences %10.1f us (max difference from AD = %.2e)\n", elapsed_fd, err_fd);
+  printf("  dense AD           %10.1f us\n", elapsed_dense);
+  printf("  sparse AD          %10.1f us (max difference from dense AD = %.2e)\n", elapsed_sparse, err_sparse);
+
+  if (err_jac > 1e-14 || err_x > 1e-12 || err_sparse != 0 || err_fd > 1e-5) {
+    printf("The AD Jacobian differs from the reference\n");
+    return 1;
+  }
+  return 0;
+}
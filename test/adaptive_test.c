@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <math.h>
+#include "libeuler.h"
+#include "models.h"
+
+/* Two tanks of test/models.h, with the inflow switching at t = 251 and t = 451 */
+
+void input_provider(double *u, const double t, const double *x, void *data)
+{
+  u[0] = tanks_input(t);
+}
+
+int sink(const double *rows, const lapack_int n_rows, const lapack_int n_cols, void *data)
+{
+  *(lapack_int *)data += n_rows;
+  return 0;
+}
+
+/* Integration from t = 0 to 500: final state, number of steps and vector field evaluations */
+int simulate(euler_options *opt, const euler_integrate_options *iopt_in, double *xf, lapack_int *steps, long *evaluations)
+{
+  const double x0[2] = {1e-6, 0.1};
+  euler_integrate_options iopt = *iopt_in;
+  lapack_int rows = 0;
+  iopt.input = input_provider;
+  iopt.u_size = 1;
+  iopt.sink = sink;
+  iopt.data = &rows;
+  model_evaluations = 0;
+  if (euler_integrate(opt, &iopt, NULL, 0, 500, x0, xf, NULL) != EULER_SUCCESS)
+    return 1;
+  *evaluations = model_evaluations;
+  *steps = rows - 1;
+  return 0;
+}
+
+int main()
+{
+  const char *name[3] = {"full", "modified", "broyden"};
+  const double tstops[2] = {251, 451};
+  euler_options opt = {
+      .ts = 1e-3,
+      .alpha = 0.5,
+      .x_size = 2,
+      .u_offset = 0,
+      .ordering = LAPACK_COL_MAJOR,
+      .s_tol = 1e-12,
+      .x_tol = 1e-12,
+      .max_iter = 100,
+      .f = tanks_f,
+      .df = tanks_df};
+  euler_integrate_options fixed = {.tstops = tstops, .n_tstops = 2};
+  double x_ref[2], x[2];
+  lapack_int steps;
+  long evaluations;
+
+  /* Reference: Tustin with a fine fixed step */
+  if (simulate(&opt, &fixed, x_ref, &steps, &evaluations))
+    return 1;
+  printf("Two tanks, Tustin, reference with %d steps: x(500) = (%.6f, %.6f)\n", (int)steps, x_ref[0], x_ref[1]);
+
+  double worst = 0;
+  int fewer = 1;
+  for (int m = NEWTON_FULL; m <= NEWTON_BROYDEN; m++) {
+    opt.method = (newton_method)m;
+
+    /* Fixed step of the tank test (test/euleri_test.c), sized for the transients */
+    opt.ts = 1e-2;
+    if (simulate(&opt, &fixed, x, &steps, &evaluations))
+      return 1;
+    const lapack_int fixed_steps = steps;
+    double err = fmax(fabs(x[0] - x_ref[0]), fabs(x[1] - x_ref[1]));
+    printf("  %-8s fixed step 0.01 s            %6d steps, %7ld f evals, error = %.2e\n",
+           name[m], (int)steps, evaluations, err);
+
+    /* Adaptive step, not bounded: the input switches are tstops */
+    euler_integrate_options adaptive = {.rtol = 1e-4, .atol = 1e-6, .tstops = tstops, .n_tstops = 2};
+    if (simulate(&opt, &adaptive, x, &steps, &evaluations)) {
+      printf("The adaptive integration failed (%s)\n", name[m]);
+      return 1;
+    }
+    err = fmax(fabs(x[0] - x_ref[0]), fabs(x[1] - x_ref[1]));
+    printf("  %-8s adaptive, rtol = 1e-4       %6d steps, %7ld f evals, error = %.2e\n",
+           name[m], (int)steps, evaluations, err);
+    worst = fmax(worst, err);
+    fewer &= 10 * steps < fixed_steps;
+    opt.ts = 1e-3;
+  }
+
+  /* The quiet stretches between the switches take a few steps: an order of magnitude fewer steps,
+     with an error within the tolerance */
+  if (worst > 1e-4 || !fewer) {
+    printf("Unexpected behaviour of the adaptive step\n");
+    return 1;
+  }
+  return 0;
+}
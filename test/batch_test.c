@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "libeuler.h"
+
+/* Chain of nonlinear states x_i' = -K tanh(x_i) + C (x_{i-1} - 2 x_i + x_{i+1}) + u. The vector
+   field is a surrogate with a fixed cost per call (e.g. loading a lookup table or launching an
+   inference), emulated by OVERHEAD operations, and a small cost per point */
+#define K 50.0
+#define C 10.0
+#define OVERHEAD 20000
+lapack_int N;
+lapack_int *row_ptr, *col_idx;
+long calls = 0, points = 0;
+volatile double sink;
+
+static void overhead()
+{
+  double s = 0;
+  for (int k = 0; k < OVERHEAD; k++)
+    s += 1e-9 * k;
+  sink = s;
+}
+
+static void chain(double *f, const double *x, const double *u)
+{
+  for (lapack_int i = 0; i < N; i++) {
+    const double left = i > 0 ? x[i - 1] : 0;
+    const double right = i < N - 1 ? x[i + 1] : 0;
+    f[i] = -K * tanh(x[i]) + C * (left - 2 * x[i] + right) + u[0];
+  }
+}
+
+void f(double *f, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  calls++;
+  points++;
+  overhead();
+  chain(f, x, u);
+}
+
+void f_batch(double *f, const double t, const double *x, const double *u, const double **p, const lapack_int count, const lapack_int ld, void *data)
+{
+  calls++;
+  points += count;
+  overhead();
+  for (lapack_int k = 0; k < count; k++)
+    chain(f + k * ld, x + k * ld, u);
+}
+
+void build_pattern()
+{
+  row_ptr = (lapack_int *)malloc((N + 1) * sizeof(lapack_int));
+  col_idx = (lapack_int *)malloc(3 * N * sizeof(lapack_int));
+  lapack_int q = 0;
+  for (lapack_int i = 0; i < N; i++) {
+    row_ptr[i] = q;
+    if (i > 0)
+      col_idx[q++] = i - 1;
+    col_idx[q++] = i;
+    if (i < N - 1)
+      col_idx[q++] = i + 1;
+  }
+  row_ptr[N] = q;
+}
+
+/* Implicit steps from a unit state with a finite difference Jacobian */
+void integrate(const euler_options *opt, lapack_int steps, double *x, double *elapsed)
+{
+  double u[2] = {1.0, 1.0};
+  double *xp = (double *)malloc(N * sizeof(double));
+  for (lapack_int i = 0; i < N; i++)
+    x[i] = 1;
+  calls = 0;
+  points = 0;
+
+  clock_t start = clock();
+  euler_workspace *ws = euler_workspace_alloc(opt);
+  if (!ws) {
+    printf("Cannot allocate the workspace\n");
+    exit(1);
+  }
+  for (lapack_int k = 0; k < steps; k++) {
+    if (euler_ws(opt, ws, xp, k * opt->ts, x, u, NULL, NULL) != EULER_SUCCESS || ws->status >= NEWTON_MAX_ITER) {
+      printf("Step %d failed\n", (int)k);
+      exit(1);
+    }
+    for (lapack_int i = 0; i < N; i++)
+      x[i] = xp[i];
+  }
+  *elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+  euler_workspace_free(ws);
+  free(xp);
+}
+
+int main()
+{
+  euler_options opt = {
+      .ts = 1e-2,
+      .alpha = 1.0,
+      .u_offset = 1,
+      .ordering = LAPACK_ROW_MAJOR,
+      .s_tol = 1e-10,
+      .x_tol = 1e-12,
+      .max_iter = 50,
+      .f = f};
+  const lapack_int sizes[2] = {64, 1000};
+  const char *method[2] = {"full", "modified"};
+
+  for (int s = 0; s < 2; s++) {
+    N = sizes[s];
+    opt.x_size = N;
+    build_pattern();
+    sparse_pattern pattern = {N, row_ptr, col_idx};
+    opt.pattern = N > 100 ? &pattern : NULL;
+    double *x = (double *)malloc(N * sizeof(double));
+    double *x_ref = (double *)malloc(N * sizeof(double));
+    double elapsed;
+
+    printf("Chain of %d states, %s finite difference Jacobian\n", (int)N, opt.pattern ? "colored" : "dense");
+    for (int m = 0; m < 2; m++) {
+      opt.method = (newton_method)m;
+      opt.f_batch = NULL;
+      integrate(&opt, 100, x_ref, &elapsed);
+      printf("  %-8s single  %8.3f s, %7ld calls, %7ld points\n", method[m], elapsed, calls, points);
+
+      opt.f_batch = f_batch;
+      integrate(&opt, 100, x, &elapsed);
+      double err = 0;
+      for (lapack_int i = 0; i < N; i++)
+        err = fmax(err, fabs(x[i] - x_ref[i]));
+      printf("  %-8s batched %8.3f s, %7ld calls, %7ld points, max difference = %e\n", method[m], elapsed, calls, points, err);
+      if (err > 1e-12) {
+        printf("The batched evaluations changed the solution\n");
+        return 1;
+      }
+    }
+    free(x);
+    free(x_ref);
+    free(row_ptr);
+    free(col_idx);
+  }
+  return 0;
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <math.h>
+#include "libbdf.h"
+#include "models.h"
+
+/* Integrates from 0 to t1 with the given number of steps. Order 0 selects the Tustin step */
+long integrate(euler_options *opt, const lapack_int order, const long steps, const double t1, const double *x0, double *x)
+{
+  const lapack_int n = opt->x_size;
+  double xp[2], u[2] = {8.0, 8.0};
+  long jacobians = 0;
+  opt->ts = t1 / steps;
+  opt->alpha = 0.5;
+  bdf_workspace *bdf = order ? bdf_workspace_alloc(opt, order) : NULL;
+  euler_workspace *ws = order ? NULL : euler_workspace_alloc(opt);
+  if (!bdf && !ws)
+    return -1;
+
+  for (lapack_int i = 0; i < n; i++)
+    x[i] = x0[i];
+  for (long s = 0; s < steps; s++) {
+    euler_ret ret = order ? bdf_step(opt, bdf, xp, NULL, s * opt->ts, x, u, NULL) : euler_ws(opt, ws, xp, s * opt->ts, x, u, NULL, NULL);
+    if (ret != EULER_SUCCESS) {
+      jacobians = -1;
+      break;
+    }
+    jacobians += order ? bdf->euler->stats.jacobians : ws->stats.jacobians;
+    for (lapack_int i = 0; i < n; i++)
+      x[i] = xp[i];
+  }
+  bdf_workspace_free(bdf);
+  euler_workspace_free(ws);
+  return jacobians;
+}
+
+int main()
+{
+  const long steps[] = {100, 1000, 10000};
+  euler_options opt = {
+      .x_size = 2,
+      .u_offset = 1,
+      .ordering = LAPACK_COL_MAJOR,
+      .s_tol = 1e-13,
+      .x_tol = 1e-15,
+      .max_iter = 50,
+      .f = tanks_f,
+      .df = tanks_df,
+      .method = NEWTON_MODIFIED};
+
+  /* Reference solution of the tanks model, with a fine integration */
+  const double x0[2] = {0.5, 0.5}, t1 = 100;
+  double ref[2], x[2];
+  integrate(&opt, 5, 1000000, t1, x0, ref);
+
+  printf("Two tanks, t in [0, %g], error at the final time\n", t1);
+  printf("%8s %8s %14s %10s %10s\n", "method", "steps", "error", "f evals", "jacobians");
+  for (lapack_int q = 0; q <= BDF_MAX_ORDER; q++)
+    for (int s = 0; s < 3; s++) {
+      model_evaluations = 0;
+      long jacobians = integrate(&opt, q, steps[s], t1, x0, x);
+      if (jacobians < 0) {
+        printf("%7s%d %8ld %14s\n", q ? "bdf" : "tustin", q ? (int)q : 0, steps[s], "failed");
+        continue;
+      }
+      double err = fmax(fabs(x[0] - ref[0]), fabs(x[1] - ref[1]));
+      printf("%7s%c %8ld %14.6e %10ld %10ld\n", q ? "bdf" : "tustin", q ? '0' + (char)q : ' ', steps[s], err, model_evaluations, jacobians);
+    }
+
+  /* Observed order of convergence, halving the step from 1 s: the start-up steps must not lower it */
+  int failed = 0;
+  printf("\nObserved order, %d and %d steps\n", 100, 200);
+  for (lapack_int q = 0; q <= BDF_MAX_ORDER; q++) {
+    double err[2];
+    for (int s = 0; s < 2; s++) {
+      if (integrate(&opt, q, 100 << s, t1, x0, x) < 0)
+        return 1;
+      err[s] = fmax(fabs(x[0] - ref[0]), fabs(x[1] - ref[1]));
+    }
+    const double observed = log2(err[0] / err[1]), expected = q ? q : 2;
+    printf("%7s%c %8.2f\n", q ? "bdf" : "tustin", q ? '0' + (char)q : ' ', observed);
+    failed |= observed < expected - 0.5;
+  }
+
+  /* Stiff problem */
+  opt.x_size = 1;
+  opt.u_offset = 0;
+  opt.f = pr_f;
+  opt.df = pr_df;
+  const double y0[1] = {0.0};
+  printf("\nProthero-Robinson, lambda = %g, t in [0, 10], error at the final time\n", PR_LAMBDA);
+  printf("%8s %8s %14s %10s %10s\n", "method", "steps", "error", "f evals", "jacobians");
+  for (lapack_int q = 0; q <= BDF_MAX_ORDER; q++)
+    for (int s = 0; s < 3; s++) {
+      model_evaluations = 0;
+      long jacobians = integrate(&opt, q, steps[s], 10, y0, x);
+      if (jacobians < 0) {
+        printf("%7s%d %8ld %14s\n", q ? "bdf" : "tustin", q ? (int)q : 0, steps[s], "failed");
+        continue;
+      }
+      printf("%7s%c %8ld %14.6e %10ld %10ld\n", q ? "bdf" : "tustin", q ? '0' + (char)q : ' ', steps[s], fabs(x[0] - sin(10)), model_evaluations, jacobians);
+    }
+  if (failed) {
+    printf("The observed order is lower than the order of the formula\n");
+    return 1;
+  }
+  return 0;
+}
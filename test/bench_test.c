@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "libeuler.h"
+
+/*
+ * Benchmark of the solver hot paths: explicit and implicit steps (euler_ws(), and euler() for
+ * small models) and standalone Newton solutions (newton_solve() and newton_solve_r()), swept on
+ * state size, stiffness, Jacobian density, alpha and Newton method. Each case runs in a child
+ * process (thus the peak RSS is the one of the case) and the results are printed on stdout as a
+ * JSON document. The model and its pattern are generated with a fixed seed.
+ *
+ * Allocations are counted by wrapping malloc, calloc and realloc at link time (see the bench
+ * target of the Makefile): only the calls of the library (and of this file) are counted, not the
+ * ones inside BLAS/LAPACK.
+ *
+ * Usage: ./bench_test [filter], where filter selects the cases whose name contains it.
+ */
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* Allocation counters */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+long allocations = 0;
+
+void *__wrap_malloc(size_t size)
+{
+  allocations++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+  allocations++;
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  allocations++;
+  return __real_realloc(ptr, size);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* Model: f_i = 1 + u - lambda_i x_i - x_i^3 + sum_j a_ij x_j, with the input u(t) = sin(10 t)
+ *
+ * The eigenvalues lambda_i are spaced geometrically in [1, stiffness], and each row has deg_i off
+ * diagonal nonzeros a_ij = 0.5 / deg_i (thus the Jacobian is diagonally dominant). The pattern
+ * is a chain (band) or random columns with the given density. */
+
+typedef struct model {
+  lapack_int n;
+  lapack_int *ptr;    /* CSR pattern of the Jacobian, with the diagonal */
+  lapack_int *idx;
+  double *a;          /* Off diagonal values (0 on the diagonal) */
+  double *lambda;
+  lapack_int dense;   /* The Jacobian callback stores the whole (row major) matrix */
+  long f_count;
+  long df_count;
+} model;
+
+unsigned long long seed = 42;
+double uniform()
+{
+  seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (double)(seed >> 11) / 9007199254740992.0;
+}
+
+void model_build(model *m, const lapack_int n, const double stiffness, const double density)
+{
+  m->n = n;
+  m->ptr = (lapack_int *)malloc((n + 1) * sizeof(lapack_int));
+  m->lambda = (double *)malloc(n * sizeof(double));
+  char *row = (char *)calloc(n, 1);
+  lapack_int cap = n * 3, nnz = 0;
+  m->idx = (lapack_int *)malloc(cap * sizeof(lapack_int));
+  seed = 42;
+
+  for (lapack_int i = 0; i < n; i++) {
+    m->lambda[i] = n > 1 ? pow(stiffness, (double)i / (n - 1)) : 1;
+    row[i] = 1;
+    if (density <= 0) {
+      if (i > 0)
+        row[i - 1] = 1;
+      if (i < n - 1)
+        row[i + 1] = 1;
+    } else {
+      for (lapack_int j = 0; j < n; j++)
+        if (uniform() < density)
+          row[j] = 1;
+    }
+    m->ptr[i] = nnz;
+    for (lapack_int j = 0; j < n; j++) {
+      if (!row[j])
+        continue;
+      if (nnz == cap) {
+        cap *= 2;
+        m->idx = (lapack_int *)realloc(m->idx, cap * sizeof(lapack_int));
+      }
+      m->idx[nnz++] = j;
+      row[j] = 0;
+    }
+  }
+  m->ptr[n] = nnz;
+  m->a = (double *)malloc(nnz * sizeof(double));
+  for (lapack_int i = 0; i < n; i++) {
+    const lapack_int deg = m->ptr[i + 1] - m->ptr[i] - 1;
+    for (lapack_int q = m->ptr[i]; q < m->ptr[i + 1]; q++)
+      m->a[q] = m->idx[q] == i ? 0 : 0.5 / deg;
+  }
+  free(row);
+}
+
+void model_free(model *m)
+{
+  free(m->ptr);
+  free(m->idx);
+  free(m->a);
+  free(m->lambda);
+}
+
+void f(double *f, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  model *m = (model *)data;
+  m->f_count++;
+  for (lapack_int i = 0; i < m->n; i++) {
+    double s = 1 + (u ? u[0] : 0) - m->lambda[i] * x[i] - x[i] * x[i] * x[i];
+    for (lapack_int q = m->ptr[i]; q < m->ptr[i + 1]; q++)
+      s += m->a[q] * x[m->idx[q]];
+    f[i] = s;
+  }
+}
+
+void df(double *df, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  model *m = (model *)data;
+  m->df_count++;
+  if (m->dense)
+    memset(df, 0, m->n * m->n * sizeof(double));
+  for (lapack_int i = 0; i < m->n; i++)
+    for (lapack_int q = m->ptr[i]; q < m->ptr[i + 1]; q++) {
+      const double v = m->idx[q] == i ? -m->lambda[i] - 3 * x[i] * x[i] : m->a[q];
+      if (m->dense)
+        df[i * m->n + m->idx[q]] = v;
+      else
+        df[q] = v;
+    }
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* Cases */
+
+typedef enum bench_api {
+  BENCH_EULER_WS = 0,
+  BENCH_EULER,
+  BENCH_NEWTON_WS,
+  BENCH_NEWTON
+} bench_api;
+
+const char *api_name[] = {"euler_ws", "euler", "newton_solve_r", "newton_solve"};
+const char *method_name[] = {"full", "modified", "broyden", "krylov"};
+
+typedef struct bench_case {
+  bench_api api;
+  lapack_int n;
+  double stiffness;
+  double density;     /* 0 for a band (chain) pattern, 1 for a full matrix */
+  lapack_int sparse;  /* The Jacobian is given as a sparsity pattern */
+  double alpha;
+  newton_method method;
+  long steps;
+} bench_case;
+
+double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void bench_run(const bench_case *c, const char *name)
+{
+  model m = {0};
+  model_build(&m, c->n, c->stiffness, c->density);
+  m.dense = !c->sparse;
+  sparse_pattern pattern = {c->n, m.ptr, m.idx};
+
+  double *x = (double *)calloc(c->n, sizeof(double));
+  double *xp = (double *)calloc(c->n, sizeof(double));
+  long iterations = -1, failures = 0;
+  double elapsed = 0;
+  long alloc_count = 0;
+
+  if (c->api == BENCH_EULER_WS || c->api == BENCH_EULER) {
+    euler_options opt = {
+        .ts = 1e-3,
+        .alpha = c->alpha,
+        .x_size = c->n,
+        .u_offset = 1,
+        .ordering = LAPACK_ROW_MAJOR,
+        .s_tol = 1e-10,
+        .x_tol = 1e-12,
+        .max_iter = 20,
+        .f = f,
+        .df = df,
+        .data = &m,
+        .method = c->method,
+        .pattern = c->sparse ? &pattern : NULL};
+    euler_workspace *ws = c->api == BENCH_EULER_WS ? euler_workspace_alloc(&opt) : NULL;
+    if (c->api == BENCH_EULER_WS && !ws) {
+      printf("{\"name\": \"%s\", \"error\": \"workspace\"}", name);
+      exit(0);
+    }
+    iterations = ws && c->alpha > 0 ? 0 : -1;
+    m.f_count = m.df_count = 0;
+    alloc_count = allocations;
+    const double start = now();
+    for (long k = 0; k < c->steps; k++) {
+      const double u[2] = {sin(10 * k * opt.ts), sin(10 * (k + 1) * opt.ts)};
+      euler_ret ret = ws ? euler_ws(&opt, ws, xp, k * opt.ts, x, u, NULL, NULL) : euler(&opt, xp, k * opt.ts, x, u, NULL, NULL);
+      failures += ret != EULER_SUCCESS;
+      if (ws && c->alpha > 0)
+        iterations += ws->stats.iterations;
+      memcpy(x, xp, c->n * sizeof(double));
+    }
+    elapsed = now() - start;
+    alloc_count = allocations - alloc_count;
+    euler_workspace_free(ws);
+  } else {
+    newton_options opt = {
+        .ordering = LAPACK_ROW_MAJOR,
+        .f_size = c->n,
+        .x_size = c->n,
+        .f_tol = 1e-10,
+        .x_tol = 1e-12,
+        .max_iter = 50,
+        .f = f,
+        .df = df,
+        .method = c->method,
+        .pattern = c->sparse ? &pattern : NULL};
+    newton_workspace *ws = c->api == BENCH_NEWTON_WS ? newton_workspace_alloc(&opt) : NULL;
+    if (c->api == BENCH_NEWTON_WS && !ws) {
+      printf("{\"name\": \"%s\", \"error\": \"workspace\"}", name);
+      exit(0);
+    }
+    iterations = 0;
+    m.f_count = m.df_count = 0;
+    alloc_count = allocations;
+    const double start = now();
+    for (long k = 0; k < c->steps; k++) {
+      newton_ret ret;
+      for (lapack_int i = 0; i < c->n; i++)
+        x[i] = 0;
+      if (ws) {
+        newton_stats stats;
+        ret = newton_solve_r(&opt, ws, &stats, 0, x, NULL, NULL, &m);
+        iterations += stats.iterations;
+        newton_workspace_invalidate(ws);
+      } else {
+        newton_options o = opt;
+        ret = newton_solve(&o, 0, x, NULL, NULL, &m);
+        iterations += o.max_iter;
+      }
+      failures += ret > NEWTON_X_TOL;
+    }
+    elapsed = now() - start;
+    alloc_count = allocations - alloc_count;
+    newton_workspace_free(ws);
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  const char *unit = c->api == BENCH_EULER_WS || c->api == BENCH_EULER ? "step" : "solve";
+  char newton_iterations[32] = "null";
+  if (iterations >= 0)
+    snprintf(newton_iterations, sizeof(newton_iterations), "%.3f", (double)iterations / c->steps);
+  printf("{\"name\": \"%s\", \"api\": \"%s\", \"n\": %d, \"stiffness\": %g, \"density\": %g, "
+         "\"nnz\": %d, \"jacobian\": \"%s\", \"alpha\": %g, \"method\": \"%s\", \"%ss\": %ld, "
+         "\"ns_per_%s\": %.1f, \"newton_iterations_per_%s\": %s, \"f_per_%s\": %.3f, "
+         "\"df_per_%s\": %.3f, \"allocations_per_%s\": %.3f, \"failures\": %ld, \"peak_rss_kb\": %ld}",
+         name, api_name[c->api], (int)c->n, c->stiffness, c->density, (int)m.ptr[c->n],
+         c->sparse ? "sparse" : "dense", c->alpha, method_name[c->method], unit, c->steps,
+         unit, elapsed / c->steps, unit, newton_iterations, unit, (double)m.f_count / c->steps,
+         unit, (double)m.df_count / c->steps, unit, (double)alloc_count / c->steps, failures, usage.ru_maxrss);
+
+  free(x);
+  free(xp);
+  model_free(&m);
+}
+
+/* Runs a case in a child process. Returns 1 if the case was printed */
+int bench_fork(const bench_case *c, const char *filter, const int first)
+{
+  char name[128], pattern[32];
+  if (c->density > 0)
+    snprintf(pattern, sizeof(pattern), "density=%g%s", c->density, c->sparse ? "" : "-dense");
+  else
+    snprintf(pattern, sizeof(pattern), "band%s", c->sparse ? "" : "-dense");
+  snprintf(name, sizeof(name), "%s/n=%d/stiff=%g/%s/alpha=%g/%s", api_name[c->api], (int)c->n,
+           c->stiffness, pattern, c->alpha, method_name[c->method]);
+  if (filter && !strstr(name, filter))
+    return 0;
+
+  printf("%s\n    ", first ? "" : ",");
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    bench_run(c, name);
+    fflush(stdout);
+    _exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    printf("{\"name\": \"%s\", \"error\": \"crashed\"}", name);
+  fflush(stdout);
+  return 1;
+}
+
+/* Number of steps for a case (roughly constant total work) */
+long bench_steps(const lapack_int n, const lapack_int sparse, const double density)
+{
+  long steps = n <= 2 ? 100000 : (n <= 10 ? 20000 : (n <= 100 ? 1000 : (n <= 1000 ? 100 : 20)));
+  if (n >= 1000 && (!sparse || density > 0))
+    steps = 5;
+  return steps;
+}
+
+int main(int argc, char **argv)
+{
+  const char *filter = argc > 1 ? argv[1] : NULL;
+  const lapack_int sizes[] = {2, 10, 100, 1000, 10000};
+  const double stiffness[] = {1, 1e6};
+  const double density[] = {0, 0.1, 1};
+  const double alpha[] = {0, 0.5, 1};
+  int printed = 0;
+
+  printf("{\n  \"benchmark\": \"libeuler\",\n  \"compiler\": \"%s\",\n  \"cases\": [", __VERSION__);
+  for (int s = 0; s < 5; s++)
+    for (int d = 0; d < 3; d++) {
+      const lapack_int n = sizes[s];
+      /* Dense Jacobians up to 1000 states, sparse ones while the fill is moderate */
+      const lapack_int sparse = density[d] < 1 && n >= 10;
+      if ((density[d] >= 1 && n > 1000) || (density[d] > 0 && density[d] < 1 && (n < 10 || n > 1000)))
+        continue;
+      const long steps = bench_steps(n, sparse, density[d]);
+
+      for (int k = 0; k < 2; k++)
+        for (int a = 0; a < 3; a++) {
+          /* The explicit step is unstable for stiff models, and does not use the Jacobian */
+          if (alpha[a] == 0 && (k > 0 || d > 0))
+            continue;
+          for (int me = 0; me < (alpha[a] > 0 ? 2 : 1); me++) {
+            bench_case c = {BENCH_EULER_WS, n, stiffness[k], density[d], sparse, alpha[a], (newton_method)me, steps};
+            printed += bench_fork(&c, filter, !printed);
+            if (n <= 100 && a == 1 && me == 0) {
+              c.api = BENCH_EULER;
+              printed += bench_fork(&c, filter, !printed);
+            }
+          }
+        }
+
+      for (int k = 0; k < 2; k++)
+        for (int me = 0; me < 2; me++) {
+          bench_case c = {BENCH_NEWTON_WS, n, stiffness[k], density[d], sparse, 0, (newton_method)me, n >= 1000 ? 2 : steps / 10};
+          printed += bench_fork(&c, filter, !printed);
+          if (me == 0 && n <= 100) {
+            c.api = BENCH_NEWTON;
+            printed += bench_fork(&c, filter, !printed);
+          }
+        }
+    }
+  printf("\n  ]\n}\n");
+  return 0;
+}
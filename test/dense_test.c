@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "libeuler.h"
+#include "models.h"
+
+/* Two tanks of test/models.h, sampled every 0.01 s with larger integration steps */
+
+void input_provider(double *u, const double t, const double *x, void *data)
+{
+  u[0] = tanks_input(t);
+}
+
+#define T_END 500.0
+#define OUTPUT_DT 0.01
+#define SAMPLES 50001
+
+/* Collects the rows of the trajectory */
+typedef struct samples {
+  double *rows;
+  lapack_int count;
+} samples;
+
+int sink(const double *rows, const lapack_int n_rows, const lapack_int n_cols, void *data)
+{
+  samples *s = (samples *)data;
+  for (lapack_int i = 0; i < n_rows && s->count < SAMPLES + 2; i++, s->count++)
+    for (lapack_int j = 0; j < 3; j++)
+      s->rows[s->count * 3 + j] = rows[i * n_cols + j];
+  return 0;
+}
+
+euler_options opt = {
+    .ts = 1e-2,
+    .alpha = 0.5,
+    .x_size = 2,
+    .u_offset = 0,
+    .ordering = LAPACK_COL_MAJOR,
+    .s_tol = 1e-12,
+    .x_tol = 1e-12,
+    .max_iter = 100,
+    .f = tanks_f,
+    .df = tanks_df,
+    .data = NULL};
+
+const double tstops[] = {251, 451};
+
+double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* Trajectory on the output grid, with integration step ts */
+double run(const double ts, samples *s)
+{
+  euler_options o = opt;
+  o.ts = ts;
+  euler_integrate_options iopt = {
+      .u_size = 1,
+      .input = input_provider,
+      .sink = sink,
+      .data = s,
+      .tstops = tstops,
+      .n_tstops = 2,
+      .output_dt = OUTPUT_DT};
+  double x0[2] = {1e-6, 0.1};
+  s->count = 0;
+  double t_start = now();
+  if (euler_integrate(&o, &iopt, NULL, 0, T_END, x0, NULL, NULL) != EULER_SUCCESS)
+    return -1;
+  return now() - t_start;
+}
+
+int main()
+{
+  samples ref = {(double *)malloc((SAMPLES + 2) * 3 * sizeof(double)), 0};
+  samples out = {(double *)malloc((SAMPLES + 2) * 3 * sizeof(double)), 0};
+  if (!ref.rows || !out.rows)
+    return 1;
+
+  /* Reference: step 1e-3, sampled by the dense output on the same grid */
+  if (run(1e-3, &ref) < 0 || ref.count != SAMPLES)
+    return 1;
+
+  /* With ts = output_dt the rows are the steps, larger steps are interpolated */
+  printf("%8s  %8s  %12s  %12s  %10s\n", "ts", "rows", "max error", "at steps", "time [s]");
+  const double steps[] = {0.01, 0.1, 0.5, 1, 2};
+  for (int i = 0; i < 5; i++) {
+    double elapsed = run(steps[i], &out);
+    if (elapsed < 0 || out.count != SAMPLES)
+      return 1;
+    double err = 0, err_steps = 0;
+    const lapack_int stride = (lapack_int)round(steps[i] / OUTPUT_DT);
+    for (lapack_int k = 0; k < SAMPLES; k++)
+      for (lapack_int j = 1; j < 3; j++) {
+        const double e = fabs(out.rows[3 * k + j] - ref.rows[3 * k + j]);
+        err = fmax(err, e);
+        if (k % stride == 0)
+          err_steps = fmax(err_steps, e);
+      }
+    printf("%8g  %8d  %12.3e  %12.3e  %10.4f\n", steps[i], (int)out.count, err, err_steps, elapsed);
+  }
+
+  /* The same samples from a loop of euler_ws(), with euler_dense() on the last step */
+  opt.ts = 1;
+  opt.dense = NEWTON_TRUE;
+  euler_workspace *ws = euler_workspace_alloc(&opt);
+  if (!ws)
+    return 1;
+  double t = 0, x[2] = {1e-6, 0.1}, xp[2], xs[2], u = tanks_input(0), err = 0;
+  lapack_int k = 1;
+  while (t < 250 - 1e-9) {
+    if (euler_ws(&opt, ws, xp, t, x, &u, NULL, NULL) != EULER_SUCCESS)
+      return 1;
+    for (; k * OUTPUT_DT <= t + opt.ts + 1e-9; k++) {
+      if (euler_dense(ws, k * OUTPUT_DT, xs) != EULER_SUCCESS)
+        return 1;
+      err = fmax(err, fmax(fabs(xs[0] - ref.rows[3 * k + 1]), fabs(xs[1] - ref.rows[3 * k + 2])));
+    }
+    t += opt.ts;
+    u = tanks_input(t);
+    x[0] = xp[0];
+    x[1] = xp[1];
+  }
+  printf("\neuler_ws + euler_dense, ts = 1, t in [0, 250]: max error %.3e\n", err);
+
+  euler_workspace_free(ws);
+  free(ref.rows);
+  free(out.rows);
+  return 0;
+}
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <math.h>
+#include "libensemble.h"
+
+#define INSTANCES 1000
+
+/* Two tanks model: the inflow gain k of each instance is stored in p[0] */
+void f(double *f, const double t, const double *x, const double *u, const double **p, const lapack_int first, const lapack_int count, const lapack_int ld, void *data)
+{
+  double A1 = 0.180;
+  double a1 = 0.006;
+  double g = 9.810;
+  double A2 = 0.080;
+  double a2 = 0.008;
+
+  for (lapack_int k = 0; k < count; k++) {
+    double k_in = p[0][first + k];
+    f[k] = 1.0 / A1 * (k_in * u[k] - a1 * sqrt(2 * g * x[k]));
+    f[ld + k] = 1.0 / A2 * (a1 * sqrt(2 * g * x[k]) - a2 * sqrt(2 * g * x[ld + k]));
+  }
+}
+
+void df(double *df, const double t, const double *x, const double *u, const double **p, const lapack_int first, const lapack_int count, const lapack_int ld, void *data)
+{
+  double A1 = 0.180;
+  double a1 = 0.006;
+  double g = 9.810;
+  double A2 = 0.080;
+  double a2 = 0.008;
+
+  for (lapack_int k = 0; k < count; k++) {
+    df[k] = -(a1 * sqrt(g)) / (A1 * sqrt(2 * x[k]));
+    df[ld + k] = (a1 * sqrt(g)) / (A2 * sqrt(2 * x[k]));
+    df[2 * ld + k] = 0;
+    df[3 * ld + k] = -(a2 * sqrt(g)) / (A2 * sqrt(2 * x[ld + k]));
+  }
+}
+
+/* Single instance model, for comparison */
+void f_single(double *out, double t, const double *x, const double *u, const double **p, void *data)
+{
+  f(out, t, x, u, p, *(lapack_int *)data, 1, 1, NULL);
+}
+
+void df_single(double *out, double t, const double *x, const double *u, const double **p, void *data)
+{
+  df(out, t, x, u, p, *(lapack_int *)data, 1, 1, NULL);
+}
+
+ensemble_options opt = {
+    .ts = 1e-2,
+    .alpha = 0.5,
+    .x_size = 2,
+    .u_size = 1,
+    .u_offset = 0,
+    .count = INSTANCES,
+    .s_tol = 1e-12,
+    .x_tol = 1e-12,
+    .max_iter = 100,
+    .f = f,
+    .df = df,
+    .data = NULL};
+
+double input(double t)
+{
+  if (t < 251)
+    return 10.0;
+  if (t < 451)
+    return 5.0;
+  return 8.0;
+}
+
+int main()
+{
+  const lapack_int ld = ENSEMBLE_LD(INSTANCES);
+  double k_in[INSTANCES];
+  const double *p[1] = {k_in};
+
+  ensemble_workspace *ws = ensemble_workspace_alloc(&opt);
+  double *x = ensemble_array_alloc(&opt, opt.x_size);
+  double *xp = ensemble_array_alloc(&opt, opt.x_size);
+  double *u = ensemble_array_alloc(&opt, opt.u_size);
+  if (!ws || !x || !xp || !u)
+    return 1;
+
+  for (lapack_int k = 0; k < INSTANCES; k++) {
+    k_in[k] = 0.002 + 0.002 * k / INSTANCES;
+    x[k] = 1e-6;
+    x[ld + k] = 0.1;
+  }
+
+  /* Reference for some instances, with the single instance integrator */
+  lapack_int checked[3] = {0, INSTANCES / 2, INSTANCES - 1};
+  double x_ref[3][2], xp_ref[2];
+  euler_options ref = {
+      .ts = opt.ts, .alpha = opt.alpha, .x_size = 2, .u_offset = 0,
+      .ordering = LAPACK_COL_MAJOR, .s_tol = opt.s_tol, .x_tol = opt.x_tol,
+      .max_iter = opt.max_iter, .f = f_single, .df = df_single, .data = NULL};
+  euler_workspace *ref_ws = euler_workspace_alloc(&ref);
+  for (int i = 0; i < 3; i++) {
+    x_ref[i][0] = 1e-6;
+    x_ref[i][1] = 0.1;
+  }
+
+  double t = 0;
+  long iterations = 0;
+  while (t < 500) {
+    double u_t = input(t);
+    for (lapack_int k = 0; k < INSTANCES; k++)
+      u[k] = u_t;
+
+    if (ensemble_step(&opt, ws, xp, t, x, u, p) != EULER_SUCCESS)
+      return 1;
+    for (lapack_int k = 0; k < INSTANCES; k++)
+      iterations += ws->iterations[k];
+
+    for (int i = 0; i < 3; i++) {
+      ref.data = &checked[i];
+      euler_ws(&ref, ref_ws, xp_ref, t, x_ref[i], &u_t, p, NULL);
+      x_ref[i][0] = xp_ref[0];
+      x_ref[i][1] = xp_ref[1];
+    }
+
+    double *swap = x;
+    x = xp;
+    xp = swap;
+    t += opt.ts;
+  }
+
+  double error = 0;
+  for (int i = 0; i < 3; i++) {
+    lapack_int k = checked[i];
+    printf("k = % 5.6f, x = (% 5.6f, % 5.6f), reference = (% 5.6f, % 5.6f)\n",
+           k_in[k], x[k], x[ld + k], x_ref[i][0], x_ref[i][1]);
+    error = fmax(error, fmax(fabs(x[k] - x_ref[i][0]), fabs(x[ld + k] - x_ref[i][1])));
+  }
+  printf("max error = %e\n", error);
+  printf("mean iterations = %f\n", (double)iterations / (50000.0 * INSTANCES));
+
+  ensemble_array_free(x);
+  ensemble_array_free(xp);
+  ensemble_array_free(u);
+  ensemble_workspace_free(ws);
+  euler_workspace_free(ref_ws);
+  return error < 1e-9 ? 0 : 1;
+}
@@ -37,21 +37,30 @@ double input(double t) {
   return 8.0;
 }
 
+void input_provider(double *u, const double t, const double *x, void *data) {
+  u[0] = input(t);
+}
+
+int output_sink(const double *rows, const lapack_int n_rows, const lapack_int n_cols, void *data) {
+  for (lapack_int i = 0; i < n_rows; i++) {
+    const double *row = rows + i * n_cols;
+    printf("% 5.3f, % 5.6f, % 5.6f, % 5.6f\n", row[0], input(row[0]), row[1], row[2]);
+  }
+  return 0;
+}
+
+euler_integrate_options iopt = {
+  .u_size = 1,
+  .input = input_provider,
+  .sink = output_sink,
+  .decimation = 1,
+  .block_rows = 0,
+  .data = NULL
+};
+
 int main() {
-  double t = 0;
   double x[2] = {1e-6, 0.1};
-  double xp[2] = {0, 0.1};
-  double u = input(t);
-
-  while (t < 500) {
-    printf("% 5.3f, % 5.6f, % 5.6f, % 5.6f\n", t, u, x[0], x[1]);
-    
-    euler(&opt, xp, t, x, &u, NULL, NULL);
-
-    t += opt.ts;
-    u = input(t);
-    x[0] = xp[0];
-    x[1] = xp[1];
-  }
 
-}
\ No newline at end of file
+  euler_ret ret = euler_integrate(&opt, &iopt, NULL, 0, 500, x, x, NULL);
+  return ret == EULER_SUCCESS ? 0 : 1;
+}
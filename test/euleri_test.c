@@ -59,15 +59,22 @@ int main()
   double xp[2] = {0, 0.1};
   double u = input(t);
 
+  euler_workspace *ws = euler_workspace_alloc(&opt);
+  if (!ws)
+    return 1;
+
   while (t < 500)
   {
     printf("% 5.3f, % 5.6f, % 5.6f, % 5.6f\n", t, u, x[0], x[1]);
 
-    euler(&opt, xp, t, x, &u, NULL, NULL);
+    euler_ws(&opt, ws, xp, t, x, &u, NULL, NULL);
 
     t += opt.ts;
     u = input(t);
     x[0] = xp[0];
     x[1] = xp[1];
   }
+
+  euler_workspace_free(ws);
+  return 0;
 }
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+#include "libeuler.h"
+#include "libeuler.hpp"
+
+/* Two tanks model, as in euleri_test.c */
+const double A1 = 0.180, k = 0.003, a1 = 0.006, g = 9.810, A2 = 0.080, a2 = 0.008;
+
+void f(double *f, double t, const double *x, const double *u, const double **p, void *data)
+{
+  f[0] = 1.0 / A1 * (k * u[0] - a1 * sqrt(2 * g * x[0]));
+  f[1] = 1.0 / A2 * (a1 * sqrt(2 * g * x[0]) - a2 * sqrt(2 * g * x[1]));
+}
+
+void df(double *df, double t, const double *x, const double *u, const double **p, void *data)
+{
+  df[0] = -(a1 * sqrt(g)) / (A1 * sqrt(2 * x[0]));
+  df[1] = (a1 * sqrt(g)) / (A2 * sqrt(2 * x[0]));
+  df[2] = 0;
+  df[3] = -(a2 * sqrt(g)) / (A2 * sqrt(2 * x[1]));
+}
+
+double input(double t)
+{
+  if (t < 251)
+    return 10.0;
+  if (t < 451)
+    return 5.0;
+  return 8.0;
+}
+
+int main()
+{
+  euler_options opt = {};
+  opt.ts = 1e-2;
+  opt.alpha = 0.5;
+  opt.x_size = 2;
+  opt.ordering = LAPACK_COL_MAJOR;
+  opt.s_tol = 1e-12;
+  opt.x_tol = 1e-12;
+  opt.max_iter = 100;
+  opt.f = f;
+  opt.df = df;
+
+  const libeuler::euler_options opt_pp = {opt.ts, opt.alpha, 0, opt.s_tol, opt.x_tol, opt.max_iter};
+  auto f_pp = [](libeuler::vector<2> &f, const double t, const libeuler::vector<2> &x, const double *u) {
+    f[0] = 1.0 / A1 * (k * u[0] - a1 * std::sqrt(2 * g * x[0]));
+    f[1] = 1.0 / A2 * (a1 * std::sqrt(2 * g * x[0]) - a2 * std::sqrt(2 * g * x[1]));
+  };
+  auto df_pp = [](libeuler::matrix<2> &df, const double t, const libeuler::vector<2> &x, const double *u) {
+    df[0] = -(a1 * std::sqrt(g)) / (A1 * std::sqrt(2 * x[0]));
+    df[1] = (a1 * std::sqrt(g)) / (A2 * std::sqrt(2 * x[0]));
+    df[2] = 0;
+    df[3] = -(a2 * std::sqrt(g)) / (A2 * std::sqrt(2 * x[1]));
+  };
+
+  const long steps = 50000;
+  double x[2] = {1e-6, 0.1}, xp[2];
+  libeuler::vector<2> x_pp = {1e-6, 0.1}, xp_pp;
+  double err = 0, elapsed_c = 0, elapsed_pp = 0;
+
+  euler_workspace *ws = euler_workspace_alloc(&opt);
+  if (!ws)
+    return 1;
+
+  for (long s = 0; s < steps; s++) {
+    const double t = s * opt.ts;
+    const double u = input(t);
+
+    auto start = std::chrono::steady_clock::now();
+    euler_ws(&opt, ws, xp, t, x, &u, NULL, NULL);
+    auto middle = std::chrono::steady_clock::now();
+    if (libeuler::euler_step<2, libeuler::ordering::col_major>(opt_pp, f_pp, df_pp, xp_pp, t, x_pp, &u) != libeuler::euler_ret::success) {
+      printf("Step %ld failed\n", s);
+      return 1;
+    }
+    auto end = std::chrono::steady_clock::now();
+    elapsed_c += std::chrono::duration<double, std::nano>(middle - start).count();
+    elapsed_pp += std::chrono::duration<double, std::nano>(end - middle).count();
+
+    for (int i = 0; i < 2; i++) {
+      x[i] = xp[i];
+      x_pp[i] = xp_pp[i];
+      err = fmax(err, fabs(x[i] - x_pp[i]));
+    }
+  }
+  euler_workspace_free(ws);
+
+  printf("Final state: % 5.6f, % 5.6f\n", x_pp[0], x_pp[1]);
+  printf("max error = %e\n", err);
+  printf("euler_ws:              %8.1f ns / step\n", elapsed_c / steps);
+  printf("libeuler::euler_step:  %8.1f ns / step\n", elapsed_pp / steps);
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <math.h>
+#include "libeuler.h"
+#include "models.h"
+
+/* Two tanks of test/models.h, with the inflow switching at t = 251 and t = 451 */
+
+void input_provider(double *u, const double t, const double *x, void *data)
+{
+  u[0] = tanks_input(t);
+}
+
+/* Guards: level of the second tank crossing 0.5, level of the first tank below 0.4 */
+void event(double *g, const double t, const double *x, void *data)
+{
+  g[0] = x[1] - 0.5;
+  g[1] = x[0] - 0.4;
+}
+
+typedef struct run_data {
+  lapack_int rows;          /* stored rows */
+  lapack_int n_events;      /* located crossings of the first guard */
+  double t_events[8];       /* times of the crossings */
+  int terminal;             /* the second guard terminates the integration */
+  double t_stop;            /* time of the terminal event */
+} run_data;
+
+int handler(const lapack_int *fired, const double t, double *x, void *data)
+{
+  run_data *run = (run_data *)data;
+  if (fired[0] && run->n_events < 8)
+    run->t_events[run->n_events++] = t;
+  if (run->terminal && fired[1] < 0) {
+    run->t_stop = t;
+    return 1;
+  }
+  return 0;
+}
+
+int sink(const double *rows, const lapack_int n_rows, const lapack_int n_cols, void *data)
+{
+  ((run_data *)data)->rows += n_rows;
+  return 0;
+}
+
+euler_options opt = {
+    .ts = 1e-2,
+    .alpha = 0.5,
+    .x_size = 2,
+    .u_offset = 0,
+    .ordering = LAPACK_COL_MAJOR,
+    .s_tol = 1e-12,
+    .x_tol = 1e-12,
+    .max_iter = 100,
+    .f = tanks_f,
+    .df = tanks_df,
+    .data = NULL};
+
+const double tstops[] = {251, 451};
+
+euler_ret run(double ts, int with_tstops, int terminal, double *xf, run_data *data)
+{
+  euler_options o = opt;
+  o.ts = ts;
+  euler_integrate_options iopt = {
+      .u_size = 1,
+      .input = input_provider,
+      .sink = sink,
+      .data = data,
+      .tstops = with_tstops ? tstops : NULL,
+      .n_tstops = with_tstops ? 2 : 0,
+      .event = event,
+      .handler = handler,
+      .n_events = 2};
+  double x0[2] = {1e-6, 0.1};
+  data->rows = 0;
+  data->n_events = 0;
+  data->terminal = terminal;
+  return euler_integrate(&o, &iopt, NULL, 0, 500, x0, xf, NULL);
+}
+
+int main()
+{
+  /* Reference: small step, landing on the discontinuities */
+  run_data ref;
+  double x_ref[2];
+  if (run(1e-3, 1, 0, x_ref, &ref) != EULER_SUCCESS)
+    return 1;
+  printf("reference (ts = 1e-3): x(500) = [%.6f, %.6f], level 2 crosses 0.5 at", x_ref[0], x_ref[1]);
+  for (lapack_int i = 0; i < ref.n_events; i++)
+    printf(" %.4f", ref.t_events[i]);
+  printf("\n\n");
+
+  printf("%8s  %12s  %12s  %8s  %s\n", "ts", "err (plain)", "err (tstops)", "rows", "event times (tstops)");
+  const double steps[] = {10, 5, 2, 1, 0.1};
+  for (int i = 0; i < 5; i++) {
+    run_data plain, stops;
+    double x_plain[2], x_stops[2];
+    if (run(steps[i], 0, 0, x_plain, &plain) != EULER_SUCCESS)
+      return 1;
+    if (run(steps[i], 1, 0, x_stops, &stops) != EULER_SUCCESS)
+      return 1;
+    double err_plain = fmax(fabs(x_plain[0] - x_ref[0]), fabs(x_plain[1] - x_ref[1]));
+    double err_stops = fmax(fabs(x_stops[0] - x_ref[0]), fabs(x_stops[1] - x_ref[1]));
+    printf("%8g  %12.3e  %12.3e  %8d ", steps[i], err_plain, err_stops, (int)stops.rows);
+    for (lapack_int j = 0; j < stops.n_events; j++)
+      printf(" %.4f", stops.t_events[j]);
+    printf("\n");
+  }
+
+  /* Terminal event: the integration stops when the first tank falls below 0.4 */
+  run_data term;
+  double x_term[2];
+  if (run(5, 1, 1, x_term, &term) != EULER_SUCCESS)
+    return 1;
+  printf("\nterminal event (ts = 5): stopped at t = %.4f with x = [%.6f, %.6f]\n", term.t_stop, x_term[0], x_term[1]);
+  return 0;
+}
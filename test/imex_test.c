@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "libeuler.h"
+
+/* Plant with a few fast hydraulic states and many slow thermal ones. The pressures follow the
+   supply through a stiff valve, and heat the thermal chain of their segment:
+     P_k' = -L (P_k - u - c T_k) - P_k^3,  T_k the mean temperature of the segment k
+     T_i' = D (T_{i-1} - 2 T_i + T_{i+1}) + q (P_k - T_i) */
+#define P 4
+#define T 400
+#define N (P + T)
+#define SEGMENT (T / P)
+#define L 1e4
+#define C 0.01
+#define D 1.0
+#define Q 0.5
+#define STEPS 500
+
+static double segment_mean(const double *x, const int k)
+{
+  double mean = 0;
+  for (int i = 0; i < SEGMENT; i++)
+    mean += x[P + k * SEGMENT + i];
+  return mean / SEGMENT;
+}
+
+void f(double *f, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  for (int k = 0; k < P; k++)
+    f[k] = -L * (x[k] - u[0] - C * segment_mean(x, k)) - x[k] * x[k] * x[k];
+  for (int i = 0; i < T; i++) {
+    const double left = i > 0 ? x[P + i - 1] : 0;
+    const double right = i < T - 1 ? x[P + i + 1] : 0;
+    f[P + i] = D * (left - 2 * x[P + i] + right) + Q * (x[i / SEGMENT] - x[P + i]);
+  }
+}
+
+/* Dense column major Jacobian */
+void df(double *df, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  for (int q = 0; q < N * N; q++)
+    df[q] = 0;
+  for (int k = 0; k < P; k++) {
+    df[k + k * N] = -L - 3 * x[k] * x[k];
+    for (int i = 0; i < SEGMENT; i++)
+      df[k + (P + k * SEGMENT + i) * N] = L * C / SEGMENT;
+  }
+  for (int i = 0; i < T; i++) {
+    const int r = P + i;
+    df[r + r * N] = -2 * D - Q;
+    if (i > 0)
+      df[r + (r - 1) * N] = D;
+    if (i < T - 1)
+      df[r + (r + 1) * N] = D;
+    df[r + (i / SEGMENT) * N] = Q;
+  }
+}
+
+/* Nonzeros of the Jacobian, in the CSC pattern built from the dense one */
+lapack_int col_ptr[N + 1], row_idx[N * 8];
+double dense[N * N];
+
+void df_sparse(double *nz, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  df(dense, t, x, u, p, data);
+  for (int c = 0; c < N; c++)
+    for (lapack_int q = col_ptr[c]; q < col_ptr[c + 1]; q++)
+      nz[q] = dense[row_idx[q] + c * N];
+}
+
+void build_pattern()
+{
+  double x[N], u[2] = {1, 1};
+  for (int i = 0; i < N; i++)
+    x[i] = 1;
+  df(dense, 0, x, u, NULL, NULL);
+  lapack_int q = 0;
+  for (int c = 0; c < N; c++) {
+    col_ptr[c] = q;
+    for (int r = 0; r < N; r++)
+      if (dense[r + c * N] != 0)
+        row_idx[q++] = r;
+  }
+  col_ptr[N] = q;
+}
+
+/* Integration from a cold plant with a supply step. Returns the final state */
+int simulate(const euler_options *opt, double *x, double *elapsed, lapack_int *iterations)
+{
+  double xp[N], u[2] = {1.0, 1.0};
+  for (int i = 0; i < N; i++)
+    x[i] = 0;
+  *iterations = 0;
+  euler_workspace *ws = euler_workspace_alloc(opt);
+  if (!ws)
+    return 1;
+  clock_t start = clock();
+  for (int s = 0; s < STEPS; s++) {
+    if (euler_ws(opt, ws, xp, s * opt->ts, x, u, NULL, NULL) != EULER_SUCCESS ||
+        (opt->alpha > 0 && ws->status >= NEWTON_MAX_ITER)) {
+      euler_workspace_free(ws);
+      return 1;
+    }
+    *iterations += opt->alpha > 0 ? ws->stats.iterations : 0;
+    for (int i = 0; i < N; i++)
+      x[i] = xp[i];
+  }
+  *elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+  euler_workspace_free(ws);
+  return 0;
+}
+
+double max_difference(const double *a, const double *b)
+{
+  double err = 0;
+  for (int i = 0; i < N; i++)
+    err = fmax(err, fabs(a[i] - b[i]));
+  return err;
+}
+
+int main()
+{
+  const lapack_int stiff[P] = {0, 1, 2, 3};
+  build_pattern();
+  sparse_pattern pattern = {N, col_ptr, row_idx};
+  euler_options opt = {
+      .ts = 1e-2,
+      .alpha = 1.0,
+      .x_size = N,
+      .u_offset = 1,
+      .ordering = LAPACK_COL_MAJOR,
+      .s_tol = 1e-10,
+      .x_tol = 1e-14,
+      .max_iter = 50,
+      .f = f,
+      .df = df,
+      .method = NEWTON_MODIFIED};
+  double x_ref[N], x[N], elapsed;
+  lapack_int iterations;
+
+  printf("Plant with %d stiff and %d non stiff states, %d steps of %g s\n", P, T, STEPS, opt.ts);
+  if (simulate(&opt, x_ref, &elapsed, &iterations)) {
+    printf("The implicit integration failed\n");
+    return 1;
+  }
+  printf("  implicit (modified Newton)        %8.3f s, %4d Newton iterations\n", elapsed, (int)iterations);
+
+  opt.alpha = 0;
+  int diverged = simulate(&opt, x, &elapsed, &iterations) || !isfinite(x[0]) || max_difference(x, x_ref) > 1;
+  printf("  explicit                          %s\n", diverged ? "diverged" : "stable");
+
+  const char *name[3] = {"dense Jacobian", "sparse Jacobian", "finite diff."};
+  const char *method[3] = {"full", "modified", "broyden"};
+  opt.alpha = 1.0;
+  opt.stiff = stiff;
+  opt.stiff_size = P;
+  double worst = 0;
+  for (int variant = 0; variant < 3; variant++) {
+    opt.df = variant == 0 ? df : variant == 1 ? df_sparse : NULL;
+    opt.pattern = variant == 1 ? &pattern : NULL;
+    for (int m = NEWTON_FULL; m <= NEWTON_BROYDEN; m++) {
+      opt.method = (newton_method)m;
+      if (simulate(&opt, x, &elapsed, &iterations)) {
+        printf("The partitioned integration failed (%s, method %d)\n", name[variant], m);
+        return 1;
+      }
+      const double err = max_difference(x, x_ref);
+      printf("  IMEX %-15s %-8s %8.3f s, %4d Newton iterations, max difference = %.2e\n",
+             name[variant], method[m], elapsed, (int)iterations, err);
+      worst = fmax(worst, err);
+    }
+  }
+
+  /* The partitioned step differs from the implicit one by the explicit step of the slow states */
+  if (!diverged || worst > 1e-2) {
+    printf("Unexpected behaviour of the partitioned step\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "libeuler.h"
+
+/* Stiff model with a dense Jacobian:
+   dx_i/dt = u - l_i x_i - x_i^3 + c/n sum_j sin(x_j + i - j), l_i in [1, 1e3] */
+#define COUPLING 1.0
+lapack_int N;
+
+void f(double *f, double t, const double *x, const double *u, const double **p, void *data)
+{
+  for (lapack_int i = 0; i < N; i++) {
+    double coupling = 0;
+    for (lapack_int j = 0; j < N; j++)
+      coupling += sin(x[j] + i - j);
+    f[i] = u[0] - (1 + 1e3 * i / N) * x[i] - x[i] * x[i] * x[i] + COUPLING * coupling / N;
+  }
+}
+
+void df(double *df, double t, const double *x, const double *u, const double **p, void *data)
+{
+  for (lapack_int j = 0; j < N; j++)
+    for (lapack_int i = 0; i < N; i++)
+      df[i + j * N] = COUPLING * cos(x[j] + i - j) / N - (i == j ? (1 + 1e3 * i / N) + 3 * x[i] * x[i] : 0);
+}
+
+/* Linear system with the Hilbert matrix (condition number about 1e10 for n = 8), that is singular
+   in single precision: the refinement stalls and the solver falls back to the double precision LU */
+#define HILBERT 8
+
+void hilbert(double *f, double t, const double *x, const double *u, const double **p, void *data)
+{
+  for (int i = 0; i < HILBERT; i++) {
+    f[i] = -1;
+    for (int j = 0; j < HILBERT; j++)
+      f[i] += x[j] / (i + j + 1);
+  }
+}
+
+void hilbert_df(double *df, double t, const double *x, const double *u, const double **p, void *data)
+{
+  for (int j = 0; j < HILBERT; j++)
+    for (int i = 0; i < HILBERT; i++)
+      df[i + j * HILBERT] = 1.0 / (i + j + 1);
+}
+
+/* Implicit steps from a zero state. Returns the solver statistics, summed over the steps */
+newton_stats integrate(const euler_options *opt, lapack_int steps, double *x, double *elapsed)
+{
+  double u[1] = {1.0};
+  double *xp = (double *)malloc(N * sizeof(double));
+  newton_stats total = {0};
+  for (lapack_int i = 0; i < N; i++)
+    x[i] = 0;
+
+  euler_workspace *ws = euler_workspace_alloc(opt);
+  if (!ws) {
+    printf("Cannot allocate the workspace\n");
+    exit(1);
+  }
+  clock_t start = clock();
+  for (lapack_int k = 0; k < steps; k++) {
+    if (euler_ws(opt, ws, xp, k * opt->ts, x, u, NULL, NULL) != EULER_SUCCESS || ws->status >= NEWTON_MAX_ITER) {
+      printf("Step %d failed\n", (int)k);
+      exit(1);
+    }
+    total.iterations += ws->stats.iterations;
+    total.refinements += ws->stats.refinements;
+    total.fallbacks += ws->stats.fallbacks;
+    for (lapack_int i = 0; i < N; i++)
+      x[i] = xp[i];
+  }
+  *elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+  euler_workspace_free(ws);
+  free(xp);
+  return total;
+}
+
+int main()
+{
+  euler_options opt = {
+      .ts = 1e-2,
+      .alpha = 1.0,
+      .ordering = LAPACK_COL_MAJOR,
+      .s_tol = 1e-10,
+      .x_tol = 1e-14,
+      .max_iter = 20,
+      .f = f,
+      .df = df,
+      .method = NEWTON_FULL};
+  const lapack_int sizes[3] = {200, 500, 1000};
+
+  for (int s = 0; s < 3; s++) {
+    N = sizes[s];
+    opt.x_size = N;
+    double *x = (double *)malloc(N * sizeof(double));
+    double *x_ref = (double *)malloc(N * sizeof(double));
+    double elapsed_ref, elapsed;
+
+    opt.mixed = NEWTON_FALSE;
+    newton_stats ref = integrate(&opt, 10, x_ref, &elapsed_ref);
+    opt.mixed = NEWTON_TRUE;
+    newton_stats mixed = integrate(&opt, 10, x, &elapsed);
+
+    double err = 0;
+    for (lapack_int i = 0; i < N; i++)
+      err = fmax(err, fabs(x[i] - x_ref[i]));
+    printf("n = %4d  double %7.3f s (%3d iterations)  mixed %7.3f s (%3d iterations, %3d refinements, "
+           "%d fallbacks)  max difference = %.2e\n",
+           (int)N, elapsed_ref, (int)ref.iterations, elapsed, (int)mixed.iterations,
+           (int)mixed.refinements, (int)mixed.fallbacks, err);
+    if (err > 1e-10) {
+      printf("The mixed precision solution differs from the double precision one\n");
+      return 1;
+    }
+    free(x);
+    free(x_ref);
+  }
+
+  /* Fallback to the double precision factors */
+  newton_options hopt = {
+    .ordering = LAPACK_COL_MAJOR, .f_size = HILBERT, .x_size = HILBERT,
+    .f_tol = 1e-10, .x_tol = 1e-14, .max_iter = 5,
+    .f = hilbert, .df = hilbert_df, .mixed = NEWTON_TRUE};
+  newton_workspace *ws = newton_workspace_alloc(&hopt);
+  double x[HILBERT] = {0};
+  newton_stats stats = {0};
+  newton_ret ret = newton_solve_r(&hopt, ws, &stats, 0, x, NULL, NULL, NULL);
+  printf("Hilbert %d: EXIT = %d, |f| = %.2e, %d refinements, %d fallbacks\n",
+         HILBERT, ret, stats.f_norm, (int)stats.refinements, (int)stats.fallbacks);
+  newton_workspace_free(ws);
+  if (ret != NEWTON_F_TOL || stats.fallbacks == 0) {
+    printf("The ill-conditioned system did not fall back to the double precision factors\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,59 @@
+/* Models shared by the tests: the two tanks of test/euleri_test.c and the Prothero-Robinson
+   stiff problem. Each test is a single translation unit, thus the functions are static */
+#ifndef TEST_MODELS_H
+#define TEST_MODELS_H
+
+#include <math.h>
+#include "libeuler.h"
+
+/* Evaluations of the vector fields of the models */
+static long model_evaluations = 0;
+
+/* Two tanks: x are the levels, u[0] the inflow */
+#define TANKS_A1 0.180
+#define TANKS_K 0.003
+#define TANKS_a1 0.006
+#define TANKS_G 9.810
+#define TANKS_A2 0.080
+#define TANKS_a2 0.008
+
+static inline void tanks_f(double *f, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  model_evaluations++;
+  f[0] = 1.0 / TANKS_A1 * (TANKS_K * u[0] - TANKS_a1 * sqrt(2 * TANKS_G * x[0]));
+  f[1] = 1.0 / TANKS_A2 * (TANKS_a1 * sqrt(2 * TANKS_G * x[0]) - TANKS_a2 * sqrt(2 * TANKS_G * x[1]));
+}
+
+static inline void tanks_df(double *df, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  df[0] = -(TANKS_a1 * sqrt(TANKS_G)) / (TANKS_A1 * sqrt(2 * x[0]));
+  df[1] = (TANKS_a1 * sqrt(TANKS_G)) / (TANKS_A2 * sqrt(2 * x[0]));
+  df[2] = 0;
+  df[3] = -(TANKS_a2 * sqrt(TANKS_G)) / (TANKS_A2 * sqrt(2 * x[1]));
+}
+
+/* Inflow of the tanks switching at t = 251 and t = 451 */
+static inline double tanks_input(const double t)
+{
+  if (t < 251)
+    return 10.0;
+  if (t < 451)
+    return 5.0;
+  return 8.0;
+}
+
+/* Prothero-Robinson stiff problem x' = -lambda (x - sin(t)) + cos(t), with solution sin(t) */
+#define PR_LAMBDA 1e6
+
+static inline void pr_f(double *f, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  model_evaluations++;
+  f[0] = -PR_LAMBDA * (x[0] - sin(t)) + cos(t);
+}
+
+static inline void pr_df(double *df, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  df[0] = -PR_LAMBDA;
+}
+
+#endif
@@ -2,37 +2,104 @@
 #include <math.h>
 #include "libnewton.h"
 
-void function(double *f, const double *x, const double *u, const double **p, void *data) {
+void function(double *f, const double t, const double *x, const double *u, const double **p, void *data) {
   f[0] = 2 * x[0] - x[1] - exp(-x[0]);
   f[1] = -x[0] + 2 * x[1] - exp(-x[1]);
 }
 
-void gradient(double *df, const double *x, const double *u, const double **p, void *data) {
+void gradient(double *df, const double t, const double *x, const double *u, const double **p, void *data) {
   df[0] = 2 + exp(-x[0]);
   df[1] = -1;
   df[2] = -1;
   df[3] = 2 + exp(-x[1]);
 }
 
+/* Implicit Euler step residual of x1' = -k atan(x1) + x2, x2' = -x2, from x(0) = [10, 1] with
+   h = 1: plain Newton overshoots the saturated vector field and diverges */
+#define STIFF_K 100.0
+#define STIFF_H 1.0
+static const double stiff_x0[2] = {10, 1};
+
+void stiff_function(double *f, const double t, const double *x, const double *u, const double **p, void *data) {
+  f[0] = stiff_x0[0] - x[0] + STIFF_H * (-STIFF_K * atan(x[0]) + x[1]);
+  f[1] = stiff_x0[1] - x[1] - STIFF_H * x[1];
+}
+
+void stiff_gradient(double *df, const double t, const double *x, const double *u, const double **p, void *data) {
+  df[0] = -1 - STIFF_H * STIFF_K / (1 + x[0] * x[0]);
+  df[1] = 0;
+  df[2] = STIFF_H;
+  df[3] = -1 - STIFF_H;
+}
+
+/* System without roots, x0^2 + 1 = 0 and x1 = 1: |f| has a local minimum in (0, 1), where the
+   Jacobian is singular. The Newton steps grow without bound, and the dogleg rejects them until
+   the trust region collapses */
+void rootless_function(double *f, const double t, const double *x, const double *u, const double **p, void *data) {
+  f[0] = x[0] * x[0] + 1;
+  f[1] = x[1] - 1;
+}
+
+void rootless_gradient(double *df, const double t, const double *x, const double *u, const double **p, void *data) {
+  df[0] = 2 * x[0];
+  df[1] = 0;
+  df[2] = 0;
+  df[3] = 1;
+}
+
+/* The rootless system, that spends the rest of the time budget (the deadline in data) at the
+   evaluation DEADLINE_EVALS, recording the smallest and the last residual norms */
+#define DEADLINE_EVALS 30
+static int deadline_evals = 0;
+static double deadline_min = INFINITY, deadline_last = 0;
+
+void deadline_function(double *f, const double t, const double *x, const double *u, const double **p, void *data) {
+  rootless_function(f, t, x, u, p, data);
+  deadline_last = hypot(f[0], f[1]);
+  deadline_min = fmin(deadline_min, deadline_last);
+  if (++deadline_evals == DEADLINE_EVALS)
+    while (newton_clock() < *(const double *)data)
+      ;
+}
 
 newton_options options = {
-  LAPACK_COL_MAJOR,
-  2,
-  2,
-  1e-12,
-  1e-12,
-  100,
-  function,
-  gradient
+  .ordering = LAPACK_COL_MAJOR,
+  .f_size = 2,
+  .x_size = 2,
+  .f_tol = 1e-12,
+  .x_tol = 1e-12,
+  .max_iter = 100,
+  .f = function,
+  .df = gradient
 };
 
+static const char *globalization_name[] = {"none", "line search", "dogleg"};
+
+/* Solves from x0 with the given method and globalization, printing the outcome. Returns the exit
+   code of the dogleg, with its statistics */
+static newton_ret compare(newton_options *opt, const double *x0, newton_stats *dogleg) {
+  newton_ret ret = NEWTON_GENERIC_ERROR;
+  for (int g = NEWTON_GLOBAL_NONE; g <= NEWTON_DOGLEG; g++) {
+    opt->globalization = (newton_globalization)g;
+    newton_workspace *ws = newton_workspace_alloc(opt);
+    double x[2] = {x0[0], x0[1]};
+    newton_stats stats = {0};
+    ret = ws ? newton_solve_r(opt, ws, &stats, 0, x, NULL, NULL, NULL) : NEWTON_GENERIC_ERROR;
+    printf("  %-11s EXIT = %d  x = (% .6e, % .6e)  |f| = %.3e  iter = %3d  f evals = %3d\n",
+           globalization_name[g], ret, x[0], x[1], stats.f_norm, stats.iterations, stats.evaluations);
+    *dogleg = stats;
+    newton_workspace_free(ws);
+  }
+  return ret;
+}
+
 int main() {
 
   double x[2] = {10, 10};
   double f[2] = {0, 0};
 
-  newton_ret ret = newton_solve(&options, x, NULL, NULL, NULL);
-  function(f, x, NULL, NULL, NULL);
+  newton_ret ret = newton_solve(&options, 0, x, NULL, NULL, NULL);
+  function(f, 0, x, NULL, NULL, NULL);
 
   printf("EXIT = %d\n", ret);
   printf("  f(% 5.10f, % 5.10f) = (% 5.10f, % 5.10f)\n", x[0], x[1], f[0], f[1]);
@@ -40,5 +107,59 @@ int main() {
   printf("  |x| = % 5.20f\n", options.x_tol);
   printf(" iter = %d\n", options.max_iter);
 
+  /* Globalization strategies */
+  newton_options opt = {
+    .ordering = LAPACK_COL_MAJOR, .f_size = 2, .x_size = 2,
+    .f_tol = 1e-12, .x_tol = 1e-12, .max_iter = 100,
+    .f = function, .df = gradient};
+  const double starts[][2] = {{10, 10}, {-10, -10}, {-2, 5}};
+  newton_stats stats;
+  for (int s = 0; s < 3; s++) {
+    printf("\nexp system from (% g, % g), full Newton:\n", starts[s][0], starts[s][1]);
+    compare(&opt, starts[s], &stats);
+  }
+
+  /* The dogleg rejects the first steps (an evaluation each) and converges */
+  int failed = 0;
+  opt.f = stiff_function;
+  opt.df = stiff_gradient;
+  printf("\nimplicit step, k h = %g, full Newton:\n", STIFF_K * STIFF_H);
+  ret = compare(&opt, stiff_x0, &stats);
+  failed |= ret != NEWTON_F_TOL || stats.evaluations <= stats.iterations + 1;
+
+  /* Without roots the trust region collapses, and the solution must fail */
+  const double rootless_x0[2] = {0.3, 5};
+  opt.f = rootless_function;
+  opt.df = rootless_gradient;
+  printf("\nsystem without roots from (% g, % g), full Newton:\n", rootless_x0[0], rootless_x0[1]);
+  ret = compare(&opt, rootless_x0, &stats);
+  failed |= ret == NEWTON_F_TOL || ret == NEWTON_X_TOL;
+
+  /* Under a deadline the solution is the iterate with the smallest residual, not the last one */
+  opt.f = deadline_function;
+  opt.globalization = NEWTON_GLOBAL_NONE;
+  opt.deadline = newton_clock() + 0.05;
+  newton_workspace *ws = newton_workspace_alloc(&opt);
+  x[0] = rootless_x0[0];
+  x[1] = rootless_x0[1];
+  ret = ws ? newton_solve_r(&opt, ws, &stats, 0, x, NULL, NULL, &opt.deadline) : NEWTON_GENERIC_ERROR;
+  newton_workspace_free(ws);
+  rootless_function(f, 0, x, NULL, NULL, NULL);
+  printf("\nsystem without roots under a deadline: EXIT = %d  |f| = %.3e (smallest %.3e, last %.3e)\n",
+         ret, hypot(f[0], f[1]), deadline_min, deadline_last);
+  failed |= ret != NEWTON_DEADLINE || hypot(f[0], f[1]) != deadline_min || stats.f_norm != deadline_min ||
+            deadline_last == deadline_min;
+  opt.deadline = 0;
+
+  opt.f = stiff_function;
+  opt.df = stiff_gradient;
+  opt.method = NEWTON_MODIFIED;
+  printf("\nimplicit step, k h = %g, modified Newton:\n", STIFF_K * STIFF_H);
+  compare(&opt, stiff_x0, &stats);
+
+  if (failed) {
+    printf("Unexpected behaviour of the dogleg or of the deadline\n");
+    return 1;
+  }
   return 0;
 }
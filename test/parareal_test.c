@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <math.h>
+#include "libpool.h"
+
+/* Nonlinear reaction-diffusion chain of N cells, driven by a slow input on the first one:
+   x_i' = -sin(x_i) - x_i^3 + k (x_{i-1} - 2 x_i + x_{i+1}) */
+#define N 32
+#define K 2.0
+#define T1 40.0
+#define SLICES 32
+
+void f(double *f, double t, const double *x, const double *u, const double **p, void *data)
+{
+  for (int i = 0; i < N; i++) {
+    const double left = i > 0 ? x[i - 1] : u[0];
+    const double right = i < N - 1 ? x[i + 1] : x[i];
+    f[i] = -sin(x[i]) - x[i] * x[i] * x[i] + K * (left - 2 * x[i] + right);
+  }
+}
+
+void df(double *df, double t, const double *x, const double *u, const double **p, void *data)
+{
+  for (int k = 0; k < N * N; k++)
+    df[k] = 0;
+  for (int i = 0; i < N; i++) {
+    df[i + i * N] = -cos(x[i]) - 3 * x[i] * x[i] - K * (i < N - 1 ? 2 : 1);
+    if (i > 0)
+      df[i + (i - 1) * N] = K;
+    if (i < N - 1)
+      df[i + (i + 1) * N] = K;
+  }
+}
+
+void input(double *u, const double t, const double *x, void *data)
+{
+  u[0] = 1.0 + 0.5 * sin(0.2 * t);
+}
+
+/* Ratio between the sequential fine propagation and the longest fine propagation of the iterations
+   on the given threads (iteration k propagates SLICES - k slices), neglecting the coarse sweeps */
+double speedup_bound(const pool_parareal_stats *stats, const int threads)
+{
+  int critical = 0;
+  for (int k = 0; k < stats->iterations; k++)
+    critical += (SLICES - k + threads - 1) / threads;
+  return (double)SLICES / critical;
+}
+
+int main()
+{
+  euler_options opt = {
+      .ts = 1e-3,
+      .alpha = 0.5,
+      .x_size = N,
+      .u_offset = 1,
+      .ordering = LAPACK_COL_MAJOR,
+      .s_tol = 1e-12,
+      .x_tol = 1e-12,
+      .max_iter = 20,
+      .f = f,
+      .df = df,
+      .method = NEWTON_MODIFIED};
+  euler_integrate_options iopt = {.u_size = 1, .input = input};
+  pool_parareal_options popt = {.slices = SLICES, .coarse_steps = 10, .tol = 1e-9};
+
+  double x0[N] = {0};
+  for (int i = 0; i < N; i++)
+    x0[i] = 1.0 - (double)i / N;
+
+  /* Sequential fine integration */
+  double x_ref[N];
+  double start = newton_clock();
+  if (euler_integrate(&opt, &iopt, NULL, 0, T1, x0, x_ref, NULL) != EULER_SUCCESS) {
+    printf("Sequential integration failed\n");
+    return 1;
+  }
+  const double elapsed_ref = newton_clock() - start;
+
+  pool *pl = pool_create(0);
+  if (!pl) {
+    printf("Cannot create the pool\n");
+    return 1;
+  }
+  static double xs[(SLICES + 1) * N];
+  pool_parareal_stats stats;
+  start = newton_clock();
+  euler_ret ret = pool_parareal(pl, &opt, &iopt, &popt, 0, T1, x0, xs, NULL, &stats);
+  const double elapsed = newton_clock() - start;
+
+  double err = 0;
+  for (int i = 0; i < N; i++)
+    err = fmax(err, fabs(xs[SLICES * N + i] - x_ref[i]));
+  printf("sequential %8.3f s\n", elapsed_ref);
+  printf("parareal   %8.3f s on %d threads, %d slices, %d iterations, %d fine slices, correction %.2e\n",
+         elapsed, (int)pool_threads(pl), SLICES, (int)stats.iterations, (int)stats.fine_slices, stats.correction);
+  printf("  max difference of the final state = %.2e\n", err);
+  printf("  fine propagation speedup bound: %.2f on %d threads, %.2f on %d threads\n",
+         speedup_bound(&stats, pool_threads(pl)), (int)pool_threads(pl), speedup_bound(&stats, SLICES), SLICES);
+  pool_destroy(pl);
+
+  if (ret != EULER_SUCCESS || err > 1e-6) {
+    printf("Parareal did not converge to the sequential solution\n");
+    return 1;
+  }
+  return 0;
+}
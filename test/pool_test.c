@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <math.h>
+#include "libpool.h"
+
+#define TRAJECTORIES 500
+
+/* Two tanks model: the inflow gain k is the parameter p[0][0] */
+void f(double *f, double t, const double *x, const double *u, const double **p, void *data)
+{
+  double A1 = 0.180;
+  double k = p[0][0];
+  double a1 = 0.006;
+  double g = 9.810;
+  double A2 = 0.080;
+  double a2 = 0.008;
+
+  f[0] = 1.0 / A1 * (k * u[0] - a1 * sqrt(2 * g * x[0]));
+  f[1] = 1.0 / A2 * (a1 * sqrt(2 * g * x[0]) - a2 * sqrt(2 * g * x[1]));
+}
+
+void df(double *df, double t, const double *x, const double *u, const double **p, void *data)
+{
+  double A1 = 0.180;
+  double a1 = 0.006;
+  double g = 9.810;
+  double A2 = 0.080;
+  double a2 = 0.008;
+
+  df[0] = -(a1 * sqrt(g)) / (A1 * sqrt(2 * x[0]));
+  df[1] = (a1 * sqrt(g)) / (A2 * sqrt(2 * x[0]));
+  df[2] = 0;
+  df[3] = -(a2 * sqrt(g)) / (A2 * sqrt(2 * x[1]));
+}
+
+euler_options opt = {
+    .ts = 1e-1,
+    .alpha = 0.5,
+    .x_size = 2,
+    .u_offset = 0,
+    .ordering = LAPACK_COL_MAJOR,
+    .s_tol = 1e-12,
+    .x_tol = 1e-12,
+    .max_iter = 100,
+    .f = f,
+    .df = df,
+    .data = NULL};
+
+void input(double *u, const double t, const double *x, void *data)
+{
+  if (t < 251)
+    u[0] = 10.0;
+  else if (t < 451)
+    u[0] = 5.0;
+  else
+    u[0] = 8.0;
+}
+
+euler_integrate_options iopt = {
+    .u_size = 1,
+    .input = input,
+    .sink = NULL,
+    .decimation = 1,
+    .block_rows = 0,
+    .data = NULL};
+
+double k_in[TRAJECTORIES];
+double x_final[TRAJECTORIES][2];
+
+euler_ret task(const euler_options *opt, euler_workspace *ws, const lapack_int index, void *data)
+{
+  const double *p[1] = {k_in + index};
+  double x0[2] = {1e-6, 0.1};
+  return euler_integrate(opt, &iopt, ws, 0, 500, x0, x_final[index], p);
+}
+
+int main()
+{
+  for (lapack_int i = 0; i < TRAJECTORIES; i++)
+    k_in[i] = 0.001 + 0.004 * i / TRAJECTORIES;
+
+  pool *pl = pool_create(4);
+  if (!pl)
+    return 1;
+  euler_ret ret = pool_euler_run(pl, &opt, TRAJECTORIES, task, NULL, NULL);
+  pool_destroy(pl);
+  printf("EXIT = %d\n", ret);
+
+  /* Serial check of some trajectories */
+  double error = 0;
+  euler_workspace *ws = euler_workspace_alloc(&opt);
+  for (lapack_int i = 0; i < TRAJECTORIES; i += TRAJECTORIES / 4) {
+    double x_parallel[2] = {x_final[i][0], x_final[i][1]};
+    task(&opt, ws, i, NULL);
+    printf("k = % 5.6f, x = (% 5.6f, % 5.6f)\n", k_in[i], x_parallel[0], x_parallel[1]);
+    error = fmax(error, fmax(fabs(x_parallel[0] - x_final[i][0]), fabs(x_parallel[1] - x_final[i][1])));
+  }
+  euler_workspace_free(ws);
+  printf("max error = %e\n", error);
+
+  return (ret == EULER_SUCCESS && error == 0) ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <math.h>
+#include "libeuler.h"
+
+/* Nonlinear diffusion chain driven by a sinusoidal input on the first cell:
+   x_i' = -x_i^3 + c (x_{i-1} - 2 x_i + x_{i+1}), x_{-1} = u, x_N = 0 */
+#define N 30
+#define STEPS 2000
+#define C 50.0
+
+void f(double *f, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  for (int i = 0; i < N; i++) {
+    const double left = i > 0 ? x[i - 1] : u[0];
+    const double right = i < N - 1 ? x[i + 1] : 0;
+    f[i] = -x[i] * x[i] * x[i] + C * (left - 2 * x[i] + right);
+  }
+}
+
+void df(double *df, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  for (int q = 0; q < N * N; q++)
+    df[q] = 0;
+  for (int i = 0; i < N; i++) {
+    df[i + i * N] = -3 * x[i] * x[i] - 2 * C;
+    if (i > 0)
+      df[i + (i - 1) * N] = C;
+    if (i < N - 1)
+      df[i + (i + 1) * N] = C;
+  }
+}
+
+/* Integration from a zero state, with the total of the Newton iterations and evaluations */
+int simulate(const euler_options *opt, double *x, lapack_int *iterations, lapack_int *evaluations)
+{
+  double xp[N], u[2];
+  for (int i = 0; i < N; i++)
+    x[i] = 0;
+  *iterations = *evaluations = 0;
+  euler_workspace *ws = euler_workspace_alloc(opt);
+  if (!ws)
+    return 1;
+  for (int k = 0; k < STEPS; k++) {
+    u[0] = sin(k * opt->ts);
+    u[1] = sin((k + 1) * opt->ts);
+    if (euler_ws(opt, ws, xp, k * opt->ts, x, u, NULL, NULL) != EULER_SUCCESS || ws->status >= NEWTON_MAX_ITER) {
+      euler_workspace_free(ws);
+      return 1;
+    }
+    *iterations += ws->stats.iterations;
+    *evaluations += ws->stats.evaluations;
+    for (int i = 0; i < N; i++)
+      x[i] = xp[i];
+  }
+  euler_workspace_free(ws);
+  return 0;
+}
+
+int main()
+{
+  const char *name[3] = {"none", "explicit", "extrapolate"};
+  const double alphas[2] = {0.5, 1.0};
+  euler_options opt = {
+      .ts = 1e-2,
+      .x_size = N,
+      .u_offset = 1,
+      .ordering = LAPACK_COL_MAJOR,
+      .s_tol = 1e-10,
+      .x_tol = 1e-12,
+      .max_iter = 50,
+      .f = f,
+      .df = df};
+
+  printf("Chain of %d cells, %d steps of %g s, full Newton\n", N, STEPS, opt.ts);
+  int failed = 0;
+  for (int a = 0; a < 2; a++) {
+    opt.alpha = alphas[a];
+    double x_ref[N], x[N];
+    lapack_int iterations[3], evaluations[3];
+    for (int pr = EULER_PREDICT_NONE; pr <= EULER_PREDICT_EXTRAPOLATE; pr++) {
+      opt.predictor = (euler_predictor)pr;
+      if (simulate(&opt, pr == EULER_PREDICT_NONE ? x_ref : x, &iterations[pr], &evaluations[pr])) {
+        printf("The integration failed (alpha = %g, predictor %s)\n", opt.alpha, name[pr]);
+        return 1;
+      }
+      double err = 0;
+      for (int i = 0; pr != EULER_PREDICT_NONE && i < N; i++)
+        err = fmax(err, fabs(x[i] - x_ref[i]));
+      printf("  alpha = %.1f, predictor %-11s %5d Newton iterations, %5d f evals, max difference = %.2e\n",
+             opt.alpha, name[pr], (int)iterations[pr], (int)evaluations[pr], err);
+      failed |= err > 1e-8;
+    }
+    /* The extrapolation of the smooth trajectory starts closer to the solution */
+    failed |= iterations[EULER_PREDICT_EXTRAPOLATE] >= iterations[EULER_PREDICT_NONE];
+  }
+
+  if (failed) {
+    printf("Unexpected behaviour of the predictor\n");
+    return 1;
+  }
+  return 0;
+}
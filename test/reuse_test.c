@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include "libnewton.h"
+
+/* Sequence of implicit Euler residuals of a nonlinear diffusion chain, driven on the first cell:
+     F(x) = x_prev - x + h (-x_i^3 + c (x_{i-1} - 2 x_i + x_{i+1})), x_{-1} = u
+   The previous solution is passed as data. Consecutive systems differ a little, thus the LU
+   factors of modified Newton and Broyden remain good across the calls */
+#define N 60
+#define STEPS 200
+#define H 0.05
+#define C 20.0
+
+void function(double *f, const double t, const double *x, const double *u, const double **p, void *data) {
+  const double *x_prev = (const double *)data;
+  for (int i = 0; i < N; i++) {
+    const double left = i > 0 ? x[i - 1] : u[0];
+    const double right = i < N - 1 ? x[i + 1] : 0;
+    f[i] = x_prev[i] - x[i] + H * (-x[i] * x[i] * x[i] + C * (left - 2 * x[i] + right));
+  }
+}
+
+/* Column major Jacobian */
+void gradient(double *df, const double t, const double *x, const double *u, const double **p, void *data) {
+  for (int q = 0; q < N * N; q++)
+    df[q] = 0;
+  for (int i = 0; i < N; i++) {
+    df[i + i * N] = -1 - H * (3 * x[i] * x[i] + 2 * C);
+    if (i > 0)
+      df[i + (i - 1) * N] = H * C;
+    if (i < N - 1)
+      df[i + (i + 1) * N] = H * C;
+  }
+}
+
+/* Solves the whole sequence with one workspace, storing the solutions in x_all */
+static int sequence(newton_options *opt, double *x_all, newton_stats *total, double *elapsed) {
+  newton_workspace *ws = newton_workspace_alloc(opt);
+  if (!ws)
+    return 1;
+  double x_prev[N] = {0}, x[N] = {0};
+  clock_t start = clock();
+  for (int k = 0; k < STEPS; k++) {
+    const double u = 1.0 + sin(0.05 * k);
+    newton_stats stats = {0};
+    newton_ret ret = newton_solve_r(opt, ws, &stats, k * H, x, &u, NULL, x_prev);
+    if (ret != NEWTON_F_TOL && ret != NEWTON_X_TOL) {
+      newton_workspace_free(ws);
+      return 1;
+    }
+    total->iterations += stats.iterations;
+    total->jacobians += stats.jacobians;
+    total->evaluations += stats.evaluations;
+    for (int i = 0; i < N; i++)
+      x_prev[i] = x_all[k * N + i] = x[i];
+  }
+  *elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+  newton_workspace_free(ws);
+  return 0;
+}
+
+int main() {
+  const char *name[3] = {"full", "modified", "broyden"};
+  static double x_ref[STEPS * N], x_all[STEPS * N];
+  newton_options opt = {
+    .ordering = LAPACK_COL_MAJOR, .f_size = N, .x_size = N,
+    .f_tol = 1e-12, .x_tol = 1e-12, .max_iter = 100,
+    .f = function, .df = gradient};
+
+  printf("%d implicit steps of a chain of %d cells, one workspace per method\n", STEPS, N);
+  printf("  method     iterations  Jacobians  factorizations  f evals  time [s]  max difference\n");
+  double worst = 0;
+  for (int m = NEWTON_FULL; m <= NEWTON_BROYDEN; m++) {
+    opt.method = (newton_method)m;
+    newton_stats total = {0};
+    double elapsed;
+    if (sequence(&opt, m == NEWTON_FULL ? x_ref : x_all, &total, &elapsed)) {
+      printf("The %s Newton method failed\n", name[m]);
+      return 1;
+    }
+    double err = 0;
+    for (int q = 0; m != NEWTON_FULL && q < STEPS * N; q++)
+      err = fmax(err, fabs(x_all[q] - x_ref[q]));
+    worst = fmax(worst, err);
+
+    /* The full method solves each iteration with a new QR factorization (DGELS), the others
+       factorize a Jacobian once when it is evaluated */
+    const lapack_int factorizations = m == NEWTON_FULL ? total.iterations : total.jacobians;
+    printf("  %-9s  %10d  %9d  %14d  %7d  %8.4f  %.2e\n", name[m], (int)total.iterations,
+           (int)total.jacobians, (int)factorizations, (int)total.evaluations, elapsed, err);
+  }
+
+  if (worst > 1e-9) {
+    printf("The LU based methods differ from the full Newton\n");
+    return 1;
+  }
+  return 0;
+}
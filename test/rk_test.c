@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <math.h>
+#include "librk.h"
+#include "models.h"
+
+/* Integrates from 0 to t1 with the given number of steps. Tableau NULL selects euler_ws() */
+double integrate(euler_options *opt, const rk_tableau *tableau, const long steps, const double t1, const double *x0, double *x, double *err_max)
+{
+  const lapack_int n = opt->x_size;
+  double xp[2], err[2], u = 8.0, result = 0;
+  opt->ts = t1 / steps;
+  rk_workspace *rk = tableau ? rk_workspace_alloc(opt, tableau) : NULL;
+  euler_workspace *ws = tableau ? NULL : euler_workspace_alloc(opt);
+  if (!rk && !ws)
+    return -1;
+
+  for (lapack_int i = 0; i < n; i++)
+    x[i] = x0[i];
+  *err_max = 0;
+  for (long s = 0; s < steps; s++) {
+    euler_ret ret = tableau ? rk_step(opt, tableau, rk, xp, err, s * opt->ts, x, &u, NULL) : euler_ws(opt, ws, xp, s * opt->ts, x, &u, NULL, NULL);
+    if (ret != EULER_SUCCESS) {
+      result = -1;
+      break;
+    }
+    for (lapack_int i = 0; i < n; i++) {
+      x[i] = xp[i];
+      if (tableau)
+        *err_max = fmax(*err_max, fabs(err[i]));
+    }
+  }
+  rk_workspace_free(rk);
+  euler_workspace_free(ws);
+  return result;
+}
+
+int main()
+{
+  const char *names[] = {"euler", "tustin", "rk4", "dopri5", "sdirk2", "sdirk3"};
+  const rk_tableau *tableaus[] = {NULL, NULL, &rk_rk4, &rk_dopri5, &rk_sdirk2, &rk_sdirk3};
+  const double alphas[] = {0.0, 0.5, 0.0, 0.0, 0.0, 0.0};
+  const long steps[] = {10, 100, 1000, 10000};
+
+  euler_options opt = {
+      .x_size = 2,
+      .ordering = LAPACK_COL_MAJOR,
+      .s_tol = 1e-13,
+      .x_tol = 1e-15,
+      .max_iter = 50,
+      .f = tanks_f,
+      .df = tanks_df,
+      .method = NEWTON_MODIFIED};
+
+  /* Reference solution of the tanks model, with a fine DOPRI5 integration */
+  const double x0[2] = {0.5, 0.5}, t1 = 100;
+  double ref[2], x[2], err_max;
+  integrate(&opt, &rk_dopri5, 100000, t1, x0, ref, &err_max);
+
+  printf("Two tanks, t in [0, %g], error at the final time\n", t1);
+  printf("%8s %8s %14s %14s %10s\n", "method", "steps", "error", "estimate", "f evals");
+  for (int m = 0; m < 6; m++)
+    for (int s = 0; s < 4; s++) {
+      opt.alpha = alphas[m];
+      model_evaluations = 0;
+      if (integrate(&opt, tableaus[m], steps[s], t1, x0, x, &err_max)) {
+        printf("%8s %8ld %14s\n", names[m], steps[s], "failed");
+        continue;
+      }
+      double err = fmax(fabs(x[0] - ref[0]), fabs(x[1] - ref[1]));
+      printf("%8s %8ld %14.6e %14.6e %10ld\n", names[m], steps[s], err, err_max, model_evaluations);
+    }
+
+  /* Stiff problem: explicit methods are unstable for h > 2.8 / lambda */
+  opt.x_size = 1;
+  opt.f = pr_f;
+  opt.df = pr_df;
+  const double y0[1] = {0.0};
+  printf("\nProthero-Robinson, lambda = %g, t in [0, 10], error at the final time\n", PR_LAMBDA);
+  printf("%8s %8s %14s %14s %10s\n", "method", "steps", "error", "estimate", "f evals");
+  for (int m = 0; m < 6; m++)
+    for (int s = 0; s < 3; s++) {
+      opt.alpha = m == 0 ? 1.0 : alphas[m];
+      model_evaluations = 0;
+      if (integrate(&opt, tableaus[m], steps[s], 10, y0, x, &err_max)) {
+        printf("%8s %8ld %14s\n", m == 0 ? "implicit" : names[m], steps[s], "failed");
+        continue;
+      }
+      printf("%8s %8ld %14.6e %14.6e %10ld\n", m == 0 ? "implicit" : names[m], steps[s], fabs(x[0] - sin(10)), err_max, model_evaluations);
+    }
+  return 0;
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <math.h>
+#include "libeuler.h"
+
+/* Stiff model with a dense Jacobian, integrated by a 1 kHz loop:
+   dx_i/dt = u(t) - l_i x_i - x_i^3 + 1/n sum_j sin(x_j), l_i in [1, 1e3] */
+
+#define N 120
+#define STEPS 2000
+
+void f(double *f, double t, const double *x, const double *u, const double **p, void *data)
+{
+  double coupling = 0;
+  for (int j = 0; j < N; j++)
+    coupling += sin(x[j]) / N;
+  for (int i = 0; i < N; i++)
+    f[i] = u[0] - (1 + 1e3 * i / N) * x[i] - x[i] * x[i] * x[i] + coupling;
+}
+
+void df(double *df, double t, const double *x, const double *u, const double **p, void *data)
+{
+  for (int j = 0; j < N; j++)
+    for (int i = 0; i < N; i++)
+      df[i + j * N] = cos(x[j]) / N - (i == j ? (1 + 1e3 * i / N) + 3 * x[i] * x[i] : 0);
+}
+
+euler_options opt = {
+    .ts = 1e-3,
+    .alpha = 1,
+    .x_size = N,
+    .u_offset = 0,
+    .ordering = LAPACK_COL_MAJOR,
+    .s_tol = 1e-10,
+    .x_tol = 1e-12,
+    .max_iter = 20,
+    .f = f,
+    .df = df,
+    .data = NULL,
+    .predictor = EULER_PREDICT_EXPLICIT};
+
+void print_stats(const char *name, const euler_rt_stats *s, const double dev)
+{
+  printf("%-22s worst %8.1f us, deadlines %4d, fallbacks %4d, max deviation %.2e\n",
+         name, 1e6 * s->worst_latency, (int)s->deadlines, (int)s->fallbacks, dev);
+  printf("  latency [us]:");
+  for (int i = 0; i < EULER_RT_LATENCY_BINS; i++)
+    if (s->latency[i])
+      printf(" <%d:%d", 1 << i, (int)s->latency[i]);
+  printf("\n  iterations:  ");
+  for (int i = 0; i < EULER_RT_ITER_BINS; i++)
+    if (s->iterations[i])
+      printf(" %d:%d", i, (int)s->iterations[i]);
+  printf("\n");
+}
+
+/* Trajectory of the loop, with a square wave input. Returns the maximum deviation from ref */
+double run(const newton_method method, const double budget, double ref[][N], euler_rt_stats *stats)
+{
+  euler_options o = opt;
+  o.method = method;
+  euler_workspace *ws = euler_workspace_alloc(&o);
+  if (!ws)
+    return -1;
+  double x[N] = {0}, xp[N], dev = 0;
+  for (int k = 0; k < STEPS; k++) {
+    const double t = k * o.ts;
+    const double u = fmod(t, 0.5) < 0.25 ? 10 : -10;
+    euler_rt_status status;
+    if (euler_rt_step(&o, ws, budget, xp, t, x, &u, NULL, &status, stats) != EULER_SUCCESS)
+      return -1;
+    for (int i = 0; i < N; i++) {
+      x[i] = xp[i];
+      dev = fmax(dev, fabs(x[i] - ref[k][i]));
+    }
+  }
+  euler_workspace_free(ws);
+  return dev;
+}
+
+double ref[STEPS][N];
+
+int main()
+{
+  /* Reference: the same loop without deadline, storing the trajectory */
+  euler_rt_stats unbounded = {0};
+  euler_workspace *ws = euler_workspace_alloc(&opt);
+  if (!ws)
+    return 1;
+  double x[N] = {0};
+  for (int k = 0; k < STEPS; k++) {
+    const double t = k * opt.ts;
+    const double u = fmod(t, 0.5) < 0.25 ? 10 : -10;
+    if (euler_rt_step(&opt, ws, 0, ref[k], t, x, &u, NULL, NULL, &unbounded) != EULER_SUCCESS)
+      return 1;
+    for (int i = 0; i < N; i++)
+      x[i] = ref[k][i];
+  }
+  euler_workspace_free(ws);
+  print_stats("full, no deadline", &unbounded, 0);
+
+  /* Budget of the step: half of the period of the 1 kHz loop */
+  const double budget = 5e-4;
+  printf("\nbudget: %.1f us\n", 1e6 * budget);
+
+  euler_rt_stats full = {0}, modified = {0};
+  double dev_full = run(NEWTON_FULL, budget, ref, &full);
+  double dev_modified = run(NEWTON_MODIFIED, budget, ref, &modified);
+  if (dev_full < 0 || dev_modified < 0)
+    return 1;
+  print_stats("full, deadline", &full, dev_full);
+  print_stats("modified, deadline", &modified, dev_modified);
+  return 0;
+}
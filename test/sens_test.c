@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "libsens.h"
+
+/* Nonlinear diffusion chain of N cells, driven by an input on the first one, with the reaction
+   and diffusion coefficients as parameters p = {k, c}:
+   x_i' = -k x_i^3 + c (x_{i-1} - 2 x_i + x_{i+1}), x_{-1} = u, x_N = 0 */
+#define N 20
+#define NP 2
+#define STEPS 200
+lapack_int ordering;
+double params[NP] = {2.0, 5.0};
+lapack_int row_ptr[N + 1], col_idx[3 * N];
+
+void f(double *f, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  for (int i = 0; i < N; i++) {
+    const double left = i > 0 ? x[i - 1] : u[0];
+    const double right = i < N - 1 ? x[i + 1] : 0;
+    f[i] = -p[0][0] * x[i] * x[i] * x[i] + p[0][1] * (left - 2 * x[i] + right);
+  }
+}
+
+/* Dense Jacobian in the option ordering */
+void df(double *df, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  for (int q = 0; q < N * N; q++)
+    df[q] = 0;
+  for (int i = 0; i < N; i++) {
+    df[i + i * N] = -3 * p[0][0] * x[i] * x[i] - 2 * p[0][1];
+    if (i > 0)
+      df[ordering == LAPACK_ROW_MAJOR ? i * N + i - 1 : i + (i - 1) * N] = p[0][1];
+    if (i < N - 1)
+      df[ordering == LAPACK_ROW_MAJOR ? i * N + i + 1 : i + (i + 1) * N] = p[0][1];
+  }
+}
+
+/* Nonzeros of the tridiagonal pattern (symmetric, thus the same CSR and CSC) */
+void df_sparse(double *df, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  for (int c = 0; c < N; c++)
+    for (lapack_int q = row_ptr[c]; q < row_ptr[c + 1]; q++)
+      df[q] = col_idx[q] == c ? -3 * p[0][0] * x[c] * x[c] - 2 * p[0][1] : p[0][1];
+}
+
+void dfdp(double *dfdp, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  for (int i = 0; i < N; i++) {
+    const double left = i > 0 ? x[i - 1] : u[0];
+    const double right = i < N - 1 ? x[i + 1] : 0;
+    dfdp[i] = -x[i] * x[i] * x[i];
+    dfdp[i + N] = left - 2 * x[i] + right;
+  }
+}
+
+void build_pattern()
+{
+  lapack_int q = 0;
+  for (int i = 0; i < N; i++) {
+    row_ptr[i] = q;
+    if (i > 0)
+      col_idx[q++] = i - 1;
+    col_idx[q++] = i;
+    if (i < N - 1)
+      col_idx[q++] = i + 1;
+  }
+  row_ptr[N] = q;
+}
+
+void input(double *u, const double t)
+{
+  u[0] = 1.0 + 0.5 * sin(t);
+  u[1] = 1.0 + 0.5 * sin(t + 1e-2);
+}
+
+/* Final state from a zero state. With s, the sensitivities are propagated too */
+int simulate(const euler_options *opt, const sens_options *sopt, double *x, double *s, lapack_int *iterations, lapack_int *factorizations)
+{
+  const double *p[1] = {params};
+  double xp[N], sp[N * NP], u[2];
+  for (int i = 0; i < N; i++)
+    x[i] = 0;
+  for (int q = 0; q < N * NP; q++)
+    s[q] = 0;
+
+  sens_workspace *ws = sens_workspace_alloc(opt, sopt);
+  if (!ws)
+    return 1;
+  for (int k = 0; k < STEPS; k++) {
+    input(u, k * opt->ts);
+    if (sens_step(opt, sopt, ws, xp, sp, k * opt->ts, x, s, u, p) != EULER_SUCCESS) {
+      sens_workspace_free(ws);
+      return 1;
+    }
+    for (int i = 0; i < N; i++)
+      x[i] = xp[i];
+    for (int q = 0; q < N * NP; q++)
+      s[q] = sp[q];
+    if (ws->iterations > *iterations)
+      *iterations = ws->iterations;
+    *factorizations += ws->factorizations;
+  }
+  sens_workspace_free(ws);
+  return 0;
+}
+
+int main()
+{
+  const char *method[3] = {"full", "modified", "broyden"};
+  const double alphas[3] = {0.0, 0.5, 1.0};
+  double *p_values[NP] = {&params[0], &params[1]};
+  build_pattern();
+  sparse_pattern pattern = {N, row_ptr, col_idx};
+  double worst = 0;
+
+  for (int m = 0; m < 3; m++) {
+    for (int a = 0; a < 3; a++) {
+      double err = 0;
+      lapack_int iterations = 0, factorizations = 0;
+
+      /* Orderings, dense and sparse Jacobians, with and without the callbacks */
+      for (int variant = 0; variant < 16; variant++) {
+        ordering = variant & 1 ? LAPACK_ROW_MAJOR : LAPACK_COL_MAJOR;
+        const int sparse = variant & 2, jacobian = variant & 4, parameter = variant & 8;
+        euler_options opt = {
+            .ts = 1e-2,
+            .alpha = alphas[a],
+            .x_size = N,
+            .u_offset = 1,
+            .ordering = ordering,
+            .s_tol = 1e-12,
+            .x_tol = 1e-14,
+            .max_iter = 50,
+            .f = f,
+            .df = jacobian ? (sparse ? df_sparse : df) : NULL,
+            .method = (newton_method)m,
+            .pattern = sparse ? &pattern : NULL};
+        sens_options sopt = {NP, parameter ? dfdp : NULL, p_values};
+
+        double x[N], s[N * NP], xr[N], xl[N], sd[N * NP];
+        if (simulate(&opt, &sopt, x, s, &iterations, &factorizations)) {
+          printf("Sensitivity integration failed (%s, alpha = %g, variant %d)\n", method[m], alphas[a], variant);
+          return 1;
+        }
+
+        /* Central differences of the simulation */
+        for (int j = 0; j < NP; j++) {
+          const double pj = params[j], delta = 1e-5 * pj;
+          lapack_int dummy = 0;
+          params[j] = pj + delta;
+          simulate(&opt, &sopt, xr, sd, &dummy, &dummy);
+          params[j] = pj - delta;
+          simulate(&opt, &sopt, xl, sd, &dummy, &dummy);
+          params[j] = pj;
+          for (int i = 0; i < N; i++)
+            err = fmax(err, fabs((xr[i] - xl[i]) / (2 * delta) - s[i + j * N]) / fmax(fabs(s[i + j * N]), 1e-3));
+        }
+      }
+      printf("%-8s alpha = %.1f: max relative error = %.2e, max solves per column = %d, fresh factorizations = %d\n",
+             method[m], alphas[a], err, (int)iterations, (int)factorizations);
+      worst = fmax(worst, err);
+    }
+  }
+
+  if (worst > 1e-5) {
+    printf("The sensitivities differ from the finite differences of the simulation\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "libeuler.h"
+
+/* Fisher-KPP reaction diffusion u' = D lap(u) + r u (1 - u) on a NX x NY grid (5 points stencil) */
+lapack_int NX, NY;
+lapack_int *row_ptr, *col_idx;
+const double D = 1.0, R = 10.0;
+long evaluations = 0;
+
+void f(double *f, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  evaluations++;
+  const double h2 = 1.0 / ((NX + 1) * (NX + 1));
+  for (lapack_int i = 0; i < NX * NY; i++) {
+    const lapack_int ix = i % NX, iy = i / NX;
+    double lap = -(NY > 1 ? 4 : 2) * x[i];
+    lap += ix > 0 ? x[i - 1] : 0;
+    lap += ix < NX - 1 ? x[i + 1] : u[0];
+    if (NY > 1) {
+      lap += iy > 0 ? x[i - NX] : 0;
+      lap += iy < NY - 1 ? x[i + NX] : 0;
+    }
+    f[i] = D * lap / h2 + R * x[i] * (1 - x[i]);
+  }
+}
+
+/* Nonzeros in the order of the CSR pattern */
+void df(double *df, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  const double h2 = 1.0 / ((NX + 1) * (NX + 1));
+  for (lapack_int i = 0; i < NX * NY; i++)
+    for (lapack_int q = row_ptr[i]; q < row_ptr[i + 1]; q++)
+      df[q] = col_idx[q] == i ? -(NY > 1 ? 4 : 2) * D / h2 + R * (1 - 2 * x[i]) : D / h2;
+}
+
+/* Product of the Jacobian with v, without forming it */
+void jv(double *jv, const double *v, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  const double h2 = 1.0 / ((NX + 1) * (NX + 1));
+  for (lapack_int i = 0; i < NX * NY; i++) {
+    const lapack_int ix = i % NX, iy = i / NX;
+    double lap = -(NY > 1 ? 4 : 2) * v[i];
+    lap += ix > 0 ? v[i - 1] : 0;
+    lap += ix < NX - 1 ? v[i + 1] : 0;
+    if (NY > 1) {
+      lap += iy > 0 ? v[i - NX] : 0;
+      lap += iy < NY - 1 ? v[i + NX] : 0;
+    }
+    jv[i] = D * lap / h2 + R * (1 - 2 * x[i]) * v[i];
+  }
+}
+
+/* Jacobi preconditioner: diagonal of I - gamma J */
+void jacobi(double *z, const double *r, const double gamma, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  const double h2 = 1.0 / ((NX + 1) * (NX + 1));
+  for (lapack_int i = 0; i < NX * NY; i++)
+    z[i] = r[i] / (1 - gamma * (-(NY > 1 ? 4 : 2) * D / h2 + R * (1 - 2 * x[i])));
+}
+
+/* Same Jacobian, as a dense row major matrix */
+double *df_values;
+void df_dense(double *out, const double t, const double *x, const double *u, const double **p, void *data)
+{
+  const lapack_int n = NX * NY;
+  df(df_values, t, x, u, p, data);
+  for (lapack_int k = 0; k < n * n; k++)
+    out[k] = 0;
+  for (lapack_int i = 0; i < n; i++)
+    for (lapack_int q = row_ptr[i]; q < row_ptr[i + 1]; q++)
+      out[i * n + col_idx[q]] = df_values[q];
+}
+
+void build_pattern()
+{
+  const lapack_int n = NX * NY;
+  row_ptr = (lapack_int *)malloc((n + 1) * sizeof(lapack_int));
+  col_idx = (lapack_int *)malloc(5 * n * sizeof(lapack_int));
+  df_values = (double *)malloc(5 * n * sizeof(double));
+  lapack_int q = 0;
+  for (lapack_int i = 0; i < n; i++) {
+    const lapack_int ix = i % NX, iy = i / NX;
+    row_ptr[i] = q;
+    if (iy > 0)
+      col_idx[q++] = i - NX;
+    if (ix > 0)
+      col_idx[q++] = i - 1;
+    col_idx[q++] = i;
+    if (ix < NX - 1)
+      col_idx[q++] = i + 1;
+    if (iy < NY - 1)
+      col_idx[q++] = i + NX;
+  }
+  row_ptr[n] = q;
+}
+
+void free_pattern()
+{
+  free(row_ptr);
+  free(col_idx);
+  free(df_values);
+}
+
+/* Implicit steps from a zero state with a unit boundary. Returns the nonzeros of L (-1 if banded) */
+double integrate(euler_options *opt, lapack_int steps, double *x, double *elapsed)
+{
+  const lapack_int n = opt->x_size;
+  double u[1] = {1.0};
+  double *xp = (double *)malloc(n * sizeof(double));
+  for (lapack_int i = 0; i < n; i++)
+    x[i] = 0;
+
+  clock_t start = clock();
+  euler_workspace *ws = euler_workspace_alloc(opt);
+  if (!ws) {
+    printf("Cannot allocate the workspace\n");
+    exit(1);
+  }
+  for (lapack_int k = 0; k < steps; k++) {
+    if (euler_ws(opt, ws, xp, k * opt->ts, x, u, NULL, NULL) != EULER_SUCCESS) {
+      printf("Step %d failed\n", (int)k);
+      exit(1);
+    }
+    for (lapack_int i = 0; i < n; i++)
+      x[i] = xp[i];
+  }
+  *elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  double nnz_lu = 0;
+  if (ws->newton->lu)
+    nnz_lu = ws->newton->lu->ku >= 0 ? -1 : ws->newton->lu->nnz_lu;
+  euler_workspace_free(ws);
+  free(xp);
+  return nnz_lu;
+}
+
+int main()
+{
+  euler_options opt = {
+      .ts = 1e-3,
+      .alpha = 1.0,
+      .ordering = LAPACK_ROW_MAJOR,
+      .s_tol = 1e-10,
+      .x_tol = 1e-12,
+      .max_iter = 20};
+  const lapack_int sizes[3][2] = {{12, 12}, {200, 1}, {100, 100}};
+  const char *method[3] = {"full", "modified", "broyden"};
+
+  for (int s = 0; s < 3; s++) {
+    NX = sizes[s][0];
+    NY = sizes[s][1];
+    opt.x_size = NX * NY;
+    build_pattern();
+    sparse_pattern pattern = {opt.x_size, row_ptr, col_idx};
+    double *x = (double *)malloc(opt.x_size * sizeof(double));
+    double *x_ref = (double *)malloc(opt.x_size * sizeof(double));
+    double elapsed;
+
+    printf("Grid %d x %d (%d states)\n", (int)NX, (int)NY, (int)opt.x_size);
+    opt.f = f;
+    if (opt.x_size <= 1000) {
+      opt.df = df_dense;
+      opt.pattern = NULL;
+      opt.method = NEWTON_FULL;
+      integrate(&opt, 50, x_ref, &elapsed);
+      printf("  dense  %-8s %8.3f s\n", method[0], elapsed);
+    }
+
+    for (int m = 0; m < 3; m++) {
+      opt.df = df;
+      opt.pattern = &pattern;
+      opt.method = (newton_method)m;
+      double nnz_lu = integrate(&opt, 50, x, &elapsed);
+      if (m == 0 && opt.x_size > 1000)
+        for (lapack_int i = 0; i < opt.x_size; i++)
+          x_ref[i] = x[i];
+      double err = 0;
+      for (lapack_int i = 0; i < opt.x_size; i++)
+      err = fmax(err, fabs(x[i] - x_ref[i]));
+      if (nnz_lu < 0)
+        printf("  sparse %-8s %8.3f s, banded, max error = %e\n", method[m], elapsed, err);
+      else
+        printf("  sparse %-8s %8.3f s, nnz(L) = %.0f, max error = %e\n", method[m], elapsed, nnz_lu, err);
+    }
+
+    /* Finite difference Jacobian with column groups */
+    opt.df = NULL;
+    opt.pattern = &pattern;
+    opt.method = NEWTON_MODIFIED;
+    evaluations = 0;
+    integrate(&opt, 50, x, &elapsed);
+    double err = 0;
+    for (lapack_int i = 0; i < opt.x_size; i++)
+      err = fmax(err, fabs(x[i] - x_ref[i]));
+    printf("  fd     %-8s %8.3f s, %ld evaluations of f, max error = %e\n", method[1], elapsed, evaluations, err);
+
+    /* Jacobian-free Newton-Krylov */
+    const char *krylov[3] = {"krylov", "jacobi", "jv"};
+    for (int k = 0; k < 3; k++) {
+      opt.df = NULL;
+      opt.pattern = NULL;
+      opt.method = NEWTON_KRYLOV;
+      opt.prec = k > 0 ? jacobi : NULL;
+      opt.jv = k > 1 ? jv : NULL;
+      evaluations = 0;
+      integrate(&opt, 50, x, &elapsed);
+      err = 0;
+      for (lapack_int i = 0; i < opt.x_size; i++)
+        err = fmax(err, fabs(x[i] - x_ref[i]));
+      printf("  jfnk   %-8s %8.3f s, %ld evaluations of f, max error = %e\n", krylov[k], elapsed, evaluations, err);
+    }
+    opt.prec = NULL;
+    opt.jv = NULL;
+    free(x);
+    free(x_ref);
+    free_pattern();
+  }
+
+  /* Static pivoting: the Newton solver rejects a pattern without the whole diagonal, and the
+     sparse LU rejects the tiny pivot of the nearly singular Laplacian of a star graph */
+  const lapack_int n = 40;
+  lapack_int star_ptr[41], star_idx[3 * 40], hollow_ptr[41], hollow_idx[3 * 40];
+  double star[3 * 40];
+  lapack_int q = 0, h = 0;
+  for (lapack_int c = 0; c < n; c++) {
+    star_ptr[c] = q;
+    hollow_ptr[c] = h;
+    for (lapack_int r = 0; r < n; r++) {
+      if (r != c && (r == 0 || c == 0))
+        hollow_idx[h++] = r;
+      if (r == c || r == 0 || c == 0) {
+        star_idx[q] = r;
+        star[q++] = r == c ? (c == 0 ? n - 1 + 1e-14 : 1) : -1;
+      }
+    }
+  }
+  star_ptr[n] = q;
+  hollow_ptr[n] = h;
+  sparse_pattern star_pattern = {n, star_ptr, star_idx};
+  sparse_pattern hollow_pattern = {n, hollow_ptr, hollow_idx};
+  newton_options nopt = {.ordering = LAPACK_COL_MAJOR, .f_size = n, .x_size = n, .pattern = &hollow_pattern};
+  newton_workspace *nws = newton_workspace_alloc(&nopt);
+  sparse_lu *lu = sparse_lu_alloc(&star_pattern);
+  const lapack_int pivot = lu ? sparse_lu_factor(lu, star) : 0;
+  printf("Star graph (%d nodes): pattern without diagonal %s, nearly singular matrix pivot %d %s\n",
+         (int)n, nws ? "accepted" : "rejected", (int)pivot, pivot > 0 ? "rejected" : "accepted");
+  newton_workspace_free(nws);
+  sparse_lu_free(lu);
+  return (nws || pivot <= 0) ? 1 : 0;
+}
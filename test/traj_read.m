@@ -0,0 +1,29 @@
+function [t, x, u] = traj_read(path)
+% TRAJ_READ Reads a trajectory file written by libtraj.c
+%   [t, x, u] = traj_read(path) returns the time column, the states (one column per state)
+%   and the inputs (one column per input), as load() does for the CSV of the tests.
+
+fid = fopen(path, 'r');
+magic = fread(fid, 8, '*char')';
+header = fread(fid, 7, 'int64');
+if ~strcmp(magic(1:7), 'EULTRAJ') || header(1) ~= 1
+  fclose(fid);
+  error('traj_read: %s is not a trajectory file', path);
+end
+x_size = header(2);
+u_size = header(3);
+chunk_rows = header(4);
+rows = header(5);
+cols = 1 + x_size + u_size;
+chunks = ceil(rows / chunk_rows);
+
+% Each chunk is a chunk_rows x cols column major block
+data = fread(fid, [chunk_rows, cols * chunks], 'double');
+fclose(fid);
+data = reshape(permute(reshape(data, chunk_rows, cols, chunks), [1, 3, 2]), [], cols);
+data = data(1:rows, :);
+
+t = data(:, 1);
+x = data(:, 2:1 + x_size);
+u = data(:, 2 + x_size:end);
+end
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "libeuler.h"
+#include "libtraj.h"
+#include "models.h"
+
+/* Two tanks of test/models.h, stored as CSV and as a binary trajectory */
+
+euler_options opt = {
+    .ts = 1e-3,
+    .alpha = 0.5,
+    .x_size = 2,
+    .u_offset = 0,
+    .ordering = LAPACK_COL_MAJOR,
+    .s_tol = 1e-12,
+    .x_tol = 1e-12,
+    .max_iter = 100,
+    .f = tanks_f,
+    .df = tanks_df,
+    .data = NULL};
+
+void input_provider(double *u, const double t, const double *x, void *data)
+{
+  u[0] = tanks_input(t);
+}
+
+double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+#define STEPS 500000
+#define COLS 4
+
+int main(int argc, char **argv)
+{
+  const char *bin_path = argc > 1 ? argv[1] : "traj_test.bin";
+  const char *csv_path = "traj_test.csv";
+  double *rows = (double *)malloc((STEPS + 1) * COLS * sizeof(double));
+  euler_workspace *ws = euler_workspace_alloc(&opt);
+  if (!rows || !ws)
+    return 1;
+
+  /* Integration only: rows [t, x1, x2, u] kept in memory */
+  double t = 0, x[2] = {1e-6, 0.1}, xp[2], u = tanks_input(0);
+  double t_start = now();
+  for (int k = 0; k <= STEPS; k++) {
+    double *row = rows + k * COLS;
+    row[0] = t;
+    row[1] = x[0];
+    row[2] = x[1];
+    row[3] = u;
+    if (k == STEPS)
+      break;
+    euler_ws(&opt, ws, xp, t, x, &u, NULL, NULL);
+    t = (k + 1) * opt.ts;
+    u = tanks_input(t);
+    x[0] = xp[0];
+    x[1] = xp[1];
+  }
+  const double t_integration = now() - t_start;
+
+  /* CSV, as the other test programs */
+  t_start = now();
+  FILE *csv = fopen(csv_path, "w");
+  if (!csv)
+    return 1;
+  for (int k = 0; k <= STEPS; k++) {
+    const double *row = rows + k * COLS;
+    fprintf(csv, "% 5.3f, % 5.6f, % 5.6f, % 5.6f\n", row[0], row[3], row[1], row[2]);
+  }
+  fclose(csv);
+  const double t_csv = now() - t_start;
+
+  /* Binary trajectory, written by the background thread */
+  t_start = now();
+  traj_writer *w = traj_writer_open(bin_path, 2, 1, 0);
+  if (!w)
+    return 1;
+  double t_push = 0;
+  for (int k = 0; k <= STEPS; k++) {
+    const double *row = rows + k * COLS;
+    if (traj_writer_push(w, row[0], row + 1, row + 3) != TRAJ_SUCCESS)
+      return 1;
+  }
+  t_push = now() - t_start;
+  if (traj_writer_close(w) != TRAJ_SUCCESS)
+    return 1;
+  const double t_bin = now() - t_start;
+
+  printf("rows: %d\n", STEPS + 1);
+  printf("integration:          %8.3f s\n", t_integration);
+  printf("csv (fprintf):        %8.3f s\n", t_csv);
+  printf("binary (push only):   %8.3f s\n", t_push);
+  printf("binary (with close):  %8.3f s\n", t_bin);
+
+  /* Zero-copy read back, compared bit by bit */
+  t_start = now();
+  traj_reader *r = traj_reader_open(bin_path);
+  if (!r)
+    return 1;
+  long mismatch = 0, k = 0;
+  for (lapack_int c = 0; c < r->chunks; c++) {
+    const double *tc = traj_reader_column(r, c, 0);
+    const double *x1 = traj_reader_column(r, c, 1);
+    const double *x2 = traj_reader_column(r, c, 2);
+    const double *uc = traj_reader_column(r, c, 3);
+    for (lapack_int i = 0; i < traj_reader_chunk_rows(r, c); i++, k++) {
+      const double *row = rows + k * COLS;
+      mismatch += tc[i] != row[0] || x1[i] != row[1] || x2[i] != row[2] || uc[i] != row[3];
+    }
+  }
+  printf("read back:            %8.3f s, %ld rows in %d chunks, %ld mismatches\n", now() - t_start, k, (int)r->chunks, mismatch);
+  traj_reader_close(r);
+
+  /* euler_integrate() with the trajectory sink: [t, x, u] rows, with the input held along each
+     step (zero input offset), thus the input of a row is the one sampled at the previous row */
+  const double tstops[1] = {251};
+  euler_integrate_options iopt = {.u_size = 1, .input = input_provider, .sink = traj_sink, .data = NULL,
+                                  .tstops = tstops, .n_tstops = 1};
+  double x0[2] = {1e-6, 0.1};
+  opt.ts = 1e-2;
+  w = traj_writer_open(bin_path, 2, 1, 1000);
+  iopt.data = w;
+  euler_ret ret = euler_integrate(&opt, &iopt, ws, 0, 300, x0, x, NULL);
+  if (traj_writer_close(w) != TRAJ_SUCCESS || ret != EULER_SUCCESS)
+    return 1;
+  r = traj_reader_open(bin_path);
+  if (!r)
+    return 1;
+  long wrong = 0;
+  double t_prev = 0;
+  for (lapack_int c = 0; c < r->chunks; c++) {
+    const double *tc = traj_reader_column(r, c, 0);
+    const double *uc = traj_reader_column(r, c, 3);
+    for (lapack_int i = 0; i < traj_reader_chunk_rows(r, c); i++) {
+      wrong += !isfinite(uc[i]) || uc[i] != tanks_input(t_prev);
+      t_prev = tc[i];
+    }
+  }
+  const lapack_int last = r->chunks - 1;
+  const lapack_int n_last = traj_reader_chunk_rows(r, last);
+  printf("euler_integrate sink: %ld rows, last row t = %g, x = [%f, %f], u = %f, %ld wrong inputs\n", (long)r->rows,
+         traj_reader_column(r, last, 0)[n_last - 1], traj_reader_column(r, last, 1)[n_last - 1],
+         traj_reader_column(r, last, 2)[n_last - 1], traj_reader_column(r, last, 3)[n_last - 1], wrong);
+  traj_reader_close(r);
+
+  remove(bin_path);
+  remove(csv_path);
+  euler_workspace_free(ws);
+  free(rows);
+  return mismatch != 0 || wrong != 0;
+}